@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * The native binding, loaded when first used rather than when this module
+ * is.  Where the binding can't be built -- on a system without contracts,
+ * to replay a recorded trace, say -- another implementation may be
+ * substituted with use() before anything asks for the binding.
+ */
+
+var impl = null;
+
+function
+get()
+{
+	if (impl === null)
+		impl = require('./contract_binding');
+
+	return (impl);
+}
+
+function
+use(b)
+{
+	impl = b;
+}
+
+module.exports = {
+	get: get,
+	use: use
+};
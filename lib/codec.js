@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Compact binary encoding of contract events and status records, for
+ * forwarding between processes without JSON.  The field set is exactly that
+ * produced by the binding's event and status marshalling.
+ *
+ * Every record is a self-delimiting frame with an 8-byte header:
+ *
+ *	0	u8	magic (0xc7)
+ *	1	u8	format version
+ *	2	u8	record kind (KIND_EVENT or KIND_STATUS)
+ *	3	u8	reserved, 0
+ *	4	u32	total frame length, including this header
+ *
+ * All integers are little-endian.  64-bit quantities (event ids, cookies)
+ * are stored as two u32 words, low word first.  Event frames have a fixed
+ * layout.  Status frames have a fixed common section followed by a sequence
+ * of type-specific tag/length/value fields; decoders skip tags they do not
+ * recognise, so fields may be added without bumping the version.  Codes for
+ * enumerated values (event types, states, flag bits) are append-only.
+ *
+ * Decoding is lazy: decode() returns a view over the caller's buffer whose
+ * accessors read fields on demand, so a relay can inspect a record (or just
+ * its length) and forward the bytes untouched.
+ */
+
+var MAGIC = 0xc7;
+var VERSION = 1;
+
+var KIND_EVENT = 1;
+var KIND_STATUS = 2;
+
+var HDR_LEN = 8;
+var EVENT_LEN = HDR_LEN + 32;
+var STATUS_FIXED_LEN = HDR_LEN + 52;
+var TLV_HDR_LEN = 6;
+
+var EVF_INFO = 0x1;
+var EVF_ACK = 0x2;
+var EVF_NEG = 0x4;
+
+var EVP_NEGEND = 0x1;
+
+var EVENT_TYPES = [
+	null,
+	'negend',
+	'pr_empty',
+	'pr_fork',
+	'pr_exit',
+	'pr_core',
+	'pr_signal',
+	'pr_hwerr',
+	'dev_online',
+	'dev_degraded',
+	'dev_offline'
+];
+var CT_TYPES = [ null, 'process', 'device' ];
+var CT_STATES = [ null, 'owned', 'inherited', 'orphan', 'dead' ];
+var PR_PARAMS = [ 'inherit', 'noorphan', 'pgrponly', 'regent' ];
+var DEV_STATES = [ 'online', 'degraded', 'offline' ];
+var PR_EVENTS = EVENT_TYPES.slice(1, 8);
+var DEV_EVENTS = [ 'negend' ].concat(EVENT_TYPES.slice(8));
+
+var TAG_PR_PARAM = 1;
+var TAG_PR_FATAL = 2;
+var TAG_PR_MEMBERS = 3;
+var TAG_PR_CONTRACTS = 4;
+var TAG_PR_SVC_FMRI = 5;
+var TAG_PR_SVC_AUX = 6;
+var TAG_PR_SVC_CTID = 7;
+var TAG_PR_SVC_CREATOR = 8;
+var TAG_DEV_STATE = 9;
+var TAG_DEV_ASET = 10;
+var TAG_DEV_MINOR = 11;
+var TAG_DEV_NONEG = 12;
+
+var TWO32 = 4294967296;
+
+function
+code_of(table, name)
+{
+	var i = table.indexOf(name);
+
+	return (i < 0 ? 0 : i);
+}
+
+/*
+ * Event sets are carried as objects with one boolean per event name; on the
+ * wire they are bitmasks indexed by the same append-only event type codes.
+ */
+function
+evset_to_mask(set)
+{
+	var mask = 0;
+
+	if (!set)
+		return (0);
+
+	Object.keys(set).forEach(function (k) {
+		var c = code_of(EVENT_TYPES, k);
+
+		if (set[k] && c > 0)
+			mask |= 1 << (c - 1);
+	});
+
+	return (mask >>> 0);
+}
+
+function
+mask_to_evset(mask, names)
+{
+	var set = {};
+
+	names.forEach(function (n) {
+		set[n] = (mask & (1 << (code_of(EVENT_TYPES, n) - 1))) !== 0;
+	});
+
+	return (set);
+}
+
+function
+flags_to_mask(set, names)
+{
+	var mask = 0;
+	var i;
+
+	if (!set)
+		return (0);
+
+	for (i = 0; i < names.length; i++) {
+		if (set[names[i]])
+			mask |= 1 << i;
+	}
+
+	return (mask >>> 0);
+}
+
+function
+mask_to_flags(mask, names)
+{
+	var set = {};
+	var i;
+
+	for (i = 0; i < names.length; i++)
+		set[names[i]] = (mask & (1 << i)) !== 0;
+
+	return (set);
+}
+
+/*
+ * The binding hands us 64-bit values as decimal strings.  Those below 2^53
+ * round-trip through a double; anything larger takes the slow path of
+ * base-10^6 long arithmetic on a pair of 32-bit words.
+ */
+function
+u64_write(buf, off, v)
+{
+	var s = String(v === undefined ? 0 : v);
+	var hi = 0;
+	var lo = 0;
+	var i, n, d, chunk, scale, t;
+
+	if (s.length < 16 && s.indexOf('x') < 0) {
+		n = Number(s);
+		buf.writeUInt32LE(n % TWO32, off);
+		buf.writeUInt32LE(Math.floor(n / TWO32), off + 4);
+		return;
+	}
+
+	if (s.substr(0, 2) === '0x' || s.substr(0, 2) === '0X') {
+		s = s.substr(2);
+		d = s.length;
+		lo = parseInt(s.substr(Math.max(0, d - 8)) || '0', 16);
+		hi = d > 8 ? parseInt(s.substr(0, d - 8), 16) : 0;
+	} else {
+		for (i = 0; i < s.length; i += 6) {
+			chunk = s.substr(i, 6);
+			scale = Math.pow(10, chunk.length);
+			t = lo * scale + Number(chunk);
+			lo = t % TWO32;
+			hi = (hi * scale + Math.floor(t / TWO32)) % TWO32;
+		}
+	}
+
+	buf.writeUInt32LE(lo >>> 0, off);
+	buf.writeUInt32LE(hi >>> 0, off + 4);
+}
+
+function
+u64_read(buf, off)
+{
+	var lo = buf.readUInt32LE(off);
+	var hi = buf.readUInt32LE(off + 4);
+	var digits = '';
+	var r, t, pad;
+
+	if (hi < 0x200000)
+		return (String(hi * TWO32 + lo));
+
+	while (hi !== 0 || lo !== 0) {
+		r = hi % 1000000;
+		hi = Math.floor(hi / 1000000);
+		t = r * TWO32 + lo;
+		lo = Math.floor(t / 1000000);
+		r = t % 1000000;
+		pad = String(r);
+		if (hi !== 0 || lo !== 0)
+			pad = '000000'.substr(pad.length) + pad;
+		digits = pad + digits;
+	}
+
+	return (digits);
+}
+
+function
+write_header(buf, off, kind, len)
+{
+	buf[off] = MAGIC;
+	buf[off + 1] = VERSION;
+	buf[off + 2] = kind;
+	buf[off + 3] = 0;
+	buf.writeUInt32LE(len, off + 4);
+}
+
+/*
+ * Returns the length of the frame beginning at buf[off], or -1 if the buffer
+ * does not (yet) contain a complete frame.  Throws on a malformed header.
+ */
+function
+frameLength(buf, off)
+{
+	var len;
+
+	off = off || 0;
+	if (buf.length - off < HDR_LEN)
+		return (-1);
+	if (buf[off] !== MAGIC)
+		throw (new Error('bad contract record magic'));
+	if (buf[off + 1] !== VERSION)
+		throw (new Error('unsupported contract record version ' +
+		    buf[off + 1]));
+
+	len = buf.readUInt32LE(off + 4);
+	if (len < HDR_LEN)
+		throw (new Error('bad contract record length'));
+
+	return (buf.length - off < len ? -1 : len);
+}
+
+function
+encodeEvent(ev, buf, off)
+{
+	var fm = 0;
+
+	if (!buf) {
+		buf = new Buffer(EVENT_LEN);
+		off = 0;
+	}
+	off = off || 0;
+
+	if (ev.flagsMask !== undefined) {
+		fm = ev.flagsMask;
+	} else if (ev.flags) {
+		fm = (ev.flags.info ? EVF_INFO : 0) |
+		    (ev.flags.ack ? EVF_ACK : 0) |
+		    (ev.flags.neg ? EVF_NEG : 0);
+	}
+
+	write_header(buf, off, KIND_EVENT, EVENT_LEN);
+	buf.writeInt32LE(ev.ctid | 0, off + 8);
+	u64_write(buf, off + 12, ev.evid);
+	buf.writeUInt16LE(code_of(EVENT_TYPES, ev.type), off + 20);
+	buf[off + 22] = fm;
+	buf[off + 23] = ev.nevid !== undefined ? EVP_NEGEND : 0;
+	u64_write(buf, off + 24, ev.nevid);
+	buf.writeInt32LE((ev.newct || 0) | 0, off + 32);
+	buf.writeUInt32LE(0, off + 36);
+
+	return (buf);
+}
+
+/*
+ * Status fields are collected as [tag, kind, value] triples so that the
+ * frame can be sized once and written without intermediate buffers.
+ */
+var TLV_U32 = 0;
+var TLV_INTS = 1;
+var TLV_STRING = 2;
+
+function
+tlv_len(f)
+{
+	switch (f[1]) {
+	case TLV_U32:
+		return (4);
+	case TLV_INTS:
+		return (4 * Object.keys(f[2]).length);
+	default:
+		return (Buffer.byteLength(f[2], 'utf8'));
+	}
+}
+
+function
+tlv_write(buf, off, f, len)
+{
+	var keys, i;
+
+	buf.writeUInt16LE(f[0], off);
+	buf.writeUInt32LE(len, off + 2);
+	off += TLV_HDR_LEN;
+
+	switch (f[1]) {
+	case TLV_U32:
+		buf.writeUInt32LE(f[2] >>> 0, off);
+		break;
+	case TLV_INTS:
+		keys = Object.keys(f[2]);
+		for (i = 0; i < keys.length; i++)
+			buf.writeInt32LE(f[2][keys[i]] | 0, off + 4 * i);
+		break;
+	default:
+		buf.write(f[2], off, len, 'utf8');
+		break;
+	}
+
+	return (off + len);
+}
+
+function
+encodeStatus(st)
+{
+	var fields = [];
+	var lens = [];
+	var len = STATUS_FIXED_LEN;
+	var buf, off, i;
+
+	if (st.pr_param !== undefined)
+		fields.push([ TAG_PR_PARAM, TLV_U32,
+		    flags_to_mask(st.pr_param, PR_PARAMS) ]);
+	if (st.pr_fatal !== undefined)
+		fields.push([ TAG_PR_FATAL, TLV_U32,
+		    evset_to_mask(st.pr_fatal) ]);
+	if (st.pr_members !== undefined)
+		fields.push([ TAG_PR_MEMBERS, TLV_INTS, st.pr_members ]);
+	if (st.pr_contracts !== undefined)
+		fields.push([ TAG_PR_CONTRACTS, TLV_INTS, st.pr_contracts ]);
+	if (st.pr_svc_fmri !== undefined)
+		fields.push([ TAG_PR_SVC_FMRI, TLV_STRING, st.pr_svc_fmri ]);
+	if (st.pr_svc_aux !== undefined)
+		fields.push([ TAG_PR_SVC_AUX, TLV_STRING, st.pr_svc_aux ]);
+	if (st.pr_svc_ctid !== undefined)
+		fields.push([ TAG_PR_SVC_CTID, TLV_U32, st.pr_svc_ctid ]);
+	if (st.pr_svc_creator !== undefined)
+		fields.push([ TAG_PR_SVC_CREATOR, TLV_STRING,
+		    st.pr_svc_creator ]);
+	if (st.dev_state !== undefined)
+		fields.push([ TAG_DEV_STATE, TLV_U32,
+		    1 + DEV_STATES.indexOf(st.dev_state) ]);
+	if (st.dev_aset !== undefined)
+		fields.push([ TAG_DEV_ASET, TLV_U32,
+		    flags_to_mask(st.dev_aset, DEV_STATES) ]);
+	if (st.dev_minor !== undefined)
+		fields.push([ TAG_DEV_MINOR, TLV_STRING, st.dev_minor ]);
+	if (st.dev_noneg !== undefined)
+		fields.push([ TAG_DEV_NONEG, TLV_U32, st.dev_noneg ? 1 : 0 ]);
+
+	for (i = 0; i < fields.length; i++) {
+		lens[i] = tlv_len(fields[i]);
+		len += TLV_HDR_LEN + lens[i];
+	}
+
+	buf = new Buffer(len);
+	write_header(buf, 0, KIND_STATUS, len);
+	buf.writeInt32LE(st.ctid | 0, 8);
+	buf.writeInt32LE(st.zoneid | 0, 12);
+	buf[16] = code_of(CT_TYPES, st.type);
+	buf[17] = code_of(CT_STATES, st.state);
+	buf.writeUInt16LE(0, 18);
+	buf.writeInt32LE(st.holder | 0, 20);
+	buf.writeInt32LE(st.nevents | 0, 24);
+	buf.writeInt32LE(st.ntime | 0, 28);
+	buf.writeInt32LE(st.qtime | 0, 32);
+	u64_write(buf, 36, st.nevid);
+	u64_write(buf, 44, st.cookie);
+	buf.writeUInt32LE(evset_to_mask(st.informative), 52);
+	buf.writeUInt32LE(evset_to_mask(st.critical), 56);
+
+	off = STATUS_FIXED_LEN;
+	for (i = 0; i < fields.length; i++)
+		off = tlv_write(buf, off, fields[i], lens[i]);
+
+	return (buf);
+}
+
+function
+EventView(buf, off)
+{
+	this.buffer = buf;
+	this.offset = off;
+}
+
+EventView.prototype.kind = 'event';
+
+EventView.prototype.byteLength = function byteLength() {
+	return (EVENT_LEN);
+};
+
+EventView.prototype.ctid = function ctid() {
+	return (this.buffer.readInt32LE(this.offset + 8));
+};
+
+EventView.prototype.evid = function evid() {
+	return (u64_read(this.buffer, this.offset + 12));
+};
+
+EventView.prototype.type = function type() {
+	return (EVENT_TYPES[this.buffer.readUInt16LE(this.offset + 20)] ||
+	    'unknown');
+};
+
+EventView.prototype.flagsMask = function flagsMask() {
+	return (this.buffer[this.offset + 22]);
+};
+
+EventView.prototype.isCritical = function isCritical() {
+	return ((this.buffer[this.offset + 22] & EVF_ACK) !== 0);
+};
+
+EventView.prototype.nevid = function nevid() {
+	if (!(this.buffer[this.offset + 23] & EVP_NEGEND))
+		return (undefined);
+	return (u64_read(this.buffer, this.offset + 24));
+};
+
+EventView.prototype.newct = function newct() {
+	if (!(this.buffer[this.offset + 23] & EVP_NEGEND))
+		return (undefined);
+	return (this.buffer.readInt32LE(this.offset + 32));
+};
+
+/*
+ * Materialize the event in the same shape the binding emits.
+ */
+EventView.prototype.toObject = function toObject() {
+	var fm = this.flagsMask();
+	var ev = {
+		ctid: this.ctid(),
+		evid: this.evid(),
+		type: this.type(),
+		flags: {
+			info: (fm & EVF_INFO) !== 0,
+			ack: (fm & EVF_ACK) !== 0,
+			neg: (fm & EVF_NEG) !== 0
+		}
+	};
+
+	if (this.buffer[this.offset + 23] & EVP_NEGEND) {
+		ev.nevid = this.nevid();
+		ev.newct = this.newct();
+	}
+
+	return (ev);
+};
+
+function
+StatusView(buf, off, len)
+{
+	this.buffer = buf;
+	this.offset = off;
+	this.length = len;
+}
+
+StatusView.prototype.kind = 'status';
+
+StatusView.prototype.byteLength = function byteLength() {
+	return (this.length);
+};
+
+StatusView.prototype.ctid = function ctid() {
+	return (this.buffer.readInt32LE(this.offset + 8));
+};
+
+StatusView.prototype.type = function type() {
+	return (CT_TYPES[this.buffer[this.offset + 16]] || 'unknown');
+};
+
+StatusView.prototype.state = function state() {
+	return (CT_STATES[this.buffer[this.offset + 17]] || 'unknown');
+};
+
+StatusView.prototype.holder = function holder() {
+	return (this.buffer.readInt32LE(this.offset + 20));
+};
+
+StatusView.prototype.nevents = function nevents() {
+	return (this.buffer.readInt32LE(this.offset + 24));
+};
+
+/*
+ * Returns the offset and length of the value for the given tag, or null if
+ * the record does not carry it.
+ */
+StatusView.prototype._field = function _field(tag) {
+	var b = this.buffer;
+	var off = this.offset + STATUS_FIXED_LEN;
+	var end = this.offset + this.length;
+	var len;
+
+	while (off + TLV_HDR_LEN <= end) {
+		len = b.readUInt32LE(off + 2);
+		if (b.readUInt16LE(off) === tag)
+			return ({ off: off + TLV_HDR_LEN, len: len });
+		off += TLV_HDR_LEN + len;
+	}
+
+	return (null);
+};
+
+StatusView.prototype.svcFmri = function svcFmri() {
+	var f = this._field(TAG_PR_SVC_FMRI);
+
+	return (f ? this.buffer.toString('utf8', f.off, f.off + f.len) :
+	    undefined);
+};
+
+StatusView.prototype.memberCount = function memberCount() {
+	var f = this._field(TAG_PR_MEMBERS);
+
+	return (f ? f.len / 4 : 0);
+};
+
+StatusView.prototype.toObject = function toObject() {
+	var b = this.buffer;
+	var o = this.offset;
+	var names = this.type() === 'device' ? DEV_EVENTS : PR_EVENTS;
+	var st = {
+		ctid: this.ctid(),
+		zoneid: b.readInt32LE(o + 12),
+		type: this.type(),
+		state: this.state(),
+		holder: this.holder(),
+		nevents: this.nevents(),
+		ntime: b.readInt32LE(o + 28),
+		qtime: b.readInt32LE(o + 32),
+		nevid: u64_read(b, o + 36),
+		cookie: u64_read(b, o + 44),
+		informative: mask_to_evset(b.readUInt32LE(o + 52), names),
+		critical: mask_to_evset(b.readUInt32LE(o + 56), names)
+	};
+	var off = o + STATUS_FIXED_LEN;
+	var end = o + this.length;
+	var tag, len, v, i, n;
+
+	function ints() {
+		var r = {};
+
+		for (i = 0, n = len / 4; i < n; i++)
+			r[String(i)] = b.readInt32LE(v + 4 * i);
+		return (r);
+	}
+
+	function str() {
+		return (b.toString('utf8', v, v + len));
+	}
+
+	while (off + TLV_HDR_LEN <= end) {
+		tag = b.readUInt16LE(off);
+		len = b.readUInt32LE(off + 2);
+		v = off + TLV_HDR_LEN;
+
+		switch (tag) {
+		case TAG_PR_PARAM:
+			st.pr_param = mask_to_flags(b.readUInt32LE(v),
+			    PR_PARAMS);
+			break;
+		case TAG_PR_FATAL:
+			st.pr_fatal = mask_to_evset(b.readUInt32LE(v),
+			    PR_EVENTS);
+			break;
+		case TAG_PR_MEMBERS:
+			st.pr_members = ints();
+			break;
+		case TAG_PR_CONTRACTS:
+			st.pr_contracts = ints();
+			break;
+		case TAG_PR_SVC_FMRI:
+			st.pr_svc_fmri = str();
+			break;
+		case TAG_PR_SVC_AUX:
+			st.pr_svc_aux = str();
+			break;
+		case TAG_PR_SVC_CTID:
+			st.pr_svc_ctid = b.readUInt32LE(v);
+			break;
+		case TAG_PR_SVC_CREATOR:
+			st.pr_svc_creator = str();
+			break;
+		case TAG_DEV_STATE:
+			st.dev_state = DEV_STATES[b.readUInt32LE(v) - 1] ||
+			    'unknown';
+			break;
+		case TAG_DEV_ASET:
+			st.dev_aset = mask_to_flags(b.readUInt32LE(v),
+			    DEV_STATES);
+			break;
+		case TAG_DEV_MINOR:
+			st.dev_minor = str();
+			break;
+		case TAG_DEV_NONEG:
+			st.dev_noneg = b.readUInt32LE(v) !== 0;
+			break;
+		default:
+			break;
+		}
+
+		off = v + len;
+	}
+
+	return (st);
+};
+
+/*
+ * Returns a view of the record at buf[off].  No bytes are copied.
+ */
+function
+decode(buf, off)
+{
+	var len;
+
+	off = off || 0;
+	if ((len = frameLength(buf, off)) < 0)
+		throw (new Error('truncated contract record'));
+
+	switch (buf[off + 2]) {
+	case KIND_EVENT:
+		if (len !== EVENT_LEN)
+			throw (new Error('bad contract event length'));
+		return (new EventView(buf, off));
+	case KIND_STATUS:
+		if (len < STATUS_FIXED_LEN)
+			throw (new Error('bad contract status length'));
+		return (new StatusView(buf, off, len));
+	default:
+		throw (new Error('unknown contract record kind ' +
+		    buf[off + 2]));
+	}
+}
+
+module.exports = {
+	VERSION: VERSION,
+	KIND_EVENT: KIND_EVENT,
+	KIND_STATUS: KIND_STATUS,
+	EVENT_LENGTH: EVENT_LEN,
+	encodeEvent: encodeEvent,
+	encodeStatus: encodeStatus,
+	decode: decode,
+	frameLength: frameLength
+};
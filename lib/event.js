@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * The object passed to contract event listeners.  The binding hands us an
+ * event's fields as plain arguments rather than as an object, and every
+ * event is built here by the one constructor, which assigns every field in
+ * the same order whether or not the event has it.  Every event therefore
+ * has the same shape, and listeners' property accesses see only one.
+ *
+ * The event flags arrive as a mask (the same bits as the record codec
+ * uses); the `flags` object of booleans is built only when first asked for.
+ * Event ids remain decimal strings, as elsewhere in the API, since they may
+ * exceed 2^53.
+ */
+
+var FLAG_INFO = 0x1;
+var FLAG_ACK = 0x2;
+var FLAG_NEG = 0x4;
+
+function
+ContractEvent(ctid, evid, type, flagsMask, nevid, newct)
+{
+	this.ctid = ctid;
+	this.evid = evid;
+	this.type = type;
+	this.flagsMask = flagsMask;
+	this.nevid = nevid;
+	this.newct = newct;
+	this.time = undefined;
+	this.delivered = undefined;
+	this.previousBoot = undefined;
+	this._flags = null;
+}
+
+Object.defineProperty(ContractEvent.prototype, 'flags', {
+	get: function flags() {
+		var fm = this.flagsMask;
+
+		if (this._flags === null) {
+			this._flags = {
+				info: (fm & FLAG_INFO) !== 0,
+				ack: (fm & FLAG_ACK) !== 0,
+				neg: (fm & FLAG_NEG) !== 0
+			};
+		}
+
+		return (this._flags);
+	},
+	enumerable: true
+});
+
+ContractEvent.prototype.isCritical = function isCritical() {
+	return ((this.flagsMask & FLAG_ACK) !== 0);
+};
+
+/*
+ * Whether the event awaits an answer from the consumer: it is critical, or
+ * part of a negotiation.
+ */
+ContractEvent.prototype.awaitsAnswer = function awaitsAnswer() {
+	return ((this.flagsMask & (FLAG_ACK | FLAG_NEG)) !== 0);
+};
+
+/*
+ * Serialize in the shape events have always had, without the fields this
+ * event lacks.  Events replayed from the journal also carry `delivered' and
+ * `previousBoot'.
+ */
+ContractEvent.prototype.toJSON = function toJSON() {
+	var o = {
+		ctid: this.ctid,
+		evid: this.evid,
+		type: this.type,
+		flags: this.flags
+	};
+
+	if (this.nevid !== undefined) {
+		o.nevid = this.nevid;
+		o.newct = this.newct;
+	}
+	if (this.time !== undefined)
+		o.time = this.time;
+	if (this.delivered !== undefined) {
+		o.delivered = this.delivered;
+		o.previousBoot = this.previousBoot;
+	}
+
+	return (o);
+};
+
+/*
+ * Build an event from an object in the binding's batch form, which has
+ * `flagsMask` in place of `flags`.
+ */
+ContractEvent.fromObject = function fromObject(o) {
+	return (new ContractEvent(o.ctid, o.evid, o.type, o.flagsMask,
+	    o.nevid, o.newct));
+};
+
+module.exports = {
+	ContractEvent: ContractEvent,
+	FLAG_INFO: FLAG_INFO,
+	FLAG_ACK: FLAG_ACK,
+	FLAG_NEG: FLAG_NEG
+};
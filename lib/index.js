@@ -1,42 +1,316 @@
 var util = require('util');
 var EventEmitter = require('events').EventEmitter;
-var binding = require('./contract_binding');
+var binding = require('./binding');
+var codec = require('./codec');
+var ContractEvent = require('./event').ContractEvent;
+var metrics = require('./metrics');
+var record = require('./record');
+var trace = require('./trace');
 
+/*
+ * Every live native contract, by ctid, as its SharedContract.  Asking again
+ * for a contract we already have reuses the native object, rather than
+ * building a second one with its own descriptors and event source, but each
+ * caller gets a Contract of its own: a handle holding its own reference,
+ * listeners and event queue, to be released with dispose().
+ */
+var contracts = {};
+
+var GROUP_KINDS = [ 'svc_fmri', 'svc_ctid', 'cookie' ];
+
+/*
+ * The binding delivers each contract event by calling _event() on the
+ * native object with the event's fields, and anything else it emits (lost
+ * and deadline events) by calling _emit().  Rather than give every native
+ * object closures of its own, we install trampolines on the prototype they
+ * share, which find the SharedContract through a back-reference, and it
+ * emits to each Contract holding it.
+ */
+function
+eventTrampoline(type, ctid, evid, flagsMask, nevid, newct, wakeup, read)
+{
+	var self = this._shared;
+	var ev = new ContractEvent(ctid, evid, type, flagsMask, nevid, newct);
+
+	if (wakeup !== undefined) {
+		ev.time = { wakeup: wakeup, read: read };
+		if (record.active())
+			record.event(ev, wakeup, read);
+		trace.emit(self, [ type, ev ]);
+		return;
+	}
+	self.emit(type, ev);
+}
+
+function
+emitTrampoline(name, obj)
+{
+	var self = this._shared;
+
+	if (record.active())
+		record.emit(self.ctid, name, obj);
+	self.emit.apply(self, arguments);
+}
+
+/*
+ * The native contract and what its holders share: the Contracts holding it,
+ * in the order they were handed out, and the one native event queue.  The
+ * native queue takes every type any holder's EventQueue wants, and we keep
+ * a request for its next batch outstanding while it is open, sorting each
+ * batch into the queues that want each event and emitting the event to the
+ * holders that don't.  We also note whether we own the contract, so that
+ * adopting it again costs nothing.
+ */
 function
-Contract(/* ... */)
+SharedContract(args, owned)
 {
+	var proto;
+
+	this.binding = binding.get()._new.apply(null, args);
+	this.binding._shared = this;
+
+	proto = Object.getPrototypeOf(this.binding);
+	if (proto._emit !== emitTrampoline) {
+		proto._emit = emitTrampoline;
+		proto._event = eventTrampoline;
+	}
+
+	this.ctid = this.binding._ctid();
+	this.owned = owned;
+	this.holders = [];
+	this._qkey = null;
+	this._qgen = 0;
+	this._qstalled = false;
+	contracts[this.ctid] = this;
+}
+
+SharedContract.prototype.emit = function emit() {
+	var holders = this.holders.slice();
+	var i;
+
+	for (i = 0; i < holders.length; i++) {
+		if (holders[i]._binding !== null)
+			holders[i].emit.apply(holders[i], arguments);
+	}
+
+	return (holders.length > 0);
+};
+
+/*
+ * Some holder's EventQueue has been opened or closed: set the native queue
+ * to take what the remaining queues want, if that has changed.
+ */
+SharedContract.prototype.queuesChanged = function queuesChanged() {
+	var all = false;
+	var types = {};
+	var max = 0;
+	var nqueues = 0;
+	var key;
+
+	this.holders.forEach(function (c) {
+		var q = c._queue;
+
+		if (q === undefined)
+			return;
+		nqueues++;
+		if (q._types === null)
+			all = true;
+		else
+			q._types.forEach(function (t) { types[t] = true; });
+		max = Math.max(max, q._max);
+	});
+
+	types = all ? [] : Object.keys(types).sort();
+	key = nqueues === 0 ? null : JSON.stringify([ types, max ]);
+	if (key === this._qkey)
+		return;
+
+	if (key === null) {
+		this._qgen++;
+		this._qkey = null;
+		if (this.binding !== null)
+			this.binding._queue_stop();
+		return;
+	}
+
+	this.binding._queue_start(types, max);
+	this._qgen++;
+	this._qkey = key;
+	this._qstalled = false;
+	this._pump();
+};
+
+SharedContract.prototype._pump = function _pump() {
 	var self = this;
+	var gen = this._qgen;
+	var res;
 
-	EventEmitter.call(this);
+	while (this._qgen === gen) {
+		res = this.binding._queue_next(function (err, batch) {
+			if (self._qgen !== gen)
+				return;
+			if (err) {
+				self._fail(err);
+				return;
+			}
+			self._dispatch(batch);
+			if (self._qgen === gen)
+				self._pump();
+		});
+		if (res === undefined)
+			return;
+		this._dispatch(res);
+	}
+};
 
-	this._binding = binding._new.apply(this,
-	    Array.prototype.slice.call(arguments));
+/*
+ * The native queue could not hand over a batch, though its events remain
+ * queued.  Pass the error to each queue's outstanding request, and ask
+ * again when one of them next asks.
+ */
+SharedContract.prototype._fail = function _fail(err) {
+	var holders = this.holders.slice();
+	var j;
 
-	this._binding._emit = function () {
-		var args = Array.prototype.slice.call(arguments);
-		self.emit.apply(self, args);
-	};
+	this._qstalled = true;
+	for (j = 0; j < holders.length; j++) {
+		if (holders[j]._queue !== undefined)
+			holders[j]._queue._fail(err);
+	}
+};
+
+/*
+ * Resume asking for batches after a failure.  If asking fails at once, we
+ * remain stalled and the caller sees the error.
+ */
+SharedContract.prototype._resume = function _resume() {
+	if (!this._qstalled)
+		return;
+
+	this._qstalled = false;
+	try {
+		this._pump();
+	} catch (e) {
+		this._qstalled = true;
+		throw (e);
+	}
+};
+
+SharedContract.prototype._dispatch = function _dispatch(batch) {
+	var evs = values(batch.events).map(ContractEvent.fromObject);
+	var holders = this.holders.slice();
+	var i, j, c;
+
+	for (j = 0; j < holders.length; j++) {
+		if (holders[j]._queue !== undefined)
+			holders[j]._queue._lose(batch.lost);
+	}
+
+	for (i = 0; i < evs.length; i++) {
+		for (j = 0; j < holders.length; j++) {
+			c = holders[j];
+			if (c._binding === null)
+				continue;
+			if (c._queue !== undefined && c._queue._wants(evs[i]))
+				c._queue._push(evs[i]);
+			else
+				c.emit(evs[i].type, evs[i]);
+		}
+	}
+
+	for (j = 0; j < holders.length; j++) {
+		if (holders[j]._queue !== undefined)
+			holders[j]._queue._deliver();
+	}
+};
+
+/*
+ * disposeAll() has torn the native contract down: release every holder as
+ * dispose() would, but without touching the binding, which would only
+ * refuse.  Handles are cut off first, so that closing their queues doesn't
+ * try to reconfigure the native queue.
+ */
+SharedContract.prototype._teardown = function _teardown() {
+	var holders = this.holders;
+	var i, c;
+
+	this.holders = [];
+	this._qgen++;
+	for (i = 0; i < holders.length; i++) {
+		c = holders[i];
+		c._binding = null;
+		if (c._queue !== undefined)
+			c._queue.close();
+		c.removeAllListeners();
+	}
+	this.binding._shared = null;
+	this.binding = null;
+};
+
+/*
+ * A caller's handle on a native contract, holding one reference to it.
+ */
+function
+Contract(shared)
+{
+	EventEmitter.call(this);
 
-	this._binding._hold();
+	shared.binding._hold();
+	this._shared = shared;
+	this._binding = shared.binding;
+	this._queue = undefined;
+	this.ctid = shared.ctid;
+	shared.holders.push(this);
 }
 util.inherits(Contract, EventEmitter);
 
 /* XXX async? */
 Contract.prototype.status = function status() {
-	return (this._binding._status());
+	var st = this._binding._status();
+
+	if (record.active())
+		record.status(st);
+	return (st);
+};
+
+Contract.prototype.statusBuffer = function statusBuffer() {
+	return (codec.encodeStatus(this.status()));
 };
 
 Contract.prototype.abandon = function abandon() {
 	this._binding._abandon();
+	this._shared.owned = false;
 };
 
 Contract.prototype.ack = function ack(evid) {
 	this._binding._ack(evid);
 };
 
+/*
+ * Release this handle: its queue is closed and its listeners removed, and
+ * it can't be used again.  Other holders are unaffected, and the native
+ * contract is torn down with the last.
+ */
 Contract.prototype.dispose = function dispose() {
-	this._binding._rele();
+	var shared = this._shared;
+	var b = this._binding;
+
+	if (b === null)
+		return;
+
+	if (this._queue !== undefined)
+		this._queue.close();
+	this.removeAllListeners();
+	shared.holders.splice(shared.holders.indexOf(this), 1);
 	this._binding = null;
+
+	if (b._rele() !== 0)
+		return;
+
+	if (contracts[this.ctid] === shared)
+		delete contracts[this.ctid];
+	b._shared = null;
+	shared.binding = null;
 };
 
 Contract.prototype.nack = function nack(evid) {
@@ -51,40 +325,565 @@ Contract.prototype.sigsend = function sigsend(sig) {
 	this._binding._sigsend(sig);
 };
 
+Contract.prototype.terminateTree = function terminateTree(opts, cb) {
+	if (typeof (opts) === 'function') {
+		cb = opts;
+		opts = {};
+	}
+
+	this._binding._terminate_tree(opts || {}, function (err, res) {
+		var e;
+
+		if (err) {
+			cb(new Error(err.message));
+			return;
+		}
+
+		res.contracts = values(res.contracts);
+		if (res.timedout) {
+			e = new Error('timed out waiting for ' + res.remaining +
+			    ' contract(s) to empty');
+			e.result = res;
+			cb(e);
+			return;
+		}
+		cb(null, res);
+	});
+};
+
+/*
+ * Without a listener, once() returns a promise for the event's argument
+ * where promises are available.
+ */
+Contract.prototype.once = function once(ev, listener) {
+	var self = this;
+
+	if (listener !== undefined || typeof (Promise) !== 'function')
+		return (EventEmitter.prototype.once.call(this, ev, listener));
+
+	return (new Promise(function (resolve) {
+		EventEmitter.prototype.once.call(self, ev, resolve);
+	}));
+};
+
+/*
+ * Pull events of the given types (by default, all) in batches instead of
+ * having them emitted to this handle.
+ */
+Contract.prototype.events = function events(opts) {
+	var q;
+
+	if (this._queue !== undefined)
+		this._queue.close();
+
+	q = new EventQueue(this, opts || {});
+	this._queue = q;
+	try {
+		this._shared.queuesChanged();
+	} catch (e) {
+		this._queue = undefined;
+		throw (e);
+	}
+
+	return (q);
+};
+
+Contract.prototype.watchStatus = function watchStatus(fields, interval, cb) {
+	if (typeof (fields) === 'string')
+		fields = [ fields ];
+
+	this._binding._watch_status(fields, interval,
+	    function (err, changed, previous) {
+		var e;
+
+		if (err) {
+			e = new Error(err.message);
+			e.errno = err.errno;
+			cb(e);
+			return;
+		}
+		cb(null, changed, previous);
+	});
+};
+
+Contract.prototype.unwatchStatus = function unwatchStatus() {
+	this._binding._unwatch_status();
+};
+
+Contract.prototype.lifecycle = function lifecycle() {
+	return (this._binding._lifecycle());
+};
+
+Contract.prototype.checkLoss = function checkLoss() {
+	return (this._binding._check_loss());
+};
+
+Contract.prototype.resyncOnLoss = function resyncOnLoss(enable) {
+	this._binding._resync_on_loss(enable !== false);
+};
+
+Contract.prototype.eventSourceStats = function eventSourceStats() {
+	return (this._binding._evsrc_stats());
+};
+
+Contract.prototype.eventSample = function eventSample() {
+	return (this._binding._sample());
+};
+
+Contract.prototype.trackDeadlines = function trackDeadlines(opts) {
+	this._binding._deadlines_track(opts || {});
+};
+
+Contract.prototype.untrackDeadlines = function untrackDeadlines() {
+	this._binding._deadlines_untrack();
+};
+
+Contract.prototype.deadlineStats = function deadlineStats() {
+	return (this._binding._deadlines_stats());
+};
+
+Contract.prototype.trackMembers = function trackMembers(opts) {
+	var interval = 0;
+
+	if (opts && opts.resyncInterval !== undefined)
+		interval = opts.resyncInterval;
+
+	this._binding._members_track(interval);
+};
+
+Contract.prototype.untrackMembers = function untrackMembers() {
+	this._binding._members_untrack();
+};
+
+Contract.prototype.resyncMembers = function resyncMembers() {
+	this._binding._members_resync();
+};
+
+Contract.prototype.hasMember = function hasMember(pid) {
+	return (this._binding._members_has(pid));
+};
+
+Contract.prototype.memberCount = function memberCount() {
+	return (this._binding._members_count());
+};
+
+Contract.prototype.members = function members() {
+	var set = this._binding._members_list();
+
+	return (Object.keys(set).map(function (k) { return (set[k]); }));
+};
+
+var DEFAULT_QUEUE_MAX = 1024;
+
+/*
+ * One holder's queue.  The events its SharedContract sorts into it wait
+ * here until asked for: at most _max of them, except that events awaiting
+ * an answer are never lost.
+ */
+function
+EventQueue(contract, opts)
+{
+	this._contract = contract;
+	this._types = opts.types !== undefined && opts.types.length > 0 ?
+	    opts.types.slice() : null;
+	this._max = opts.max || DEFAULT_QUEUE_MAX;
+	this._pending = null;
+	this._queued = [];
+	this._qlost = 0;
+	this._buf = [];
+	this._closed = false;
+	this.lost = 0;
+}
+
+EventQueue.prototype._wants = function _wants(ev) {
+	return (this._types === null || this._types.indexOf(ev.type) !== -1);
+};
+
+EventQueue.prototype._push = function _push(ev) {
+	if (this._queued.length >= this._max && !ev.awaitsAnswer())
+		this._qlost++;
+	else
+		this._queued.push(ev);
+};
+
+EventQueue.prototype._lose = function _lose(n) {
+	this._qlost += n;
+};
+
+EventQueue.prototype._fail = function _fail(err) {
+	var cb = this._pending;
+
+	if (cb === null)
+		return;
+
+	this._pending = null;
+	cb(err);
+};
+
+/*
+ * Call back with (err, events, lost): the events queued since the last
+ * batch, in order, and the number lost to a full queue.  Once the queue is
+ * closed, events is null.  Only one request may be outstanding.
+ */
+EventQueue.prototype.next = function next(cb) {
+	var self = this;
+
+	if (this._closed) {
+		process.nextTick(function () { cb(null, null, 0); });
+		return;
+	}
+
+	this._pending = cb;
+	if (this._queued.length > 0 || this._qlost > 0)
+		process.nextTick(function () { self._deliver(); });
+	else
+		this._contract._shared._resume();
+};
+
+EventQueue.prototype._deliver = function _deliver() {
+	var cb = this._pending;
+	var evs = this._queued;
+	var lost = this._qlost;
+
+	if (cb === null || (evs.length === 0 && lost === 0))
+		return;
+
+	this._pending = null;
+	this._queued = [];
+	this._qlost = 0;
+	this.lost += lost;
+	cb(null, evs, lost);
+};
+
+EventQueue.prototype.close = function close() {
+	var c = this._contract;
+	var cb = this._pending;
+
+	if (this._closed)
+		return;
+
+	this._closed = true;
+	this._pending = null;
+	this._queued = [];
+	if (c._queue === this) {
+		c._queue = undefined;
+		if (c._binding !== null)
+			c._shared.queuesChanged();
+	}
+	if (cb !== null)
+		process.nextTick(function () { cb(null, null, 0); });
+};
+
+/*
+ * Promise-based access, one event at a time, where promises are available.
+ */
+EventQueue.prototype.nextEvent = function nextEvent() {
+	var self = this;
+
+	if (this._buf.length > 0)
+		return (Promise.resolve({
+			value: this._buf.shift(),
+			done: false
+		}));
+
+	return (new Promise(function (resolve, reject) {
+		self.next(function (err, evs) {
+			if (err) {
+				reject(err);
+				return;
+			}
+			if (evs === null) {
+				resolve({ value: undefined, done: true });
+				return;
+			}
+			self._buf = evs;
+			resolve(self._buf.length > 0 ?
+			    { value: self._buf.shift(), done: false } :
+			    self.nextEvent());
+		});
+	}));
+};
+
+if (typeof (Symbol) === 'function' && Symbol.asyncIterator !== undefined) {
+	EventQueue.prototype[Symbol.asyncIterator] = function () {
+		var self = this;
+
+		return ({
+			next: function () { return (self.nextEvent()); },
+			'return': function () {
+				self.close();
+				return (Promise.resolve({ done: true }));
+			}
+		});
+	};
+}
+
 function
 create()
 {
-	binding._create();
+	binding.get()._create();
+}
+
+function
+reuse(ctid)
+{
+	var shared = contracts[ctid];
+
+	if (shared === undefined || shared.binding === null)
+		return (undefined);
+
+	return (new Contract(shared));
 }
 
 function
 adopt(ctid)
 {
-	return (new Contract(ctid, true));
+	var c = reuse(ctid);
+
+	if (c === undefined)
+		return (new Contract(new SharedContract([ ctid, true ], true)));
+
+	if (c._shared.owned)
+		return (c);
+
+	try {
+		c._binding._adopt();
+	} catch (e) {
+		c.dispose();
+		throw (e);
+	}
+	c._shared.owned = true;
+	return (c);
 }
 
 function
 observe(ctid)
 {
-	return (new Contract(ctid));
+	var c = reuse(ctid);
+
+	return (c !== undefined ? c :
+	    new Contract(new SharedContract([ ctid ], false)));
 }
 
 function
 latest()
 {
-	return (new Contract());
+	var c = reuse(binding.get()._latest_ctid());
+
+	return (c !== undefined ? c :
+	    new Contract(new SharedContract([], true)));
 }
 
 function
 set_template(tmpl)
 {
-	binding._set_template(tmpl);
+	binding.get()._set_template(tmpl);
 }
 
 function
 clear_template()
 {
-	binding._clear_template();
+	binding.get()._clear_template();
+}
+
+/*
+ * If the binding throws, the map and every handle are left as they were.
+ * Otherwise every native contract has been torn down, and every handle is
+ * released at once; the map keeps the torn-down contracts, which reuse()
+ * passes over, until the binding has finished with them, and contracts
+ * created meanwhile are kept.
+ */
+function
+disposeAll(cb)
+{
+	var held = values(contracts).filter(function (shared) {
+		return (shared.binding !== null);
+	});
+
+	binding.get()._dispose_all(function (err, n) {
+		held.forEach(function (shared) {
+			if (contracts[shared.ctid] === shared)
+				delete contracts[shared.ctid];
+		});
+		if (cb !== undefined)
+			cb(err, n);
+	});
+
+	held.forEach(function (shared) { shared._teardown(); });
+}
+
+function
+journal_open(path, opts)
+{
+	if (opts === undefined)
+		binding.get()._journal_open(path);
+	else
+		binding.get()._journal_open(path, opts);
+}
+
+function
+journal_close()
+{
+	binding.get()._journal_close();
+}
+
+function
+journal_replay()
+{
+	var evs = binding.get()._journal_replay();
+
+	return (Object.keys(evs).map(function (k) {
+		var ev = ContractEvent.fromObject(evs[k]);
+
+		ev.delivered = evs[k].delivered;
+		ev.previousBoot = evs[k].previousBoot;
+		return (ev);
+	}));
+}
+
+function
+journal_stats()
+{
+	return (binding.get()._journal_stats());
+}
+
+function
+values(obj)
+{
+	return (Object.keys(obj).map(function (k) { return (obj[k]); }));
+}
+
+/*
+ * A group is named by an object with exactly one of the properties
+ * svc_fmri, svc_ctid or cookie.
+ */
+function
+groupArgs(group)
+{
+	var kinds = GROUP_KINDS.filter(function (k) {
+		return (group[k] !== undefined);
+	});
+
+	if (kinds.length !== 1) {
+		throw (new TypeError('a group is named by exactly one of ' +
+		    GROUP_KINDS.join(', ')));
+	}
+
+	return ([ kinds[0], String(group[kinds[0]]) ]);
+}
+
+function
+groups(kind)
+{
+	return (values(binding.get()._groups(kind)).map(function (g) {
+		if (kind === 'svc_ctid')
+			g.key = Number(g.key);
+		return (g);
+	}));
+}
+
+function
+groupCount(group)
+{
+	var b = binding.get();
+
+	return (b._group_count.apply(b, groupArgs(group)));
+}
+
+function
+groupCtids(group)
+{
+	var b = binding.get();
+
+	return (values(b._group_ctids.apply(b, groupArgs(group))));
+}
+
+function
+groupStatus(group)
+{
+	var b = binding.get();
+
+	return (values(b._group_status.apply(b, groupArgs(group))));
+}
+
+function
+groupSigsend(group, sig)
+{
+	var b = binding.get();
+
+	return (b._group_sigsend.apply(b, groupArgs(group).concat([ sig ])));
+}
+
+function
+groupAbandon(group)
+{
+	var b = binding.get();
+
+	return (b._group_abandon.apply(b, groupArgs(group)));
+}
+
+function
+sigsendMany(which, sig, opts, cb)
+{
+	var b = binding.get();
+	var ctids;
+
+	if (typeof (opts) === 'function') {
+		cb = opts;
+		opts = {};
+	}
+
+	if (typeof (which) === 'function')
+		ctids = values(b._held()).filter(which);
+	else if (!Array.isArray(which))
+		ctids = groupCtids(which);
+	else
+		ctids = which;
+
+	b._sigsend_many(ctids, sig, opts || {}, function (err, res) {
+		if (err) {
+			cb(new Error(err.message));
+			return;
+		}
+		res.results = values(res.results);
+		cb(null, res);
+	});
+}
+
+function
+sampleEvents(opts, cb)
+{
+	if (cb === undefined)
+		binding.get()._sample_start(opts || {});
+	else
+		binding.get()._sample_start(opts || {}, cb);
+}
+
+function
+stopSampling()
+{
+	binding.get()._sample_stop();
+}
+
+function
+topContracts(k, by)
+{
+	return (values(binding.get()._sample_top(k, by || 'rate')));
+}
+
+function
+eventSources(opts)
+{
+	if (opts !== undefined)
+		binding.get()._evsrc_config(opts);
+
+	return (binding.get()._evsrc_stats());
+}
+
+function
+stats()
+{
+	return (binding.get()._mgr_stats());
 }
 
 module.exports = {
@@ -93,5 +892,35 @@ module.exports = {
 	observe: observe,
 	latest: latest,
 	set_template: set_template,
-	clear_template: clear_template
+	clear_template: clear_template,
+	disposeAll: disposeAll,
+	journal_open: journal_open,
+	journal_close: journal_close,
+	journal_replay: journal_replay,
+	journal_stats: journal_stats,
+	eventSources: eventSources,
+	sigsendMany: sigsendMany,
+	groups: groups,
+	groupCount: groupCount,
+	groupCtids: groupCtids,
+	groupStatus: groupStatus,
+	groupSigsend: groupSigsend,
+	groupAbandon: groupAbandon,
+	sampleEvents: sampleEvents,
+	stopSampling: stopSampling,
+	topContracts: topContracts,
+	stats: stats,
+	metrics: metrics,
+	trace: {
+		enable: trace.enable,
+		disable: trace.disable,
+		stats: trace.stats
+	},
+	record: {
+		start: record.start,
+		stop: record.stop,
+		stats: record.stats
+	},
+	codec: codec,
+	ContractEvent: ContractEvent
 };
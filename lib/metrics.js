@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * OpenMetrics exporter.  The text is rendered entirely by the binding from
+ * its own counters; all we do here is serve it.
+ */
+
+var http = require('http');
+var binding = require('./binding');
+
+var CONTENT_TYPE =
+    'application/openmetrics-text; version=1.0.0; charset=utf-8';
+
+function
+enable()
+{
+	binding.get()._metrics_enable();
+}
+
+function
+render()
+{
+	return (binding.get()._metrics());
+}
+
+/*
+ * Serve metrics at /metrics.  Options are either `port` (and optionally
+ * `host`, which defaults to the loopback address) or `path`, for a unix
+ * domain socket.  The callback, if any, is invoked once listening.
+ */
+function
+createServer(opts, cb)
+{
+	var server;
+
+	enable();
+
+	server = http.createServer(function (req, res) {
+		var body;
+
+		if (req.url !== '/metrics' || req.method !== 'GET') {
+			res.writeHead(404);
+			res.end();
+			return;
+		}
+
+		try {
+			body = render();
+		} catch (e) {
+			res.writeHead(500, { 'Content-Type': 'text/plain' });
+			res.end(e.message + '\n');
+			return;
+		}
+
+		res.writeHead(200, {
+			'Content-Type': CONTENT_TYPE,
+			'Content-Length': Buffer.byteLength(body)
+		});
+		res.end(body);
+	});
+
+	if (opts.path !== undefined)
+		server.listen(opts.path, cb);
+	else
+		server.listen(opts.port, opts.host || '127.0.0.1', cb);
+
+	return (server);
+}
+
+module.exports = {
+	enable: enable,
+	render: render,
+	createServer: createServer
+};
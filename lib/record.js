@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Event trace recording, for replay with lib/replay.js.  While recording,
+ * the binding stamps every event with the time its source was woken and the
+ * time it was read (see src/event.c), and we append each event, as it is
+ * dispatched, to the trace file along with those times.  Status reads, and
+ * the other events the binding emits (`lost' and `deadline'), are recorded
+ * too, so that a replayed consumer sees what the original saw.
+ *
+ * A trace file is the 8-byte magic "CTTRACE1" followed by records, each
+ * with a 24-byte header:
+ *
+ *	0	u32	length of the record, header included
+ *	4	u8	kind: event, status or emit
+ *	5	3	(reserved)
+ *	8	f64	time, in microseconds on the process.hrtime() clock: for
+ *			events, when read; otherwise, when recorded
+ *	16	f64	for events, when the source was woken; otherwise 0
+ *
+ * and then the payload: for events and status, a record in the form of
+ * lib/codec.js; for other emitted events, the JSON text of [ ctid, name,
+ * object ].  Records are gathered into chunks and written asynchronously.
+ */
+
+var fs = require('fs');
+var binding = require('./binding');
+var codec = require('./codec');
+
+var MAGIC = 'CTTRACE1';
+var HDR_LEN = 24;
+var CHUNK_LEN = 64 * 1024;
+
+var KIND_EVENT = 1;
+var KIND_STATUS = 2;
+var KIND_EMIT = 3;
+
+var stream = null;
+var chunk = null;
+var used = 0;
+var nrecords = 0;
+var nbytes = 0;
+
+function
+now()
+{
+	var t = process.hrtime();
+
+	return (t[0] * 1e6 + t[1] / 1e3);
+}
+
+function
+flush()
+{
+	if (used === 0)
+		return;
+
+	stream.write(chunk.slice(0, used));
+	chunk = new Buffer(CHUNK_LEN);
+	used = 0;
+}
+
+/*
+ * Reserve space for a record with a payload of len bytes, write its header,
+ * and return the offset of the payload within chunk.
+ */
+function
+reserve(kind, len, time, wakeup)
+{
+	var rlen = HDR_LEN + len;
+	var off;
+
+	if (used + rlen > chunk.length) {
+		flush();
+		if (rlen > chunk.length)
+			chunk = new Buffer(rlen);
+	}
+
+	off = used;
+	chunk.writeUInt32LE(rlen, off);
+	chunk[off + 4] = kind;
+	chunk[off + 5] = 0;
+	chunk[off + 6] = 0;
+	chunk[off + 7] = 0;
+	chunk.writeDoubleLE(time, off + 8);
+	chunk.writeDoubleLE(wakeup, off + 16);
+
+	used += rlen;
+	nrecords++;
+	nbytes += rlen;
+
+	return (off + HDR_LEN);
+}
+
+function
+active()
+{
+	return (stream !== null);
+}
+
+/*
+ * Begin recording to the file at path, which is truncated.
+ */
+function
+start(path)
+{
+	stop();
+
+	stream = fs.createWriteStream(path);
+	stream.write(new Buffer(MAGIC, 'ascii'));
+	chunk = new Buffer(CHUNK_LEN);
+	used = 0;
+	nrecords = 0;
+	nbytes = MAGIC.length;
+
+	binding.get()._record(true);
+}
+
+/*
+ * Stop recording; cb, if supplied, is called once the file is complete.
+ */
+function
+stop(cb)
+{
+	if (stream === null) {
+		if (cb)
+			process.nextTick(cb);
+		return;
+	}
+
+	binding.get()._record(false);
+	flush();
+	stream.end();
+	if (cb)
+		stream.on('close', cb);
+	stream = null;
+	chunk = null;
+}
+
+function
+event(ev, wakeup, read)
+{
+	codec.encodeEvent(ev, chunk,
+	    reserve(KIND_EVENT, codec.EVENT_LENGTH, read, wakeup));
+}
+
+function
+status(st)
+{
+	var buf = codec.encodeStatus(st);
+
+	buf.copy(chunk, reserve(KIND_STATUS, buf.length, now(), 0));
+}
+
+function
+emit(ctid, name, obj)
+{
+	var text = JSON.stringify([ ctid, name, obj ]);
+	var len = Buffer.byteLength(text);
+
+	chunk.write(text, reserve(KIND_EMIT, len, now(), 0), len, 'utf8');
+}
+
+function
+stats()
+{
+	return ({ active: active(), records: nrecords, bytes: nbytes });
+}
+
+module.exports = {
+	MAGIC: MAGIC,
+	HDR_LEN: HDR_LEN,
+	KIND_EVENT: KIND_EVENT,
+	KIND_STATUS: KIND_STATUS,
+	KIND_EMIT: KIND_EMIT,
+	active: active,
+	start: start,
+	stop: stop,
+	event: event,
+	status: status,
+	emit: emit,
+	stats: stats
+};
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Replay of a trace recorded with contract.record (see lib/record.js), on
+ * any system, with or without contracts.  We substitute a stand-in for the
+ * native binding whose objects share a prototype, as the binding's do, so
+ * that lib/index.js installs its trampolines there; each recorded event is
+ * then delivered by calling _event() on the stand-in for its contract, and
+ * so passes through the same ContractEvent construction, tracing and
+ * listener dispatch as a live one.  Status reads return the contract's
+ * latest recorded status, and control operations are counted but have no
+ * effect.
+ *
+ * Events read in one drain -- those recorded with the same wakeup time --
+ * are delivered together from a single turn of the event loop, as they were
+ * originally.  Each drain is delivered at its recorded offset from the start
+ * divided by opts.speed (default 1); a speed of 0 delivers each drain as
+ * soon as the previous one has been and the loop has turned.
+ *
+ * The stand-in replaces the binding for the whole process, so a replay
+ * should have the process to itself.
+ */
+
+var fs = require('fs');
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+var binding = require('./binding');
+var codec = require('./codec');
+var record = require('./record');
+
+var defer = typeof (setImmediate) === 'function' ? setImmediate :
+    function (f) { setTimeout(f, 0); };
+
+function
+now()
+{
+	var t = process.hrtime();
+
+	return (t[0] * 1e6 + t[1] / 1e3);
+}
+
+function
+ReplayNative(replay, ctid)
+{
+	this._replay = replay;
+	this._id = ctid;
+	this._refs = 0;
+}
+
+ReplayNative.prototype._hold = function _hold() {
+	this._refs++;
+};
+
+ReplayNative.prototype._rele = function _rele() {
+	return (--this._refs);
+};
+
+ReplayNative.prototype._ctid = function _ctid() {
+	return (this._id);
+};
+
+/*
+ * Return the statuses recorded for this contract in the order in which they
+ * were read, so that a consumer making the same reads sees the same
+ * results; once they run out, the last is returned again.
+ */
+ReplayNative.prototype._status = function _status() {
+	var q = this._replay._status[this._id];
+	var off;
+
+	if (q === undefined) {
+		throw (new Error('no status was recorded for contract ' +
+		    this._id));
+	}
+
+	off = q.offs[Math.min(q.next++, q.offs.length - 1)];
+
+	return (codec.decode(this._replay._buf, off).toObject());
+};
+
+ReplayNative.prototype._ack = function _ack() {
+	this._replay._stats.acks++;
+};
+
+ReplayNative.prototype._nack = ReplayNative.prototype._ack;
+ReplayNative.prototype._qack = ReplayNative.prototype._ack;
+
+ReplayNative.prototype._sigsend = function _sigsend() {
+	this._replay._stats.ops++;
+};
+
+ReplayNative.prototype._abandon = ReplayNative.prototype._sigsend;
+
+function
+Replay(path, opts)
+{
+	var self = this;
+	var buf = fs.readFileSync(path);
+
+	EventEmitter.call(this);
+
+	opts = opts || {};
+
+	if (buf.length < record.MAGIC.length ||
+	    buf.toString('ascii', 0, record.MAGIC.length) !== record.MAGIC)
+		throw (new Error(path + ' is not a contract event trace'));
+
+	this._buf = buf;
+	this._off = record.MAGIC.length;
+	this._speed = opts.speed === undefined ? 1 : opts.speed;
+	this._status = {};
+	this._contracts = {};
+	this._t0 = -1;
+	this._started = 0;
+	this._stats = {
+		records: 0,
+		events: 0,
+		drains: 0,
+		statuses: 0,
+		emits: 0,
+		unclaimed: 0,
+		acks: 0,
+		ops: 0,
+		recorded_ms: 0,
+		elapsed_ms: 0,
+		lag_max_ms: 0
+	};
+
+	this._scan();
+
+	binding.use({
+		_new: function (ctid) {
+			return (new ReplayNative(self, ctid));
+		},
+		_record: function () {},
+		_trace: function () {}
+	});
+	this._contract = require('./index');
+}
+util.inherits(Replay, EventEmitter);
+
+/*
+ * Check that the records are intact, and index the recorded statuses.
+ */
+Replay.prototype._scan = function _scan() {
+	var buf = this._buf;
+	var off = this._off;
+	var r, ctid;
+
+	while (off < buf.length) {
+		if (buf.length - off < record.HDR_LEN ||
+		    (r = this._recordAt(off)).len < record.HDR_LEN ||
+		    r.len > buf.length - off)
+			throw (new Error('truncated trace record at offset ' +
+			    off));
+
+		if (r.kind === record.KIND_STATUS) {
+			ctid = codec.decode(buf, r.payload).ctid();
+			if (this._status[ctid] === undefined)
+				this._status[ctid] = { offs: [], next: 0 };
+			this._status[ctid].offs.push(r.payload);
+		}
+		off += r.len;
+	}
+};
+
+/*
+ * Return the Contract for ctid, creating it (and announcing it, so that the
+ * consumer may attach listeners) on first sight, or null if the consumer
+ * has since disposed of it.
+ */
+Replay.prototype._lookup = function _lookup(ctid) {
+	var c = this._contracts[ctid];
+
+	if (c === undefined) {
+		c = this._contracts[ctid] = this._contract.observe(ctid);
+		this.emit('contract', c);
+	}
+
+	return (c._binding !== null ? c : null);
+};
+
+Replay.prototype._recordAt = function _recordAt(off) {
+	var buf = this._buf;
+
+	return ({
+		len: buf.readUInt32LE(off),
+		kind: buf[off + 4],
+		time: buf.readDoubleLE(off + 8),
+		wakeup: buf.readDoubleLE(off + 16),
+		payload: off + record.HDR_LEN
+	});
+};
+
+Replay.prototype._event = function _event(r, wakeup) {
+	var v = codec.decode(this._buf, r.payload);
+	var c = this._lookup(v.ctid());
+
+	this._stats.events++;
+	if (c === null) {
+		this._stats.unclaimed++;
+		return;
+	}
+
+	c._binding._event(v.type(), v.ctid(), v.evid(), v.flagsMask(),
+	    v.nevid(), v.newct(), wakeup, now());
+};
+
+Replay.prototype._emitRecord = function _emitRecord(r) {
+	var a = JSON.parse(this._buf.toString('utf8', r.payload,
+	    r.payload + r.len - record.HDR_LEN));
+	var c = this._lookup(a[0]);
+
+	this._stats.emits++;
+	if (c === null) {
+		this._stats.unclaimed++;
+		return;
+	}
+
+	c._binding._emit(a[1], a[2]);
+};
+
+Replay.prototype._dispatch = function _dispatch(r, wakeup) {
+	this._stats.records++;
+
+	switch (r.kind) {
+	case record.KIND_EVENT:
+		this._event(r, wakeup);
+		break;
+	case record.KIND_STATUS:
+		/* Served in order by _status(); see _scan(). */
+		this._stats.statuses++;
+		break;
+	case record.KIND_EMIT:
+		this._emitRecord(r);
+		break;
+	default:
+		throw (new Error('unknown trace record kind ' + r.kind));
+	}
+};
+
+/*
+ * Whether the record at off belongs to the drain woken at t: it does if it
+ * is an event with that wakeup time, or if it is something else (a status
+ * read by a listener, or a `lost' event emitted ahead of the event that
+ * revealed the loss) followed by such an event.
+ */
+Replay.prototype._inDrain = function _inDrain(off, t) {
+	var r;
+
+	for (; off < this._buf.length; off += r.len) {
+		r = this._recordAt(off);
+		if (r.kind === record.KIND_EVENT)
+			return (r.wakeup === t);
+	}
+
+	return (false);
+};
+
+/*
+ * Deliver the next drain (or the next record outside any drain), then
+ * schedule the one after.
+ */
+Replay.prototype._step = function _step() {
+	var r, t, due, late, wakeup;
+
+	if (this._off >= this._buf.length) {
+		this._finish();
+		return;
+	}
+
+	r = this._recordAt(this._off);
+	t = r.kind === record.KIND_EVENT ? r.wakeup : r.time;
+	if (this._t0 < 0)
+		this._t0 = t;
+	due = this._speed === 0 ? 0 : (t - this._t0) / this._speed;
+
+	late = (now() - this._started - due) / 1000;
+	if (late < 0) {
+		setTimeout(this._step.bind(this), Math.ceil(-late));
+		return;
+	}
+	if (this._speed !== 0 && late > this._stats.lag_max_ms)
+		this._stats.lag_max_ms = late;
+	this._stats.recorded_ms = (t - this._t0) / 1000;
+
+	try {
+		if (r.kind === record.KIND_EVENT) {
+			this._stats.drains++;
+			wakeup = now();
+			while (this._off < this._buf.length &&
+			    this._inDrain(this._off, t)) {
+				r = this._recordAt(this._off);
+				this._off += r.len;
+				this._dispatch(r, wakeup);
+			}
+		} else {
+			this._off += r.len;
+			this._dispatch(r);
+		}
+	} catch (e) {
+		this._finish(e);
+		return;
+	}
+
+	defer(this._step.bind(this));
+};
+
+Replay.prototype._finish = function _finish(err) {
+	this._stats.elapsed_ms = (now() - this._started) / 1000;
+	if (err)
+		this.emit('error', err);
+	else
+		this.emit('end', this._stats);
+};
+
+/*
+ * Begin delivering events; 'end' is emitted with the stats once the whole
+ * trace has been delivered.
+ */
+Replay.prototype.start = function start() {
+	this._started = now();
+	defer(this._step.bind(this));
+};
+
+Replay.prototype.stats = function stats() {
+	return (this._stats);
+};
+
+module.exports = {
+	Replay: Replay
+};
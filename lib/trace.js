@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Per-event latency tracing.  When enabled, the binding stamps a sample of
+ * events with the time their event source was woken and the time each was
+ * read (see src/event.c).  We add the time at which the event reached
+ * JavaScript and the time at which its listeners returned, giving three
+ * stages:
+ *
+ *	drain		wakeup to read: time spent behind other ready
+ *			sources and earlier events from the same one
+ *	dispatch	read to arrival in JavaScript: marshalling and the
+ *			crossing into V8
+ *	listeners	arrival to return from the last listener
+ *
+ * Each stage is recorded in a log2 histogram of microseconds, and each
+ * traced event may also be written as one JSON line to a file.
+ */
+
+var fs = require('fs');
+var binding = require('./binding');
+
+var NBUCKETS = 32;
+var STAGES = [ 'drain', 'dispatch', 'listeners', 'total' ];
+
+var active = false;
+var stream = null;
+var hists = null;
+var nevents = 0;
+
+function
+now()
+{
+	var t = process.hrtime();
+
+	return (t[0] * 1e6 + t[1] / 1e3);
+}
+
+function
+newHistogram()
+{
+	var buckets = [];
+	var i;
+
+	for (i = 0; i < NBUCKETS; i++)
+		buckets.push(0);
+
+	return ({ count: 0, sum: 0, max: 0, buckets: buckets });
+}
+
+function
+observe(h, us)
+{
+	var i = 0;
+
+	if (us < 0)
+		us = 0;
+	while (i < NBUCKETS - 1 && us > (1 << i))
+		i++;
+
+	h.buckets[i]++;
+	h.count++;
+	h.sum += us;
+	if (us > h.max)
+		h.max = us;
+}
+
+/*
+ * Options:
+ *	every	trace one event in this many (default 1)
+ *	path	if present, append one JSON line per traced event here
+ */
+function
+enable(opts)
+{
+	var every;
+
+	opts = opts || {};
+	every = opts.every === undefined ? 1 : opts.every;
+
+	disable();
+
+	hists = {};
+	STAGES.forEach(function (s) { hists[s] = newHistogram(); });
+	nevents = 0;
+	if (opts.path !== undefined)
+		stream = fs.createWriteStream(opts.path, { flags: 'a' });
+
+	binding.get()._trace(every);
+	active = true;
+}
+
+function
+disable()
+{
+	if (!active)
+		return;
+
+	binding.get()._trace(0);
+	active = false;
+	if (stream !== null) {
+		stream.end();
+		stream = null;
+	}
+}
+
+/*
+ * Called in place of emit() for each event carrying timestamps.
+ */
+function
+emit(c, args)
+{
+	var ev = args[1];
+	var t = ev.time;
+	var arrived = now();
+	var done;
+
+	c.emit.apply(c, args);
+	done = now();
+
+	if (!active)
+		return;
+
+	nevents++;
+	observe(hists.drain, t.read - t.wakeup);
+	observe(hists.dispatch, arrived - t.read);
+	observe(hists.listeners, done - arrived);
+	observe(hists.total, done - t.wakeup);
+
+	if (stream !== null) {
+		stream.write(JSON.stringify({
+			ctid: ev.ctid,
+			evid: ev.evid,
+			type: ev.type,
+			wakeup: t.wakeup,
+			read: t.read,
+			arrived: arrived,
+			done: done
+		}) + '\n');
+	}
+}
+
+function
+stats()
+{
+	var res = { events: nevents, stages: {} };
+
+	if (hists === null)
+		return (res);
+
+	STAGES.forEach(function (s) {
+		var h = hists[s];
+
+		res.stages[s] = {
+			count: h.count,
+			mean_us: h.count === 0 ? 0 : h.sum / h.count,
+			max_us: h.max,
+			buckets: h.buckets.slice(0)
+		};
+	});
+
+	return (res);
+}
+
+module.exports = {
+	enable: enable,
+	disable: disable,
+	emit: emit,
+	stats: stats
+};
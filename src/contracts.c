@@ -3,16 +3,74 @@
  */
 
 #include <sys/debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
 #include "node_contract.h"
 
-static node_contract_t *ctid_head;
+/*
+ * Each contract manager's registry of held contracts, keyed by ctid.  This
+ * is a chained hash table whose chains are doubly linked (via a pointer to
+ * the previous link) so that removal is O(1); it is consulted for every
+ * event we read, so lookup must be cheap as well.  We start with the small
+ * bucket array embedded in the manager and double it whenever the load
+ * factor exceeds 2; if we can't allocate a larger array we simply carry on
+ * with longer chains.
+ */
+
+static void ngrp_link(node_contract_t *);
+static void ngrp_unlink(node_contract_t *);
+
+static uint_t
+nc_hash(ctid_t ctid, uint_t nbuckets)
+{
+	return (((uint32_t)ctid * 2654435761U) & (nbuckets - 1));
+}
+
+static void
+nc_insert(node_contract_t **buckets, uint_t nbuckets, node_contract_t *cp)
+{
+	node_contract_t **bp = &buckets[nc_hash(cp->nc_id, nbuckets)];
+
+	cp->nc_next = *bp;
+	cp->nc_prevp = bp;
+	if (*bp != NULL)
+		(*bp)->nc_prevp = &cp->nc_next;
+	*bp = cp;
+}
+
+static void
+nc_grow(contract_mgr_t *mp)
+{
+	node_contract_t **nbuckets, *cp, *np;
+	uint_t n = mp->cm_ctid_nbuckets * 2;
+	uint_t i;
+
+	if ((nbuckets = calloc(n, sizeof (node_contract_t *))) == NULL)
+		return;
+
+	for (i = 0; i < mp->cm_ctid_nbuckets; i++) {
+		for (cp = mp->cm_ctid_buckets[i]; cp != NULL; cp = np) {
+			np = cp->nc_next;
+			nc_insert(nbuckets, n, cp);
+		}
+	}
+
+	if (mp->cm_ctid_buckets != mp->cm_ctid_initial)
+		free(mp->cm_ctid_buckets);
+	mp->cm_ctid_buckets = nbuckets;
+	mp->cm_ctid_nbuckets = n;
+}
 
 node_contract_t *
-nc_lookup(ctid_t ctid)
+nc_lookup(contract_mgr_t *mp, ctid_t ctid)
 {
 	node_contract_t *cp;
 
-	for (cp = ctid_head; cp != NULL; cp = cp->nc_next) {
+	for (cp = mp->cm_ctid_buckets[nc_hash(ctid, mp->cm_ctid_nbuckets)];
+	    cp != NULL; cp = cp->nc_next) {
 		if (cp->nc_id == ctid)
 			return (cp);
 	}
@@ -23,25 +81,417 @@ nc_lookup(ctid_t ctid)
 void
 nc_add(node_contract_t *cp)
 {
-	VERIFY(cp->nc_next == NULL);
+	contract_mgr_t *mp = cp->nc_mgr;
+
+	VERIFY(cp->nc_prevp == NULL);
 
-	cp->nc_next = ctid_head;
-	ctid_head = cp;
+	if (mp->cm_ctid_count >= mp->cm_ctid_nbuckets * 2)
+		nc_grow(mp);
+
+	nc_insert(mp->cm_ctid_buckets, mp->cm_ctid_nbuckets, cp);
+	++mp->cm_ctid_count;
+	ngrp_link(cp);
 }
 
 void
 nc_del(node_contract_t *cp)
 {
-	node_contract_t **ep, *np;
+	VERIFY(cp->nc_prevp != NULL);
+	VERIFY(*cp->nc_prevp == cp);
+
+	*cp->nc_prevp = cp->nc_next;
+	if (cp->nc_next != NULL)
+		cp->nc_next->nc_prevp = cp->nc_prevp;
+
+	cp->nc_next = NULL;
+	cp->nc_prevp = NULL;
+	--cp->nc_mgr->cm_ctid_count;
+	ngrp_unlink(cp);
+}
+
+uint_t
+nc_count(const contract_mgr_t *mp)
+{
+	return (mp->cm_ctid_count);
+}
+
+/*
+ * Call func on every registered contract.  func may remove the contract it
+ * is passed from the registry, but must not add or remove any other.
+ */
+void
+nc_walk(contract_mgr_t *mp, void (*func)(node_contract_t *, void *),
+    void *arg)
+{
+	node_contract_t *cp, *np;
+	uint_t i;
+
+	for (i = 0; i < mp->cm_ctid_nbuckets; i++) {
+		for (cp = mp->cm_ctid_buckets[i]; cp != NULL; cp = np) {
+			np = cp->nc_next;
+			func(cp, arg);
+		}
+	}
+}
+
+/*
+ * Alongside the registry, we index registered contracts by the service
+ * attributes fixed when they were created: the service FMRI, the id of the
+ * service's restarter contract, and the cookie.  Each distinct key is a
+ * group, holding a list of its registered members, so that operating on
+ * every contract belonging to a service costs time proportional to the size
+ * of the service rather than to the number of contracts we hold.
+ *
+ * A contract's keys are read when it is constructed and never change, so we
+ * resolve them to groups once, at that point, and only link into and unlink
+ * from the groups' member lists as the contract enters and leaves the
+ * registry.  A group lives as long as any contract bound to it.  Contracts
+ * with no cookie are not indexed by cookie, and those with an empty FMRI are
+ * not indexed by FMRI; device contracts are indexed by cookie alone.  A
+ * contract has a member entry only for each key it has.
+ *
+ * Groups are found through a chained hash table that grows as the registry
+ * does: it is allocated when the first group is created, and doubled
+ * whenever the load factor exceeds 2, unless we can't allocate a larger one.
+ */
+
+#define	NG_MINBUCKETS	16	/* must be a power of 2 */
+
+const char *nc_gkind_names[NGK_MAX] = {
+	"svc_fmri",
+	"svc_ctid",
+	"cookie"
+};
+
+struct nc_gmember {
+	node_contract_t *ngm_cp;
+	nc_group_t *ngm_group;
+	struct nc_gmember *ngm_next;
+	struct nc_gmember **ngm_prevp;
+};
+
+struct nc_group {
+	nc_gkind_t ng_kind;
+	uint64_t ng_num;
+	char *ng_fmri;
+	uint32_t ng_hash;
+	uint_t ng_refs;		/* contracts bound to this group */
+	uint_t ng_count;	/* ... of which are registered */
+	nc_gmember_t *ng_members;
+	struct nc_group *ng_next;
+	struct nc_group **ng_prevp;
+};
+
+static uint32_t
+ngrp_hash(nc_gkind_t kind, uint64_t num, const char *fmri)
+{
+	uint32_t h = 2166136261U;
+	uint_t i;
+
+	h = (h ^ (uint32_t)kind) * 16777619U;
+	if (fmri != NULL) {
+		for (; *fmri != '\0'; fmri++)
+			h = (h ^ (uint8_t)*fmri) * 16777619U;
+	} else {
+		for (i = 0; i < sizeof (num); i++, num >>= 8)
+			h = (h ^ (uint8_t)num) * 16777619U;
+	}
+
+	return (h);
+}
+
+static void
+ngrp_insert(nc_group_t **buckets, uint_t nbuckets, nc_group_t *gp)
+{
+	nc_group_t **bp = &buckets[gp->ng_hash & (nbuckets - 1)];
+
+	gp->ng_next = *bp;
+	gp->ng_prevp = bp;
+	if (*bp != NULL)
+		(*bp)->ng_prevp = &gp->ng_next;
+	*bp = gp;
+}
+
+static void
+ngrp_grow(contract_mgr_t *mp)
+{
+	nc_group_t **nbuckets, *gp, *np;
+	uint_t n = mp->cm_groups_nbuckets * 2;
+	uint_t i;
+
+	if ((nbuckets = calloc(n, sizeof (nc_group_t *))) == NULL)
+		return;
+
+	for (i = 0; i < mp->cm_groups_nbuckets; i++) {
+		for (gp = mp->cm_groups[i]; gp != NULL; gp = np) {
+			np = gp->ng_next;
+			ngrp_insert(nbuckets, n, gp);
+		}
+	}
+
+	free(mp->cm_groups);
+	mp->cm_groups = nbuckets;
+	mp->cm_groups_nbuckets = n;
+}
+
+static nc_group_t *
+ngrp_find(contract_mgr_t *mp, nc_gkind_t kind, uint64_t num,
+    const char *fmri, uint32_t h)
+{
+	nc_group_t *gp;
+
+	if (mp->cm_groups == NULL)
+		return (NULL);
+
+	for (gp = mp->cm_groups[h & (mp->cm_groups_nbuckets - 1)];
+	    gp != NULL; gp = gp->ng_next) {
+		if (gp->ng_hash != h || gp->ng_kind != kind)
+			continue;
+		if (fmri != NULL ? strcmp(gp->ng_fmri, fmri) == 0 :
+		    gp->ng_num == num)
+			return (gp);
+	}
+
+	return (NULL);
+}
+
+static nc_group_t *
+ngrp_get(contract_mgr_t *mp, nc_gkind_t kind, uint64_t num,
+    const char *fmri)
+{
+	uint32_t h = ngrp_hash(kind, num, fmri);
+	nc_group_t *gp;
+
+	if ((gp = ngrp_find(mp, kind, num, fmri, h)) != NULL) {
+		++gp->ng_refs;
+		return (gp);
+	}
+
+	if (mp->cm_groups == NULL) {
+		if ((mp->cm_groups = calloc(NG_MINBUCKETS,
+		    sizeof (nc_group_t *))) == NULL)
+			return (NULL);
+		mp->cm_groups_nbuckets = NG_MINBUCKETS;
+	} else if (mp->cm_groups_count >= mp->cm_groups_nbuckets * 2) {
+		ngrp_grow(mp);
+	}
+
+	if ((gp = calloc(1, sizeof (nc_group_t))) == NULL)
+		return (NULL);
+	if (fmri != NULL && (gp->ng_fmri = strdup(fmri)) == NULL) {
+		free(gp);
+		return (NULL);
+	}
+	gp->ng_kind = kind;
+	gp->ng_num = num;
+	gp->ng_hash = h;
+	gp->ng_refs = 1;
+
+	ngrp_insert(mp->cm_groups, mp->cm_groups_nbuckets, gp);
+	++mp->cm_groups_count;
+
+	return (gp);
+}
+
+static void
+ngrp_rele(contract_mgr_t *mp, nc_group_t *gp)
+{
+	VERIFY(gp->ng_refs > 0);
+	if (--gp->ng_refs > 0)
+		return;
+
+	VERIFY(gp->ng_count == 0);
+	*gp->ng_prevp = gp->ng_next;
+	if (gp->ng_next != NULL)
+		gp->ng_next->ng_prevp = gp->ng_prevp;
+	--mp->cm_groups_count;
+	free(gp->ng_fmri);
+	free(gp);
+}
 
-	for (ep = &ctid_head; *ep != NULL; ep = &((*ep)->nc_next)) {
-		if (*ep == cp) {
-			np = (*ep)->nc_next;
-			(*ep)->nc_next = NULL;
-			*ep = np;
-			return;
+/*
+ * Resolve the contract's keys, from a status handle read at CTD_FIXED or
+ * greater, to groups.
+ */
+int
+nc_group_bind(node_contract_t *cp, ct_stathdl_t st)
+{
+	contract_mgr_t *mp = cp->nc_mgr;
+	nc_gmember_t *gm = NULL;
+	nc_group_t *gps[NGK_MAX];
+	uint64_t cookie = ct_status_get_cookie(st);
+	char *fmri = NULL;
+	ctid_t svc_ctid = 0;
+	uint_t i, n = 0;
+
+	bzero(gps, sizeof (gps));
+
+	if (cp->nc_type->nct_type == NCT_PROCESS) {
+		(void) ct_pr_status_get_svc_fmri(st, &fmri);
+		(void) ct_pr_status_get_svc_ctid(st, &svc_ctid);
+	}
+
+	if ((fmri == NULL || *fmri == '\0') && svc_ctid <= 0 && cookie == 0)
+		return (0);
+
+	if ((fmri != NULL && *fmri != '\0' && (gps[n++] =
+	    ngrp_get(mp, NGK_SVC_FMRI, 0, fmri)) == NULL) ||
+	    (svc_ctid > 0 && (gps[n++] =
+	    ngrp_get(mp, NGK_SVC_CTID, (uint64_t)svc_ctid, NULL)) == NULL) ||
+	    (cookie != 0 && (gps[n++] =
+	    ngrp_get(mp, NGK_COOKIE, cookie, NULL)) == NULL) ||
+	    (gm = calloc(n, sizeof (nc_gmember_t))) == NULL) {
+		for (i = 0; i < n; i++) {
+			if (gps[i] != NULL)
+				ngrp_rele(mp, gps[i]);
 		}
+		return (ENOMEM);
 	}
 
-	VERIFY("deletion of nonexistent contract entry" == NULL);
+	for (i = 0; i < n; i++) {
+		gm[i].ngm_cp = cp;
+		gm[i].ngm_group = gps[i];
+	}
+	cp->nc_groups = gm;
+	cp->nc_ngroups = n;
+
+	return (0);
+}
+
+void
+nc_group_unbind(node_contract_t *cp)
+{
+	nc_gmember_t *gm = cp->nc_groups;
+	uint_t i;
+
+	if (gm == NULL)
+		return;
+
+	for (i = 0; i < cp->nc_ngroups; i++) {
+		VERIFY(gm[i].ngm_prevp == NULL);
+		ngrp_rele(cp->nc_mgr, gm[i].ngm_group);
+	}
+	cp->nc_groups = NULL;
+	cp->nc_ngroups = 0;
+	free(gm);
+}
+
+static void
+ngrp_link(node_contract_t *cp)
+{
+	nc_gmember_t *gmp;
+	nc_group_t *gp;
+	uint_t i;
+
+	for (i = 0; i < cp->nc_ngroups; i++) {
+		gmp = &cp->nc_groups[i];
+		gp = gmp->ngm_group;
+		gmp->ngm_next = gp->ng_members;
+		gmp->ngm_prevp = &gp->ng_members;
+		if (gp->ng_members != NULL)
+			gp->ng_members->ngm_prevp = &gmp->ngm_next;
+		gp->ng_members = gmp;
+		++gp->ng_count;
+	}
+}
+
+static void
+ngrp_unlink(node_contract_t *cp)
+{
+	nc_gmember_t *gmp;
+	uint_t i;
+
+	for (i = 0; i < cp->nc_ngroups; i++) {
+		gmp = &cp->nc_groups[i];
+		if (gmp->ngm_prevp == NULL)
+			continue;
+		*gmp->ngm_prevp = gmp->ngm_next;
+		if (gmp->ngm_next != NULL)
+			gmp->ngm_next->ngm_prevp = gmp->ngm_prevp;
+		gmp->ngm_next = NULL;
+		gmp->ngm_prevp = NULL;
+		--gmp->ngm_group->ng_count;
+	}
+}
+
+/*
+ * Find the group with the given key, which for the numeric kinds is a
+ * decimal string.  *gpp is NULL if no contract we know of has the key.
+ */
+int
+nc_group_lookup(contract_mgr_t *mp, nc_gkind_t kind, const char *key,
+    nc_group_t **gpp)
+{
+	unsigned long long num = 0;
+	char *end;
+
+	*gpp = NULL;
+
+	if (kind == NGK_SVC_FMRI) {
+		*gpp = ngrp_find(mp, kind, 0, key, ngrp_hash(kind, 0, key));
+		return (0);
+	}
+
+	errno = 0;
+	num = strtoull(key, &end, 10);
+	if (errno != 0 || end == key || *end != '\0')
+		return (EINVAL);
+
+	*gpp = ngrp_find(mp, kind, num, NULL, ngrp_hash(kind, num, NULL));
+
+	return (0);
+}
+
+uint_t
+nc_group_count(const nc_group_t *gp)
+{
+	return (gp == NULL ? 0 : gp->ng_count);
+}
+
+void
+nc_group_key(const nc_group_t *gp, char *buf, size_t len)
+{
+	if (gp->ng_fmri != NULL)
+		(void) snprintf(buf, len, "%s", gp->ng_fmri);
+	else
+		(void) snprintf(buf, len, "%llu",
+		    (unsigned long long)gp->ng_num);
+}
+
+/*
+ * Call func on every registered member of the group.  func must not add
+ * contracts to or remove them from the registry.
+ */
+void
+nc_group_walk(nc_group_t *gp, void (*func)(node_contract_t *, void *),
+    void *arg)
+{
+	nc_gmember_t *gmp;
+
+	if (gp == NULL)
+		return;
+
+	for (gmp = gp->ng_members; gmp != NULL; gmp = gmp->ngm_next)
+		func(gmp->ngm_cp, arg);
+}
+
+/*
+ * Call func on every group of the given kind with registered members.
+ */
+void
+nc_groups_walk(contract_mgr_t *mp, nc_gkind_t kind,
+    void (*func)(nc_group_t *, void *), void *arg)
+{
+	nc_group_t *gp;
+	uint_t i;
+
+	if (mp->cm_groups == NULL)
+		return;
+
+	for (i = 0; i < mp->cm_groups_nbuckets; i++) {
+		for (gp = mp->cm_groups[i]; gp != NULL; gp = gp->ng_next) {
+			if (gp->ng_kind == kind && gp->ng_count != 0)
+				func(gp, arg);
+		}
+	}
 }
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Negotiation deadline tracking for device contracts.  Critical and
+ * negotiation events on a device contract must be answered before the
+ * kernel's negotiation time runs out, after which the kernel decides for
+ * us.  When tracking is enabled on a contract, each such event is entered
+ * into a timer wheel at its arrival time plus the remaining negotiation time
+ * read from status.  Shortly before that deadline, we either qack the event
+ * ourselves (buying another quantum) or emit a 'deadline' event so that the
+ * consumer can do so.  When the consumer acks or nacks, we record how much
+ * time was left.
+ *
+ * The wheel itself is in dlwheel.c; here we connect it to the contract
+ * manager.  A single unref'd uv timer on the manager's loop drives the
+ * wheel, and runs only while entries exist.
+ */
+
+#include <sys/types.h>
+#include <sys/contract/device.h>
+#include <errno.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+static uint64_t
+ndl_now(void *arg)
+{
+	contract_mgr_t *mp = arg;
+
+	return (uv_now(mp->cm_loop));
+}
+
+static void
+ndl_timer_cb(uv_timer_t *tp, int status __UNUSED)
+{
+	contract_mgr_t *mp = tp->data;
+
+	nc_dlwheel_advance(mp->cm_dlwheel);
+}
+
+static void
+ndl_run(void *arg, int run)
+{
+	contract_mgr_t *mp = arg;
+
+	if (run) {
+		(void) uv_timer_start(&mp->cm_dltimer, ndl_timer_cb,
+		    NDL_TICK_MS, NDL_TICK_MS);
+	} else {
+		(void) uv_timer_stop(&mp->cm_dltimer);
+	}
+}
+
+/*
+ * The kernel's remaining negotiation time, or failing that its quantum.
+ */
+static int64_t
+ndl_remaining(void *arg)
+{
+	node_contract_t *cp = arg;
+	ct_stathdl_t st;
+	int ntime = -1;
+	int qtime = -1;
+
+	if (cp->nc_st_fd >= 0 &&
+	    ct_status_read(cp->nc_st_fd, CTD_COMMON, &st) == 0) {
+		ntime = ct_status_get_ntime(st);
+		qtime = ct_status_get_qtime(st);
+		ct_status_free(st);
+	}
+
+	if (ntime > 0)
+		return ((int64_t)ntime * 1000);
+	if (qtime > 0)
+		return ((int64_t)qtime * 1000);
+
+	return (-1);
+}
+
+static int
+ndl_qack(void *arg, uint64_t evid)
+{
+	node_contract_t *cp = arg;
+
+	if (cp->nc_ctl_fd < 0)
+		return (EBADF);
+
+	return (ct_ctl_qack(cp->nc_ctl_fd, (ctevid_t)evid));
+}
+
+static void
+ndl_warn(void *arg, uint64_t evid, double remaining)
+{
+	node_contract_t *cp = arg;
+	nvlist_t *ap, *rp;
+
+	ap = v8plus_obj(
+	    V8PLUS_TYPE_STRING, "0", "deadline",
+	    V8PLUS_TYPE_INL_OBJECT, "1",
+		V8PLUS_TYPE_NUMBER, "ctid", (double)cp->nc_id,
+		V8PLUS_TYPE_STRNUMBER64, "evid", evid,
+		V8PLUS_TYPE_NUMBER, "remaining", remaining,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	if (ap == NULL)
+		return;
+
+	rp = v8plus_method_call(cp, "_emit", ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+}
+
+static const nc_dlops_t ndl_ops = {
+	ndo_now: ndl_now,
+	ndo_run: ndl_run,
+	ndo_remaining: ndl_remaining,
+	ndo_qack: ndl_qack,
+	ndo_warn: ndl_warn
+};
+
+/*
+ * The wheel is allocated on first use and lives as long as its manager.
+ */
+static nc_dlwheel_t *
+ndl_wheel(contract_mgr_t *mp)
+{
+	nc_dlwheel_t *wp;
+
+	if (mp->cm_dlwheel != NULL)
+		return (mp->cm_dlwheel);
+
+	if ((wp = nc_dlwheel_create(&ndl_ops, mp)) == NULL)
+		return (NULL);
+
+	(void) uv_timer_init(mp->cm_loop, &mp->cm_dltimer);
+	uv_unref((uv_handle_t *)&mp->cm_dltimer);
+	mp->cm_dltimer.data = mp;
+	mp->cm_dlwheel = wp;
+
+	return (wp);
+}
+
+/*
+ * Note an incoming event.  Only events awaiting a response are tracked.  A
+ * negend concludes the negotiation identified by its nevid.
+ */
+void
+nc_deadline_event(node_contract_t *cp, ctevid_t evid, uint_t evtype,
+    uint_t flags, ctevid_t nevid)
+{
+	if (evtype == CT_EV_NEGEND)
+		nc_dlwheel_concluded(cp->nc_deadlines, nevid);
+	else if (flags & (CTE_ACK | CTE_NEG))
+		nc_dlwheel_track(cp->nc_deadlines, evid);
+}
+
+/*
+ * The consumer has responded to an event.  An ack or nack ends tracking and
+ * records the remaining slack; a qack extends the deadline.
+ */
+void
+nc_deadline_answered(node_contract_t *cp, ctevid_t evid, boolean_t final)
+{
+	if (cp->nc_deadlines != NULL)
+		nc_dlwheel_answered(cp->nc_deadlines, evid, final);
+}
+
+int
+nc_deadline_init(node_contract_t *cp, boolean_t autoqack, uint64_t margin,
+    uint64_t timeout)
+{
+	nc_dlwheel_t *wp;
+
+	if ((wp = ndl_wheel(cp->nc_mgr)) == NULL)
+		return (ENOMEM);
+
+	if (cp->nc_deadlines == NULL &&
+	    (cp->nc_deadlines = nc_dlwheel_set_create(wp, cp)) == NULL)
+		return (ENOMEM);
+
+	nc_dlwheel_set_config(cp->nc_deadlines, autoqack, margin, timeout);
+
+	return (0);
+}
+
+void
+nc_deadline_fini(node_contract_t *cp)
+{
+	if (cp->nc_deadlines == NULL)
+		return;
+
+	nc_dlwheel_set_destroy(cp->nc_deadlines);
+	cp->nc_deadlines = NULL;
+}
+
+boolean_t
+nc_deadline_stats(const node_contract_t *cp, nc_deadline_stats_t *sp)
+{
+	if (cp->nc_deadlines == NULL)
+		return (B_FALSE);
+
+	nc_dlwheel_stats(cp->nc_deadlines, sp);
+
+	return (B_TRUE);
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * The negotiation deadline wheel.  Each set of deadlines belongs to one
+ * device contract, and holds an entry for each of its events awaiting an
+ * answer.  An entry is armed at its deadline less the set's margin; when
+ * it fires, we either qack the event (buying another quantum, and rearming
+ * at the new deadline) or warn the consumer, and rearm at the deadline
+ * itself to notice expiry.  An ack or nack records how much time was left,
+ * a qack rearms, and a negend concludes the negotiation.
+ *
+ * Each contract manager has one wheel, of NDL_SLOTS slots of NDL_TICK_MS
+ * each.  Each entry records the absolute tick at which it fires, so entries
+ * further out than one revolution simply stay put when their slot is visited
+ * early.  The wheel asks to be advanced every tick only while entries exist.
+ *
+ * Nothing here touches contracts or the system; see dlwheel.h.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "dlwheel.h"
+
+#define	NDL_SLOTS	256
+#define	NDL_DEF_MARGIN	1000
+#define	NDL_DEF_TIMEOUT	60000
+
+typedef enum nc_dlstate {
+	NDS_WARN,	/* will fire at deadline less margin */
+	NDS_EXPIRE	/* warned; will fire at the deadline itself */
+} nc_dlstate_t;
+
+typedef struct nc_dlent {
+	nc_deadlines_t *nde_set;
+	uint64_t nde_evid;
+	uint64_t nde_deadline;
+	nc_dlstate_t nde_state;
+	uint64_t nde_tick;
+	struct nc_dlent *nde_wnext;
+	struct nc_dlent **nde_wprevp;
+	struct nc_dlent *nde_cnext;
+} nc_dlent_t;
+
+struct nc_deadlines {
+	nc_dlwheel_t *ndl_wheel;
+	void *ndl_owner;
+	int ndl_autoqack;
+	uint64_t ndl_margin;
+	uint64_t ndl_timeout;
+	nc_dlent_t *ndl_pending;
+	nc_deadline_stats_t ndl_stats;
+};
+
+struct nc_dlwheel {
+	const nc_dlops_t *ndw_ops;
+	void *ndw_arg;
+	nc_dlent_t *ndw_slots[NDL_SLOTS];
+	uint64_t ndw_tick;
+	unsigned int ndw_nents;
+};
+
+static uint64_t
+ndw_now(const nc_dlwheel_t *wp)
+{
+	return (wp->ndw_ops->ndo_now(wp->ndw_arg));
+}
+
+nc_dlwheel_t *
+nc_dlwheel_create(const nc_dlops_t *ops, void *arg)
+{
+	nc_dlwheel_t *wp;
+
+	if ((wp = calloc(1, sizeof (nc_dlwheel_t))) == NULL)
+		return (NULL);
+
+	wp->ndw_ops = ops;
+	wp->ndw_arg = arg;
+
+	return (wp);
+}
+
+static void
+ndw_remove(nc_dlent_t *ep)
+{
+	nc_dlwheel_t *wp = ep->nde_set->ndl_wheel;
+
+	*ep->nde_wprevp = ep->nde_wnext;
+	if (ep->nde_wnext != NULL)
+		ep->nde_wnext->nde_wprevp = ep->nde_wprevp;
+	ep->nde_wnext = NULL;
+	ep->nde_wprevp = NULL;
+
+	if (--wp->ndw_nents == 0)
+		wp->ndw_ops->ndo_run(wp->ndw_arg, 0);
+}
+
+static void
+ndw_insert(nc_dlwheel_t *wp, nc_dlent_t *ep, uint64_t when)
+{
+	uint64_t now = ndw_now(wp);
+	uint64_t ticks;
+	nc_dlent_t **bp;
+
+	if (wp->ndw_nents == 0) {
+		wp->ndw_tick = now / NDL_TICK_MS;
+		wp->ndw_ops->ndo_run(wp->ndw_arg, 1);
+	}
+
+	/*
+	 * Round the firing time down, so that we never fire late by more
+	 * than the timer's own latency, and never schedule in the past.
+	 */
+	ticks = when > now ? when / NDL_TICK_MS : now / NDL_TICK_MS;
+	if (ticks <= wp->ndw_tick)
+		ticks = wp->ndw_tick + 1;
+
+	ep->nde_tick = ticks;
+	bp = &wp->ndw_slots[ticks % NDL_SLOTS];
+
+	ep->nde_wnext = *bp;
+	ep->nde_wprevp = bp;
+	if (*bp != NULL)
+		(*bp)->nde_wprevp = &ep->nde_wnext;
+	*bp = ep;
+
+	++wp->ndw_nents;
+}
+
+static void
+ndw_arm(nc_dlent_t *ep)
+{
+	nc_deadlines_t *dlp = ep->nde_set;
+	uint64_t when;
+
+	if (ep->nde_state == NDS_WARN && ep->nde_deadline > dlp->ndl_margin)
+		when = ep->nde_deadline - dlp->ndl_margin;
+	else
+		when = ep->nde_deadline;
+
+	ndw_insert(dlp->ndl_wheel, ep, when);
+}
+
+/*
+ * Remove the entry from its set's pending list and free it.  The entry must
+ * already be off the wheel.
+ */
+static void
+ndw_free(nc_dlent_t *ep)
+{
+	nc_deadlines_t *dlp = ep->nde_set;
+	nc_dlent_t **pp;
+
+	assert(ep->nde_wprevp == NULL);
+
+	for (pp = &dlp->ndl_pending; *pp != NULL; pp = &(*pp)->nde_cnext) {
+		if (*pp == ep) {
+			*pp = ep->nde_cnext;
+			break;
+		}
+	}
+
+	--dlp->ndl_stats.nds_pending;
+	free(ep);
+}
+
+/*
+ * The absolute deadline for the set's current negotiation: the kernel's
+ * remaining negotiation time if it will tell us, else the set's timeout.
+ */
+static uint64_t
+ndw_deadline(nc_deadlines_t *dlp)
+{
+	nc_dlwheel_t *wp = dlp->ndl_wheel;
+	int64_t remaining = wp->ndw_ops->ndo_remaining(dlp->ndl_owner);
+
+	if (remaining > 0)
+		return (ndw_now(wp) + (uint64_t)remaining);
+
+	return (ndw_now(wp) + dlp->ndl_timeout);
+}
+
+static void
+ndw_record_answer(nc_deadlines_t *dlp, nc_dlent_t *ep)
+{
+	nc_deadline_stats_t *sp = &dlp->ndl_stats;
+	double slack = (double)ep->nde_deadline -
+	    (double)ndw_now(dlp->ndl_wheel);
+
+	++sp->nds_answered;
+	sp->nds_last_slack = slack;
+	sp->nds_sum_slack += slack;
+	if (sp->nds_answered == 1 || slack < sp->nds_min_slack)
+		sp->nds_min_slack = slack;
+	if (slack < 0)
+		++sp->nds_late;
+}
+
+static void
+ndw_fire(nc_dlent_t *ep)
+{
+	nc_deadlines_t *dlp = ep->nde_set;
+	const nc_dlops_t *ops = dlp->ndl_wheel->ndw_ops;
+	void *owner = dlp->ndl_owner;
+	uint64_t evid = ep->nde_evid;
+	double remaining;
+
+	if (ep->nde_state == NDS_EXPIRE) {
+		++dlp->ndl_stats.nds_expired;
+		ndw_free(ep);
+		return;
+	}
+
+	if (dlp->ndl_autoqack && ops->ndo_qack(owner, evid) == 0) {
+		++dlp->ndl_stats.nds_autoqacked;
+		ep->nde_deadline = ndw_deadline(dlp);
+		ndw_arm(ep);
+		return;
+	}
+
+	/*
+	 * Either we aren't qacking on the consumer's behalf or the qack
+	 * failed; let the consumer know, and rearm to notice expiry.  The
+	 * consumer may answer, or destroy the set, from within the warning,
+	 * so we must be done with the entry before calling out.
+	 */
+	++dlp->ndl_stats.nds_warned;
+	remaining = (double)ep->nde_deadline - (double)ndw_now(dlp->ndl_wheel);
+	ep->nde_state = NDS_EXPIRE;
+	ndw_arm(ep);
+
+	ops->ndo_warn(owner, evid, remaining);
+}
+
+void
+nc_dlwheel_advance(nc_dlwheel_t *wp)
+{
+	uint64_t target = ndw_now(wp) / NDL_TICK_MS;
+	nc_dlent_t *ep;
+	unsigned int slot;
+
+	while (wp->ndw_tick < target && wp->ndw_nents > 0) {
+		slot = (unsigned int)(++wp->ndw_tick % NDL_SLOTS);
+
+		/*
+		 * Firing may call out, and the caller may add or remove
+		 * entries anywhere, so after each firing rescan the slot from
+		 * the beginning.
+		 */
+again:
+		for (ep = wp->ndw_slots[slot]; ep != NULL;
+		    ep = ep->nde_wnext) {
+			if (ep->nde_tick <= wp->ndw_tick) {
+				ndw_remove(ep);
+				ndw_fire(ep);
+				goto again;
+			}
+		}
+	}
+}
+
+nc_deadlines_t *
+nc_dlwheel_set_create(nc_dlwheel_t *wp, void *owner)
+{
+	nc_deadlines_t *dlp;
+
+	if ((dlp = calloc(1, sizeof (nc_deadlines_t))) == NULL)
+		return (NULL);
+
+	dlp->ndl_wheel = wp;
+	dlp->ndl_owner = owner;
+	nc_dlwheel_set_config(dlp, 0, 0, 0);
+
+	return (dlp);
+}
+
+/*
+ * A margin or timeout of 0 selects the default.
+ */
+void
+nc_dlwheel_set_config(nc_deadlines_t *dlp, int autoqack, uint64_t margin,
+    uint64_t timeout)
+{
+	dlp->ndl_autoqack = autoqack;
+	dlp->ndl_margin = margin != 0 ? margin : NDL_DEF_MARGIN;
+	dlp->ndl_timeout = timeout != 0 ? timeout : NDL_DEF_TIMEOUT;
+}
+
+void
+nc_dlwheel_set_destroy(nc_deadlines_t *dlp)
+{
+	nc_dlent_t *ep;
+
+	while ((ep = dlp->ndl_pending) != NULL) {
+		if (ep->nde_wprevp != NULL)
+			ndw_remove(ep);
+		ndw_free(ep);
+	}
+
+	free(dlp);
+}
+
+/*
+ * Begin tracking an event awaiting an answer.
+ */
+void
+nc_dlwheel_track(nc_deadlines_t *dlp, uint64_t evid)
+{
+	nc_dlent_t *ep;
+
+	if ((ep = calloc(1, sizeof (nc_dlent_t))) == NULL) {
+		++dlp->ndl_stats.nds_untracked;
+		return;
+	}
+
+	ep->nde_set = dlp;
+	ep->nde_evid = evid;
+	ep->nde_state = NDS_WARN;
+	ep->nde_deadline = ndw_deadline(dlp);
+	ep->nde_cnext = dlp->ndl_pending;
+	dlp->ndl_pending = ep;
+	++dlp->ndl_stats.nds_tracked;
+	++dlp->ndl_stats.nds_pending;
+
+	ndw_arm(ep);
+}
+
+/*
+ * A negend has concluded the negotiation begun by the event nevid.
+ */
+void
+nc_dlwheel_concluded(nc_deadlines_t *dlp, uint64_t nevid)
+{
+	nc_dlent_t *ep;
+
+	for (ep = dlp->ndl_pending; ep != NULL; ep = ep->nde_cnext) {
+		if (ep->nde_evid == nevid) {
+			++dlp->ndl_stats.nds_concluded;
+			if (ep->nde_wprevp != NULL)
+				ndw_remove(ep);
+			ndw_free(ep);
+			return;
+		}
+	}
+}
+
+/*
+ * The consumer has responded to an event.  An ack or nack (final) ends
+ * tracking and records the remaining slack; a qack extends the deadline.
+ */
+void
+nc_dlwheel_answered(nc_deadlines_t *dlp, uint64_t evid, int final)
+{
+	nc_dlent_t *ep;
+
+	for (ep = dlp->ndl_pending; ep != NULL; ep = ep->nde_cnext) {
+		if (ep->nde_evid == evid)
+			break;
+	}
+	if (ep == NULL)
+		return;
+
+	if (ep->nde_wprevp != NULL)
+		ndw_remove(ep);
+
+	if (final) {
+		ndw_record_answer(dlp, ep);
+		ndw_free(ep);
+		return;
+	}
+
+	ep->nde_state = NDS_WARN;
+	ep->nde_deadline = ndw_deadline(dlp);
+	ndw_arm(ep);
+}
+
+void
+nc_dlwheel_stats(const nc_deadlines_t *dlp, nc_deadline_stats_t *sp)
+{
+	*sp = dlp->ndl_stats;
+}
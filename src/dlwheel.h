@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+#ifndef _DLWHEEL_H
+#define	_DLWHEEL_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/*
+ * The negotiation deadline wheel (see dlwheel.c).  It knows nothing of
+ * contracts, libcontract, libuv or V8: what it needs of them it asks for
+ * through an nc_dlops_t, so that it may be driven by a simulation as well
+ * as by deadline.c.
+ */
+
+#define	NDL_TICK_MS	50
+
+typedef struct nc_deadlines nc_deadlines_t;
+typedef struct nc_dlwheel nc_dlwheel_t;
+
+typedef struct nc_deadline_stats {
+	uint64_t nds_tracked;
+	uint64_t nds_pending;
+	uint64_t nds_untracked;
+	uint64_t nds_answered;
+	uint64_t nds_late;
+	uint64_t nds_autoqacked;
+	uint64_t nds_warned;
+	uint64_t nds_expired;
+	uint64_t nds_concluded;
+	double nds_last_slack;
+	double nds_min_slack;
+	double nds_sum_slack;
+} nc_deadline_stats_t;
+
+/*
+ * ndo_now and ndo_run are passed the wheel's argument; the rest, the owner
+ * of the set of deadlines concerned.  ndo_run starts (if its second
+ * argument is nonzero) or stops calling nc_dlwheel_advance() every
+ * NDL_TICK_MS.  ndo_remaining returns the negotiation time the kernel has
+ * left, in ms, or -1 if unknown.  ndo_qack returns 0 if the event was
+ * qacked.  ndo_warn may call back into the wheel, destroying any set.
+ */
+typedef struct nc_dlops {
+	uint64_t (*ndo_now)(void *);
+	void (*ndo_run)(void *, int);
+	int64_t (*ndo_remaining)(void *);
+	int (*ndo_qack)(void *, uint64_t);
+	void (*ndo_warn)(void *, uint64_t, double);
+} nc_dlops_t;
+
+extern nc_dlwheel_t *nc_dlwheel_create(const nc_dlops_t *, void *);
+extern void nc_dlwheel_advance(nc_dlwheel_t *);
+extern nc_deadlines_t *nc_dlwheel_set_create(nc_dlwheel_t *, void *);
+extern void nc_dlwheel_set_config(nc_deadlines_t *, int, uint64_t, uint64_t);
+extern void nc_dlwheel_set_destroy(nc_deadlines_t *);
+extern void nc_dlwheel_track(nc_deadlines_t *, uint64_t);
+extern void nc_dlwheel_concluded(nc_deadlines_t *, uint64_t);
+extern void nc_dlwheel_answered(nc_deadlines_t *, uint64_t, int);
+extern void nc_dlwheel_stats(const nc_deadlines_t *, nc_deadline_stats_t *);
+
+#ifdef	__cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _DLWHEEL_H */
@@ -2,12 +2,16 @@
  * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
  */
 
+#include <sys/time.h>
 #include <sys/contract/process.h>
 #include <sys/contract/device.h>
 #include <libcontract.h>
 #include <libnvpair.h>
 #include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <alloca.h>
 #include "node_contract.h"
 
@@ -16,10 +20,458 @@
 #define	VP_V(_n, _t) \
 	V8PLUS_TYPE_##_t, #_n
 
-static uint_t ev_failures;
+/*
+ * Tracing stamps one event in every cm_trace_every with the time at which
+ * its source was woken and the time at which we read it, both in
+ * microseconds on the gethrtime() clock (the same clock as
+ * process.hrtime()), so that the consumer can tell how long each event
+ * waited within a drain, in marshalling, and in its listeners.  The kernel
+ * does not record when an event was posted, so queue time before the wakeup
+ * is not visible to us.  While a trace is being recorded, every event is
+ * stamped, so that it can be replayed with its original timing.
+ */
+static hrtime_t
+trace_stamp(contract_mgr_t *mp)
+{
+	if (mp->cm_record)
+		return (gethrtime());
+
+	if (mp->cm_trace_every == 0 ||
+	    ++mp->cm_trace_count < mp->cm_trace_every)
+		return (0);
+
+	mp->cm_trace_count = 0;
+
+	return (gethrtime());
+}
+
+/*
+ * Event flags as passed to JS: the same bits as lib/event.js and the
+ * record codec use, which are not those of the kernel.
+ */
+#define	NC_EVF_INFO	0x1
+#define	NC_EVF_ACK	0x2
+#define	NC_EVF_NEG	0x4
+
+static uint_t
+nc_event_flagsmask(uint_t flags)
+{
+	return (((flags & CTE_INFO) ? NC_EVF_INFO : 0) |
+	    ((flags & CTE_ACK) ? NC_EVF_ACK : 0) |
+	    ((flags & CTE_NEG) ? NC_EVF_NEG : 0));
+}
+
+/*
+ * Build the object describing an event, as handed over in queue batches;
+ * lib/event.js turns each into a ContractEvent.
+ */
+nvlist_t *
+nc_event_to_nvlist(ctid_t ctid, ctevid_t evid, const char *evtypename,
+    uint_t evtype, uint_t flags, ctevid_t nevid, ctid_t newct)
+{
+	nvlist_t *sap;
+
+	sap = v8plus_obj(
+		VP(ctid, NUMBER, (double)ctid),
+		VP(evid, STRNUMBER64, (uint64_t)evid),
+		VP(type, STRING, evtypename),
+		VP(flagsMask, NUMBER, (double)nc_event_flagsmask(flags)),
+		V8PLUS_TYPE_NONE);
+
+	if (sap == NULL || evtype != CT_EV_NEGEND)
+		return (sap);
+
+	if (v8plus_obj_setprops(sap,
+	    VP(nevid, STRNUMBER64, (uint64_t)nevid),
+	    VP(newct, NUMBER, (double)newct),
+	    V8PLUS_TYPE_NONE) != 0) {
+		nvlist_free(sap);
+		return (NULL);
+	}
+
+	return (sap);
+}
+
+/*
+ * Deliver an event to the contract's listeners.  Rather than build an
+ * object, which V8 would have to fill in field by field from the nvlist,
+ * we pass the fields as arguments to _event(), and lib/event.js constructs
+ * every event alike.  The arguments are the type, ctid, evid, flag mask,
+ * nevid and newct (undefined unless this is a negend), and, if the event
+ * is being traced, its wakeup and read times.
+ */
+static int
+nc_event_emit(node_contract_t *cp, const char *evtypename, ctevid_t evid,
+    uint_t evtype, uint_t flags, ctevid_t nevid, ctid_t newct, hrtime_t wt,
+    hrtime_t rt)
+{
+	nvlist_t *ap, *rp;
+	int err;
+
+	ap = v8plus_obj(
+	    VP(0, STRING, evtypename),
+	    VP(1, NUMBER, (double)cp->nc_id),
+	    VP(2, STRNUMBER64, (uint64_t)evid),
+	    VP(3, NUMBER, (double)nc_event_flagsmask(flags)),
+	    V8PLUS_TYPE_NONE);
+	if (ap == NULL)
+		return (ENOMEM);
+
+	if (evtype == CT_EV_NEGEND) {
+		err = v8plus_obj_setprops(ap,
+		    VP(4, STRNUMBER64, (uint64_t)nevid),
+		    VP(5, NUMBER, (double)newct),
+		    V8PLUS_TYPE_NONE);
+	} else {
+		err = v8plus_obj_setprops(ap,
+		    VP_V(4, UNDEFINED),
+		    VP_V(5, UNDEFINED),
+		    V8PLUS_TYPE_NONE);
+	}
+	if (err == 0 && rt != 0) {
+		err = v8plus_obj_setprops(ap,
+		    VP(6, NUMBER, (double)(wt != 0 ? wt : rt) / 1000),
+		    VP(7, NUMBER, (double)rt / 1000),
+		    V8PLUS_TYPE_NONE);
+	}
+	if (err != 0) {
+		nvlist_free(ap);
+		return (err);
+	}
+
+	rp = v8plus_method_call(cp, "_event", ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+
+	return (0);
+}
+
+/*
+ * Loss accounting.  Each contract remembers the highest evid it has
+ * accepted; the kernel assigns evids in increasing order, so an event at or
+ * below that mark is one we have already seen -- through a second endpoint,
+ * say, while observing a contract we also own, or redelivered after a
+ * reconnect -- and is dropped as a duplicate.  An event we read but could
+ * not deliver is counted against its contract, and a source that had to be
+ * reopened marks every contract it serves as having possibly lost an
+ * unknown number.  Before the next event for such a contract is delivered
+ * (or when the consumer asks), it receives a `lost' event with the count,
+ * and, if it asked for resync, the contract's current status, from which it
+ * can recover whatever state the lost events would have conveyed.
+ */
+static void
+nc_loss_count(node_contract_t *cp)
+{
+	++cp->nc_lost;
+	++cp->nc_mgr->cm_ev_lost;
+}
+
+static void
+nc_loss_flag_one(node_contract_t *cp, void *arg)
+{
+	const nc_evsrc_t *sp = arg;
+
+	if (cp->nc_type == sp->nes_type && cp->nc_evsrc == NULL)
+		cp->nc_flags |= NCF_LOSS_UNKNOWN;
+}
 
 void
-handle_events(int fd)
+nc_loss_source(nc_evsrc_t *sp)
+{
+	node_contract_t *cp;
+
+	if (sp->nes_kind == NES_PBUNDLE) {
+		nc_walk(sp->nes_mgr, nc_loss_flag_one, sp);
+		return;
+	}
+
+	if ((cp = sp->nes_arg) != NULL)
+		cp->nc_flags |= NCF_LOSS_UNKNOWN;
+}
+
+/*
+ * Tell the consumer that a source could not be reopened, and that it is
+ * being retried: a `source_error' event on the contract it serves, or, for
+ * a bundle, on every held contract of its type without a source of its own.
+ * Listeners may dispose of contracts, so those of a bundle are held across
+ * the emits.
+ */
+typedef struct nc_srcerr {
+	const nc_evsrc_t *nse_src;
+	node_contract_t **nse_list;
+	uint_t nse_count;
+} nc_srcerr_t;
+
+static void
+nc_srcerr_one(node_contract_t *cp, void *arg)
+{
+	nc_srcerr_t *ep = arg;
+
+	if (cp->nc_type != ep->nse_src->nes_type || cp->nc_evsrc != NULL)
+		return;
+
+	if (ep->nse_list != NULL) {
+		v8plus_obj_hold(cp);
+		ep->nse_list[ep->nse_count] = cp;
+	}
+	++ep->nse_count;
+}
+
+static void
+nc_srcerr_emit(node_contract_t *cp, const nc_evsrc_t *sp, int err)
+{
+	nvlist_t *ap, *rp;
+
+	if (cp->nc_flags & NCF_DISPOSED)
+		return;
+
+	ap = v8plus_obj(
+	    VP(0, STRING, "source_error"),
+	    V8PLUS_TYPE_INL_OBJECT, "1",
+		VP(ctid, NUMBER, (double)cp->nc_id),
+		VP(source, STRING, nc_evsrc_kind_names[sp->nes_kind]),
+		V8PLUS_TYPE_NUMBER, "errno", (double)err,
+		VP(message, STRING, strerror(err)),
+		VP(retry_ms, NUMBER, (double)sp->nes_stats.nes_retry_ms),
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	if (ap == NULL)
+		return;
+
+	rp = v8plus_method_call(cp, "_emit", ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+}
+
+void
+nc_evsrc_error(nc_evsrc_t *sp, int err)
+{
+	nc_srcerr_t se;
+	uint_t i;
+
+	if (sp->nes_kind != NES_PBUNDLE) {
+		if (sp->nes_arg != NULL)
+			nc_srcerr_emit(sp->nes_arg, sp, err);
+		return;
+	}
+
+	bzero(&se, sizeof (se));
+	se.nse_src = sp;
+	nc_walk(sp->nes_mgr, nc_srcerr_one, &se);
+	if (se.nse_count == 0 ||
+	    (se.nse_list = malloc(se.nse_count * sizeof (*se.nse_list))) ==
+	    NULL)
+		return;
+
+	se.nse_count = 0;
+	nc_walk(sp->nes_mgr, nc_srcerr_one, &se);
+
+	for (i = 0; i < se.nse_count; i++) {
+		nc_srcerr_emit(se.nse_list[i], sp, err);
+		v8plus_obj_rele(se.nse_list[i]);
+	}
+
+	free(se.nse_list);
+}
+
+/*
+ * Emit a `lost' event for the contract if it has lost any since it was last
+ * told.  Returns 0 if there was nothing to report or the report was made.
+ */
+int
+nc_loss_report(node_contract_t *cp)
+{
+	nvlist_t *sap, *lp, *ap, *rp;
+	ct_stathdl_t st;
+	int err;
+
+	if (cp->nc_lost == 0 && !(cp->nc_flags & NCF_LOSS_UNKNOWN))
+		return (0);
+
+	sap = v8plus_obj(
+	    VP(ctid, NUMBER, (double)cp->nc_id),
+	    VP(count, NUMBER, (double)cp->nc_lost),
+	    VP(unknown, BOOLEAN, (cp->nc_flags & NCF_LOSS_UNKNOWN) != 0),
+	    VP(last_evid, STRNUMBER64, (uint64_t)cp->nc_last_evid),
+	    V8PLUS_TYPE_NONE);
+	if (sap == NULL)
+		return (ENOMEM);
+
+	if ((cp->nc_flags & NCF_RESYNC) &&
+	    ct_status_read(cp->nc_st_fd, CTD_ALL, &st) == 0) {
+		lp = nc_status_to_nvlist(st);
+		ct_status_free(st);
+		err = lp == NULL ? ENOMEM : v8plus_obj_setprops(sap,
+		    VP(status, OBJECT, lp),
+		    V8PLUS_TYPE_NONE);
+		nvlist_free(lp);
+		if (err != 0) {
+			nvlist_free(sap);
+			return (err);
+		}
+	}
+
+	ap = v8plus_obj(
+	    VP(0, STRING, "lost"),
+	    VP(1, OBJECT, sap),
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(sap);
+	if (ap == NULL)
+		return (ENOMEM);
+
+	/*
+	 * The listener may dispose of the contract, so reset first.
+	 */
+	cp->nc_lost = 0;
+	cp->nc_flags &= ~NCF_LOSS_UNKNOWN;
+
+	rp = v8plus_method_call(cp, "_emit", ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+
+	return (0);
+}
+
+/*
+ * Tell the consumer that an event could not be journalled, because the
+ * journal was full of critical events awaiting acknowledgement and could not
+ * be grown.  The event is still delivered, but would not survive a restart.
+ */
+static int
+nc_event_unjournaled(node_contract_t *cp, ctevid_t evid, const char *evtypename)
+{
+	nvlist_t *ap, *rp;
+
+	ap = v8plus_obj(
+	    VP(0, STRING, "unjournaled"),
+	    V8PLUS_TYPE_INL_OBJECT, "1",
+		VP(ctid, NUMBER, (double)cp->nc_id),
+		VP(evid, STRNUMBER64, (uint64_t)evid),
+		VP(type, STRING, evtypename),
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	if (ap == NULL)
+		return (ENOMEM);
+
+	rp = v8plus_method_call(cp, "_emit", ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+
+	return (0);
+}
+
+/*
+ * Priority lane.  During a storm of informative events -- pr_fork and
+ * pr_exit, say -- an event that must be acknowledged or negotiated could
+ * otherwise wait behind every informative event read before it in the
+ * same drain.  So, while cm_lanes is set, critical and negotiation events
+ * are delivered as soon as they are read, and informative ones are set
+ * aside, as little as we need to deliver them, until the drain's reads are
+ * done.  Events within each lane keep their order; across lanes, a
+ * contract's critical event may overtake its informative ones.  For each
+ * lane we count the events delivered and the time from the source's wakeup
+ * (or the start of the drain) to each delivery.
+ *
+ * Listeners may start another drain from within one -- by calling
+ * checkLoss(), say -- so the set-aside events of nested drains are stacked
+ * above ours, and each drain delivers only its own.
+ */
+#define	NC_DEFERRED_MIN	64
+
+static void
+nc_lane_note(nc_evsrc_t *sp, uint_t lane, hrtime_t since)
+{
+	nc_evsrc_stats_t *stp = &sp->nes_stats;
+	hrtime_t lat = gethrtime() - since;
+
+	++stp->nes_lane_events[lane];
+	stp->nes_lane_ns[lane] += lat;
+	if (lat > stp->nes_lane_max_ns[lane])
+		stp->nes_lane_max_ns[lane] = lat;
+}
+
+/*
+ * Set an informative event aside.  Returns 0, or ENOMEM if there is no room,
+ * in which case the caller delivers the event at once.
+ */
+static int
+nc_lane_defer(contract_mgr_t *mp, ctid_t ctid, ctevid_t evid, uint_t evtype,
+    uint_t flags, hrtime_t wt, hrtime_t rt, int64_t jidx)
+{
+	nc_deferred_t *dp;
+	uint_t nsize;
+
+	if (mp->cm_ndeferred == mp->cm_deferred_size) {
+		nsize = mp->cm_deferred_size == 0 ? NC_DEFERRED_MIN :
+		    mp->cm_deferred_size * 2;
+		if ((dp = realloc(mp->cm_deferred,
+		    nsize * sizeof (nc_deferred_t))) == NULL)
+			return (ENOMEM);
+		mp->cm_deferred = dp;
+		mp->cm_deferred_size = nsize;
+	}
+
+	dp = &mp->cm_deferred[mp->cm_ndeferred++];
+	dp->nd_ctid = ctid;
+	dp->nd_evid = evid;
+	dp->nd_type = evtype;
+	dp->nd_flags = flags;
+	dp->nd_wakeup = wt;
+	dp->nd_read = rt;
+	dp->nd_jidx = jidx;
+
+	return (0);
+}
+
+/*
+ * Deliver the events set aside since base.  A listener may have disposed of
+ * a contract, so each is looked up again; and may grow the array, so each
+ * entry is copied before its listeners run.
+ */
+static void
+nc_lane_flush(contract_mgr_t *mp, nc_evsrc_t *sp, uint_t base,
+    hrtime_t since)
+{
+	uint_t end = mp->cm_ndeferred;
+	node_contract_t *cp;
+	nc_deferred_t d;
+	uint_t i;
+
+	for (i = base; i < end; i++) {
+		d = mp->cm_deferred[i];
+
+		if ((cp = nc_lookup(mp, d.nd_ctid)) == NULL) {
+			++mp->cm_ev_failures;
+			++mp->cm_ev_unclaimed;
+			continue;
+		}
+
+		nc_lane_note(sp, NC_LANE_INFO, since);
+		if (nc_event_emit(cp,
+		    nc_descr_strlookup(cp->nc_type->nct_events, d.nd_type),
+		    d.nd_evid, d.nd_type, d.nd_flags, 0, 0, d.nd_wakeup,
+		    d.nd_read) != 0) {
+			nc_loss_count(cp);
+			continue;
+		}
+
+		nc_journal_delivered(mp, d.nd_jidx, d.nd_evid);
+	}
+
+	mp->cm_ndeferred = base;
+}
+
+/*
+ * Read and deliver up to budget events from the source.  Returns EAGAIN if
+ * the source was drained, 0 if the budget ran out first, or another error
+ * from ct_event_read().  The number of events read is stored in *countp.
+ * Listeners may dispose of the source's contract, so we check the
+ * descriptor before every read.  Informative events may be delivered after
+ * the reads; see above.
+ */
+int
+handle_events(contract_mgr_t *mp, nc_evsrc_t *sp, uint_t budget,
+    uint_t *countp)
 {
 	node_contract_t *cp;
 	const nc_descr_t *dp;
@@ -30,13 +482,30 @@ handle_events(int fd)
 	ctevid_t nevid;
 	ctid_t newct;
 	uint_t flags;
-	nvlist_t *ap, *sap, *rp;
+	hrtime_t rt;
 	const char *evtypename;
-	int err;
+	int64_t jidx;
+	uint_t lane;
+	uint_t base = mp->cm_ndeferred;
+	hrtime_t since;
+	uint_t n = 0;
+	int err = 0;
+
+	nc_sample_drain(mp);
+	since = sp->nes_wakeup != 0 ? sp->nes_wakeup : gethrtime();
+
+	while (n < budget) {
+		if (sp->nes_fd < 0) {
+			err = EAGAIN;
+			break;
+		}
+		if ((err = ct_event_read(sp->nes_fd, &eh)) != 0)
+			break;
+		++n;
+		rt = trace_stamp(mp);
 
-	while ((err = ct_event_read(fd, &eh)) == 0) {
 		ctid = ct_event_get_ctid(eh);
-		cp = nc_lookup(ctid);
+		cp = nc_lookup(mp, ctid);
 
 		/*
 		 * This contract has gone away.  This should be possible only
@@ -47,7 +516,8 @@ handle_events(int fd)
 		 */
 		if (cp == NULL) {
 			ct_event_free(eh);
-			++ev_failures;
+			++mp->cm_ev_failures;
+			++mp->cm_ev_unclaimed;
 			continue;
 		}
 
@@ -58,60 +528,102 @@ handle_events(int fd)
 		evid = ct_event_get_evid(eh);
 		flags = ct_event_get_flags(eh);
 
-		sap = v8plus_obj(
-			VP(ctid, NUMBER, (double)ctid),
-			VP(evid, STRNUMBER64, (uint64_t)evid),
-			VP(type, STRING, evtypename),
-			VP_V(flags, INL_OBJECT),
-			    VP(info, BOOLEAN, (flags & CTE_INFO) != 0),
-			    VP(ack, BOOLEAN, (flags & CTE_ACK) != 0),
-			    VP(neg, BOOLEAN, (flags & CTE_NEG) != 0),
-			    V8PLUS_TYPE_NONE,
-			V8PLUS_TYPE_NONE);
-
-		if (sap == NULL) {
+		if (evid <= cp->nc_last_evid) {
 			ct_event_free(eh);
-			++ev_failures;
+			++mp->cm_ev_duplicates;
 			continue;
 		}
+		cp->nc_last_evid = evid;
+
+		if ((flags & (CTE_ACK | CTE_NEG)) || evtype == CT_EV_NEGEND) {
+			++sp->nes_critical;
+			lane = NC_LANE_CRITICAL;
+		} else {
+			lane = NC_LANE_INFO;
+		}
+		nc_life_event(cp, evtype, flags);
+
+		/*
+		 * If this event was already in the journal when we opened it,
+		 * it has been (or will be) replayed to the consumer; this is
+		 * the kernel redelivering it because it was never acked.
+		 */
+		if (nc_journal_seen(mp, evid)) {
+			ct_event_free(eh);
+			continue;
+		}
+
+		if (mp->cm_sampler != NULL)
+			nc_sample_event(cp);
+		if (mp->cm_metrics != NULL)
+			nc_metrics_event(mp, cp, evtype, evid, flags);
+
+		if (cp->nc_members != NULL)
+			nc_members_event(cp, eh, evtype);
 
+		nevid = 0;
+		newct = 0;
 		if (evtype == CT_EV_NEGEND) {
 			(void) ct_event_get_nevid(eh, &nevid);
 			(void) ct_event_get_newct(eh, &newct);
-			err = v8plus_obj_setprops(sap,
-			    VP(nevid, STRNUMBER64, (uint64_t)nevid),
-			    VP(newct, NUMBER, (double)newct),
-			    V8PLUS_TYPE_NONE);
-			if (err != 0) {
-				nvlist_free(sap);
+		}
+
+		jidx = nc_journal_append(mp, ctid, cp->nc_type->nct_type,
+		    evid, evtype, flags, nevid, newct);
+
+		if (cp->nc_deadlines != NULL)
+			nc_deadline_event(cp, evid, evtype, flags, nevid);
+
+		if (cp->nc_lost != 0 || (cp->nc_flags & NCF_LOSS_UNKNOWN)) {
+			(void) nc_loss_report(cp);
+			if (cp->nc_flags & NCF_DISPOSED) {
 				ct_event_free(eh);
-				++ev_failures;
 				continue;
 			}
 		}
 
-		ap = v8plus_obj(
-		    VP(0, STRING, evtypename),
-		    VP(1, OBJECT, sap),
-		    V8PLUS_TYPE_NONE);
+		if (jidx == NC_JOURNAL_REFUSED) {
+			(void) nc_event_unjournaled(cp, evid, evtypename);
+			if (cp->nc_flags & NCF_DISPOSED) {
+				ct_event_free(eh);
+				continue;
+			}
+		}
+
+		/*
+		 * Events the consumer is pulling through a queue wait there,
+		 * unmarshalled, until it asks for them.
+		 */
+		if (cp->nc_queue != NULL &&
+		    nc_queue_push(cp, evid, evtype, flags, nevid, newct,
+		    jidx)) {
+			ct_event_free(eh);
+			continue;
+		}
 
-		nvlist_free(sap);
 		ct_event_free(eh);
 
-		if (ap == NULL) {
-			++ev_failures;
+		if (lane == NC_LANE_INFO && mp->cm_lanes &&
+		    nc_lane_defer(mp, ctid, evid, evtype, flags,
+		    sp->nes_wakeup, rt, jidx) == 0)
+			continue;
+
+		nc_lane_note(sp, lane, since);
+		if (nc_event_emit(cp, evtypename, evid, evtype, flags, nevid,
+		    newct, sp->nes_wakeup, rt) != 0) {
+			nc_loss_count(cp);
 			continue;
 		}
 
-		rp = v8plus_method_call(cp, "_emit", ap);
-		nvlist_free(ap);
-		nvlist_free(rp);
+		nc_journal_delivered(mp, jidx, evid);
 	}
 
-	if (err != EAGAIN) {
-		v8plus_panic("unexpected error from ct_event_read: %s",
-		    strerror(err));
-	}
+	nc_lane_flush(mp, sp, base, since);
+	nc_queue_flush(mp);
+
+	*countp = n;
+
+	return (err);
 }
 
 #undef	VP
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Event sources.  Every ctfs event endpoint we read -- the per-type pbundle
+ * on which we receive events for contracts we own, and the per-contract
+ * event endpoint of each contract we observe -- is an nc_evsrc_t.  Each
+ * source knows its kind and where to find its endpoint.
+ *
+ * Sources are read edge-style.  When a source's poll reports it readable,
+ * we stop polling it and put it on the manager's ready list; an idle
+ * handle then services that list once per turn of the event loop.  Each
+ * turn is a round in which every ready source may read up to its kind's
+ * budget of events, in turn.  A source that is drained (EAGAIN) leaves the
+ * list and is polled again; one that uses its whole budget waits for the
+ * next round, behind the others.  A storm on one endpoint -- either pbundle,
+ * or any observed contract -- thus costs every other source at most one
+ * budget's worth of delay per round.
+ *
+ * The list has two tiers.  A source that read any critical or negotiation
+ * event in its last quantum is serviced ahead of the rest in the next
+ * round, since those events have deadlines and block the kernel's progress;
+ * a source that goes quiet drops back.  Each source records how long it
+ * waited between becoming readable and first being serviced.
+ *
+ * If the poll reports an error, or reading the endpoint fails with anything
+ * but EAGAIN, the source reopens its endpoint in place (onto the same
+ * descriptor number, so that the poll handle remains valid) and resumes.
+ * Events that were queued on the old descriptor and not yet read are lost
+ * to this listener, but any critical event will be redelivered until
+ * acknowledged.  If the endpoint can't be reopened, we try again after a
+ * backoff that doubles from NES_RETRY_MIN_MS to NES_RETRY_MAX_MS, and the
+ * contracts whose events the source carries are told that it has failed,
+ * so that a source never goes deaf unnoticed.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/ctfs.h>
+#include <sys/debug.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NESF_INIT	0x1	/* nes_poll is initialized */
+#define	NESF_ACTIVE	0x2	/* nes_poll is started */
+#define	NESF_READY	0x4	/* on the ready list */
+#define	NESF_WAITING	0x8	/* not yet serviced since becoming readable */
+#define	NESF_RETRY	0x10	/* nes_retry is initialized */
+
+#define	NES_RETRY_MIN_MS	100
+#define	NES_RETRY_MAX_MS	30000
+
+#define	NES_TIER_CRITICAL	0
+#define	NES_TIER_NORMAL		1
+
+const uint_t nc_evsrc_default_budget[NES_MAX] = {
+	256,	/* NES_PBUNDLE */
+	64	/* NES_CONTRACT */
+};
+
+const char *nc_evsrc_kind_names[NES_MAX] = {
+	"pbundle",
+	"contract"
+};
+
+static void nes_unready(nc_evsrc_t *);
+static void nes_reconnect(nc_evsrc_t *);
+
+/*
+ * A pbundle source needs only the contract type; a contract source needs
+ * only the ctid.
+ */
+void
+nc_evsrc_init(nc_evsrc_t *sp, contract_mgr_t *mp, nc_evsrc_kind_t kind,
+    const nc_typedesc_t *ntp, ctid_t ctid)
+{
+	bzero(sp, sizeof (nc_evsrc_t));
+	sp->nes_kind = kind;
+	sp->nes_mgr = mp;
+	sp->nes_fd = -1;
+	sp->nes_type = ntp;
+	sp->nes_ctid = ctid;
+}
+
+static int
+nes_openpath(const nc_evsrc_t *sp)
+{
+	char buf[MAXPATHLEN];
+	int fd, flags;
+
+	if (sp->nes_kind == NES_PBUNDLE) {
+		(void) snprintf(buf, sizeof (buf), "%s/pbundle",
+		    sp->nes_type->nct_root);
+	} else {
+		(void) snprintf(buf, sizeof (buf), CTFS_ROOT "/all/%d/events",
+		    (int)sp->nes_ctid);
+	}
+
+	if ((fd = open(buf, O_RDONLY | O_NONBLOCK)) < 0)
+		return (-1);
+
+	if ((flags = fcntl(fd, F_GETFD, 0)) < 0 ||
+	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0) {
+		(void) close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+int
+nc_evsrc_open(nc_evsrc_t *sp)
+{
+	VERIFY(sp->nes_fd < 0);
+
+	if ((sp->nes_fd = nes_openpath(sp)) < 0)
+		return (errno);
+
+	return (0);
+}
+
+static void
+nes_retry_cb(uv_timer_t *tp, int status __UNUSED)
+{
+	nes_reconnect(tp->data);
+}
+
+/*
+ * The endpoint couldn't be reopened: count it, arm the retry timer, and, if
+ * the source was working until now, tell the consumer.  That may run
+ * listeners, which may tear the source down, so it comes last.
+ */
+static void
+nes_failed(nc_evsrc_t *sp, int err)
+{
+	boolean_t first = (sp->nes_stats.nes_retry_ms == 0);
+
+	++sp->nes_stats.nes_reconnect_failures;
+	sp->nes_stats.nes_last_errno = err;
+
+	if (!(sp->nes_flags & NESF_RETRY)) {
+		(void) uv_timer_init(sp->nes_mgr->cm_loop, &sp->nes_retry);
+		sp->nes_retry.data = sp;
+		sp->nes_flags |= NESF_RETRY;
+	}
+
+	sp->nes_stats.nes_retry_ms = first ? NES_RETRY_MIN_MS :
+	    MIN(sp->nes_stats.nes_retry_ms * 2, NES_RETRY_MAX_MS);
+	(void) uv_timer_start(&sp->nes_retry, nes_retry_cb,
+	    sp->nes_stats.nes_retry_ms, 0);
+
+	if (first)
+		nc_evsrc_error(sp, err);
+}
+
+/*
+ * Reopen the endpoint onto the same descriptor, and re-arm the poll.  Any
+ * events still queued on the old descriptor are lost to us; the contracts
+ * whose events we read here are told so.
+ */
+static void
+nes_reconnect(nc_evsrc_t *sp)
+{
+	int fd, err;
+
+	uv_poll_stop(&sp->nes_poll);
+	sp->nes_flags &= ~NESF_ACTIVE;
+	nes_unready(sp);
+	nc_loss_source(sp);
+
+	if ((fd = nes_openpath(sp)) < 0) {
+		nes_failed(sp, errno);
+		return;
+	}
+
+	if (dup2(fd, sp->nes_fd) < 0) {
+		err = errno;
+		(void) close(fd);
+		nes_failed(sp, err);
+		return;
+	}
+	(void) close(fd);
+
+	++sp->nes_stats.nes_reconnects;
+	sp->nes_stats.nes_retry_ms = 0;
+	(void) uv_poll_start(&sp->nes_poll, UV_READABLE, nc_evsrc_poll_cb);
+	sp->nes_flags |= NESF_ACTIVE;
+}
+
+static void
+nes_unready(nc_evsrc_t *sp)
+{
+	contract_mgr_t *mp = sp->nes_mgr;
+	uint_t i;
+
+	if (!(sp->nes_flags & NESF_READY))
+		return;
+
+	for (i = 0; i < NES_NTIERS; i++) {
+		if (mp->cm_ready_tailp[i] == &sp->nes_rnext)
+			mp->cm_ready_tailp[i] = sp->nes_rprevp;
+	}
+	*sp->nes_rprevp = sp->nes_rnext;
+	if (sp->nes_rnext != NULL)
+		sp->nes_rnext->nes_rprevp = sp->nes_rprevp;
+	sp->nes_rnext = NULL;
+	sp->nes_rprevp = NULL;
+	sp->nes_flags &= ~NESF_READY;
+
+	if (mp->cm_ready[NES_TIER_CRITICAL] == NULL &&
+	    mp->cm_ready[NES_TIER_NORMAL] == NULL)
+		(void) uv_idle_stop(&mp->cm_sched);
+}
+
+static void
+nes_ready(nc_evsrc_t *sp, uint_t tier)
+{
+	contract_mgr_t *mp = sp->nes_mgr;
+
+	VERIFY(!(sp->nes_flags & NESF_READY));
+
+	sp->nes_rnext = NULL;
+	sp->nes_rprevp = mp->cm_ready_tailp[tier];
+	*mp->cm_ready_tailp[tier] = sp;
+	mp->cm_ready_tailp[tier] = &sp->nes_rnext;
+	sp->nes_flags |= NESF_READY;
+
+	(void) uv_idle_start(&mp->cm_sched, nc_evsrc_sched_cb);
+}
+
+/*
+ * Give the source one quantum, and decide where it goes next: back to
+ * polling if drained, or to the tail of the tier its events call for.
+ */
+static void
+nes_service(contract_mgr_t *mp, nc_evsrc_t *sp)
+{
+	hrtime_t wait;
+	uint_t n = 0;
+	int err;
+
+	nes_unready(sp);
+	sp->nes_round = mp->cm_sched_round;
+
+	if (sp->nes_flags & NESF_WAITING) {
+		sp->nes_flags &= ~NESF_WAITING;
+		wait = gethrtime() - sp->nes_wakeup;
+		++sp->nes_stats.nes_waits;
+		sp->nes_stats.nes_wait_ns += wait;
+		if (wait > sp->nes_stats.nes_wait_max_ns)
+			sp->nes_stats.nes_wait_max_ns = wait;
+	}
+
+	sp->nes_critical = 0;
+	err = handle_events(mp, sp, mp->cm_evsrc_budget[sp->nes_kind], &n);
+
+	/*
+	 * The consumer may have torn this source down from within an event
+	 * listener, in which case we must not touch it further.
+	 */
+	if (!(sp->nes_flags & NESF_INIT))
+		return;
+
+	sp->nes_stats.nes_events += n;
+	if (n > sp->nes_stats.nes_max_drain)
+		sp->nes_stats.nes_max_drain = n;
+
+	if (err == 0) {
+		++sp->nes_stats.nes_exhausted;
+		if (sp->nes_critical != 0) {
+			++sp->nes_stats.nes_priority;
+			nes_ready(sp, NES_TIER_CRITICAL);
+		} else {
+			nes_ready(sp, NES_TIER_NORMAL);
+		}
+		return;
+	}
+
+	if (err != EAGAIN) {
+		++sp->nes_stats.nes_errors;
+		sp->nes_stats.nes_last_errno = err;
+		nes_reconnect(sp);
+		return;
+	}
+
+	(void) uv_poll_start(&sp->nes_poll, UV_READABLE, nc_evsrc_poll_cb);
+	sp->nes_flags |= NESF_ACTIVE;
+}
+
+/*
+ * One round: every source that was ready when the round began is serviced
+ * once, critical tier first.  Sources requeued during the round carry its
+ * number (never 0, which marks a newly ready source), so reaching one
+ * means its tier has been done.  Being an idle
+ * handle, we also keep libuv from blocking in poll while work remains.
+ */
+void
+nc_evsrc_sched_cb(uv_idle_t *hp, int status __UNUSED)
+{
+	contract_mgr_t *mp = hp->data;
+	nc_evsrc_t *sp;
+	uint_t tier;
+
+	if (++mp->cm_sched_round == 0)
+		++mp->cm_sched_round;
+
+	for (tier = 0; tier < NES_NTIERS; tier++) {
+		while ((sp = mp->cm_ready[tier]) != NULL &&
+		    sp->nes_round != mp->cm_sched_round)
+			nes_service(mp, sp);
+	}
+}
+
+void
+nc_evsrc_poll_cb(uv_poll_t *hp, int status, int events)
+{
+	nc_evsrc_t *sp = hp->data;
+	contract_mgr_t *mp = sp->nes_mgr;
+
+	++sp->nes_stats.nes_wakeups;
+
+	if (status < 0) {
+		++sp->nes_stats.nes_errors;
+		nes_reconnect(sp);
+		return;
+	}
+
+	if (!(events & UV_READABLE))
+		return;
+
+	if (!mp->cm_sched_init) {
+		mp->cm_ready_tailp[NES_TIER_CRITICAL] =
+		    &mp->cm_ready[NES_TIER_CRITICAL];
+		mp->cm_ready_tailp[NES_TIER_NORMAL] =
+		    &mp->cm_ready[NES_TIER_NORMAL];
+		(void) uv_idle_init(mp->cm_loop, &mp->cm_sched);
+		mp->cm_sched.data = mp;
+		mp->cm_sched_init = B_TRUE;
+	}
+
+	uv_poll_stop(&sp->nes_poll);
+	sp->nes_flags &= ~NESF_ACTIVE;
+	sp->nes_flags |= NESF_WAITING;
+	sp->nes_wakeup = gethrtime();
+	sp->nes_round = 0;
+	nes_ready(sp, sp->nes_critical != 0 ?
+	    NES_TIER_CRITICAL : NES_TIER_NORMAL);
+}
+
+void
+nc_evsrc_start(nc_evsrc_t *sp, void *arg)
+{
+	VERIFY(sp->nes_fd >= 0);
+	VERIFY(!(sp->nes_flags & NESF_INIT));
+
+	sp->nes_arg = arg;
+	(void) uv_poll_init(sp->nes_mgr->cm_loop, &sp->nes_poll, sp->nes_fd);
+	sp->nes_poll.data = sp;
+	(void) uv_poll_start(&sp->nes_poll, UV_READABLE, nc_evsrc_poll_cb);
+	sp->nes_flags |= NESF_INIT | NESF_ACTIVE;
+}
+
+boolean_t
+nc_evsrc_started(const nc_evsrc_t *sp)
+{
+	return ((sp->nes_flags & NESF_INIT) != 0);
+}
+
+/*
+ * The retry timer is closed first, and the poll handle only once libuv is
+ * done with it, so that the consumer's close callback comes last.
+ */
+static void
+nes_retry_close_cb(uv_handle_t *hp)
+{
+	nc_evsrc_t *sp = hp->data;
+
+	uv_close((uv_handle_t *)&sp->nes_poll, sp->nes_close_cb);
+}
+
+/*
+ * Stop the source, and return its descriptor for the caller to close.  If
+ * the poll handle was initialized, it is closed asynchronously, and close_cb
+ * is called (with the handle, whose data is the source) once libuv is done
+ * with it; until then the source's memory must remain valid.
+ */
+int
+nc_evsrc_stop(nc_evsrc_t *sp, uv_close_cb close_cb)
+{
+	int fd = sp->nes_fd;
+
+	sp->nes_fd = -1;
+
+	if (sp->nes_flags & NESF_INIT) {
+		if (sp->nes_flags & NESF_ACTIVE)
+			uv_poll_stop(&sp->nes_poll);
+		nes_unready(sp);
+		sp->nes_flags &= ~(NESF_INIT | NESF_ACTIVE);
+		if (sp->nes_flags & NESF_RETRY) {
+			sp->nes_flags &= ~NESF_RETRY;
+			(void) uv_timer_stop(&sp->nes_retry);
+			sp->nes_close_cb = close_cb;
+			uv_close((uv_handle_t *)&sp->nes_retry,
+			    nes_retry_close_cb);
+		} else {
+			uv_close((uv_handle_t *)&sp->nes_poll, close_cb);
+		}
+	}
+
+	return (fd);
+}
@@ -0,0 +1,866 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Persistent event journal.  Once an event has been read from a contract
+ * event queue, the kernel will not give it to us again, so if we die before
+ * a consumer has handled it, it is lost.  When a journal is open, each event
+ * read by handle_events() is first appended to a memory-mapped file, then
+ * marked delivered once the JS listeners have returned, and (for critical
+ * events) marked acknowledged once ack/nack/qack succeeds.  On restart, a
+ * consumer may replay the records that never reached a terminal state.
+ *
+ * Durability is batched: records are written into the mapping as they are
+ * read, and the dirty range is synced to disk either when njl_batch records
+ * have accumulated or when the sync timer fires, whichever comes first.
+ *
+ * The file is a fixed-size header followed by an array of fixed-size
+ * records.  A record is valid only if its magic is set; the magic is written
+ * last, so a torn record is ignored on replay.  When the array fills, we
+ * compact it by discarding records that have reached a terminal state.  If
+ * that frees nothing, the oldest informative record is dropped and counted.
+ * A critical event awaiting acknowledgement is what the journal exists to
+ * protect, so its record is never dropped: if every record is one, the file
+ * is doubled, and if that fails the append is refused and the consumer is
+ * told.
+ *
+ * Event ids are unique only within a boot: they start again from a low
+ * number after a reboot, and the kernel has forgotten every event it
+ * posted before.  The header therefore records the boot time of the system
+ * that last wrote the journal.  If we open a journal written before the
+ * last boot, its records are marked as coming from a previous boot: they
+ * are still replayed, so that the consumer may learn what it missed, but
+ * they are never used to suppress live events, and once replayed they
+ * need no acknowledgement, since there is nothing left to acknowledge.
+ *
+ * A journal belongs to a contract manager (cm_journal), on whose loop its
+ * sync timer runs, and records only the events that manager reads.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/debug.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <utmpx.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NJH_MAGIC	"CTJRNL01"
+#define	NJH_VERSION	1
+#define	NJR_MAGIC	0x4e4a5231	/* "NJR1" */
+
+#define	NJL_DEF_RECORDS	16384
+#define	NJL_DEF_BATCH	64
+#define	NJL_DEF_SYNC_MS	10
+
+typedef enum nc_jstate {
+	NJS_PENDING = 0,
+	NJS_DELIVERED,
+	NJS_ACKED
+} nc_jstate_t;
+
+typedef struct nc_jhdr {
+	char njh_magic[8];
+	uint32_t njh_version;
+	uint32_t njh_reclen;
+	uint64_t njh_nrecs;
+	uint64_t njh_tail;
+	uint64_t njh_boot;	/* boot time of the writer; 0 if unknown */
+	uint8_t njh_pad[24];
+} nc_jhdr_t;
+
+typedef struct nc_jrec {
+	uint32_t njr_magic;
+	uint8_t njr_state;
+	uint8_t njr_flags;
+	uint8_t njr_cttype;
+	uint8_t njr_jflags;
+	int32_t njr_ctid;
+	uint32_t njr_type;
+	uint64_t njr_evid;
+	uint64_t njr_nevid;
+	int32_t njr_newct;
+	uint32_t njr_pad2;
+	uint64_t njr_time;
+	uint8_t njr_pad3[16];
+} nc_jrec_t;
+
+#define	NJRF_PREVBOOT	0x1	/* written before the current boot */
+
+#define	NJL_PEND_MIN	64
+
+typedef struct nc_jpend {
+	ctevid_t njp_evid;	/* 0 if the slot is free */
+	uint64_t njp_idx;
+} nc_jpend_t;
+
+struct nc_journal {
+	int njl_fd;
+	nc_jhdr_t *njl_hdr;
+	nc_jrec_t *njl_recs;
+	size_t njl_maplen;
+	uint64_t njl_dirty_lo;
+	uint64_t njl_dirty_hi;
+	uint_t njl_unsynced;
+	uint_t njl_batch;
+	uint64_t njl_sync_ms;
+	uv_timer_t njl_timer;
+	boolean_t njl_timer_armed;
+	ctevid_t *njl_seen;
+	uint_t njl_seen_size;
+	uint_t njl_seen_count;
+	nc_jpend_t *njl_pend;
+	uint_t njl_pend_size;
+	uint_t njl_pend_count;
+	nc_journal_stats_t njl_stats;
+};
+
+static uint_t
+njl_seen_hash(ctevid_t evid, uint_t size)
+{
+	return ((uint_t)((evid * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1));
+}
+
+/*
+ * Return the time at which the system booted, in seconds since the epoch,
+ * or 0 if it cannot be determined.
+ */
+static uint64_t
+njl_boot_time(void)
+{
+	struct utmpx key, *up;
+	uint64_t t = 0;
+
+	bzero(&key, sizeof (key));
+	key.ut_type = BOOT_TIME;
+
+	setutxent();
+	if ((up = getutxid(&key)) != NULL)
+		t = (uint64_t)up->ut_tv.tv_sec;
+	endutxent();
+
+	return (t);
+}
+
+/*
+ * The seen set holds the event ids of every record written during this boot
+ * and present in the journal when it was opened.  The kernel will redeliver
+ * critical events that we never acknowledged, and we must not hand those to
+ * consumers a second time after they have been replayed.  Entries are never
+ * removed; the set is discarded when the journal is closed.
+ */
+static void
+njl_seen_add(nc_journal_t *jp, ctevid_t evid)
+{
+	uint_t i;
+
+	for (i = njl_seen_hash(evid, jp->njl_seen_size);
+	    jp->njl_seen[i] != 0; i = (i + 1) & (jp->njl_seen_size - 1)) {
+		if (jp->njl_seen[i] == evid)
+			return;
+	}
+	jp->njl_seen[i] = evid;
+	++jp->njl_seen_count;
+}
+
+boolean_t
+nc_journal_seen(contract_mgr_t *mp, ctevid_t evid)
+{
+	nc_journal_t *jp = mp->cm_journal;
+	uint_t i;
+
+	if (jp == NULL || jp->njl_seen_count == 0 || evid == 0)
+		return (B_FALSE);
+
+	for (i = njl_seen_hash(evid, jp->njl_seen_size);
+	    jp->njl_seen[i] != 0; i = (i + 1) & (jp->njl_seen_size - 1)) {
+		if (jp->njl_seen[i] == evid) {
+			++jp->njl_stats.njs_duplicates;
+			return (B_TRUE);
+		}
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Whether the record is of a critical event that can still be acknowledged.
+ */
+static boolean_t
+njl_critical(const nc_jrec_t *rp)
+{
+	return (rp->njr_magic == NJR_MAGIC && (rp->njr_flags & CTE_ACK) &&
+	    !(rp->njr_jflags & NJRF_PREVBOOT));
+}
+
+/*
+ * The pending index maps the event id of each critical record awaiting
+ * acknowledgement to the record's index, so that an ack need not search the
+ * journal, most of which is typically delivered informative records.  It is
+ * open-addressed with linear probing, like the seen set, but entries are
+ * removed when acked, by shifting back the rest of their cluster.
+ */
+static nc_jpend_t *
+njl_pend_slot(nc_journal_t *jp, ctevid_t evid)
+{
+	uint_t mask = jp->njl_pend_size - 1;
+	uint_t i;
+
+	for (i = njl_seen_hash(evid, jp->njl_pend_size);
+	    jp->njl_pend[i].njp_evid != 0; i = (i + 1) & mask) {
+		if (jp->njl_pend[i].njp_evid == evid)
+			break;
+	}
+
+	return (&jp->njl_pend[i]);
+}
+
+static int
+njl_pend_resize(nc_journal_t *jp, uint_t size)
+{
+	nc_jpend_t *old = jp->njl_pend;
+	uint_t osize = jp->njl_pend_size;
+	nc_jpend_t *np;
+	uint_t i;
+
+	if ((np = calloc(size, sizeof (nc_jpend_t))) == NULL)
+		return (ENOMEM);
+
+	jp->njl_pend = np;
+	jp->njl_pend_size = size;
+	for (i = 0; i < osize; i++) {
+		if (old[i].njp_evid != 0)
+			*njl_pend_slot(jp, old[i].njp_evid) = old[i];
+	}
+	free(old);
+
+	return (0);
+}
+
+static int
+njl_pend_add(nc_journal_t *jp, ctevid_t evid, uint64_t idx)
+{
+	nc_jpend_t *pp;
+	int err;
+
+	if (evid == 0)
+		return (0);
+
+	if ((jp->njl_pend_count + 1) * 2 > jp->njl_pend_size &&
+	    (err = njl_pend_resize(jp, jp->njl_pend_size == 0 ?
+	    NJL_PEND_MIN : jp->njl_pend_size * 2)) != 0)
+		return (err);
+
+	pp = njl_pend_slot(jp, evid);
+	if (pp->njp_evid == 0)
+		++jp->njl_pend_count;
+	pp->njp_evid = evid;
+	pp->njp_idx = idx;
+
+	return (0);
+}
+
+/*
+ * Remove evid from the index, returning its record's index, or -1 if it was
+ * not there.
+ */
+static int64_t
+njl_pend_del(nc_journal_t *jp, ctevid_t evid)
+{
+	uint_t mask = jp->njl_pend_size - 1;
+	nc_jpend_t *pp;
+	uint_t i, j, h;
+	int64_t idx;
+
+	if (jp->njl_pend_count == 0 || evid == 0)
+		return (-1);
+
+	pp = njl_pend_slot(jp, evid);
+	if (pp->njp_evid == 0)
+		return (-1);
+	idx = (int64_t)pp->njp_idx;
+
+	i = pp - jp->njl_pend;
+	for (j = (i + 1) & mask; jp->njl_pend[j].njp_evid != 0;
+	    j = (j + 1) & mask) {
+		h = njl_seen_hash(jp->njl_pend[j].njp_evid, jp->njl_pend_size);
+		/*
+		 * An entry may fill the hole at i only if i lies cyclically
+		 * within [h, j), i.e., between its home slot and where it is.
+		 */
+		if (((j - h) & mask) >= ((j - i) & mask)) {
+			jp->njl_pend[i] = jp->njl_pend[j];
+			i = j;
+		}
+	}
+	jp->njl_pend[i].njp_evid = 0;
+	--jp->njl_pend_count;
+
+	return (idx);
+}
+
+/*
+ * Index every critical record still awaiting acknowledgement, as after the
+ * records have been moved.
+ */
+static int
+njl_pend_rebuild(nc_journal_t *jp)
+{
+	nc_jrec_t *rp;
+	uint64_t i;
+	int err;
+
+	if (jp->njl_pend != NULL)
+		bzero(jp->njl_pend, jp->njl_pend_size * sizeof (nc_jpend_t));
+	jp->njl_pend_count = 0;
+
+	for (i = 0; i < jp->njl_hdr->njh_tail; i++) {
+		rp = &jp->njl_recs[i];
+		if (njl_critical(rp) && rp->njr_state != NJS_ACKED &&
+		    (err = njl_pend_add(jp, rp->njr_evid, i)) != 0)
+			return (err);
+	}
+
+	return (0);
+}
+
+static void
+njl_sync(nc_journal_t *jp)
+{
+	long pgsz = sysconf(_SC_PAGESIZE);
+	uintptr_t lo, hi;
+	hrtime_t start;
+
+	if (jp->njl_unsynced == 0)
+		return;
+
+	start = gethrtime();
+
+	lo = (uintptr_t)&jp->njl_recs[jp->njl_dirty_lo];
+	hi = (uintptr_t)&jp->njl_recs[jp->njl_dirty_hi];
+	lo &= ~(uintptr_t)(pgsz - 1);
+
+	/*
+	 * The header (and with it the tail) always changes along with the
+	 * records, so we sync it as well.
+	 */
+	(void) msync((caddr_t)lo, hi - lo, MS_SYNC);
+	(void) msync((caddr_t)jp->njl_hdr, sizeof (nc_jhdr_t), MS_SYNC);
+
+	jp->njl_unsynced = 0;
+	jp->njl_dirty_lo = jp->njl_hdr->njh_tail;
+	jp->njl_dirty_hi = jp->njl_hdr->njh_tail;
+
+	++jp->njl_stats.njs_syncs;
+	jp->njl_stats.njs_sync_ns += gethrtime() - start;
+}
+
+static void
+njl_timer_cb(uv_timer_t *tp, int status __UNUSED)
+{
+	nc_journal_t *jp = tp->data;
+
+	jp->njl_timer_armed = B_FALSE;
+	njl_sync(jp);
+}
+
+static void
+njl_dirty(nc_journal_t *jp, uint64_t idx)
+{
+	if (jp->njl_unsynced == 0 || idx < jp->njl_dirty_lo)
+		jp->njl_dirty_lo = idx;
+	if (jp->njl_unsynced == 0 || idx + 1 > jp->njl_dirty_hi)
+		jp->njl_dirty_hi = idx + 1;
+
+	if (++jp->njl_unsynced >= jp->njl_batch) {
+		njl_sync(jp);
+		return;
+	}
+
+	if (!jp->njl_timer_armed) {
+		(void) uv_timer_start(&jp->njl_timer, njl_timer_cb,
+		    jp->njl_sync_ms, 0);
+		jp->njl_timer_armed = B_TRUE;
+	}
+}
+
+static boolean_t
+njl_done(const nc_jrec_t *rp)
+{
+	if (rp->njr_magic != NJR_MAGIC)
+		return (B_TRUE);
+	if (njl_critical(rp))
+		return (rp->njr_state == NJS_ACKED);
+
+	return (rp->njr_state != NJS_PENDING);
+}
+
+/*
+ * Double the capacity of the journal, remapping it.  On failure, the old
+ * mapping remains in use.
+ */
+static int
+njl_grow(nc_journal_t *jp)
+{
+	uint64_t nrecs = jp->njl_hdr->njh_nrecs * 2;
+	size_t len = sizeof (nc_jhdr_t) + nrecs * sizeof (nc_jrec_t);
+	void *addr;
+
+	if (ftruncate(jp->njl_fd, (off_t)len) != 0)
+		return (errno);
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    jp->njl_fd, 0);
+	if (addr == MAP_FAILED)
+		return (errno);
+
+	(void) munmap((caddr_t)jp->njl_hdr, jp->njl_maplen);
+	jp->njl_maplen = len;
+	jp->njl_hdr = addr;
+	jp->njl_recs = (nc_jrec_t *)((char *)addr + sizeof (nc_jhdr_t));
+	jp->njl_hdr->njh_nrecs = nrecs;
+
+	++jp->njl_stats.njs_grown;
+
+	return (0);
+}
+
+/*
+ * Make room for one more record: squeeze out records that no longer need to
+ * be kept; failing that, drop the oldest informative record; failing that,
+ * grow the file.  The whole array is rewritten, so it is all dirty
+ * afterward.  Returns 0, or the error that prevented the file growing.
+ */
+static int
+njl_makeroom(nc_journal_t *jp)
+{
+	nc_jhdr_t *hp = jp->njl_hdr;
+	uint64_t i, j;
+	int err;
+
+	for (i = j = 0; i < hp->njh_tail; i++) {
+		if (njl_done(&jp->njl_recs[i]))
+			continue;
+		if (i != j) {
+			bcopy(&jp->njl_recs[i], &jp->njl_recs[j],
+			    sizeof (nc_jrec_t));
+		}
+		j++;
+	}
+
+	if (j == hp->njh_tail) {
+		for (i = 0; i < j && njl_critical(&jp->njl_recs[i]); i++)
+			;
+		if (i < j) {
+			bcopy(&jp->njl_recs[i + 1], &jp->njl_recs[i],
+			    (j - i - 1) * sizeof (nc_jrec_t));
+			--j;
+			++jp->njl_stats.njs_dropped;
+		} else if ((err = njl_grow(jp)) != 0) {
+			++jp->njl_stats.njs_refused;
+			return (err);
+		} else {
+			hp = jp->njl_hdr;
+		}
+	}
+
+	bzero(&jp->njl_recs[j], (hp->njh_nrecs - j) * sizeof (nc_jrec_t));
+	hp->njh_tail = j;
+
+	/*
+	 * No more records are pending than before, so the index need not
+	 * grow, and this cannot fail.
+	 */
+	(void) njl_pend_rebuild(jp);
+
+	/*
+	 * Arrange for the append that follows to sync the entire array.
+	 */
+	++jp->njl_stats.njs_compactions;
+	jp->njl_dirty_lo = 0;
+	jp->njl_dirty_hi = hp->njh_nrecs;
+	jp->njl_unsynced = jp->njl_batch - 1;
+
+	return (0);
+}
+
+/*
+ * Append a record for an event we have just read.  Returns the record's
+ * index, which is used to mark it delivered (even if the record has since
+ * moved; see njl_find()), -1 if no journal is open, or NC_JOURNAL_REFUSED if
+ * there was no room for it.
+ */
+int64_t
+nc_journal_append(contract_mgr_t *mp, ctid_t ctid, nc_type_t cttype,
+    ctevid_t evid, uint_t type, uint_t flags, ctevid_t nevid, ctid_t newct)
+{
+	nc_journal_t *jp = mp->cm_journal;
+	nc_jhdr_t *hp;
+	nc_jrec_t *rp;
+	uint64_t idx;
+	hrtime_t start;
+
+	if (jp == NULL)
+		return (-1);
+
+	start = gethrtime();
+	hp = jp->njl_hdr;
+
+	if (hp->njh_tail == hp->njh_nrecs) {
+		if (njl_makeroom(jp) != 0)
+			return (NC_JOURNAL_REFUSED);
+		hp = jp->njl_hdr;
+	}
+
+	idx = hp->njh_tail;
+	if ((flags & CTE_ACK) && njl_pend_add(jp, evid, idx) != 0) {
+		++jp->njl_stats.njs_refused;
+		return (NC_JOURNAL_REFUSED);
+	}
+
+	rp = &jp->njl_recs[idx];
+	rp->njr_state = NJS_PENDING;
+	rp->njr_flags = (uint8_t)flags;
+	rp->njr_cttype = (uint8_t)cttype;
+	rp->njr_jflags = 0;
+	rp->njr_ctid = ctid;
+	rp->njr_type = type;
+	rp->njr_evid = evid;
+	rp->njr_nevid = nevid;
+	rp->njr_newct = newct;
+	rp->njr_time = (uint64_t)start;
+	rp->njr_magic = NJR_MAGIC;
+	hp->njh_tail = idx + 1;
+
+	njl_dirty(jp, idx);
+
+	++jp->njl_stats.njs_records;
+	jp->njl_stats.njs_append_ns += gethrtime() - start;
+
+	return ((int64_t)idx);
+}
+
+/*
+ * Find the record of evid, which was appended at idx.  A caller may hold an
+ * index across later appends, and if one of those made room, the record may
+ * have moved.  Making room only ever moves records toward the start of the
+ * array, so we search back from where it was.  Returns -1 if the record is
+ * gone, as when it was dropped.
+ */
+static int64_t
+njl_find(nc_journal_t *jp, int64_t idx, ctevid_t evid)
+{
+	nc_jrec_t *rp;
+	int64_t i;
+
+	i = MIN(idx, (int64_t)jp->njl_hdr->njh_tail - 1);
+	for (; i >= 0; i--) {
+		rp = &jp->njl_recs[i];
+		if (rp->njr_magic != NJR_MAGIC || rp->njr_evid != evid ||
+		    (rp->njr_jflags & NJRF_PREVBOOT))
+			continue;
+		if (i != idx)
+			++jp->njl_stats.njs_relocated;
+		return (i);
+	}
+
+	++jp->njl_stats.njs_missing;
+
+	return (-1);
+}
+
+void
+nc_journal_delivered(contract_mgr_t *mp, int64_t idx, ctevid_t evid)
+{
+	nc_journal_t *jp = mp->cm_journal;
+	nc_jrec_t *rp;
+
+	if (jp == NULL || idx < 0 || (idx = njl_find(jp, idx, evid)) < 0)
+		return;
+
+	rp = &jp->njl_recs[idx];
+	if (rp->njr_state != NJS_PENDING)
+		return;
+
+	rp->njr_state = NJS_DELIVERED;
+	njl_dirty(jp, (uint64_t)idx);
+}
+
+void
+nc_journal_acked(contract_mgr_t *mp, ctevid_t evid)
+{
+	nc_journal_t *jp = mp->cm_journal;
+	int64_t idx;
+
+	if (jp == NULL || (idx = njl_pend_del(jp, evid)) < 0)
+		return;
+
+	if ((uint64_t)idx < jp->njl_hdr->njh_tail &&
+	    jp->njl_recs[idx].njr_evid == evid) {
+		jp->njl_recs[idx].njr_state = NJS_ACKED;
+		njl_dirty(jp, (uint64_t)idx);
+	}
+}
+
+/*
+ * If the journal was last written before the current boot (or we cannot
+ * tell), mark every record in it as coming from a previous boot, and claim
+ * the journal for this one.
+ */
+static void
+njl_check_boot(nc_journal_t *jp)
+{
+	nc_jhdr_t *hp = jp->njl_hdr;
+	uint64_t boot = njl_boot_time();
+	uint64_t i;
+
+	if (boot != 0 && hp->njh_boot == boot)
+		return;
+
+	for (i = 0; i < hp->njh_tail; i++) {
+		if (jp->njl_recs[i].njr_magic == NJR_MAGIC &&
+		    !(jp->njl_recs[i].njr_jflags & NJRF_PREVBOOT)) {
+			jp->njl_recs[i].njr_jflags |= NJRF_PREVBOOT;
+			++jp->njl_stats.njs_prevboot;
+		}
+	}
+	hp->njh_boot = boot;
+
+	(void) msync((caddr_t)hp, jp->njl_maplen, MS_SYNC);
+}
+
+static int
+njl_map(nc_journal_t *jp, uint64_t nrecs, boolean_t create)
+{
+	struct stat sb;
+	size_t len = sizeof (nc_jhdr_t) + nrecs * sizeof (nc_jrec_t);
+	void *addr;
+
+	if (!create) {
+		if (fstat(jp->njl_fd, &sb) != 0)
+			return (errno);
+		if ((size_t)sb.st_size < sizeof (nc_jhdr_t))
+			return (EINVAL);
+		len = (size_t)sb.st_size;
+	} else if (ftruncate(jp->njl_fd, (off_t)len) != 0) {
+		return (errno);
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    jp->njl_fd, 0);
+	if (addr == MAP_FAILED)
+		return (errno);
+
+	jp->njl_maplen = len;
+	jp->njl_hdr = addr;
+	jp->njl_recs = (nc_jrec_t *)((char *)addr + sizeof (nc_jhdr_t));
+
+	if (create) {
+		bzero(addr, sizeof (nc_jhdr_t));
+		bcopy(NJH_MAGIC, jp->njl_hdr->njh_magic, 8);
+		jp->njl_hdr->njh_version = NJH_VERSION;
+		jp->njl_hdr->njh_reclen = sizeof (nc_jrec_t);
+		jp->njl_hdr->njh_nrecs = nrecs;
+		jp->njl_hdr->njh_tail = 0;
+		jp->njl_hdr->njh_boot = njl_boot_time();
+		(void) msync(addr, len, MS_SYNC);
+		return (0);
+	}
+
+	if (bcmp(jp->njl_hdr->njh_magic, NJH_MAGIC, 8) != 0 ||
+	    jp->njl_hdr->njh_version != NJH_VERSION ||
+	    jp->njl_hdr->njh_reclen != sizeof (nc_jrec_t) ||
+	    sizeof (nc_jhdr_t) + jp->njl_hdr->njh_nrecs * sizeof (nc_jrec_t) >
+	    len || jp->njl_hdr->njh_tail > jp->njl_hdr->njh_nrecs) {
+		(void) munmap(addr, len);
+		return (EINVAL);
+	}
+
+	njl_check_boot(jp);
+
+	return (0);
+}
+
+int
+nc_journal_open(contract_mgr_t *mp, const char *path, uint64_t nrecs,
+    uint_t batch, uint64_t sync_ms)
+{
+	nc_journal_t *jp;
+	struct stat sb;
+	uint64_t i;
+	int err;
+
+	if (mp->cm_journal != NULL)
+		return (EBUSY);
+
+	if ((jp = calloc(1, sizeof (nc_journal_t))) == NULL)
+		return (ENOMEM);
+
+	jp->njl_batch = batch != 0 ? batch : NJL_DEF_BATCH;
+	jp->njl_sync_ms = sync_ms != 0 ? sync_ms : NJL_DEF_SYNC_MS;
+	if (nrecs == 0)
+		nrecs = NJL_DEF_RECORDS;
+
+	if ((jp->njl_fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+		err = errno;
+		free(jp);
+		return (err);
+	}
+	(void) fcntl(jp->njl_fd, F_SETFD, FD_CLOEXEC);
+
+	if (fstat(jp->njl_fd, &sb) != 0) {
+		err = errno;
+		(void) close(jp->njl_fd);
+		free(jp);
+		return (err);
+	}
+
+	if ((err = njl_map(jp, nrecs, sb.st_size == 0)) != 0) {
+		(void) close(jp->njl_fd);
+		free(jp);
+		return (err);
+	}
+
+	/*
+	 * Size the seen set at twice the number of records present, rounded
+	 * up to a power of two, so that it never fills.
+	 */
+	if (jp->njl_hdr->njh_tail > 0) {
+		for (jp->njl_seen_size = 16;
+		    jp->njl_seen_size < jp->njl_hdr->njh_tail * 2;
+		    jp->njl_seen_size <<= 1)
+			;
+		jp->njl_seen = calloc(jp->njl_seen_size, sizeof (ctevid_t));
+		if (jp->njl_seen == NULL) {
+			(void) munmap((caddr_t)jp->njl_hdr, jp->njl_maplen);
+			(void) close(jp->njl_fd);
+			free(jp);
+			return (ENOMEM);
+		}
+		for (i = 0; i < jp->njl_hdr->njh_tail; i++) {
+			if (jp->njl_recs[i].njr_magic == NJR_MAGIC &&
+			    !(jp->njl_recs[i].njr_jflags & NJRF_PREVBOOT))
+				njl_seen_add(jp,
+				    jp->njl_recs[i].njr_evid);
+		}
+	}
+
+	if (njl_pend_rebuild(jp) != 0) {
+		(void) munmap((caddr_t)jp->njl_hdr, jp->njl_maplen);
+		(void) close(jp->njl_fd);
+		free(jp->njl_seen);
+		free(jp->njl_pend);
+		free(jp);
+		return (ENOMEM);
+	}
+
+	jp->njl_dirty_lo = jp->njl_dirty_hi = jp->njl_hdr->njh_tail;
+
+	(void) uv_timer_init(mp->cm_loop, &jp->njl_timer);
+	jp->njl_timer.data = jp;
+	uv_unref((uv_handle_t *)&jp->njl_timer);
+
+	mp->cm_journal = jp;
+
+	return (0);
+}
+
+static void
+njl_timer_close_cb(uv_handle_t *hp)
+{
+	free(hp->data);
+}
+
+void
+nc_journal_close(contract_mgr_t *mp)
+{
+	nc_journal_t *jp = mp->cm_journal;
+
+	if (jp == NULL)
+		return;
+
+	mp->cm_journal = NULL;
+
+	njl_sync(jp);
+	(void) uv_timer_stop(&jp->njl_timer);
+	(void) munmap((caddr_t)jp->njl_hdr, jp->njl_maplen);
+	(void) close(jp->njl_fd);
+	free(jp->njl_seen);
+	free(jp->njl_pend);
+
+	uv_close((uv_handle_t *)&jp->njl_timer, njl_timer_close_cb);
+}
+
+/*
+ * Call func for each record that has not reached a terminal state, oldest
+ * first.  Informative records, and those from a previous boot, passed to
+ * func are considered delivered.
+ */
+int
+nc_journal_replay(contract_mgr_t *mp,
+    int (*func)(const nc_journal_ev_t *, void *), void *arg)
+{
+	nc_journal_t *jp = mp->cm_journal;
+	nc_journal_ev_t ev;
+	uint64_t i;
+	int err;
+
+	if (jp == NULL)
+		return (ENOENT);
+
+	for (i = 0; i < jp->njl_hdr->njh_tail; i++) {
+		nc_jrec_t *rp = &jp->njl_recs[i];
+
+		if (njl_done(rp))
+			continue;
+
+		ev.nje_ctid = rp->njr_ctid;
+		ev.nje_cttype = rp->njr_cttype < NCT_MAX ?
+		    (nc_type_t)rp->njr_cttype : NCT_PROCESS;
+		ev.nje_evid = rp->njr_evid;
+		ev.nje_type = rp->njr_type;
+		ev.nje_flags = rp->njr_flags;
+		ev.nje_nevid = rp->njr_nevid;
+		ev.nje_newct = rp->njr_newct;
+		ev.nje_delivered = (rp->njr_state != NJS_PENDING);
+		ev.nje_prevboot = (rp->njr_jflags & NJRF_PREVBOOT) != 0;
+
+		if ((err = func(&ev, arg)) != 0)
+			return (err);
+
+		if (rp->njr_state == NJS_PENDING) {
+			rp->njr_state = NJS_DELIVERED;
+			njl_dirty(jp, i);
+		}
+		++jp->njl_stats.njs_replayed;
+	}
+
+	njl_sync(jp);
+
+	return (0);
+}
+
+boolean_t
+nc_journal_stats(const contract_mgr_t *mp, nc_journal_stats_t *sp)
+{
+	const nc_journal_t *jp = mp->cm_journal;
+
+	if (jp == NULL)
+		return (B_FALSE);
+
+	*sp = jp->njl_stats;
+	sp->njs_capacity = jp->njl_hdr->njh_nrecs;
+	sp->njs_used = jp->njl_hdr->njh_tail;
+
+	return (B_TRUE);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Contract lifecycle.  Each contract carries, in its flags, the state
+ * (CTS_OWNED, CTS_INHERITED, CTS_ORPHAN or CTS_DEAD) in which we last knew
+ * it, and whether it is known to be empty or to be negotiating.  The state
+ * is seeded from the status read we make when constructing the contract,
+ * and thereafter kept current from what we see and do: adopting makes a
+ * contract ours, abandoning it leaves it dead if it was empty and orphaned
+ * or inherited otherwise, pr_empty marks it empty, an event requiring
+ * negotiation marks it negotiating until negend arrives, and any full
+ * status read brings everything up to date.  Consumers may thus ask where a
+ * contract stands without touching ctfs.
+ *
+ * What we know is used to refuse operations that cannot succeed, without
+ * making the system call only to have it fail: no process can join an
+ * empty process contract, so signalling one fails with ESRCH, as does any
+ * operation on a dead contract.  Only transitions that can't be undone are
+ * acted on this way; changes made by others -- another process adopting an
+ * orphan we observe, say -- are seen only at the next status read, so the
+ * state may lag, but never so as to refuse an operation that would have
+ * succeeded.
+ */
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <sys/contract/process.h>
+#include <errno.h>
+#include <libcontract.h>
+#include "node_contract.h"
+
+static void
+nc_life_setstate(node_contract_t *cp, uint_t state)
+{
+	VERIFY(state <= CTS_DEAD);
+
+	cp->nc_flags = (cp->nc_flags & ~NCF_STATE_MASK) |
+	    (state << NCF_STATE_SHIFT);
+}
+
+uint_t
+nc_life_state(const node_contract_t *cp)
+{
+	return ((cp->nc_flags & NCF_STATE_MASK) >> NCF_STATE_SHIFT);
+}
+
+/*
+ * Bring the lifecycle up to date from a status read at CTD_COMMON or
+ * above; with CTD_ALL, a process contract without members is also known to
+ * be empty.
+ */
+void
+nc_life_status(node_contract_t *cp, ct_stathdl_t st, int detail)
+{
+	pid_t *pids;
+	uint_t npids;
+
+	nc_life_setstate(cp, ct_status_get_state(st));
+	if (ct_status_get_state(st) == CTS_DEAD)
+		cp->nc_flags |= NCF_EMPTY;
+
+	if (detail == CTD_ALL && cp->nc_type->nct_type == NCT_PROCESS &&
+	    ct_pr_status_get_members(st, &pids, &npids) == 0 && npids == 0)
+		cp->nc_flags |= NCF_EMPTY;
+}
+
+void
+nc_life_event(node_contract_t *cp, uint_t evtype, uint_t flags)
+{
+	if (cp->nc_type->nct_type == NCT_PROCESS && evtype == CT_PR_EV_EMPTY)
+		cp->nc_flags |= NCF_EMPTY;
+
+	if (evtype == CT_EV_NEGEND)
+		cp->nc_flags &= ~NCF_NEGOTIATING;
+	else if (flags & CTE_NEG)
+		cp->nc_flags |= NCF_NEGOTIATING;
+}
+
+void
+nc_life_adopted(node_contract_t *cp)
+{
+	nc_life_setstate(cp, CTS_OWNED);
+}
+
+/*
+ * An empty contract dies when abandoned.  Any other goes to its regent, if
+ * it has one, or is orphaned; which, only the kernel can tell us, so we ask.
+ * Abandoning is rare enough that the status read costs nothing that
+ * matters.
+ */
+void
+nc_life_abandoned(node_contract_t *cp)
+{
+	ct_stathdl_t st;
+
+	cp->nc_flags &= ~NCF_NEGOTIATING;
+
+	if (cp->nc_flags & NCF_EMPTY) {
+		nc_life_setstate(cp, CTS_DEAD);
+		return;
+	}
+
+	if (cp->nc_st_fd >= 0 &&
+	    ct_status_read(cp->nc_st_fd, CTD_COMMON, &st) == 0) {
+		nc_life_status(cp, st, CTD_COMMON);
+		ct_status_free(st);
+		return;
+	}
+
+	nc_life_setstate(cp, CTS_ORPHAN);
+}
+
+/*
+ * Return ESRCH if the operation is certain to fail, counting it, or 0 if
+ * it should be attempted.
+ */
+int
+nc_life_check(node_contract_t *cp, nc_lifeop_t op)
+{
+	if (nc_life_state(cp) == CTS_DEAD ||
+	    (op == NLO_SIGNAL && (cp->nc_flags & NCF_EMPTY))) {
+		++cp->nc_mgr->cm_ops_elided;
+		return (ESRCH);
+	}
+
+	return (0);
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Incremental member-set tracking for process contracts.  When enabled on a
+ * contract, we seed a set of member pids from a single status read and then
+ * keep it current from the pr_fork, pr_exit and pr_empty events we see in
+ * handle_events(), so that membership and count queries need no ctfs I/O.
+ * Because events may be lost (or may not be subscribed to), consumers may
+ * ask for the set to be rebuilt from status periodically.
+ *
+ * The set itself is an open-addressed hash table of pids with linear probing
+ * and backward-shift deletion; pid 0 marks an empty slot.
+ */
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <sys/contract/process.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NCM_MINSIZE	16
+
+struct nc_members {
+	pid_t *ncm_pids;
+	uint_t ncm_size;
+	uint_t ncm_count;
+	uint64_t ncm_interval;
+	uint64_t ncm_synced;
+	boolean_t ncm_stale;
+};
+
+static uint_t
+ncm_hash(pid_t pid, uint_t size)
+{
+	uint32_t h = (uint32_t)pid * 2654435761U;
+
+	return (h & (size - 1));
+}
+
+static int
+ncm_resize(nc_members_t *mp, uint_t size)
+{
+	pid_t *opids = mp->ncm_pids;
+	uint_t osize = mp->ncm_size;
+	uint_t i, j;
+
+	if ((mp->ncm_pids = calloc(size, sizeof (pid_t))) == NULL) {
+		mp->ncm_pids = opids;
+		return (ENOMEM);
+	}
+	mp->ncm_size = size;
+
+	for (i = 0; i < osize; i++) {
+		if (opids[i] == 0)
+			continue;
+		for (j = ncm_hash(opids[i], size); mp->ncm_pids[j] != 0;
+		    j = (j + 1) & (size - 1))
+			;
+		mp->ncm_pids[j] = opids[i];
+	}
+
+	free(opids);
+
+	return (0);
+}
+
+static int
+ncm_insert(nc_members_t *mp, pid_t pid)
+{
+	uint_t i;
+	int err;
+
+	if (pid == 0)
+		return (0);
+
+	/*
+	 * Keep the load factor at or below 1/2 so probe sequences stay short.
+	 */
+	if ((mp->ncm_count + 1) * 2 > mp->ncm_size &&
+	    (err = ncm_resize(mp, mp->ncm_size * 2)) != 0)
+		return (err);
+
+	for (i = ncm_hash(pid, mp->ncm_size); mp->ncm_pids[i] != 0;
+	    i = (i + 1) & (mp->ncm_size - 1)) {
+		if (mp->ncm_pids[i] == pid)
+			return (0);
+	}
+
+	mp->ncm_pids[i] = pid;
+	++mp->ncm_count;
+
+	return (0);
+}
+
+static void
+ncm_remove(nc_members_t *mp, pid_t pid)
+{
+	uint_t mask = mp->ncm_size - 1;
+	uint_t i, j, h;
+
+	for (i = ncm_hash(pid, mp->ncm_size); mp->ncm_pids[i] != pid;
+	    i = (i + 1) & mask) {
+		if (mp->ncm_pids[i] == 0)
+			return;
+	}
+
+	/*
+	 * Shift back any subsequent entries in this cluster whose home slot
+	 * does not lie cyclically within (i, j], so that lookups never
+	 * terminate early on the hole we've just made.
+	 */
+	for (j = (i + 1) & mask; mp->ncm_pids[j] != 0; j = (j + 1) & mask) {
+		h = ncm_hash(mp->ncm_pids[j], mp->ncm_size);
+		if ((j > i && (h <= i || h > j)) ||
+		    (j < i && (h <= i && h > j))) {
+			mp->ncm_pids[i] = mp->ncm_pids[j];
+			i = j;
+		}
+	}
+
+	mp->ncm_pids[i] = 0;
+	--mp->ncm_count;
+}
+
+static void
+ncm_clear(nc_members_t *mp)
+{
+	bzero(mp->ncm_pids, mp->ncm_size * sizeof (pid_t));
+	mp->ncm_count = 0;
+}
+
+boolean_t
+nc_members_has(const nc_members_t *mp, pid_t pid)
+{
+	uint_t i;
+
+	if (pid == 0)
+		return (B_FALSE);
+
+	for (i = ncm_hash(pid, mp->ncm_size); mp->ncm_pids[i] != 0;
+	    i = (i + 1) & (mp->ncm_size - 1)) {
+		if (mp->ncm_pids[i] == pid)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+uint_t
+nc_members_count(const nc_members_t *mp)
+{
+	return (mp->ncm_count);
+}
+
+/*
+ * Calls the supplied function once for each member; used to build the list
+ * returned to consumers.  Stops early if the callback returns nonzero.
+ */
+int
+nc_members_walk(const nc_members_t *mp, int (*func)(pid_t, void *),
+    void *arg)
+{
+	uint_t i;
+	int err;
+
+	for (i = 0; i < mp->ncm_size; i++) {
+		if (mp->ncm_pids[i] != 0 &&
+		    (err = func(mp->ncm_pids[i], arg)) != 0)
+			return (err);
+	}
+
+	return (0);
+}
+
+/*
+ * Rebuild the member set from the contract's status.  This is the only
+ * place we read ctfs on behalf of member tracking.
+ */
+int
+nc_members_resync(node_contract_t *cp)
+{
+	nc_members_t *mp = cp->nc_members;
+	ct_stathdl_t st;
+	pid_t *pids;
+	uint_t npids = 0;
+	uint_t i;
+	int err;
+
+	VERIFY(mp != NULL);
+
+	if ((err = ct_status_read(cp->nc_st_fd, CTD_ALL, &st)) != 0)
+		return (err);
+
+	(void) ct_pr_status_get_members(st, &pids, &npids);
+
+	ncm_clear(mp);
+	mp->ncm_stale = B_FALSE;
+	while (npids * 2 > mp->ncm_size) {
+		if ((err = ncm_resize(mp, mp->ncm_size * 2)) != 0) {
+			ct_status_free(st);
+			return (err);
+		}
+	}
+	for (i = 0; i < npids; i++) {
+		if ((err = ncm_insert(mp, pids[i])) != 0) {
+			ct_status_free(st);
+			return (err);
+		}
+	}
+
+	ct_status_free(st);
+	mp->ncm_synced = uv_now(cp->nc_mgr->cm_loop);
+
+	return (0);
+}
+
+/*
+ * If the set is known to be stale, or the consumer asked for periodic
+ * resynchronization and the interval has elapsed, rebuild the set now.
+ * Called before answering queries.
+ */
+int
+nc_members_refresh(node_contract_t *cp)
+{
+	nc_members_t *mp = cp->nc_members;
+
+	if (!mp->ncm_stale && (mp->ncm_interval == 0 ||
+	    uv_now(cp->nc_mgr->cm_loop) - mp->ncm_synced < mp->ncm_interval))
+		return (0);
+
+	return (nc_members_resync(cp));
+}
+
+/*
+ * Begin tracking members of the contract.  The set is useful only if the
+ * contract generates both fork and exit events; otherwise it would go stale
+ * immediately, so we refuse.
+ */
+int
+nc_members_init(node_contract_t *cp, uint64_t interval)
+{
+	nc_members_t *mp;
+	ct_stathdl_t st;
+	uint_t evset;
+	int err;
+
+	if (cp->nc_members != NULL) {
+		cp->nc_members->ncm_interval = interval;
+		return (0);
+	}
+
+	if ((err = ct_status_read(cp->nc_st_fd, CTD_COMMON, &st)) != 0)
+		return (err);
+	evset = ct_status_get_informative(st) | ct_status_get_critical(st);
+	ct_status_free(st);
+
+	if ((evset & (CT_PR_EV_FORK | CT_PR_EV_EXIT)) !=
+	    (CT_PR_EV_FORK | CT_PR_EV_EXIT))
+		return (ENOTSUP);
+
+	if ((mp = calloc(1, sizeof (nc_members_t))) == NULL)
+		return (ENOMEM);
+	if ((mp->ncm_pids = calloc(NCM_MINSIZE, sizeof (pid_t))) == NULL) {
+		free(mp);
+		return (ENOMEM);
+	}
+	mp->ncm_size = NCM_MINSIZE;
+	mp->ncm_interval = interval;
+
+	cp->nc_members = mp;
+
+	if ((err = nc_members_resync(cp)) != 0) {
+		nc_members_fini(cp);
+		return (err);
+	}
+
+	return (0);
+}
+
+void
+nc_members_fini(node_contract_t *cp)
+{
+	nc_members_t *mp = cp->nc_members;
+
+	if (mp == NULL)
+		return;
+
+	cp->nc_members = NULL;
+	free(mp->ncm_pids);
+	free(mp);
+}
+
+/*
+ * Apply a single event to the member set.  If we can't keep up (allocation
+ * failure or an event without a pid), mark the set stale so that the next
+ * query rebuilds it from status.
+ */
+void
+nc_members_event(node_contract_t *cp, ct_evthdl_t eh, uint_t evtype)
+{
+	nc_members_t *mp = cp->nc_members;
+	pid_t pid;
+
+	switch (evtype) {
+	case CT_PR_EV_FORK:
+		if (ct_pr_event_get_pid(eh, &pid) != 0 ||
+		    ncm_insert(mp, pid) != 0)
+			mp->ncm_stale = B_TRUE;
+		break;
+	case CT_PR_EV_EXIT:
+		if (ct_pr_event_get_pid(eh, &pid) == 0)
+			ncm_remove(mp, pid);
+		else
+			mp->ncm_stale = B_TRUE;
+		break;
+	case CT_PR_EV_EMPTY:
+		ncm_clear(mp);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * OpenMetrics rendering.  Once the consumer enables metrics, we count
+ * events by contract and event type, and time each critical event from the
+ * moment we read it to the moment the consumer acks or nacks it.  On
+ * request, these counters, together with those the manager already keeps
+ * and a walk of the registry, are rendered as OpenMetrics text into a buffer
+ * that is reused from one scrape to the next; the consumer receives a single
+ * string.
+ *
+ * Critical events awaiting an answer are remembered in a small table
+ * indexed by evid.  An event whose slot is reused before it is answered is
+ * simply not timed; we count such evictions.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/debug.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <libcontract.h>
+#include "node_contract.h"
+
+#define	NMX_EVBITS	32	/* event types are single bits ... */
+#define	NMX_NEGEND	NMX_EVBITS	/* ... except negend, which is 0 */
+#define	NMX_EVSLOTS	(NMX_EVBITS + 1)
+#define	NMX_PENDING	1024	/* must be a power of 2 */
+#define	NMX_BUCKETS	15	/* 1 ms to 2^14 ms, doubling */
+#define	NMX_MINBUF	4096
+
+typedef struct nc_mxpending {
+	ctevid_t nmp_evid;
+	hrtime_t nmp_time;
+} nc_mxpending_t;
+
+struct nc_metrics {
+	uint64_t nmx_events[NCT_MAX][NMX_EVSLOTS];
+	nc_mxpending_t nmx_pending[NMX_PENDING];
+	uint64_t nmx_ack_buckets[NMX_BUCKETS + 1];
+	uint64_t nmx_ack_count;
+	double nmx_ack_sum;
+	uint64_t nmx_ack_evicted;
+	char *nmx_buf;
+	size_t nmx_bufsz;
+	size_t nmx_len;
+	boolean_t nmx_overflow;
+};
+
+/*
+ * Held contracts are counted by type, by whether they are observed, and by
+ * the lifecycle state in which we last knew them (see lifecycle.c).
+ */
+typedef struct nmx_census {
+	uint_t nmc_held[NCT_MAX][2][CTS_DEAD + 1];
+	uint_t nmc_fds;
+} nmx_census_t;
+
+int
+nc_metrics_enable(contract_mgr_t *mp)
+{
+	nc_metrics_t *xp;
+
+	if (mp->cm_metrics != NULL)
+		return (0);
+
+	if ((xp = calloc(1, sizeof (nc_metrics_t))) == NULL)
+		return (ENOMEM);
+
+	mp->cm_metrics = xp;
+
+	return (0);
+}
+
+/*
+ * Return the counter slot for an event type, or NMX_EVSLOTS if it has none.
+ */
+static uint_t
+nmx_evslot(uint_t evtype)
+{
+	uint_t i;
+
+	if (evtype == CT_EV_NEGEND)
+		return (NMX_NEGEND);
+
+	for (i = 0; i < NMX_EVBITS; i++) {
+		if (evtype & (1U << i))
+			return (i);
+	}
+
+	return (NMX_EVSLOTS);
+}
+
+void
+nc_metrics_event(contract_mgr_t *mp, const node_contract_t *cp,
+    uint_t evtype, ctevid_t evid, uint_t flags)
+{
+	nc_metrics_t *xp = mp->cm_metrics;
+	nc_mxpending_t *pp;
+	uint_t slot;
+
+	if ((slot = nmx_evslot(evtype)) < NMX_EVSLOTS)
+		++xp->nmx_events[cp->nc_type->nct_type][slot];
+
+	if (!(flags & CTE_ACK))
+		return;
+
+	pp = &xp->nmx_pending[evid & (NMX_PENDING - 1)];
+	if (pp->nmp_evid != 0 && pp->nmp_evid != evid)
+		++xp->nmx_ack_evicted;
+	pp->nmp_evid = evid;
+	pp->nmp_time = gethrtime();
+}
+
+void
+nc_metrics_answered(contract_mgr_t *mp, ctevid_t evid)
+{
+	nc_metrics_t *xp = mp->cm_metrics;
+	nc_mxpending_t *pp;
+	double ms;
+	uint_t i;
+
+	if (xp == NULL)
+		return;
+
+	pp = &xp->nmx_pending[evid & (NMX_PENDING - 1)];
+	if (pp->nmp_evid != evid)
+		return;
+
+	ms = (double)(gethrtime() - pp->nmp_time) / MICROSEC;
+	pp->nmp_evid = 0;
+
+	for (i = 0; i < NMX_BUCKETS && ms > (double)(1U << i); i++)
+		;
+	++xp->nmx_ack_buckets[i];
+	++xp->nmx_ack_count;
+	xp->nmx_ack_sum += ms / 1000;
+}
+
+static void
+nmx_census_one(node_contract_t *cp, void *arg)
+{
+	nmx_census_t *np = arg;
+
+	++np->nmc_held[cp->nc_type->nct_type][cp->nc_evsrc != NULL]
+	    [nc_life_state(cp)];
+	np->nmc_fds += (cp->nc_ctl_fd >= 0) + (cp->nc_st_fd >= 0) +
+	    (cp->nc_evsrc != NULL);
+}
+
+static void
+nmx_printf(nc_metrics_t *xp, const char *fmt, ...)
+{
+	va_list va;
+	int n;
+
+	if (xp->nmx_overflow)
+		return;
+
+	va_start(va, fmt);
+	n = vsnprintf(xp->nmx_buf + xp->nmx_len, xp->nmx_bufsz - xp->nmx_len,
+	    fmt, va);
+	va_end(va);
+
+	if (n < 0 || (size_t)n >= xp->nmx_bufsz - xp->nmx_len) {
+		xp->nmx_overflow = B_TRUE;
+		return;
+	}
+
+	xp->nmx_len += n;
+}
+
+static void
+nmx_render(nc_metrics_t *xp, contract_mgr_t *mp, const nmx_census_t *np)
+{
+	const nc_typedesc_t *ntp;
+	const nc_descr_t *dp, *sp;
+	uint64_t cum = 0;
+	uint_t i, slot;
+
+	xp->nmx_len = 0;
+	xp->nmx_overflow = B_FALSE;
+
+	nmx_printf(xp, "# TYPE contract_held gauge\n"
+	    "# HELP contract_held Contracts held by this process.\n");
+	for (ntp = nc_types; ntp->nct_name != NULL; ntp++) {
+		for (sp = nc_ct_states; sp->ncd_str != NULL; sp++) {
+			nmx_printf(xp, "contract_held{type=\"%s\","
+			    "mode=\"owned\",state=\"%s\"} %u\n"
+			    "contract_held{type=\"%s\","
+			    "mode=\"observed\",state=\"%s\"} %u\n",
+			    ntp->nct_name, sp->ncd_str,
+			    np->nmc_held[ntp->nct_type][0][sp->ncd_i],
+			    ntp->nct_name, sp->ncd_str,
+			    np->nmc_held[ntp->nct_type][1][sp->ncd_i]);
+		}
+	}
+
+	nmx_printf(xp, "# TYPE contract_events counter\n"
+	    "# HELP contract_events Contract events read.\n");
+	for (ntp = nc_types; ntp->nct_name != NULL; ntp++) {
+		for (dp = ntp->nct_events; dp->ncd_str != NULL; dp++) {
+			if ((slot = nmx_evslot(dp->ncd_i)) >= NMX_EVSLOTS)
+				continue;
+			nmx_printf(xp, "contract_events_total"
+			    "{type=\"%s\",event=\"%s\"} %llu\n",
+			    ntp->nct_name, dp->ncd_str, (unsigned long long)
+			    xp->nmx_events[ntp->nct_type][slot]);
+		}
+	}
+
+	nmx_printf(xp, "# TYPE contract_ack_latency_seconds histogram\n"
+	    "# HELP contract_ack_latency_seconds Time from reading a critical "
+	    "event to acking or nacking it.\n");
+	for (i = 0; i < NMX_BUCKETS; i++) {
+		cum += xp->nmx_ack_buckets[i];
+		nmx_printf(xp,
+		    "contract_ack_latency_seconds_bucket{le=\"%g\"} %llu\n",
+		    (double)(1U << i) / 1000, (unsigned long long)cum);
+	}
+	nmx_printf(xp,
+	    "contract_ack_latency_seconds_bucket{le=\"+Inf\"} %llu\n"
+	    "contract_ack_latency_seconds_sum %g\n"
+	    "contract_ack_latency_seconds_count %llu\n",
+	    (unsigned long long)xp->nmx_ack_count, xp->nmx_ack_sum,
+	    (unsigned long long)xp->nmx_ack_count);
+
+	nmx_printf(xp, "# TYPE contract_ack_untimed counter\n"
+	    "# HELP contract_ack_untimed Critical events not timed because "
+	    "too many were outstanding.\n"
+	    "contract_ack_untimed_total %llu\n",
+	    (unsigned long long)xp->nmx_ack_evicted);
+
+	nmx_printf(xp, "# TYPE contract_fds gauge\n"
+	    "# HELP contract_fds Contract file descriptors held open.\n"
+	    "contract_fds %u\n", np->nmc_fds);
+
+	nmx_printf(xp, "# TYPE contract_event_failures counter\n"
+	    "# HELP contract_event_failures Events that could not be read "
+	    "or handed over, other than those counted lost.\n"
+	    "contract_event_failures_total %u\n", mp->cm_ev_failures);
+
+	nmx_printf(xp, "# TYPE contract_leaked counter\n"
+	    "# HELP contract_leaked Contracts collected while still held.\n"
+	    "contract_leaked_total %u\n", mp->cm_leaked);
+
+	nmx_printf(xp, "# EOF\n");
+}
+
+/*
+ * Render the current metrics.  The returned string belongs to the manager
+ * and is valid until the next call.
+ */
+int
+nc_metrics_render(contract_mgr_t *mp, const char **bufp)
+{
+	nc_metrics_t *xp = mp->cm_metrics;
+	nmx_census_t nc;
+	size_t sz;
+	char *buf;
+	uint_t i;
+
+	if (xp == NULL)
+		return (ENOTSUP);
+
+	bzero(&nc, sizeof (nc));
+	nc_walk(mp, nmx_census_one, &nc);
+	for (i = 0; i < NCT_MAX; i++)
+		nc.nmc_fds += (mp->cm_pbundle[i].nes_fd >= 0);
+	nc.nmc_fds += (mp->cm_tmpl_fd >= 0);
+
+	if (xp->nmx_buf == NULL) {
+		if ((xp->nmx_buf = malloc(NMX_MINBUF)) == NULL)
+			return (ENOMEM);
+		xp->nmx_bufsz = NMX_MINBUF;
+	}
+
+	for (;;) {
+		nmx_render(xp, mp, &nc);
+		if (!xp->nmx_overflow)
+			break;
+
+		sz = xp->nmx_bufsz * 2;
+		if ((buf = realloc(xp->nmx_buf, sz)) == NULL)
+			return (ENOMEM);
+		xp->nmx_buf = buf;
+		xp->nmx_bufsz = sz;
+	}
+
+	*bufp = xp->nmx_buf;
+
+	return (0);
+}
@@ -30,12 +30,39 @@ typedef enum nc_ack {
 } nc_ack_t;
 
 static contract_mgr_t mgr = {
+	cm_loop: NULL,
 	cm_tmpl_fd: -1,
 	cm_last_type: NULL,
-	cm_ev_fds: { -1, -1 }
+	cm_lanes: B_TRUE,
+	cm_ctid_buckets: mgr.cm_ctid_initial,
+	cm_ctid_nbuckets: NC_MINBUCKETS
 };
 
-static uint_t leaked;
+/*
+ * Return the contract manager for the calling thread's event loop.  v8plus
+ * modules are loaded once per process, and every call into this module is
+ * made on the main loop, so there is exactly one manager; it binds itself to
+ * that loop on first use.  All other code reaches shared state through the
+ * manager (or a contract's nc_mgr) so that this is the only place that
+ * knows.
+ */
+contract_mgr_t *
+nc_mgr(void)
+{
+	uint_t i;
+
+	if (mgr.cm_loop == NULL) {
+		mgr.cm_loop = uv_default_loop();
+		for (i = 0; i < NCT_MAX; i++) {
+			nc_evsrc_init(&mgr.cm_pbundle[i], &mgr, NES_PBUNDLE,
+			    &nc_types[i], 0);
+		}
+		for (i = 0; i < NES_MAX; i++)
+			mgr.cm_evsrc_budget[i] = nc_evsrc_default_budget[i];
+	}
+
+	return (&mgr);
+}
 
 const char *
 nc_descr_strlookup(const nc_descr_t *dp, uint_t v)
@@ -76,38 +103,138 @@ close_on_exec(int fd)
 	return (0);
 }
 
+/*
+ * A batch of descriptors to be closed off the event loop thread.  Closing a
+ * ctfs descriptor is not free, and tearing down a large number of contracts
+ * at once would otherwise stall the loop.
+ */
+typedef struct nc_fdbatch {
+	int *nfb_fds;
+	uint_t nfb_count;
+	uint_t nfb_size;
+	v8plus_jsfunc_t nfb_cb;
+	boolean_t nfb_has_cb;
+	uint_t nfb_disposed;
+	uv_work_t nfb_work;
+} nc_fdbatch_t;
+
 static void
-node_contract_event_cb(uv_poll_t *upp, int status __UNUSED, int events)
+nc_fdbatch_close(nc_fdbatch_t *bp, int fd)
 {
-	int fd = (int)(uintptr_t)upp->data;
+	int *nfds;
+	uint_t nsize;
 
-	if (!(events & UV_READABLE))
+	if (fd < 0)
 		return;
 
-	/* XXX status == -1 => error; emit something? */
+	if (bp == NULL) {
+		(void) close(fd);
+		return;
+	}
+
+	if (bp->nfb_count == bp->nfb_size) {
+		nsize = bp->nfb_size == 0 ? 256 : bp->nfb_size * 2;
+		if ((nfds = realloc(bp->nfb_fds, nsize * sizeof (int))) ==
+		    NULL) {
+			(void) close(fd);
+			return;
+		}
+		bp->nfb_fds = nfds;
+		bp->nfb_size = nsize;
+	}
+
+	bp->nfb_fds[bp->nfb_count++] = fd;
+}
+
+static void
+node_contract_poll_close_cb(uv_handle_t *hp)
+{
+	nc_evsrc_t *sp = hp->data;
+	node_contract_t *cp = sp->nes_arg;
+
+	free(sp);
+	v8plus_obj_rele(cp);
+}
+
+static boolean_t
+nc_observing(const node_contract_t *cp)
+{
+	return (cp->nc_evsrc != NULL && nc_evsrc_started(cp->nc_evsrc));
+}
+
+/*
+ * Detach the contract's own event source, if it has one, and return its
+ * descriptor for the caller to close.  If the source was started, it is
+ * freed, and a hold on the contract dropped, once libuv is done with its
+ * poll handle.
+ */
+static int
+nc_evsrc_release(node_contract_t *cp)
+{
+	nc_evsrc_t *sp = cp->nc_evsrc;
+	int fd;
+
+	if (sp == NULL)
+		return (-1);
+
+	cp->nc_evsrc = NULL;
+	--cp->nc_mgr->cm_observed;
+
+	if (nc_evsrc_started(sp))
+		return (nc_evsrc_stop(sp, node_contract_poll_close_cb));
 
-	handle_events(fd);
+	fd = nc_evsrc_stop(sp, NULL);
+	free(sp);
+
+	return (fd);
 }
 
+/*
+ * Release every resource associated with the contract other than its memory,
+ * which belongs to the JS object.  If the contract is held, drop that hold
+ * too; if it has a poll handle, the hold is dropped only once libuv is done
+ * with the handle, since the handle lives inside the contract.  Descriptors
+ * are closed immediately unless a batch is supplied.
+ */
 static void
-node_contract_shutdown(node_contract_t *cp)
+node_contract_shutdown(node_contract_t *cp, nc_fdbatch_t *bp)
 {
-	nc_del(cp);
+	boolean_t held = (cp->nc_flags & NCF_HELD) != 0;
+
+	if (held)
+		nc_del(cp);
 
-	if (cp->nc_ctl_fd != -1)
-		(void) close(cp->nc_ctl_fd);
-	if (cp->nc_st_fd != -1)
-		(void) close(cp->nc_st_fd);
-	if (cp->nc_ev_fd != -1) {
-		uv_poll_stop(&cp->nc_uv_poll);
-		(void) close(cp->nc_ev_fd);
+	cp->nc_flags = (cp->nc_flags & ~NCF_HELD) | NCF_DISPOSED;
+	nc_members_fini(cp);
+	nc_deadline_fini(cp);
+	nc_watch_fini(cp);
+	nc_queue_fini(cp);
+	nc_group_unbind(cp);
+
+	nc_fdbatch_close(bp, cp->nc_ctl_fd);
+	nc_fdbatch_close(bp, cp->nc_st_fd);
+	cp->nc_ctl_fd = -1;
+	cp->nc_st_fd = -1;
+
+	if (nc_observing(cp)) {
+		VERIFY(held);
+		nc_fdbatch_close(bp, nc_evsrc_release(cp));
+		return;
 	}
+
+	nc_fdbatch_close(bp, nc_evsrc_release(cp));
+
+	if (held)
+		v8plus_obj_rele(cp);
 }
 
 static void
 node_contract_free(node_contract_t *cp)
 {
-	node_contract_shutdown(cp);
+	VERIFY(!(cp->nc_flags & NCF_HELD));
+	VERIFY(!nc_observing(cp));
+
+	node_contract_shutdown(cp, NULL);
 	free(cp);
 }
 
@@ -125,12 +252,15 @@ node_contract_ctor_common(int sfd)
 		return (NULL);
 	}
 
+	/*
+	 * The caller retains ownership of sfd until we succeed.
+	 */
 	bzero(cp, sizeof (node_contract_t));
+	cp->nc_mgr = nc_mgr();
 	cp->nc_ctl_fd = -1;
-	cp->nc_st_fd = sfd;
-	cp->nc_ev_fd = -1;
+	cp->nc_st_fd = -1;
 
-	if ((err = ct_status_read(sfd, CTD_COMMON, &st)) != 0) {
+	if ((err = ct_status_read(sfd, CTD_FIXED, &st)) != 0) {
 		(void) v8plus_syserr(err,
 		    "unable to obtain contract status: %s", strerror(err));
 		node_contract_free(cp);
@@ -148,10 +278,21 @@ node_contract_ctor_common(int sfd)
 		(void) v8plus_throw_exception("Error", "unknown contract type",
 		    V8PLUS_TYPE_STRING, "contract_type", typename,
 		    V8PLUS_TYPE_NONE);
+		ct_status_free(st);
 		node_contract_free(cp);
 		return (NULL);
 	}
+
+	nc_life_status(cp, st, CTD_FIXED);
+	err = nc_group_bind(cp, st);
 	ct_status_free(st);
+	if (err != 0) {
+		(void) v8plus_error(V8PLUSERR_NOMEM, NULL);
+		node_contract_free(cp);
+		return (NULL);
+	}
+
+	cp->nc_st_fd = sfd;
 
 	return (cp);
 }
@@ -165,14 +306,13 @@ node_contract_ctor_post(node_contract_t *cp)
 	 * We can't necessarily control a contract we're only observing, so
 	 * don't bother trying.
 	 */
-	if (cp->nc_ev_fd < 0 && cp->nc_ctl_fd < 0) {
+	if (cp->nc_evsrc == NULL && cp->nc_ctl_fd < 0) {
 		(void) snprintf(buf, sizeof (buf), "%s/%d/ctl",
 		    cp->nc_type->nct_root, (int)cp->nc_id);
 		if ((cp->nc_ctl_fd = open(buf, O_WRONLY)) < 0) {
 			(void) v8plus_syserr(errno,
 			    "unable to open ctl for ct %d: %s", cp->nc_id,
 			    strerror(errno));
-			node_contract_free(cp);
 			return (-1);
 		}
 	}
@@ -180,21 +320,43 @@ node_contract_ctor_post(node_contract_t *cp)
 	return (0);
 }
 
+/*
+ * Begin reading the pbundle for contracts of this type, if we aren't
+ * already.  Events for every contract we own arrive there.
+ */
+static int
+nc_pbundle_start(contract_mgr_t *mp, const nc_typedesc_t *ntp)
+{
+	nc_evsrc_t *sp = &mp->cm_pbundle[ntp->nct_type];
+	int err;
+
+	if (nc_evsrc_started(sp))
+		return (0);
+
+	nc_evsrc_init(sp, mp, NES_PBUNDLE, ntp, 0);
+	if ((err = nc_evsrc_open(sp)) != 0)
+		return (err);
+	nc_evsrc_start(sp, NULL);
+
+	return (0);
+}
+
 static nvlist_t *
 node_contract_ctor_latest(void **cpp)
 {
+	contract_mgr_t *mp = nc_mgr();
 	node_contract_t *cp;
 	char spath[MAXPATHLEN];
 	int sfd;
 
-	if (mgr.cm_last_type == NULL) {
+	if (mp->cm_last_type == NULL) {
 		return (v8plus_throw_exception("Error",
 		    "no contract template has been activated",
 		    V8PLUS_TYPE_NONE));
 	}
 
 	(void) snprintf(spath, sizeof (spath), "%s/latest",
-	    mgr.cm_last_type->nct_root);
+	    mp->cm_last_type->nct_root);
 	if ((sfd = open(spath, O_RDONLY)) < 0) {
 		return (v8plus_syserr(errno,
 		    "unable to open latest contract: %s", strerror(errno)));
@@ -265,12 +427,19 @@ node_contract_ctor_adopt(ctid_t ctid, void **cpp)
 		node_contract_free(cp);
 		return (NULL);
 	}
+	if ((err = nc_pbundle_start(cp->nc_mgr, cp->nc_type)) != 0) {
+		node_contract_free(cp);
+		return (v8plus_syserr(err,
+		    "unable to open contract pbundle event handle: %s",
+		    strerror(err)));
+	}
 	if ((err = ct_ctl_adopt(cp->nc_ctl_fd)) != 0) {
 		node_contract_free(cp);
 		return (v8plus_syserr(err,
 		    "unable to adopt contract %d: %s", (int)ctid,
 		    strerror(err)));
 	}
+	nc_life_adopted(cp);
 
 	/*
 	 * Here, we could use the per-contract event queue in a race-free way.
@@ -311,29 +480,31 @@ node_contract_ctor_observe(ctid_t ctid, void **cpp)
 		return (NULL);
 	}
 
-	(void) snprintf(buf, sizeof (buf),
-	    CTFS_ROOT "/all/%d/events", (int)ctid);
-	if ((cp->nc_ev_fd = open(buf, O_RDONLY | O_NONBLOCK)) < 0) {
-		err = errno;
+	if ((cp->nc_evsrc = malloc(sizeof (nc_evsrc_t))) == NULL) {
+		node_contract_free(cp);
+		return (v8plus_error(V8PLUSERR_NOMEM, NULL));
+	}
+	++cp->nc_mgr->cm_observed;
+
+	nc_evsrc_init(cp->nc_evsrc, cp->nc_mgr, NES_CONTRACT, cp->nc_type,
+	    ctid);
+	if ((err = nc_evsrc_open(cp->nc_evsrc)) != 0) {
 		node_contract_free(cp);
 		return (v8plus_syserr(err,
 		    "unable to open contract %d event handle: %s", (int)ctid,
 		    strerror(err)));
 	}
-	if (close_on_exec(cp->nc_ev_fd) != 0) {
-		node_contract_free(cp);
-		return (NULL);
-	}
-
-	(void) uv_poll_init(uv_default_loop(), &cp->nc_uv_poll, cp->nc_ev_fd);
-	(void) uv_poll_start(&cp->nc_uv_poll, UV_READABLE,
-	    node_contract_event_cb);
 
 	if (node_contract_ctor_post(cp) != 0) {
 		node_contract_free(cp);
 		return (NULL);
 	}
 
+	/*
+	 * The poll handle is set up only when the contract is held, so that
+	 * a contract that fails construction (or is never held) has nothing
+	 * registered with the loop.
+	 */
 	*cpp = cp;
 
 	return (v8plus_void());
@@ -383,206 +554,21 @@ node_contract_dtor(void *op)
 	node_contract_t *cp = op;
 
 	if (cp->nc_refcnt != 0)
-		++leaked;
+		++cp->nc_mgr->cm_leaked;
+	else
+		nc_group_unbind(cp);
 
 	free(cp);
 }
 
-static int
-nc_pr_tmpl_setprop(int fd, const nvlist_t *lp)
-{
-	const nc_typedesc_t *ntp = &nc_types[NCT_PROCESS];
-	double d;
-	char *s;
-	boolean_t b;
-	int err;
-	nvlist_t *sp;
-	const nc_descr_t *dp;
-
-	if (nvlist_lookup_double((nvlist_t *)lp, "transfer", &d) == 0) {
-		ctid_t ctid = (ctid_t)d;
-
-		if ((err = ct_pr_tmpl_set_transfer(fd, ctid)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property transfer: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_nvlist((nvlist_t *)lp, "fatal", &sp) == 0) {
-		uint_t evset = 0;
-
-		for (dp = ntp->nct_events; dp->ncd_str != NULL; dp++) {
-			if (nvlist_lookup_boolean_value(sp,
-			    dp->ncd_str, &b) == 0 && b)
-				evset |= dp->ncd_i;
-		}
-		if ((err = ct_pr_tmpl_set_fatal(fd, evset)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property fatal: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_nvlist((nvlist_t *)lp, "param", &sp) == 0) {
-		uint_t param = 0;
-
-		for (dp = nc_pr_params; dp->ncd_str != NULL; dp++) {
-			if (nvlist_lookup_boolean_value(sp,
-			    dp->ncd_str, &b) == 0 && b)
-				param |= dp->ncd_i;
-		}
-		if ((err = ct_pr_tmpl_set_param(fd, param)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property param: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_string((nvlist_t *)lp, "svc_fmri", &s) == 0) {
-		if ((err = ct_pr_tmpl_set_svc_fmri(fd, s)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property svc_fmri: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_string((nvlist_t *)lp, "svc_aux", &s) == 0) {
-		if ((err = ct_pr_tmpl_set_svc_aux(fd, s)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property svc_aux: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	return (0);
-}
-
-static int
-nc_dev_tmpl_setprop(int fd, const nvlist_t *lp)
-{
-	char *s;
-	boolean_t b;
-	nvlist_t *sp;
-	int err;
-	const nc_descr_t *dp;
-
-	if (nvlist_lookup_nvlist((nvlist_t *)lp, "dev_aset", &sp) == 0) {
-		uint_t aset = 0;
-
-		for (dp = nc_dev_states; dp->ncd_str != NULL; dp++) {
-			if (nvlist_lookup_boolean_value(sp,
-			    dp->ncd_str, &b) == 0 && b)
-				aset |= dp->ncd_i;
-		}
-		if ((err = ct_dev_tmpl_set_aset(fd, aset)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property aset: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_string((nvlist_t *)lp, "dev_minor", &s) == 0) {
-		if ((err = ct_dev_tmpl_set_minor(fd, s)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property minor: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_boolean_value((nvlist_t *)lp, "dev_noneg", &b) == 0) {
-		if (b)
-			err = ct_dev_tmpl_set_noneg(fd);
-		else
-			err = ct_dev_tmpl_clear_noneg(fd);
-		if (err != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set/clear template property noneg: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	return (0);
-}
-
-static int
-nc_generic_tmpl_setprop(int fd, const nvlist_t *lp, const nc_typedesc_t *ntp)
-{
-	char *s;
-	boolean_t b;
-	nvlist_t *sp;
-	int err;
-	const nc_descr_t *dp;
-
-	if (nvlist_lookup_nvlist((nvlist_t *)lp, "critical", &sp) == 0) {
-		uint_t evset = 0;
-
-		for (dp = ntp->nct_events; dp->ncd_str != NULL; dp++) {
-			if (nvlist_lookup_boolean_value(sp,
-			    dp->ncd_str, &b) == 0 && b)
-				evset |= dp->ncd_i;
-		}
-		if ((err = ct_tmpl_set_critical(fd, evset)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property critical: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_nvlist((nvlist_t *)lp, "informative", &sp) == 0) {
-		uint_t evset = 0;
-
-		for (dp = ntp->nct_events; dp->ncd_str != NULL; dp++) {
-			if (nvlist_lookup_boolean_value(sp,
-			    dp->ncd_str, &b) == 0 && b)
-				evset |= dp->ncd_i;
-		}
-		if ((err = ct_tmpl_set_informative(fd, evset)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property informative: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	if (nvlist_lookup_string((nvlist_t *)lp, "cookie", &s) == 0) {
-		uint64_t cv;
-
-		errno = 0;
-		cv = strtoull(s, NULL, 0);
-		if (errno != 0) {
-			(void) v8plus_syserr(errno,
-			    "unable to parse template property cookie: %s",
-			    strerror(errno));
-			return (-1);
-		}
-		if ((err = ct_tmpl_set_cookie(fd, cv)) != 0) {
-			(void) v8plus_syserr(err,
-			    "unable to set template property cookie: %s",
-			    strerror(err));
-			return (-1);
-		}
-	}
-
-	return (0);
-}
-
 static nvlist_t *
 node_contract_set_tmpl(const nvlist_t *ap)
 {
+	contract_mgr_t *mp = nc_mgr();
 	const nc_typedesc_t *ntp;
+	const nc_tmpl_t *tp;
 	nvlist_t *params;
 	char *typename;
-	char buf[MAXPATHLEN];
 	int err;
 
 	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
@@ -604,70 +590,19 @@ node_contract_set_tmpl(const nvlist_t *ap)
 		    "contract type '%s' is unknown", typename));
 	}
 
-	if (mgr.cm_tmpl_fd >= 0) {
-		(void) ct_tmpl_clear(mgr.cm_tmpl_fd);
-		(void) close(mgr.cm_tmpl_fd);
-	}
-
-	mgr.cm_tmpl_fd = open(CTFS_ROOT "/process/template", O_RDWR);
-	if (mgr.cm_tmpl_fd < 0) {
-		return (v8plus_syserr(errno, "unable to open %s: %s",
-		    CTFS_ROOT "/process/template", strerror(errno)));
-	}
-	if (close_on_exec(mgr.cm_tmpl_fd) != 0) {
-		(void) close(mgr.cm_tmpl_fd);
-		mgr.cm_tmpl_fd = -1;
+	if ((tp = nc_tmpl_get(mp, ntp, params)) == NULL)
 		return (NULL);
-	}
 
-	if (nc_generic_tmpl_setprop(mgr.cm_tmpl_fd, params, ntp) != 0) {
-		(void) close(mgr.cm_tmpl_fd);
-		mgr.cm_tmpl_fd = -1;
-		return (NULL);
+	if ((err = nc_pbundle_start(mp, ntp)) != 0) {
+		return (v8plus_syserr(err,
+		    "unable to open contract pbundle event handle: %s",
+		    strerror(err)));
 	}
 
-	if (ntp->nct_tmpl_setprop(mgr.cm_tmpl_fd, params) != 0) {
-		(void) close(mgr.cm_tmpl_fd);
-		mgr.cm_tmpl_fd = -1;
+	if (nc_tmpl_activate(mp, tp) != 0)
 		return (NULL);
-	}
-
-	if (mgr.cm_ev_fds[ntp->nct_type] < 0) {
-		(void) snprintf(buf, sizeof (buf), "%s/pbundle", ntp->nct_root);
-		if ((mgr.cm_ev_fds[ntp->nct_type] =
-		    open(buf, O_RDONLY | O_NONBLOCK)) < 0) {
-			err = errno;
-			(void) close(mgr.cm_tmpl_fd);
-			mgr.cm_tmpl_fd = -1;
-			return (v8plus_syserr(err,
-			    "unable to open contract pbundle event handle: %s",
-			    strerror(err)));
-		}
-		if (close_on_exec(mgr.cm_ev_fds[ntp->nct_type]) != 0) {
-			(void) close(mgr.cm_ev_fds[ntp->nct_type]);
-			mgr.cm_ev_fds[ntp->nct_type] = -1;
-			(void) close(mgr.cm_tmpl_fd);
-			mgr.cm_tmpl_fd = -1;
-			return (NULL);
-		}
-
-		(void) uv_poll_init(uv_default_loop(),
-		    &mgr.cm_uv_poll[ntp->nct_type],
-		    mgr.cm_ev_fds[ntp->nct_type]);
-		mgr.cm_uv_poll[ntp->nct_type].data =
-		    (void *)(uintptr_t)mgr.cm_ev_fds[ntp->nct_type];
-		(void) uv_poll_start(&mgr.cm_uv_poll[ntp->nct_type],
-		    UV_READABLE, node_contract_event_cb);
-	}
-
-	if ((err = ct_tmpl_activate(mgr.cm_tmpl_fd)) != 0) {
-		(void) close(mgr.cm_tmpl_fd);
-		mgr.cm_tmpl_fd = -1;
-		return (v8plus_syserr(err, "unable to activate template: %s",
-		    strerror(err)));
-	}
 
-	mgr.cm_last_type = ntp;
+	mp->cm_last_type = ntp;
 
 	return (v8plus_void());
 }
@@ -675,35 +610,31 @@ node_contract_set_tmpl(const nvlist_t *ap)
 static nvlist_t *
 node_contract_clear_tmpl(const nvlist_t *ap __UNUSED)
 {
+	contract_mgr_t *mp = nc_mgr();
 	int err;
 
-	if (mgr.cm_tmpl_fd < 0)
-		return (v8plus_void());
-
-	if ((err = ct_tmpl_clear(mgr.cm_tmpl_fd)) != 0) {
+	if ((err = nc_tmpl_clear(mp)) != 0) {
 		return (v8plus_syserr(err,
 		    "unable to clear active template: %s", strerror(err)));
 	}
 
-	(void) close(mgr.cm_tmpl_fd);
-	mgr.cm_tmpl_fd = -1;
-
 	return (v8plus_void());
 }
 
 static nvlist_t *
 node_contract_create(const nvlist_t *ap __UNUSED)
 {
+	contract_mgr_t *mp = nc_mgr();
 	int err;
 	ctid_t ctid;
 
-	if (mgr.cm_tmpl_fd < 0) {
+	if (mp->cm_tmpl_fd < 0) {
 		return (v8plus_throw_exception("Error",
 		    "no contract template has been activated",
 		    V8PLUS_TYPE_NONE));
 	}
 
-	if ((err = ct_tmpl_create(mgr.cm_tmpl_fd, &ctid)) != 0) {
+	if ((err = ct_tmpl_create(mp->cm_tmpl_fd, &ctid)) != 0) {
 		return (v8plus_syserr(err, "unable to create contract: %s",
 		    strerror(err)));
 	}
@@ -727,10 +658,12 @@ node_contract_abandon(void *op, const nvlist_t *ap __UNUSED)
 		    V8PLUS_TYPE_NONE));
 	}
 
-	if ((err = ct_ctl_abandon(cp->nc_ctl_fd)) != 0) {
+	if ((err = nc_life_check(cp, NLO_CTL)) != 0 ||
+	    (err = ct_ctl_abandon(cp->nc_ctl_fd)) != 0) {
 		return (v8plus_syserr(err, "failed to abandon contract: %s",
 		    strerror(err)));
 	}
+	nc_life_abandoned(cp);
 
 	return (v8plus_void());
 }
@@ -774,6 +707,11 @@ node_contract_ack_common(void *op, const nvlist_t *ap, nc_ack_t ack)
 		    V8PLUS_TYPE_NONE));
 	}
 
+	if ((err = nc_life_check(cp, NLO_CTL)) != 0) {
+		return (v8plus_syserr(err, "failed to ack event '%lld': %s",
+		    (unsigned long long)evid, strerror(err)));
+	}
+
 	switch (ack) {
 	case NCA_ACK:
 		err = ct_ctl_ack(cp->nc_ctl_fd, evid);
@@ -793,6 +731,15 @@ node_contract_ack_common(void *op, const nvlist_t *ap, nc_ack_t ack)
 		    (unsigned long long)evid, strerror(err)));
 	}
 
+	/*
+	 * A quantum ack only buys time; the event still awaits an answer.
+	 */
+	if (ack != NCA_QACK) {
+		nc_journal_acked(cp->nc_mgr, evid);
+		nc_metrics_answered(cp->nc_mgr, evid);
+	}
+	nc_deadline_answered(cp, evid, ack != NCA_QACK);
+
 	return (v8plus_void());
 }
 
@@ -820,6 +767,7 @@ node_contract_sigsend(void *op, const nvlist_t *ap)
 	node_contract_t *cp = op;
 	double dsigno;
 	char errbuf[64];
+	int err;
 
 	if (cp->nc_type->nct_type != NCT_PROCESS)
 		return (v8plus_error(V8PLUSERR_BADARG,
@@ -829,6 +777,16 @@ node_contract_sigsend(void *op, const nvlist_t *ap)
 	    V8PLUS_TYPE_NUMBER, &dsigno, V8PLUS_TYPE_NONE) != 0)
 		return (NULL);
 
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
+	if ((err = nc_life_check(cp, NLO_SIGNAL)) != 0) {
+		return (v8plus_throw_errno_exception(err, "sigsend", NULL,
+		    NULL, V8PLUS_TYPE_NONE));
+	}
+
 	if (sigsend(P_CTID, cp->nc_id, (int)dsigno) != 0) {
 		(void) snprintf(errbuf, sizeof (errbuf),
 		    "sigsend: %s", strerror(errno));
@@ -839,43 +797,219 @@ node_contract_sigsend(void *op, const nvlist_t *ap)
 	return (v8plus_void());
 }
 
-#define	VP(_n, _t, _v) \
-	V8PLUS_TYPE_##_t, #_n, (_v)
-
-static int
-nc_pr_status_add_to_nvlist(nvlist_t *lp, ct_stathdl_t st)
+/*
+ * Signal this contract and the contracts it has inherited, recursively, and
+ * call back once they are all empty.  See terminate.c.
+ */
+static nvlist_t *
+node_contract_terminate_tree(void *op, const nvlist_t *ap)
 {
-	const nc_typedesc_t *ntp = &nc_types[NCT_PROCESS];
-	nvlist_t *sp;
-	const nc_descr_t *dp;
-	uint_t param;
-	uint_t fatal;
-	pid_t *pids;
-	uint_t npids = 0;
-	ctid_t *cts;
-	uint_t ncts = 0;
-	char *fmri = NULL;
-	char *aux = NULL;
-	ctid_t svc_ctid = 0;
-	char *creator = NULL;
-	uint_t i;
-	char buf[32];
+	node_contract_t *cp = op;
+	nvlist_t *lp;
+	v8plus_jsfunc_t cb;
+	double signo = SIGTERM, killsig = SIGKILL;
+	double escalate = 0, timeout = 0;
+	char *order = "topDown";
+	boolean_t bottomup;
 	int err;
 
-	VERIFY(ct_pr_status_get_param(st, &param) == 0);
-	VERIFY(ct_pr_status_get_fatal(st, &fatal) == 0);
-	(void) ct_pr_status_get_members(st, &pids, &npids);
-	(void) ct_pr_status_get_contracts(st, &cts, &ncts);
-	(void) ct_pr_status_get_svc_fmri(st, &fmri);
-	(void) ct_pr_status_get_svc_aux(st, &aux);
-	(void) ct_pr_status_get_svc_ctid(st, &svc_ctid);
-	(void) ct_pr_status_get_svc_creator(st, &creator);
+	if (cp->nc_type->nct_type != NCT_PROCESS)
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "not a process contract"));
 
-	if ((sp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
-		return (-1);
-	for (dp = nc_pr_params; dp->ncd_str != NULL; dp++) {
-		if (v8plus_obj_setprops(sp,
-		    V8PLUS_TYPE_BOOLEAN, dp->ncd_str,
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp,
+	    V8PLUS_TYPE_JSFUNC, &cb,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
+	(void) nvlist_lookup_double(lp, "signal", &signo);
+	(void) nvlist_lookup_double(lp, "killSignal", &killsig);
+	(void) nvlist_lookup_double(lp, "escalateAfterMs", &escalate);
+	(void) nvlist_lookup_double(lp, "timeoutMs", &timeout);
+	(void) nvlist_lookup_string(lp, "order", &order);
+
+	if (strcmp(order, "topDown") == 0) {
+		bottomup = B_FALSE;
+	} else if (strcmp(order, "bottomUp") == 0) {
+		bottomup = B_TRUE;
+	} else {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "order must be 'topDown' or 'bottomUp'"));
+	}
+
+	if (escalate < 0 || timeout < 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "escalateAfterMs and timeoutMs must be nonnegative"));
+	}
+
+	if ((err = nc_terminate_tree(cp, (int)signo, (int)killsig, bottomup,
+	    (uint64_t)escalate, (uint64_t)timeout, cb)) != 0) {
+		return (v8plus_syserr(err, "unable to terminate contract %d: "
+		    "%s", (int)cp->nc_id, strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+/*
+ * Signal many process contracts at once, off the event loop.  The ctids are
+ * passed as an array; opts may specify staggerMs (a fixed delay between
+ * signals) and rate (a maximum number of signals per second), the stricter
+ * of which applies.  The callback receives per-ctid results.
+ */
+static nvlist_t *
+node_contract_sigsend_many(const nvlist_t *ap)
+{
+	nvlist_t *lp, *op;
+	nvpair_t *pp;
+	v8plus_jsfunc_t cb;
+	double dsigno, d;
+	double stagger = 0, rate = 0;
+	uint64_t interval;
+	ctid_t *ctids;
+	uint_t n, i;
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp,
+	    V8PLUS_TYPE_NUMBER, &dsigno,
+	    V8PLUS_TYPE_OBJECT, &op,
+	    V8PLUS_TYPE_JSFUNC, &cb,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	(void) nvlist_lookup_double(op, "staggerMs", &stagger);
+	(void) nvlist_lookup_double(op, "rate", &rate);
+	if (stagger < 0 || rate < 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "staggerMs and rate must be nonnegative"));
+	}
+
+	interval = (uint64_t)(stagger * 1000);
+	if (rate > 0 && (uint64_t)(1000000 / rate) > interval)
+		interval = (uint64_t)(1000000 / rate);
+
+	for (n = 0, pp = nvlist_next_nvpair(lp, NULL); pp != NULL;
+	    pp = nvlist_next_nvpair(lp, pp))
+		++n;
+
+	if ((ctids = calloc(n == 0 ? 1 : n, sizeof (ctid_t))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, NULL));
+
+	/*
+	 * Array members arrive keyed by index, but not necessarily in order.
+	 */
+	for (pp = nvlist_next_nvpair(lp, NULL); pp != NULL;
+	    pp = nvlist_next_nvpair(lp, pp)) {
+		i = (uint_t)strtoul(nvpair_name(pp), NULL, 10);
+		if (i >= n || nvpair_value_double(pp, &d) != 0 || d <= 0) {
+			free(ctids);
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "ctids must be an array of contract ids"));
+		}
+		ctids[i] = (ctid_t)d;
+	}
+
+	if ((err = nc_sigsend_many(nc_mgr(), ctids, n, (int)dsigno,
+	    interval, cb)) != 0) {
+		free(ctids);
+		return (v8plus_syserr(err, "unable to signal contracts: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+typedef struct nc_heldlist {
+	nvlist_t *nhl_list;
+	uint_t nhl_count;
+	int nhl_err;
+} nc_heldlist_t;
+
+static void
+nc_held_one(node_contract_t *cp, void *arg)
+{
+	nc_heldlist_t *hp = arg;
+	char key[16];
+
+	if (hp->nhl_err != 0 || cp->nc_type->nct_type != NCT_PROCESS)
+		return;
+
+	(void) snprintf(key, sizeof (key), "%u", hp->nhl_count++);
+	hp->nhl_err = v8plus_obj_setprops(hp->nhl_list,
+	    V8PLUS_TYPE_NUMBER, key, (double)cp->nc_id,
+	    V8PLUS_TYPE_NONE);
+}
+
+/*
+ * Return the ids of all held process contracts.
+ */
+static nvlist_t *
+node_contract_held(const nvlist_t *ap __UNUSED)
+{
+	nc_heldlist_t hl;
+	nvlist_t *rp;
+
+	bzero(&hl, sizeof (hl));
+	if ((hl.nhl_list = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	nc_walk(nc_mgr(), nc_held_one, &hl);
+	if (hl.nhl_err != 0) {
+		nvlist_free(hl.nhl_list);
+		return (NULL);
+	}
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", hl.nhl_list,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(hl.nhl_list);
+
+	return (rp);
+}
+
+#define	VP(_n, _t, _v) \
+	V8PLUS_TYPE_##_t, #_n, (_v)
+
+static int
+nc_pr_status_add_to_nvlist(nvlist_t *lp, ct_stathdl_t st)
+{
+	const nc_typedesc_t *ntp = &nc_types[NCT_PROCESS];
+	nvlist_t *sp;
+	const nc_descr_t *dp;
+	uint_t param;
+	uint_t fatal;
+	pid_t *pids;
+	uint_t npids = 0;
+	ctid_t *cts;
+	uint_t ncts = 0;
+	char *fmri = NULL;
+	char *aux = NULL;
+	ctid_t svc_ctid = 0;
+	char *creator = NULL;
+	uint_t i;
+	char buf[32];
+	int err;
+
+	VERIFY(ct_pr_status_get_param(st, &param) == 0);
+	VERIFY(ct_pr_status_get_fatal(st, &fatal) == 0);
+	(void) ct_pr_status_get_members(st, &pids, &npids);
+	(void) ct_pr_status_get_contracts(st, &cts, &ncts);
+	(void) ct_pr_status_get_svc_fmri(st, &fmri);
+	(void) ct_pr_status_get_svc_aux(st, &aux);
+	(void) ct_pr_status_get_svc_ctid(st, &svc_ctid);
+	(void) ct_pr_status_get_svc_creator(st, &creator);
+
+	if ((sp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (-1);
+	for (dp = nc_pr_params; dp->ncd_str != NULL; dp++) {
+		if (v8plus_obj_setprops(sp,
+		    V8PLUS_TYPE_BOOLEAN, dp->ncd_str,
 		    (param & dp->ncd_i) != 0,
 		    V8PLUS_TYPE_NONE) != 0) {
 			return (-1);
@@ -1017,7 +1151,7 @@ nc_dev_status_add_to_nvlist(nvlist_t *lp, ct_stathdl_t st)
 	return (0);
 }
 
-static nvlist_t *
+nvlist_t *
 nc_status_to_nvlist(ct_stathdl_t st)
 {
 	const char *typename;
@@ -1128,6 +1262,11 @@ node_contract_status(void *op, const nvlist_t *ap)
 		    "the status method accepts no arguments"));
 	}
 
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
 	if ((err = ct_status_read(cp->nc_st_fd, CTD_ALL, &st)) != 0) {
 		return (v8plus_syserr(err, "unable to read status: %s",
 		    strerror(err)));
@@ -1138,6 +1277,7 @@ node_contract_status(void *op, const nvlist_t *ap)
 		return (v8plus_nverr(err, NULL));
 	}
 
+	nc_life_status(cp, st, CTD_ALL);
 	lp = nc_status_to_nvlist(st);
 	ct_status_free(st);
 
@@ -1158,143 +1298,1889 @@ node_contract_hold(void *op, const nvlist_t *ap __UNUSED)
 {
 	node_contract_t *cp = op;
 
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
 	if (++cp->nc_refcnt == 1) {
 		nc_add(cp);
 		v8plus_obj_hold(cp);
+		cp->nc_flags |= NCF_HELD;
+
+		if (cp->nc_evsrc != NULL)
+			nc_evsrc_start(cp->nc_evsrc, cp);
 	}
 
 	return (v8plus_void());
 }
 
+/*
+ * Releasing a contract that has already been torn down by disposeAll() is
+ * harmless; consumers will still call dispose() on their Contract objects.
+ */
 static nvlist_t *
 node_contract_rele(void *op, const nvlist_t *ap __UNUSED)
 {
 	node_contract_t *cp = op;
 
-	if (--cp->nc_refcnt == 0) {
-		node_contract_shutdown(cp);
-		v8plus_obj_rele(cp);
-	}
+	if (cp->nc_refcnt != 0 && --cp->nc_refcnt == 0)
+		node_contract_shutdown(cp, NULL);
 
-	return (v8plus_void());
+	return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res", (double)cp->nc_refcnt,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_ctid(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res", (double)cp->nc_id,
+	    V8PLUS_TYPE_NONE));
 }
 
 /*
- * libcontract constant lookup tables
+ * Adopt a contract we have so far only observed.  Once we hold it, its
+ * events are delivered to our pbundle, so we drain its own event endpoint
+ * one last time and then stop reading it.  An event posted between that
+ * final drain and the adoption could be seen on both, and so delivered
+ * twice.
  */
-static const nc_descr_t nc_pr_events[] = {
-	{ CT_EV_NEGEND,		"negend" },
-	{ CT_PR_EV_EMPTY,	"pr_empty" },
-	{ CT_PR_EV_FORK,	"pr_fork" },
-	{ CT_PR_EV_EXIT,	"pr_exit" },
-	{ CT_PR_EV_CORE,	"pr_core" },
-	{ CT_PR_EV_SIGNAL,	"pr_signal" },
-	{ CT_PR_EV_HWERR,	"pr_hwerr" },
-	{ 0,			NULL }
-};
+static nvlist_t *
+node_contract_adopt(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	char buf[MAXPATHLEN];
+	uint_t n;
+	int err;
 
-static const nc_descr_t nc_dev_events[] = {
-	{ CT_EV_NEGEND,		"negend" },
-	{ CT_DEV_EV_ONLINE,	"dev_online" },
-	{ CT_DEV_EV_DEGRADED,	"dev_degraded" },
-	{ CT_DEV_EV_OFFLINE,	"dev_offline" },
-	{ 0,			NULL }
-};
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
 
-static const nc_descr_t _nc_pr_params[] = {
-	{ CT_PR_INHERIT,	"inherit" },
-	{ CT_PR_NOORPHAN,	"noorphan" },
-	{ CT_PR_PGRPONLY,	"pgrponly" },
-	{ CT_PR_REGENT,		"regent" },
-	{ 0,			NULL }
-};
-const nc_descr_t *nc_pr_params = _nc_pr_params;
+	if (cp->nc_ctl_fd < 0) {
+		(void) snprintf(buf, sizeof (buf), "%s/%d/ctl",
+		    cp->nc_type->nct_root, (int)cp->nc_id);
+		if ((cp->nc_ctl_fd = open(buf, O_WRONLY)) < 0) {
+			return (v8plus_syserr(errno,
+			    "unable to open contract %d ctl handle: %s",
+			    (int)cp->nc_id, strerror(errno)));
+		}
+		if (close_on_exec(cp->nc_ctl_fd) != 0) {
+			(void) close(cp->nc_ctl_fd);
+			cp->nc_ctl_fd = -1;
+			return (NULL);
+		}
+	}
 
-static const nc_descr_t _nc_dev_states[] = {
-	{ CT_DEV_EV_ONLINE,	"online" },
-	{ CT_DEV_EV_DEGRADED,	"degraded" },
-	{ CT_DEV_EV_OFFLINE,	"offline" },
-	{ 0,			NULL }
-};
-const nc_descr_t *nc_dev_states = _nc_dev_states;
+	if ((err = nc_pbundle_start(cp->nc_mgr, cp->nc_type)) != 0) {
+		return (v8plus_syserr(err,
+		    "unable to open contract pbundle event handle: %s",
+		    strerror(err)));
+	}
 
-static const nc_typedesc_t _nc_types[] = {
-	{
-		nct_type: NCT_PROCESS,
-		nct_name: "process",
-		nct_events: nc_pr_events,
-		nct_root: CTFS_ROOT "/process",
-		nct_status_add_to_nvlist: nc_pr_status_add_to_nvlist,
-		nct_tmpl_setprop: nc_pr_tmpl_setprop
-	},
-	{
-		nct_type: NCT_DEVICE,
-		nct_name: "device",
-		nct_events: nc_dev_events,
-		nct_root: CTFS_ROOT "/device",
-		nct_status_add_to_nvlist: nc_dev_status_add_to_nvlist,
-		nct_tmpl_setprop: nc_dev_tmpl_setprop
-	},
-	{
-		nct_type: NCT_MAX,
-		nct_name: NULL,
-		nct_events: NULL,
-		nct_root: NULL,
-		nct_status_add_to_nvlist: NULL,
-		nct_tmpl_setprop: NULL
+	if ((err = ct_ctl_adopt(cp->nc_ctl_fd)) != 0) {
+		return (v8plus_syserr(err, "unable to adopt contract %d: %s",
+		    (int)cp->nc_id, strerror(err)));
+	}
+	nc_life_adopted(cp);
+
+	if (nc_observing(cp)) {
+		cp->nc_evsrc->nes_wakeup = 0;
+		(void) handle_events(cp->nc_mgr, cp->nc_evsrc, UINT_MAX, &n);
+
+		/*
+		 * A listener may have disposed of the contract.  If not, the
+		 * poll handle's close callback drops this extra hold rather
+		 * than the one taken in _hold().
+		 */
+		if (nc_observing(cp)) {
+			v8plus_obj_hold(cp);
+			(void) close(nc_evsrc_release(cp));
+		}
 	}
-};
-const nc_typedesc_t *nc_types = _nc_types;
 
-static const nc_descr_t _nc_ct_states[] = {
-	{ CTS_OWNED,		"owned" },
-	{ CTS_INHERITED,	"inherited" },
-	{ CTS_ORPHAN,		"orphan" },
-	{ CTS_DEAD,		"dead" },
-	{ 0,			NULL }
-};
-const nc_descr_t *nc_ct_states = _nc_ct_states;
+	return (v8plus_void());
+}
 
-static const nc_descr_t _nc_ev_flags[] = {
-	{ CTE_INFO,		"info" },
-	{ CTE_ACK,		"ack" },
-	{ CTE_NEG,		"neg" },
-	{ 0,			NULL }
-};
-const nc_descr_t *nc_ev_flags = _nc_ev_flags;
+/*
+ * Report the contract's lifecycle as last known; see lifecycle.c.  This
+ * makes no system calls.
+ */
+static nvlist_t *
+node_contract_lifecycle(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_STRING, "state",
+		    nc_descr_strlookup(nc_ct_states, nc_life_state(cp)),
+		V8PLUS_TYPE_BOOLEAN, "empty",
+		    (cp->nc_flags & NCF_EMPTY) != 0,
+		V8PLUS_TYPE_BOOLEAN, "negotiating",
+		    (cp->nc_flags & NCF_NEGOTIATING) != 0,
+		V8PLUS_TYPE_BOOLEAN, "disposed",
+		    (cp->nc_flags & NCF_DISPOSED) != 0,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
 
 /*
- * v8+ boilerplate
+ * Drain the source from which this contract's events are read, then compare
+ * what we have seen against the kernel: a negotiation in progress whose
+ * event we have not received means that event was lost.  Report any loss
+ * and return the number of events counted lost.
  */
-const v8plus_c_ctor_f v8plus_ctor = node_contract_ctor;
-const v8plus_c_dtor_f v8plus_dtor = node_contract_dtor;
-const char *v8plus_js_factory_name = "_new";
-const char *v8plus_js_class_name = "ContractBinding";
-const v8plus_method_descr_t v8plus_methods[] = {
-	{
-		md_name: "_abandon",
-		md_c_func: node_contract_abandon
-	},
-	{
-		md_name: "_ack",
-		md_c_func: node_contract_ack
-	},
-	{
-		md_name: "_rele",
-		md_c_func: node_contract_rele
-	},
-	{
-		md_name: "_hold",
-		md_c_func: node_contract_hold
-	},
-	{
-		md_name: "_nack",
-		md_c_func: node_contract_nack
-	},
+static nvlist_t *
+node_contract_check_loss(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	contract_mgr_t *mp = cp->nc_mgr;
+	nc_evsrc_t *sp;
+	ct_stathdl_t st;
+	ctevid_t nevid;
+	uint_t lost, n;
+	int err;
+
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
+	sp = nc_observing(cp) ? cp->nc_evsrc :
+	    &mp->cm_pbundle[cp->nc_type->nct_type];
+	if (nc_evsrc_started(sp)) {
+		sp->nes_wakeup = 0;
+		(void) handle_events(mp, sp, UINT_MAX, &n);
+		if (cp->nc_flags & NCF_DISPOSED)
+			return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res", 0.0,
+			    V8PLUS_TYPE_NONE));
+	}
+
+	if ((err = ct_status_read(cp->nc_st_fd, CTD_COMMON, &st)) != 0) {
+		return (v8plus_syserr(err, "unable to read status: %s",
+		    strerror(err)));
+	}
+	nevid = ct_status_get_nevid(st);
+	ct_status_free(st);
+
+	/*
+	 * We remember which negotiation event we counted lost so as to count
+	 * it only once, but not as seen: should it yet arrive, it must not be
+	 * dropped as a duplicate.
+	 */
+	if (nevid != 0 && nevid > cp->nc_last_evid &&
+	    nevid != cp->nc_lost_nevid) {
+		cp->nc_lost_nevid = nevid;
+		++cp->nc_lost;
+		++mp->cm_ev_lost;
+	}
+
+	lost = cp->nc_lost;
+	if ((err = nc_loss_report(cp)) != 0) {
+		return (v8plus_syserr(err, "unable to report lost events: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res", (double)lost,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_resync_on_loss(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	boolean_t b;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_BOOLEAN, &b,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (b)
+		cp->nc_flags |= NCF_RESYNC;
+	else
+		cp->nc_flags &= ~NCF_RESYNC;
+
+	return (v8plus_void());
+}
+
+/*
+ * Group operations.  Each takes the kind of group ("svc_fmri", "svc_ctid"
+ * or "cookie") and its key as its first two arguments, and visits only the
+ * group's members; see contracts.c.
+ */
+typedef struct nc_groupop {
+	nvlist_t *ngo_list;
+	uint_t ngo_count;
+	uint_t ngo_ok;
+	uint_t ngo_failed;
+	int ngo_signo;
+	int ngo_err;
+} nc_groupop_t;
+
+static int
+nc_group_resolve(const char *kname, const char *key, nc_gkind_t *kindp,
+    nc_group_t **gpp)
+{
+	uint_t i;
+
+	for (i = 0; i < NGK_MAX; i++) {
+		if (strcmp(nc_gkind_names[i], kname) == 0)
+			break;
+	}
+	if (i == NGK_MAX) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "group kind must be svc_fmri, svc_ctid or cookie");
+		return (-1);
+	}
+	*kindp = (nc_gkind_t)i;
+
+	if (key != NULL && nc_group_lookup(nc_mgr(), *kindp, key, gpp) != 0) {
+		(void) v8plus_error(V8PLUSERR_BADARG,
+		    "%s must be a decimal integer", kname);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static nvlist_t *
+nc_groupop_list_result(nc_groupop_t *op)
+{
+	nvlist_t *rp;
+
+	if (op->ngo_err != 0) {
+		nvlist_free(op->ngo_list);
+		return (v8plus_error(V8PLUSERR_NOMEM, NULL));
+	}
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", op->ngo_list,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(op->ngo_list);
+
+	return (rp);
+}
+
+static void
+nc_group_ctid_one(node_contract_t *cp, void *arg)
+{
+	nc_groupop_t *op = arg;
+	char key[16];
+
+	if (op->ngo_err != 0)
+		return;
+
+	(void) snprintf(key, sizeof (key), "%u", op->ngo_count++);
+	op->ngo_err = v8plus_obj_setprops(op->ngo_list,
+	    V8PLUS_TYPE_NUMBER, key, (double)cp->nc_id,
+	    V8PLUS_TYPE_NONE);
+}
+
+static nvlist_t *
+node_contract_group_ctids(const nvlist_t *ap)
+{
+	nc_groupop_t go;
+	nc_gkind_t kind;
+	nc_group_t *gp;
+	char *kname, *key;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_STRING, &key,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, key, &kind, &gp) != 0)
+		return (NULL);
+
+	bzero(&go, sizeof (go));
+	if ((go.ngo_list = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	nc_group_walk(gp, nc_group_ctid_one, &go);
+
+	return (nc_groupop_list_result(&go));
+}
+
+static nvlist_t *
+node_contract_group_count(const nvlist_t *ap)
+{
+	nc_gkind_t kind;
+	nc_group_t *gp;
+	char *kname, *key;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_STRING, &key,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, key, &kind, &gp) != 0)
+		return (NULL);
+
+	return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res",
+	    (double)nc_group_count(gp), V8PLUS_TYPE_NONE));
+}
+
+/*
+ * Members whose status can no longer be read (because the contract has
+ * since been removed, say) are left out.
+ */
+static void
+nc_group_status_one(node_contract_t *cp, void *arg)
+{
+	nc_groupop_t *op = arg;
+	ct_stathdl_t st;
+	nvlist_t *lp;
+	char key[16];
+
+	if (op->ngo_err != 0)
+		return;
+
+	if (ct_status_read(cp->nc_st_fd, CTD_ALL, &st) != 0) {
+		++op->ngo_failed;
+		return;
+	}
+	lp = nc_status_to_nvlist(st);
+	ct_status_free(st);
+	if (lp == NULL) {
+		op->ngo_err = ENOMEM;
+		return;
+	}
+
+	(void) snprintf(key, sizeof (key), "%u", op->ngo_count++);
+	op->ngo_err = v8plus_obj_setprops(op->ngo_list,
+	    V8PLUS_TYPE_OBJECT, key, lp,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+}
+
+static nvlist_t *
+node_contract_group_status(const nvlist_t *ap)
+{
+	nc_groupop_t go;
+	nc_gkind_t kind;
+	nc_group_t *gp;
+	char *kname, *key;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_STRING, &key,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, key, &kind, &gp) != 0)
+		return (NULL);
+
+	bzero(&go, sizeof (go));
+	if ((go.ngo_list = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	nc_group_walk(gp, nc_group_status_one, &go);
+
+	return (nc_groupop_list_result(&go));
+}
+
+static void
+nc_group_sigsend_one(node_contract_t *cp, void *arg)
+{
+	nc_groupop_t *op = arg;
+	int err;
+
+	if (cp->nc_type->nct_type != NCT_PROCESS)
+		return;
+
+	if ((err = nc_life_check(cp, NLO_SIGNAL)) != 0) {
+		++op->ngo_failed;
+		op->ngo_err = err;
+	} else if (sigsend(P_CTID, cp->nc_id, op->ngo_signo) == 0) {
+		++op->ngo_ok;
+	} else {
+		++op->ngo_failed;
+		op->ngo_err = errno;
+	}
+}
+
+/*
+ * Signal every process contract in the group, synchronously.  For large
+ * groups, or to pace the signals, pass groupCtids() to sigsendMany()
+ * instead.
+ */
+static nvlist_t *
+node_contract_group_sigsend(const nvlist_t *ap)
+{
+	nc_groupop_t go;
+	nc_gkind_t kind;
+	nc_group_t *gp;
+	char *kname, *key;
+	double dsigno;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_STRING, &key,
+	    V8PLUS_TYPE_NUMBER, &dsigno,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, key, &kind, &gp) != 0)
+		return (NULL);
+
+	bzero(&go, sizeof (go));
+	go.ngo_signo = (int)dsigno;
+	nc_group_walk(gp, nc_group_sigsend_one, &go);
+
+	return (v8plus_obj(V8PLUS_TYPE_INL_OBJECT, "res",
+	    V8PLUS_TYPE_NUMBER, "sent", (double)go.ngo_ok,
+	    V8PLUS_TYPE_NUMBER, "failed", (double)go.ngo_failed,
+	    V8PLUS_TYPE_NUMBER, "errno", (double)go.ngo_err,
+	    V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+static void
+nc_group_abandon_one(node_contract_t *cp, void *arg)
+{
+	nc_groupop_t *op = arg;
+	int err;
+
+	if (cp->nc_ctl_fd < 0) {
+		++op->ngo_failed;
+		op->ngo_err = EPERM;
+		return;
+	}
+
+	if ((err = nc_life_check(cp, NLO_CTL)) == 0 &&
+	    (err = ct_ctl_abandon(cp->nc_ctl_fd)) == 0) {
+		++op->ngo_ok;
+		nc_life_abandoned(cp);
+	} else {
+		++op->ngo_failed;
+		op->ngo_err = err;
+	}
+}
+
+/*
+ * Abandon every member of the group.  The contracts remain registered until
+ * disposed of, as with abandon().
+ */
+static nvlist_t *
+node_contract_group_abandon(const nvlist_t *ap)
+{
+	nc_groupop_t go;
+	nc_gkind_t kind;
+	nc_group_t *gp;
+	char *kname, *key;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_STRING, &key,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, key, &kind, &gp) != 0)
+		return (NULL);
+
+	bzero(&go, sizeof (go));
+	nc_group_walk(gp, nc_group_abandon_one, &go);
+
+	return (v8plus_obj(V8PLUS_TYPE_INL_OBJECT, "res",
+	    V8PLUS_TYPE_NUMBER, "abandoned", (double)go.ngo_ok,
+	    V8PLUS_TYPE_NUMBER, "failed", (double)go.ngo_failed,
+	    V8PLUS_TYPE_NUMBER, "errno", (double)go.ngo_err,
+	    V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+static void
+nc_groups_one(nc_group_t *gp, void *arg)
+{
+	nc_groupop_t *op = arg;
+	char key[16], buf[MAXPATHLEN];
+
+	if (op->ngo_err != 0)
+		return;
+
+	nc_group_key(gp, buf, sizeof (buf));
+	(void) snprintf(key, sizeof (key), "%u", op->ngo_count++);
+	op->ngo_err = v8plus_obj_setprops(op->ngo_list,
+	    V8PLUS_TYPE_INL_OBJECT, key,
+	    V8PLUS_TYPE_STRING, "key", buf,
+	    V8PLUS_TYPE_NUMBER, "count", (double)nc_group_count(gp),
+	    V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+}
+
+/*
+ * List the groups of one kind that have members, with their sizes.
+ */
+static nvlist_t *
+node_contract_groups(const nvlist_t *ap)
+{
+	nc_groupop_t go;
+	nc_gkind_t kind;
+	char *kname;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &kname,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (nc_group_resolve(kname, NULL, &kind, NULL) != 0)
+		return (NULL);
+
+	bzero(&go, sizeof (go));
+	if ((go.ngo_list = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	nc_groups_walk(nc_mgr(), kind, nc_groups_one, &go);
+
+	return (nc_groupop_list_result(&go));
+}
+
+/*
+ * Return the id of the most recently created contract of the last type for
+ * which a template was activated, without constructing an object for it.
+ */
+static nvlist_t *
+node_contract_latest_ctid(const nvlist_t *ap __UNUSED)
+{
+	contract_mgr_t *mp = nc_mgr();
+	char spath[MAXPATHLEN];
+	ct_stathdl_t st;
+	ctid_t ctid;
+	int sfd, err;
+
+	if (mp->cm_last_type == NULL) {
+		return (v8plus_throw_exception("Error",
+		    "no contract template has been activated",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	(void) snprintf(spath, sizeof (spath), "%s/latest",
+	    mp->cm_last_type->nct_root);
+	if ((sfd = open(spath, O_RDONLY)) < 0) {
+		return (v8plus_syserr(errno,
+		    "unable to open latest contract: %s", strerror(errno)));
+	}
+
+	err = ct_status_read(sfd, CTD_COMMON, &st);
+	(void) close(sfd);
+	if (err != 0) {
+		return (v8plus_syserr(err,
+		    "unable to obtain contract status: %s", strerror(err)));
+	}
+
+	ctid = ct_status_get_id(st);
+	ct_status_free(st);
+
+	return (v8plus_obj(V8PLUS_TYPE_NUMBER, "res", (double)ctid,
+	    V8PLUS_TYPE_NONE));
+}
+
+static void
+nc_dispose_one(node_contract_t *cp, void *arg)
+{
+	nc_fdbatch_t *bp = arg;
+
+	cp->nc_refcnt = 0;
+	node_contract_shutdown(cp, bp);
+	++bp->nfb_disposed;
+}
+
+static void
+nc_dispose_work(uv_work_t *wp)
+{
+	nc_fdbatch_t *bp = wp->data;
+	uint_t i;
+
+	for (i = 0; i < bp->nfb_count; i++)
+		(void) close(bp->nfb_fds[i]);
+}
+
+static void
+nc_dispose_done(uv_work_t *wp)
+{
+	nc_fdbatch_t *bp = wp->data;
+	nvlist_t *ap, *rp;
+
+	if (bp->nfb_has_cb) {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_NULL, "0",
+		    V8PLUS_TYPE_NUMBER, "1", (double)bp->nfb_disposed,
+		    V8PLUS_TYPE_NONE);
+		if (ap != NULL) {
+			rp = v8plus_call(bp->nfb_cb, ap);
+			nvlist_free(ap);
+			nvlist_free(rp);
+		}
+		v8plus_jsfunc_rele(bp->nfb_cb);
+	}
+
+	free(bp->nfb_fds);
+	free(bp);
+}
+
+/*
+ * Tear down every held contract at once.  Each is removed from the registry
+ * in constant time and its poll handle closed asynchronously; all of their
+ * descriptors are then closed together on a worker thread, after which the
+ * optional callback is invoked with the number of contracts disposed.
+ */
+static nvlist_t *
+node_contract_dispose_all(const nvlist_t *ap)
+{
+	contract_mgr_t *mp = nc_mgr();
+	nc_fdbatch_t *bp;
+	v8plus_jsfunc_t cb;
+	boolean_t has_cb = B_FALSE;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &cb, V8PLUS_TYPE_NONE) == 0)
+		has_cb = B_TRUE;
+	else if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((bp = calloc(1, sizeof (nc_fdbatch_t))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, NULL));
+
+	nc_walk(mp, nc_dispose_one, bp);
+
+	if (has_cb) {
+		v8plus_jsfunc_hold(cb);
+		bp->nfb_cb = cb;
+		bp->nfb_has_cb = B_TRUE;
+	}
+
+	/*
+	 * If the work can't be queued, the contracts are already gone, so we
+	 * close their descriptors here rather than leak them.
+	 */
+	bp->nfb_work.data = bp;
+	if (uv_queue_work(mp->cm_loop, &bp->nfb_work, nc_dispose_work,
+	    nc_dispose_done) != 0) {
+		nc_dispose_work(&bp->nfb_work);
+		if (bp->nfb_has_cb)
+			v8plus_jsfunc_rele(bp->nfb_cb);
+		free(bp->nfb_fds);
+		free(bp);
+		return (v8plus_throw_exception("Error",
+		    "unable to queue descriptor close", V8PLUS_TYPE_NONE));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+nc_members_error(int err)
+{
+	if (err == ENOTSUP) {
+		return (v8plus_throw_exception("Error",
+		    "member tracking requires pr_fork and pr_exit events",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	return (v8plus_syserr(err, "unable to track contract members: %s",
+	    strerror(err)));
+}
+
+static nvlist_t *
+node_contract_members_track(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	double interval;
+	int err;
+
+	if (cp->nc_type->nct_type != NCT_PROCESS)
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "not a process contract"));
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &interval, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (interval < 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "resync interval must be nonnegative"));
+	}
+
+	if ((err = nc_members_init(cp, (uint64_t)interval)) != 0)
+		return (nc_members_error(err));
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_members_untrack(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	nc_members_fini(cp);
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+nc_members_prepare(node_contract_t *cp)
+{
+	int err;
+
+	if (cp->nc_members == NULL) {
+		return (v8plus_throw_exception("Error",
+		    "member tracking is not enabled for this contract",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	if ((err = nc_members_refresh(cp)) != 0)
+		return (nc_members_error(err));
+
+	return (NULL);
+}
+
+static nvlist_t *
+node_contract_members_resync(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	int err;
+
+	if (cp->nc_members == NULL) {
+		return (v8plus_throw_exception("Error",
+		    "member tracking is not enabled for this contract",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	if ((err = nc_members_resync(cp)) != 0)
+		return (nc_members_error(err));
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_members_has(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	nvlist_t *rp;
+	double pid;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &pid, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if ((rp = nc_members_prepare(cp)) != NULL)
+		return (rp);
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_BOOLEAN, "res",
+	    nc_members_has(cp->nc_members, (pid_t)pid),
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_members_count(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	nvlist_t *rp;
+
+	if ((rp = nc_members_prepare(cp)) != NULL)
+		return (rp);
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_NUMBER, "res",
+	    (double)nc_members_count(cp->nc_members),
+	    V8PLUS_TYPE_NONE));
+}
+
+typedef struct nc_members_list_arg {
+	nvlist_t *nmla_lp;
+	uint_t nmla_i;
+} nc_members_list_arg_t;
+
+static int
+nc_members_list_cb(pid_t pid, void *arg)
+{
+	nc_members_list_arg_t *ap = arg;
+	char buf[32];
+
+	(void) snprintf(buf, sizeof (buf), "%u", ap->nmla_i++);
+
+	return (v8plus_obj_setprops(ap->nmla_lp,
+	    V8PLUS_TYPE_NUMBER, buf, (double)pid,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_members_list(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	nc_members_list_arg_t arg;
+	nvlist_t *rp;
+
+	if ((rp = nc_members_prepare(cp)) != NULL)
+		return (rp);
+
+	if ((arg.nmla_lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+	arg.nmla_i = 0;
+
+	if (nc_members_walk(cp->nc_members, nc_members_list_cb, &arg) != 0) {
+		nvlist_free(arg.nmla_lp);
+		return (NULL);
+	}
+
+	rp = v8plus_obj(
+	    V8PLUS_TYPE_OBJECT, "res", arg.nmla_lp,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(arg.nmla_lp);
+
+	return (rp);
+}
+
+static double
+nc_lane_mean_us(const nc_evsrc_stats_t *sp, uint_t lane)
+{
+	if (sp->nes_lane_events[lane] == 0)
+		return (0);
+
+	return ((double)sp->nes_lane_ns[lane] / sp->nes_lane_events[lane] /
+	    1000);
+}
+
+static int
+nc_evsrc_stats_add(nvlist_t *lp, const char *name, const nc_evsrc_stats_t *sp)
+{
+	return (v8plus_obj_setprops(lp,
+	    V8PLUS_TYPE_INL_OBJECT, name,
+		V8PLUS_TYPE_NUMBER, "wakeups", (double)sp->nes_wakeups,
+		V8PLUS_TYPE_NUMBER, "events", (double)sp->nes_events,
+		V8PLUS_TYPE_NUMBER, "exhausted", (double)sp->nes_exhausted,
+		V8PLUS_TYPE_NUMBER, "errors", (double)sp->nes_errors,
+		V8PLUS_TYPE_NUMBER, "reconnects", (double)sp->nes_reconnects,
+		V8PLUS_TYPE_NUMBER, "reconnect_failures",
+		    (double)sp->nes_reconnect_failures,
+		V8PLUS_TYPE_NUMBER, "retry_ms", (double)sp->nes_retry_ms,
+		V8PLUS_TYPE_NUMBER, "max_drain", (double)sp->nes_max_drain,
+		V8PLUS_TYPE_NUMBER, "last_errno", (double)sp->nes_last_errno,
+		V8PLUS_TYPE_NUMBER, "priority", (double)sp->nes_priority,
+		V8PLUS_TYPE_NUMBER, "waits", (double)sp->nes_waits,
+		V8PLUS_TYPE_NUMBER, "wait_mean_us", sp->nes_waits == 0 ? 0 :
+		    (double)sp->nes_wait_ns / sp->nes_waits / 1000,
+		V8PLUS_TYPE_NUMBER, "wait_max_us",
+		    (double)sp->nes_wait_max_ns / 1000,
+		V8PLUS_TYPE_INL_OBJECT, "lanes",
+		    V8PLUS_TYPE_INL_OBJECT, "critical",
+			V8PLUS_TYPE_NUMBER, "events",
+			    (double)sp->nes_lane_events[NC_LANE_CRITICAL],
+			V8PLUS_TYPE_NUMBER, "latency_mean_us",
+			    nc_lane_mean_us(sp, NC_LANE_CRITICAL),
+			V8PLUS_TYPE_NUMBER, "latency_max_us",
+			    (double)sp->nes_lane_max_ns[NC_LANE_CRITICAL] /
+			    1000,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_INL_OBJECT, "informative",
+			V8PLUS_TYPE_NUMBER, "events",
+			    (double)sp->nes_lane_events[NC_LANE_INFO],
+			V8PLUS_TYPE_NUMBER, "latency_mean_us",
+			    nc_lane_mean_us(sp, NC_LANE_INFO),
+			V8PLUS_TYPE_NUMBER, "latency_max_us",
+			    (double)sp->nes_lane_max_ns[NC_LANE_INFO] / 1000,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+/*
+ * Return stats for the source from which this contract's events are read:
+ * its own event endpoint if we are observing it, or else its type's pbundle.
+ */
+static nvlist_t *
+node_contract_evsrc(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	const nc_evsrc_t *sp = cp->nc_evsrc;
+	nvlist_t *lp, *rp;
+
+	if (!nc_observing(cp))
+		sp = &cp->nc_mgr->cm_pbundle[cp->nc_type->nct_type];
+
+	if ((lp = v8plus_obj(
+	    V8PLUS_TYPE_STRING, "kind", nc_evsrc_kind_names[sp->nes_kind],
+	    V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	if (nc_evsrc_stats_add(lp, "stats", &sp->nes_stats) != 0) {
+		nvlist_free(lp);
+		return (NULL);
+	}
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", lp, V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+
+	return (rp);
+}
+
+static nvlist_t *
+node_contract_sample(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	nc_sample_info_t si;
+
+	if (!nc_sample_get(cp, &si)) {
+		return (v8plus_throw_exception("Error",
+		    "event sampling is not enabled", V8PLUS_TYPE_NONE));
+	}
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "rate", si.nsi_rate,
+		V8PLUS_TYPE_NUMBER, "depth", (double)si.nsi_depth,
+		V8PLUS_TYPE_NUMBER, "events", (double)si.nsi_events,
+		V8PLUS_TYPE_BOOLEAN, "over", si.nsi_over,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_watch_status(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	nvlist_t *lp;
+	nvpair_t *pp;
+	v8plus_jsfunc_t cb;
+	double interval;
+	uint_t fields = 0;
+	char *name;
+	int f, err;
+
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp,
+	    V8PLUS_TYPE_NUMBER, &interval,
+	    V8PLUS_TYPE_JSFUNC, &cb,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	for (pp = nvlist_next_nvpair(lp, NULL); pp != NULL;
+	    pp = nvlist_next_nvpair(lp, pp)) {
+		if (nvpair_value_string(pp, &name) != 0) {
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "field names must be strings"));
+		}
+		if ((f = nc_watch_field(cp, name)) < 0) {
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "field '%s' cannot be watched on a %s contract",
+			    name, cp->nc_type->nct_name));
+		}
+		fields |= 1U << f;
+	}
+
+	if (fields == 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "at least one field must be watched"));
+	}
+	if (interval < 1) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "interval must be at least 1 ms"));
+	}
+
+	if ((err = nc_watch_init(cp, fields, (uint64_t)interval, cb)) != 0) {
+		return (v8plus_syserr(err, "unable to watch status: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+/*
+ * Queue events of the named types (all types, if none are named) for the
+ * consumer to pull in batches, rather than emitting them.
+ */
+static nvlist_t *
+node_contract_queue_start(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	const nc_descr_t *dp;
+	nvlist_t *lp;
+	nvpair_t *pp;
+	double max;
+	uint_t types = 0;
+	uint_t ntypes = 0;
+	char *name;
+	int err;
+
+	if (cp->nc_flags & NCF_DISPOSED) {
+		return (v8plus_throw_exception("Error",
+		    "this contract has been disposed", V8PLUS_TYPE_NONE));
+	}
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp,
+	    V8PLUS_TYPE_NUMBER, &max,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	for (pp = nvlist_next_nvpair(lp, NULL); pp != NULL;
+	    pp = nvlist_next_nvpair(lp, pp)) {
+		if (nvpair_value_string(pp, &name) != 0) {
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "event types must be strings"));
+		}
+		for (dp = cp->nc_type->nct_events; dp->ncd_str != NULL; dp++) {
+			if (strcmp(dp->ncd_str, name) == 0)
+				break;
+		}
+		if (dp->ncd_str == NULL) {
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "'%s' is not a %s contract event", name,
+			    cp->nc_type->nct_name));
+		}
+		types |= NC_EVBIT(dp->ncd_i);
+		++ntypes;
+	}
+
+	if (max < 1 || max > UINT_MAX) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "queue limit must be between 1 and %u", UINT_MAX));
+	}
+
+	if ((err = nc_queue_init(cp, ntypes == 0, types, (uint_t)max)) != 0) {
+		return (v8plus_syserr(err, "unable to create event queue: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_queue_next(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	v8plus_jsfunc_t cb;
+	nvlist_t *bp, *rp;
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_JSFUNC, &cb, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (cp->nc_queue == NULL) {
+		return (v8plus_throw_exception("Error",
+		    "events are not being queued for this contract",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	if ((err = nc_queue_next(cp, cb, &bp)) != 0) {
+		return (v8plus_syserr(err, "unable to fetch events: %s",
+		    strerror(err)));
+	}
+
+	if (bp == NULL)
+		return (v8plus_void());
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", bp, V8PLUS_TYPE_NONE);
+	nvlist_free(bp);
+
+	return (rp);
+}
+
+static nvlist_t *
+node_contract_queue_stop(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	nc_queue_fini(cp);
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_unwatch_status(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	nc_watch_fini(cp);
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_deadlines_track(void *op, const nvlist_t *ap)
+{
+	node_contract_t *cp = op;
+	nvlist_t *lp;
+	boolean_t autoqack = B_FALSE;
+	double margin = 0;
+	double timeout = 0;
+	int err;
+
+	if (cp->nc_type->nct_type != NCT_DEVICE)
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "not a device contract"));
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	(void) nvlist_lookup_boolean_value(lp, "autoQack", &autoqack);
+	(void) nvlist_lookup_double(lp, "marginMs", &margin);
+	(void) nvlist_lookup_double(lp, "timeoutMs", &timeout);
+
+	if (margin < 0 || timeout < 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "marginMs and timeoutMs must be nonnegative"));
+	}
+
+	if ((err = nc_deadline_init(cp, autoqack, (uint64_t)margin,
+	    (uint64_t)timeout)) != 0) {
+		return (v8plus_syserr(err, "unable to track deadlines: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_deadlines_untrack(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+
+	nc_deadline_fini(cp);
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_deadlines_stats(void *op, const nvlist_t *ap __UNUSED)
+{
+	node_contract_t *cp = op;
+	nc_deadline_stats_t ds;
+
+	if (!nc_deadline_stats(cp, &ds)) {
+		return (v8plus_throw_exception("Error",
+		    "deadline tracking is not enabled for this contract",
+		    V8PLUS_TYPE_NONE));
+	}
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "tracked", (double)ds.nds_tracked,
+		V8PLUS_TYPE_NUMBER, "pending", (double)ds.nds_pending,
+		V8PLUS_TYPE_NUMBER, "untracked", (double)ds.nds_untracked,
+		V8PLUS_TYPE_NUMBER, "answered", (double)ds.nds_answered,
+		V8PLUS_TYPE_NUMBER, "late", (double)ds.nds_late,
+		V8PLUS_TYPE_NUMBER, "autoqacked", (double)ds.nds_autoqacked,
+		V8PLUS_TYPE_NUMBER, "warned", (double)ds.nds_warned,
+		V8PLUS_TYPE_NUMBER, "expired", (double)ds.nds_expired,
+		V8PLUS_TYPE_NUMBER, "concluded", (double)ds.nds_concluded,
+		V8PLUS_TYPE_NUMBER, "lastSlackMs", ds.nds_last_slack,
+		V8PLUS_TYPE_NUMBER, "minSlackMs", ds.nds_min_slack,
+		V8PLUS_TYPE_NUMBER, "meanSlackMs", ds.nds_answered == 0 ? 0 :
+		    ds.nds_sum_slack / (double)ds.nds_answered,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_journal_open(const nvlist_t *ap)
+{
+	char *path;
+	nvlist_t *op = NULL;
+	double d;
+	uint64_t nrecs = 0;
+	uint_t batch = 0;
+	uint64_t sync_ms = 0;
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &path,
+	    V8PLUS_TYPE_NONE) != 0 &&
+	    v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_STRING, &path,
+	    V8PLUS_TYPE_OBJECT, &op,
+	    V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (op != NULL) {
+		if (nvlist_lookup_double(op, "records", &d) == 0 && d > 0)
+			nrecs = (uint64_t)d;
+		if (nvlist_lookup_double(op, "batch", &d) == 0 && d > 0)
+			batch = (uint_t)d;
+		if (nvlist_lookup_double(op, "syncMs", &d) == 0 && d > 0)
+			sync_ms = (uint64_t)d;
+	}
+
+	if ((err = nc_journal_open(nc_mgr(), path, nrecs, batch,
+	    sync_ms)) != 0) {
+		if (err == EINVAL) {
+			return (v8plus_throw_exception("Error",
+			    "not a valid contract event journal",
+			    V8PLUS_TYPE_STRING, "path", path,
+			    V8PLUS_TYPE_NONE));
+		}
+		return (v8plus_syserr(err, "unable to open journal %s: %s",
+		    path, strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_journal_close(const nvlist_t *ap __UNUSED)
+{
+	nc_journal_close(nc_mgr());
+
+	return (v8plus_void());
+}
+
+typedef struct nc_journal_replay_arg {
+	nvlist_t *njra_lp;
+	uint_t njra_i;
+} nc_journal_replay_arg_t;
+
+static int
+nc_journal_replay_cb(const nc_journal_ev_t *ep, void *arg)
+{
+	nc_journal_replay_arg_t *rap = arg;
+	const nc_descr_t *dp = nc_types[ep->nje_cttype].nct_events;
+	nvlist_t *evp;
+	char buf[32];
+	int err;
+
+	evp = nc_event_to_nvlist(ep->nje_ctid, ep->nje_evid,
+	    nc_descr_strlookup(dp, ep->nje_type), ep->nje_type, ep->nje_flags,
+	    ep->nje_nevid, ep->nje_newct);
+	if (evp == NULL)
+		return (-1);
+
+	if (v8plus_obj_setprops(evp,
+	    V8PLUS_TYPE_BOOLEAN, "delivered", ep->nje_delivered,
+	    V8PLUS_TYPE_BOOLEAN, "previousBoot", ep->nje_prevboot,
+	    V8PLUS_TYPE_NONE) != 0) {
+		nvlist_free(evp);
+		return (-1);
+	}
+
+	(void) snprintf(buf, sizeof (buf), "%u", rap->njra_i++);
+	err = v8plus_obj_setprops(rap->njra_lp,
+	    V8PLUS_TYPE_OBJECT, buf, evp,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(evp);
+
+	return (err);
+}
+
+static nvlist_t *
+node_contract_journal_replay(const nvlist_t *ap __UNUSED)
+{
+	nc_journal_replay_arg_t arg;
+	nvlist_t *rp;
+	int err;
+
+	if ((arg.njra_lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+	arg.njra_i = 0;
+
+	if ((err = nc_journal_replay(nc_mgr(), nc_journal_replay_cb,
+	    &arg)) != 0) {
+		nvlist_free(arg.njra_lp);
+		if (err == ENOENT) {
+			return (v8plus_throw_exception("Error",
+			    "no event journal is open", V8PLUS_TYPE_NONE));
+		}
+		return (NULL);
+	}
+
+	rp = v8plus_obj(
+	    V8PLUS_TYPE_OBJECT, "res", arg.njra_lp,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(arg.njra_lp);
+
+	return (rp);
+}
+
+static nvlist_t *
+node_contract_journal_stats(const nvlist_t *ap __UNUSED)
+{
+	nc_journal_stats_t js;
+
+	if (!nc_journal_stats(nc_mgr(), &js)) {
+		return (v8plus_throw_exception("Error",
+		    "no event journal is open", V8PLUS_TYPE_NONE));
+	}
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "capacity", (double)js.njs_capacity,
+		V8PLUS_TYPE_NUMBER, "used", (double)js.njs_used,
+		V8PLUS_TYPE_NUMBER, "records", (double)js.njs_records,
+		V8PLUS_TYPE_NUMBER, "append_ns", (double)js.njs_append_ns,
+		V8PLUS_TYPE_NUMBER, "syncs", (double)js.njs_syncs,
+		V8PLUS_TYPE_NUMBER, "sync_ns", (double)js.njs_sync_ns,
+		V8PLUS_TYPE_NUMBER, "compactions", (double)js.njs_compactions,
+		V8PLUS_TYPE_NUMBER, "dropped", (double)js.njs_dropped,
+		V8PLUS_TYPE_NUMBER, "duplicates", (double)js.njs_duplicates,
+		V8PLUS_TYPE_NUMBER, "replayed", (double)js.njs_replayed,
+		V8PLUS_TYPE_NUMBER, "previous_boot",
+		    (double)js.njs_prevboot,
+		V8PLUS_TYPE_NUMBER, "grown", (double)js.njs_grown,
+		V8PLUS_TYPE_NUMBER, "refused", (double)js.njs_refused,
+		V8PLUS_TYPE_NUMBER, "relocated", (double)js.njs_relocated,
+		V8PLUS_TYPE_NUMBER, "missing", (double)js.njs_missing,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_sample_start(const nvlist_t *ap)
+{
+	nvlist_t *lp;
+	v8plus_jsfunc_t cb;
+	boolean_t has_cb = B_FALSE;
+	double halflife = 0, rate = 0, depth = 0;
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp,
+	    V8PLUS_TYPE_JSFUNC, &cb,
+	    V8PLUS_TYPE_NONE) == 0)
+		has_cb = B_TRUE;
+	else if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	(void) nvlist_lookup_double(lp, "halfLifeMs", &halflife);
+	(void) nvlist_lookup_double(lp, "rate", &rate);
+	(void) nvlist_lookup_double(lp, "depth", &depth);
+
+	if (halflife < 0 || rate < 0 || depth < 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "halfLifeMs, rate and depth must be nonnegative"));
+	}
+
+	if ((err = nc_sample_start(nc_mgr(), halflife, rate, (uint_t)depth,
+	    has_cb ? &cb : NULL)) != 0) {
+		return (v8plus_syserr(err, "unable to start sampling: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_sample_stop(const nvlist_t *ap __UNUSED)
+{
+	nc_sample_stop(nc_mgr());
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_sample_top(const nvlist_t *ap)
+{
+	nc_sample_info_t *ents;
+	nvlist_t *lp, *rp;
+	double k;
+	char *by = "rate";
+	uint_t n, i;
+	char key[16];
+	int err;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &k,
+	    V8PLUS_TYPE_STRING, &by,
+	    V8PLUS_TYPE_NONE) != 0 &&
+	    v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &k, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (strcmp(by, "rate") != 0 && strcmp(by, "depth") != 0) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "contracts may be ranked only by 'rate' or 'depth'"));
+	}
+
+	if (k < 1 || k > 1024) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "k must be between 1 and 1024"));
+	}
+
+	if ((ents = calloc((uint_t)k, sizeof (*ents))) == NULL)
+		return (v8plus_error(V8PLUSERR_NOMEM, NULL));
+
+	if ((err = nc_sample_topk(nc_mgr(), ents, (uint_t)k,
+	    strcmp(by, "depth") == 0, &n)) != 0) {
+		free(ents);
+		if (err == ENOTSUP) {
+			return (v8plus_throw_exception("Error",
+			    "event sampling is not enabled", V8PLUS_TYPE_NONE));
+		}
+		return (v8plus_syserr(err, "unable to rank contracts: %s",
+		    strerror(err)));
+	}
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL) {
+		free(ents);
+		return (NULL);
+	}
+
+	for (i = 0; i < n; i++) {
+		(void) snprintf(key, sizeof (key), "%u", i);
+		if (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_INL_OBJECT, key,
+			V8PLUS_TYPE_NUMBER, "ctid", (double)ents[i].nsi_ctid,
+			V8PLUS_TYPE_NUMBER, "rate", ents[i].nsi_rate,
+			V8PLUS_TYPE_NUMBER, "depth", (double)ents[i].nsi_depth,
+			V8PLUS_TYPE_NUMBER, "events",
+			    (double)ents[i].nsi_events,
+			V8PLUS_TYPE_NUMBER, "queued",
+			    (double)ents[i].nsi_queued,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE) != 0) {
+			nvlist_free(lp);
+			free(ents);
+			return (NULL);
+		}
+	}
+	free(ents);
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", lp, V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+
+	return (rp);
+}
+
+static void
+nc_evsrc_sum_one(node_contract_t *cp, void *arg)
+{
+	nc_evsrc_stats_t *tp = arg;
+	const nc_evsrc_stats_t *sp;
+	uint_t i;
+
+	if (!nc_observing(cp))
+		return;
+
+	sp = &cp->nc_evsrc->nes_stats;
+
+	tp->nes_wakeups += sp->nes_wakeups;
+	tp->nes_events += sp->nes_events;
+	tp->nes_exhausted += sp->nes_exhausted;
+	tp->nes_errors += sp->nes_errors;
+	tp->nes_reconnects += sp->nes_reconnects;
+	tp->nes_reconnect_failures += sp->nes_reconnect_failures;
+	if (sp->nes_retry_ms > tp->nes_retry_ms)
+		tp->nes_retry_ms = sp->nes_retry_ms;
+	if (sp->nes_max_drain > tp->nes_max_drain)
+		tp->nes_max_drain = sp->nes_max_drain;
+	if (sp->nes_last_errno != 0)
+		tp->nes_last_errno = sp->nes_last_errno;
+	tp->nes_priority += sp->nes_priority;
+	tp->nes_waits += sp->nes_waits;
+	tp->nes_wait_ns += sp->nes_wait_ns;
+	if (sp->nes_wait_max_ns > tp->nes_wait_max_ns)
+		tp->nes_wait_max_ns = sp->nes_wait_max_ns;
+	for (i = 0; i < NC_NLANES; i++) {
+		tp->nes_lane_events[i] += sp->nes_lane_events[i];
+		tp->nes_lane_ns[i] += sp->nes_lane_ns[i];
+		if (sp->nes_lane_max_ns[i] > tp->nes_lane_max_ns[i])
+			tp->nes_lane_max_ns[i] = sp->nes_lane_max_ns[i];
+	}
+}
+
+/*
+ * Return stats for each pbundle source, and the totals over all contract
+ * sources, along with the drain budget for each kind and whether critical
+ * events are given their own lane.
+ */
+static nvlist_t *
+node_contract_evsrc_stats(const nvlist_t *ap __UNUSED)
+{
+	contract_mgr_t *mp = nc_mgr();
+	nc_evsrc_stats_t total;
+	nvlist_t *lp, *rp;
+	uint_t i;
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	for (i = 0; i < NCT_MAX; i++) {
+		if (nc_evsrc_stats_add(lp, nc_types[i].nct_name,
+		    &mp->cm_pbundle[i].nes_stats) != 0) {
+			nvlist_free(lp);
+			return (NULL);
+		}
+	}
+
+	bzero(&total, sizeof (total));
+	nc_walk(mp, nc_evsrc_sum_one, &total);
+
+	if (nc_evsrc_stats_add(lp, "contract", &total) != 0 ||
+	    v8plus_obj_setprops(lp,
+	    V8PLUS_TYPE_INL_OBJECT, "budget",
+		V8PLUS_TYPE_NUMBER, "pbundle",
+		    (double)mp->cm_evsrc_budget[NES_PBUNDLE],
+		V8PLUS_TYPE_NUMBER, "contract",
+		    (double)mp->cm_evsrc_budget[NES_CONTRACT],
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_BOOLEAN, "priority_lane", mp->cm_lanes,
+	    V8PLUS_TYPE_NONE) != 0) {
+		nvlist_free(lp);
+		return (NULL);
+	}
+
+	rp = v8plus_obj(V8PLUS_TYPE_OBJECT, "res", lp, V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+
+	return (rp);
+}
+
+static nvlist_t *
+node_contract_evsrc_config(const nvlist_t *ap)
+{
+	contract_mgr_t *mp = nc_mgr();
+	nvlist_t *lp;
+	double budget[NES_MAX];
+	boolean_t lanes;
+	uint_t i;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_OBJECT, &lp, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	for (i = 0; i < NES_MAX; i++)
+		budget[i] = mp->cm_evsrc_budget[i];
+	lanes = mp->cm_lanes;
+
+	(void) nvlist_lookup_double(lp, "pbundleBudget",
+	    &budget[NES_PBUNDLE]);
+	(void) nvlist_lookup_double(lp, "contractBudget",
+	    &budget[NES_CONTRACT]);
+	(void) nvlist_lookup_boolean_value(lp, "priorityLane", &lanes);
+
+	for (i = 0; i < NES_MAX; i++) {
+		if (budget[i] < 1 || budget[i] > UINT_MAX) {
+			return (v8plus_error(V8PLUSERR_BADARG,
+			    "drain budgets must be positive integers"));
+		}
+	}
+
+	for (i = 0; i < NES_MAX; i++)
+		mp->cm_evsrc_budget[i] = (uint_t)budget[i];
+	mp->cm_lanes = lanes;
+
+	return (v8plus_void());
+}
+
+/*
+ * While recording (see lib/record.js), stamp every event with its wakeup
+ * and read times, whatever the trace sampling interval.
+ */
+static nvlist_t *
+node_contract_record(const nvlist_t *ap)
+{
+	boolean_t on;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_BOOLEAN, &on, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	nc_mgr()->cm_record = on;
+
+	return (v8plus_void());
+}
+
+/*
+ * Stamp one event in every N with wakeup and read times; 0 disables.
+ */
+static nvlist_t *
+node_contract_trace(const nvlist_t *ap)
+{
+	contract_mgr_t *mp = nc_mgr();
+	double every;
+
+	if (v8plus_args(ap, V8PLUS_ARG_F_NOEXTRA,
+	    V8PLUS_TYPE_NUMBER, &every, V8PLUS_TYPE_NONE) != 0)
+		return (NULL);
+
+	if (every < 0 || every > UINT_MAX) {
+		return (v8plus_error(V8PLUSERR_BADARG,
+		    "sampling interval must be between 0 and %u", UINT_MAX));
+	}
+
+	mp->cm_trace_every = (uint_t)every;
+	mp->cm_trace_count = 0;
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_metrics_enable(const nvlist_t *ap __UNUSED)
+{
+	int err;
+
+	if ((err = nc_metrics_enable(nc_mgr())) != 0) {
+		return (v8plus_syserr(err, "unable to enable metrics: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_void());
+}
+
+static nvlist_t *
+node_contract_metrics(const nvlist_t *ap __UNUSED)
+{
+	const char *buf;
+	int err;
+
+	if ((err = nc_metrics_render(nc_mgr(), &buf)) != 0) {
+		return (v8plus_syserr(err, "unable to render metrics: %s",
+		    strerror(err)));
+	}
+
+	return (v8plus_obj(V8PLUS_TYPE_STRING, "res", buf, V8PLUS_TYPE_NONE));
+}
+
+static nvlist_t *
+node_contract_mgr_stats(const nvlist_t *ap __UNUSED)
+{
+	contract_mgr_t *mp = nc_mgr();
+	nc_watch_stats_t ws;
+	nc_tmpl_stats_t ts;
+
+	if (!nc_watch_stats(mp, &ws))
+		bzero(&ws, sizeof (ws));
+	if (!nc_tmpl_stats(mp, &ts))
+		bzero(&ts, sizeof (ts));
+
+	return (v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "res",
+		V8PLUS_TYPE_NUMBER, "contracts", (double)nc_count(mp),
+		V8PLUS_TYPE_NUMBER, "buckets", (double)mp->cm_ctid_nbuckets,
+		V8PLUS_TYPE_NUMBER, "leaked", (double)mp->cm_leaked,
+		V8PLUS_TYPE_NUMBER, "event_failures",
+		    (double)mp->cm_ev_failures,
+		V8PLUS_TYPE_NUMBER, "events_lost", (double)mp->cm_ev_lost,
+		V8PLUS_TYPE_NUMBER, "events_duplicate",
+		    (double)mp->cm_ev_duplicates,
+		V8PLUS_TYPE_NUMBER, "events_unclaimed",
+		    (double)mp->cm_ev_unclaimed,
+		V8PLUS_TYPE_NUMBER, "ops_elided", (double)mp->cm_ops_elided,
+		V8PLUS_TYPE_INL_OBJECT, "memory",
+		    V8PLUS_TYPE_NUMBER, "contract_bytes",
+			(double)sizeof (node_contract_t),
+		    V8PLUS_TYPE_NUMBER, "evsrc_bytes",
+			(double)sizeof (nc_evsrc_t),
+		    V8PLUS_TYPE_NUMBER, "observed", (double)mp->cm_observed,
+		    V8PLUS_TYPE_NUMBER, "native_bytes",
+			(double)(nc_count(mp) * sizeof (node_contract_t) +
+			mp->cm_observed * sizeof (nc_evsrc_t)),
+		    V8PLUS_TYPE_NONE,
+		V8PLUS_TYPE_INL_OBJECT, "status_watch",
+		    V8PLUS_TYPE_NUMBER, "watched", (double)ws.nws_watched,
+		    V8PLUS_TYPE_NUMBER, "ticks", (double)ws.nws_ticks,
+		    V8PLUS_TYPE_NUMBER, "polls", (double)ws.nws_polls,
+		    V8PLUS_TYPE_NUMBER, "changes", (double)ws.nws_changes,
+		    V8PLUS_TYPE_NUMBER, "callbacks", (double)ws.nws_callbacks,
+		    V8PLUS_TYPE_NUMBER, "errors", (double)ws.nws_errors,
+		    V8PLUS_TYPE_NONE,
+		V8PLUS_TYPE_INL_OBJECT, "templates",
+		    V8PLUS_TYPE_NUMBER, "hits", (double)ts.nts_hits,
+		    V8PLUS_TYPE_NUMBER, "misses", (double)ts.nts_misses,
+		    V8PLUS_TYPE_NUMBER, "opens", (double)ts.nts_opens,
+		    V8PLUS_TYPE_NUMBER, "writes", (double)ts.nts_writes,
+		    V8PLUS_TYPE_NUMBER, "skipped", (double)ts.nts_skipped,
+		    V8PLUS_TYPE_NUMBER, "activations",
+			(double)ts.nts_activations,
+		    V8PLUS_TYPE_NONE,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE));
+}
+
+/*
+ * libcontract constant lookup tables
+ */
+static const nc_descr_t nc_pr_events[] = {
+	{ CT_EV_NEGEND,		"negend" },
+	{ CT_PR_EV_EMPTY,	"pr_empty" },
+	{ CT_PR_EV_FORK,	"pr_fork" },
+	{ CT_PR_EV_EXIT,	"pr_exit" },
+	{ CT_PR_EV_CORE,	"pr_core" },
+	{ CT_PR_EV_SIGNAL,	"pr_signal" },
+	{ CT_PR_EV_HWERR,	"pr_hwerr" },
+	{ 0,			NULL }
+};
+
+static const nc_descr_t nc_dev_events[] = {
+	{ CT_EV_NEGEND,		"negend" },
+	{ CT_DEV_EV_ONLINE,	"dev_online" },
+	{ CT_DEV_EV_DEGRADED,	"dev_degraded" },
+	{ CT_DEV_EV_OFFLINE,	"dev_offline" },
+	{ 0,			NULL }
+};
+
+static const nc_descr_t _nc_pr_params[] = {
+	{ CT_PR_INHERIT,	"inherit" },
+	{ CT_PR_NOORPHAN,	"noorphan" },
+	{ CT_PR_PGRPONLY,	"pgrponly" },
+	{ CT_PR_REGENT,		"regent" },
+	{ 0,			NULL }
+};
+const nc_descr_t *nc_pr_params = _nc_pr_params;
+
+static const nc_descr_t _nc_dev_states[] = {
+	{ CT_DEV_EV_ONLINE,	"online" },
+	{ CT_DEV_EV_DEGRADED,	"degraded" },
+	{ CT_DEV_EV_OFFLINE,	"offline" },
+	{ 0,			NULL }
+};
+const nc_descr_t *nc_dev_states = _nc_dev_states;
+
+static const nc_typedesc_t _nc_types[] = {
+	{
+		nct_type: NCT_PROCESS,
+		nct_name: "process",
+		nct_events: nc_pr_events,
+		nct_root: CTFS_ROOT "/process",
+		nct_status_add_to_nvlist: nc_pr_status_add_to_nvlist,
+		nct_tmpl_compile: nc_pr_tmpl_compile
+	},
+	{
+		nct_type: NCT_DEVICE,
+		nct_name: "device",
+		nct_events: nc_dev_events,
+		nct_root: CTFS_ROOT "/device",
+		nct_status_add_to_nvlist: nc_dev_status_add_to_nvlist,
+		nct_tmpl_compile: nc_dev_tmpl_compile
+	},
+	{
+		nct_type: NCT_MAX,
+		nct_name: NULL,
+		nct_events: NULL,
+		nct_root: NULL,
+		nct_status_add_to_nvlist: NULL,
+		nct_tmpl_compile: NULL
+	}
+};
+const nc_typedesc_t *nc_types = _nc_types;
+
+static const nc_descr_t _nc_ct_states[] = {
+	{ CTS_OWNED,		"owned" },
+	{ CTS_INHERITED,	"inherited" },
+	{ CTS_ORPHAN,		"orphan" },
+	{ CTS_DEAD,		"dead" },
+	{ 0,			NULL }
+};
+const nc_descr_t *nc_ct_states = _nc_ct_states;
+
+static const nc_descr_t _nc_ev_flags[] = {
+	{ CTE_INFO,		"info" },
+	{ CTE_ACK,		"ack" },
+	{ CTE_NEG,		"neg" },
+	{ 0,			NULL }
+};
+const nc_descr_t *nc_ev_flags = _nc_ev_flags;
+
+/*
+ * v8+ boilerplate
+ */
+const v8plus_c_ctor_f v8plus_ctor = node_contract_ctor;
+const v8plus_c_dtor_f v8plus_dtor = node_contract_dtor;
+const char *v8plus_js_factory_name = "_new";
+const char *v8plus_js_class_name = "ContractBinding";
+const v8plus_method_descr_t v8plus_methods[] = {
+	{
+		md_name: "_abandon",
+		md_c_func: node_contract_abandon
+	},
+	{
+		md_name: "_ack",
+		md_c_func: node_contract_ack
+	},
+	{
+		md_name: "_rele",
+		md_c_func: node_contract_rele
+	},
+	{
+		md_name: "_deadlines_stats",
+		md_c_func: node_contract_deadlines_stats
+	},
+	{
+		md_name: "_deadlines_track",
+		md_c_func: node_contract_deadlines_track
+	},
+	{
+		md_name: "_deadlines_untrack",
+		md_c_func: node_contract_deadlines_untrack
+	},
+	{
+		md_name: "_adopt",
+		md_c_func: node_contract_adopt
+	},
+	{
+		md_name: "_check_loss",
+		md_c_func: node_contract_check_loss
+	},
+	{
+		md_name: "_ctid",
+		md_c_func: node_contract_ctid
+	},
+	{
+		md_name: "_evsrc_stats",
+		md_c_func: node_contract_evsrc
+	},
+	{
+		md_name: "_hold",
+		md_c_func: node_contract_hold
+	},
+	{
+		md_name: "_lifecycle",
+		md_c_func: node_contract_lifecycle
+	},
+	{
+		md_name: "_members_count",
+		md_c_func: node_contract_members_count
+	},
+	{
+		md_name: "_members_has",
+		md_c_func: node_contract_members_has
+	},
+	{
+		md_name: "_members_list",
+		md_c_func: node_contract_members_list
+	},
+	{
+		md_name: "_members_resync",
+		md_c_func: node_contract_members_resync
+	},
+	{
+		md_name: "_members_track",
+		md_c_func: node_contract_members_track
+	},
+	{
+		md_name: "_members_untrack",
+		md_c_func: node_contract_members_untrack
+	},
+	{
+		md_name: "_nack",
+		md_c_func: node_contract_nack
+	},
 	{
 		md_name: "_qack",
 		md_c_func: node_contract_qack
 	},
+	{
+		md_name: "_resync_on_loss",
+		md_c_func: node_contract_resync_on_loss
+	},
+	{
+		md_name: "_sample",
+		md_c_func: node_contract_sample
+	},
 	{
 		md_name: "_sigsend",
 		md_c_func: node_contract_sigsend
@@ -1302,6 +3188,30 @@ const v8plus_method_descr_t v8plus_methods[] = {
 	{
 		md_name: "_status",
 		md_c_func: node_contract_status
+	},
+	{
+		md_name: "_queue_next",
+		md_c_func: node_contract_queue_next
+	},
+	{
+		md_name: "_queue_start",
+		md_c_func: node_contract_queue_start
+	},
+	{
+		md_name: "_queue_stop",
+		md_c_func: node_contract_queue_stop
+	},
+	{
+		md_name: "_terminate_tree",
+		md_c_func: node_contract_terminate_tree
+	},
+	{
+		md_name: "_unwatch_status",
+		md_c_func: node_contract_unwatch_status
+	},
+	{
+		md_name: "_watch_status",
+		md_c_func: node_contract_watch_status
 	}
 };
 const uint_t v8plus_method_count =
@@ -1319,6 +3229,102 @@ const v8plus_static_descr_t v8plus_static_methods[] = {
 	{
 		sd_name: "_create",
 		sd_c_func: node_contract_create
+	},
+	{
+		sd_name: "_dispose_all",
+		sd_c_func: node_contract_dispose_all
+	},
+	{
+		sd_name: "_evsrc_config",
+		sd_c_func: node_contract_evsrc_config
+	},
+	{
+		sd_name: "_evsrc_stats",
+		sd_c_func: node_contract_evsrc_stats
+	},
+	{
+		sd_name: "_group_abandon",
+		sd_c_func: node_contract_group_abandon
+	},
+	{
+		sd_name: "_group_count",
+		sd_c_func: node_contract_group_count
+	},
+	{
+		sd_name: "_group_ctids",
+		sd_c_func: node_contract_group_ctids
+	},
+	{
+		sd_name: "_group_sigsend",
+		sd_c_func: node_contract_group_sigsend
+	},
+	{
+		sd_name: "_group_status",
+		sd_c_func: node_contract_group_status
+	},
+	{
+		sd_name: "_groups",
+		sd_c_func: node_contract_groups
+	},
+	{
+		sd_name: "_held",
+		sd_c_func: node_contract_held
+	},
+	{
+		sd_name: "_journal_open",
+		sd_c_func: node_contract_journal_open
+	},
+	{
+		sd_name: "_journal_close",
+		sd_c_func: node_contract_journal_close
+	},
+	{
+		sd_name: "_journal_replay",
+		sd_c_func: node_contract_journal_replay
+	},
+	{
+		sd_name: "_journal_stats",
+		sd_c_func: node_contract_journal_stats
+	},
+	{
+		sd_name: "_latest_ctid",
+		sd_c_func: node_contract_latest_ctid
+	},
+	{
+		sd_name: "_metrics",
+		sd_c_func: node_contract_metrics
+	},
+	{
+		sd_name: "_metrics_enable",
+		sd_c_func: node_contract_metrics_enable
+	},
+	{
+		sd_name: "_mgr_stats",
+		sd_c_func: node_contract_mgr_stats
+	},
+	{
+		sd_name: "_record",
+		sd_c_func: node_contract_record
+	},
+	{
+		sd_name: "_sample_start",
+		sd_c_func: node_contract_sample_start
+	},
+	{
+		sd_name: "_sample_stop",
+		sd_c_func: node_contract_sample_stop
+	},
+	{
+		sd_name: "_sample_top",
+		sd_c_func: node_contract_sample_top
+	},
+	{
+		sd_name: "_sigsend_many",
+		sd_c_func: node_contract_sigsend_many
+	},
+	{
+		sd_name: "_trace",
+		sd_c_func: node_contract_trace
 	}
 };
 const uint_t v8plus_static_method_count =
@@ -7,6 +7,7 @@
 #include <libnvpair.h>
 #include <uv.h>
 #include "v8plus_glue.h"
+#include "dlwheel.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -20,38 +21,290 @@ typedef enum nc_type {
 	NCT_MAX
 } nc_type_t;
 
+typedef enum nc_tprop {
+	NTP_CRITICAL,
+	NTP_INFORMATIVE,
+	NTP_COOKIE,
+	NTP_TRANSFER,
+	NTP_FATAL,
+	NTP_PARAM,
+	NTP_SVC_FMRI,
+	NTP_SVC_AUX,
+	NTP_DEV_ASET,
+	NTP_DEV_MINOR,
+	NTP_DEV_NONEG,
+	NTP_MAX
+} nc_tprop_t;
+
+typedef enum nc_gkind {
+	NGK_SVC_FMRI,
+	NGK_SVC_CTID,
+	NGK_COOKIE,
+	NGK_MAX
+} nc_gkind_t;
+
+typedef struct nc_tmpl nc_tmpl_t;
+typedef struct nc_tmplcache nc_tmplcache_t;
+
 typedef struct nc_descr {
 	uint_t ncd_i;
 	const char *ncd_str;
 } nc_descr_t;
 
+/*
+ * Event types are distinct bits, except that negend is 0; NC_EVBIT() gives
+ * every type a bit of its own, for use in masks of event types.
+ */
+#define	NC_EVBIT_NEGEND	0x80000000U
+#define	NC_EVBIT(_t)	((_t) == CT_EV_NEGEND ? NC_EVBIT_NEGEND : (uint_t)(_t))
+
 typedef struct nc_typedesc {
 	nc_type_t nct_type;
 	const char *nct_name;
 	const nc_descr_t *nct_events;
 	const char *nct_root;
 	int (*nct_status_add_to_nvlist)(nvlist_t *, ct_stathdl_t);
-	int (*nct_tmpl_setprop)(int, const nvlist_t *);
+	int (*nct_tmpl_compile)(const nvlist_t *, nc_tmpl_t *);
 } nc_typedesc_t;
 
+typedef struct nc_members nc_members_t;
+typedef struct nc_sampler nc_sampler_t;
+typedef struct nc_watch nc_watch_t;
+typedef struct nc_watcher nc_watcher_t;
+typedef struct nc_metrics nc_metrics_t;
+typedef struct nc_journal nc_journal_t;
+typedef struct nc_queue nc_queue_t;
+typedef struct nc_group nc_group_t;
+typedef struct nc_gmember nc_gmember_t;
+
+typedef struct nc_sample {
+	double ncs_count;	/* decayed event count */
+	uint64_t ncs_last;	/* loop time of the last event */
+	uint64_t ncs_events;	/* events since sampling began */
+	uint64_t ncs_gen;	/* drain generation of ncs_batch */
+	uint_t ncs_batch;	/* events seen in that drain */
+	uint_t ncs_depth;	/* largest batch seen */
+} nc_sample_t;
+
+typedef enum nc_evsrc_kind {
+	NES_PBUNDLE,
+	NES_CONTRACT,
+	NES_MAX
+} nc_evsrc_kind_t;
+
+/*
+ * Within each drain, critical and negotiation events are delivered as soon
+ * as they are read, and informative ones once the drain's reads are done;
+ * see event.c.
+ */
+#define	NC_LANE_CRITICAL	0
+#define	NC_LANE_INFO		1
+#define	NC_NLANES		2
+
+typedef struct nc_deferred {
+	ctid_t nd_ctid;
+	ctevid_t nd_evid;
+	uint_t nd_type;
+	uint_t nd_flags;
+	hrtime_t nd_wakeup;
+	hrtime_t nd_read;
+	int64_t nd_jidx;
+} nc_deferred_t;
+
+typedef struct nc_evsrc_stats {
+	uint64_t nes_wakeups;
+	uint64_t nes_events;
+	uint64_t nes_exhausted;
+	uint64_t nes_errors;
+	uint64_t nes_reconnects;
+	uint_t nes_max_drain;
+	int nes_last_errno;
+	uint64_t nes_waits;
+	uint64_t nes_wait_ns;
+	uint64_t nes_wait_max_ns;
+	uint64_t nes_priority;
+	uint64_t nes_reconnect_failures;
+	uint_t nes_retry_ms;		/* current backoff; 0 if connected */
+	uint64_t nes_lane_events[NC_NLANES];
+	uint64_t nes_lane_ns[NC_NLANES];
+	uint64_t nes_lane_max_ns[NC_NLANES];
+} nc_evsrc_stats_t;
+
+typedef struct nc_evsrc {
+	nc_evsrc_kind_t nes_kind;
+	struct contract_mgr *nes_mgr;
+	int nes_fd;
+	uint_t nes_flags;
+	uv_poll_t nes_poll;
+	uv_timer_t nes_retry;		/* reconnect backoff */
+	uv_close_cb nes_close_cb;
+	void *nes_arg;
+	const nc_typedesc_t *nes_type;
+	ctid_t nes_ctid;
+	nc_evsrc_stats_t nes_stats;
+	hrtime_t nes_wakeup;	/* when last woken */
+	uint_t nes_round;	/* scheduler round last serviced */
+	uint_t nes_critical;	/* critical events read this round */
+	struct nc_evsrc *nes_rnext;	/* ready list */
+	struct nc_evsrc **nes_rprevp;
+} nc_evsrc_t;
+
+#define	NES_NTIERS	2
+
+#define	NCF_HELD	0x1	/* registered and held by JS */
+#define	NCF_SAMPLE_OVER	0x2	/* sampler threshold callback has fired */
+#define	NCF_DISPOSED	0x4	/* resources have been released */
+#define	NCF_LOSS_UNKNOWN 0x8	/* source reconnected; events may be lost */
+#define	NCF_RESYNC	0x10	/* attach status to lost events */
+#define	NCF_EMPTY	0x20	/* known to have no members */
+#define	NCF_NEGOTIATING	0x40	/* negotiation begun, negend not yet seen */
+#define	NCF_STATE_SHIFT	8	/* CTS_* state as last known; see lifecycle.c */
+#define	NCF_STATE_MASK	(0x3 << NCF_STATE_SHIFT)
+
+typedef enum nc_lifeop {
+	NLO_SIGNAL,
+	NLO_CTL		/* abandon, ack, nack, qack */
+} nc_lifeop_t;
+
+/*
+ * We may hold a great many contracts, so this is kept small.  Only contracts
+ * we observe read their own event endpoint; nc_evsrc, with its poll handle,
+ * is allocated for those alone.  Everything else optional hangs off a
+ * pointer that is NULL until the consumer asks for it.
+ */
 typedef struct node_contract {
+	struct contract_mgr *nc_mgr;
 	const nc_typedesc_t *nc_type;
+	nc_evsrc_t *nc_evsrc;
+	struct node_contract *nc_next;
+	struct node_contract **nc_prevp;
 	ctid_t nc_id;
 	int nc_ctl_fd;
 	int nc_st_fd;
-	int nc_ev_fd;
-	uv_poll_t nc_uv_poll;
-	struct node_contract *nc_next;
 	uint_t nc_refcnt;
+	uint_t nc_flags;
+	uint_t nc_lost;			/* lost events not yet reported */
+	ctevid_t nc_last_evid;		/* highest evid accepted */
+	ctevid_t nc_lost_nevid;		/* negotiation counted lost */
+	nc_members_t *nc_members;
+	nc_deadlines_t *nc_deadlines;
+	nc_sample_t nc_sample;
+	nc_watch_t *nc_watch;
+	nc_queue_t *nc_queue;
+	nc_gmember_t *nc_groups;	/* one per key bound */
+	uint_t nc_ngroups;
 } node_contract_t;
 
+#define	NC_MINBUCKETS	64
+
+/*
+ * Everything shared among contracts -- the active template, the pbundle
+ * event sources, the registry of held contracts, the deadline wheel and
+ * our counters -- belongs to a contract manager, which is bound to the event
+ * loop on which it was created.  Nothing outside the manager may assume the
+ * default loop; use cm_loop (or the contract's nc_mgr->cm_loop) instead.
+ */
 typedef struct contract_mgr {
+	uv_loop_t *cm_loop;
 	int cm_tmpl_fd;
 	const nc_typedesc_t *cm_last_type;
-	int cm_ev_fds[NCT_MAX];
-	uv_poll_t cm_uv_poll[NCT_MAX];
+	nc_evsrc_t cm_pbundle[NCT_MAX];
+	uint_t cm_evsrc_budget[NES_MAX];
+	boolean_t cm_lanes;
+	nc_deferred_t *cm_deferred;
+	uint_t cm_ndeferred;
+	uint_t cm_deferred_size;
+	uv_idle_t cm_sched;
+	boolean_t cm_sched_init;
+	uint_t cm_sched_round;
+	nc_evsrc_t *cm_ready[NES_NTIERS];
+	nc_evsrc_t **cm_ready_tailp[NES_NTIERS];
+	node_contract_t *cm_ctid_initial[NC_MINBUCKETS];
+	node_contract_t **cm_ctid_buckets;
+	uint_t cm_ctid_nbuckets;
+	uint_t cm_ctid_count;
+	nc_dlwheel_t *cm_dlwheel;
+	uv_timer_t cm_dltimer;
+	nc_sampler_t *cm_sampler;
+	nc_watcher_t *cm_watcher;
+	nc_metrics_t *cm_metrics;
+	nc_tmplcache_t *cm_tmplcache;
+	nc_journal_t *cm_journal;
+	nc_queue_t *cm_qready;
+	nc_group_t **cm_groups;
+	uint_t cm_groups_nbuckets;
+	uint_t cm_groups_count;
+	uint_t cm_trace_every;
+	uint_t cm_trace_count;
+	boolean_t cm_record;
+	uint_t cm_observed;
+	uint_t cm_leaked;
+	uint64_t cm_ops_elided;
+	uint_t cm_ev_failures;
+	uint64_t cm_ev_lost;
+	uint64_t cm_ev_duplicates;
+	uint64_t cm_ev_unclaimed;
 } contract_mgr_t;
 
+typedef struct nc_journal_ev {
+	ctid_t nje_ctid;
+	nc_type_t nje_cttype;
+	ctevid_t nje_evid;
+	uint_t nje_type;
+	uint_t nje_flags;
+	ctevid_t nje_nevid;
+	ctid_t nje_newct;
+	boolean_t nje_delivered;
+	boolean_t nje_prevboot;
+} nc_journal_ev_t;
+
+typedef struct nc_journal_stats {
+	uint64_t njs_capacity;
+	uint64_t njs_used;
+	uint64_t njs_records;
+	uint64_t njs_append_ns;
+	uint64_t njs_syncs;
+	uint64_t njs_sync_ns;
+	uint64_t njs_compactions;
+	uint64_t njs_dropped;
+	uint64_t njs_duplicates;
+	uint64_t njs_replayed;
+	uint64_t njs_prevboot;
+	uint64_t njs_grown;
+	uint64_t njs_refused;
+	uint64_t njs_relocated;
+	uint64_t njs_missing;
+} nc_journal_stats_t;
+
+#define	NC_JOURNAL_REFUSED	(-2LL)	/* no room; see journal.c */
+
+typedef struct nc_sample_info {
+	ctid_t nsi_ctid;
+	double nsi_rate;
+	uint_t nsi_depth;
+	uint64_t nsi_events;
+	boolean_t nsi_over;
+	int nsi_queued;
+} nc_sample_info_t;
+
+typedef struct nc_tmpl_stats {
+	uint64_t nts_hits;
+	uint64_t nts_misses;
+	uint64_t nts_opens;
+	uint64_t nts_writes;
+	uint64_t nts_skipped;
+	uint64_t nts_activations;
+} nc_tmpl_stats_t;
+
+typedef struct nc_watch_stats {
+	uint64_t nws_watched;
+	uint64_t nws_ticks;
+	uint64_t nws_polls;
+	uint64_t nws_changes;
+	uint64_t nws_callbacks;
+	uint64_t nws_errors;
+} nc_watch_stats_t;
+
 extern const nc_typedesc_t *nc_types;
 extern const nc_descr_t *nc_ct_states;
 extern const nc_descr_t *nc_pr_params;
@@ -60,10 +313,125 @@ extern const nc_descr_t *nc_ev_flags;
 
 extern const char *nc_descr_strlookup(const nc_descr_t *, uint_t);
 extern uint_t nc_descr_ilookup(const nc_descr_t *, const char *);
-extern node_contract_t *nc_lookup(ctid_t);
+extern contract_mgr_t *nc_mgr(void);
+extern node_contract_t *nc_lookup(contract_mgr_t *, ctid_t);
 extern void nc_add(node_contract_t *);
 extern void nc_del(node_contract_t *);
-extern void handle_events(int);
+extern uint_t nc_count(const contract_mgr_t *);
+extern void nc_walk(contract_mgr_t *, void (*)(node_contract_t *, void *),
+    void *);
+
+extern const char *nc_gkind_names[NGK_MAX];
+extern int nc_group_bind(node_contract_t *, ct_stathdl_t);
+extern void nc_group_unbind(node_contract_t *);
+extern int nc_group_lookup(contract_mgr_t *, nc_gkind_t, const char *,
+    nc_group_t **);
+extern uint_t nc_group_count(const nc_group_t *);
+extern void nc_group_key(const nc_group_t *, char *, size_t);
+extern void nc_group_walk(nc_group_t *, void (*)(node_contract_t *, void *),
+    void *);
+extern void nc_groups_walk(contract_mgr_t *, nc_gkind_t,
+    void (*)(nc_group_t *, void *), void *);
+
+extern int handle_events(contract_mgr_t *, nc_evsrc_t *, uint_t, uint_t *);
+extern nvlist_t *nc_event_to_nvlist(ctid_t, ctevid_t, const char *, uint_t,
+    uint_t, ctevid_t, ctid_t);
+extern nvlist_t *nc_status_to_nvlist(ct_stathdl_t);
+extern void nc_loss_source(nc_evsrc_t *);
+extern void nc_evsrc_error(nc_evsrc_t *, int);
+extern int nc_loss_report(node_contract_t *);
+
+extern const uint_t nc_evsrc_default_budget[NES_MAX];
+extern const char *nc_evsrc_kind_names[NES_MAX];
+extern void nc_evsrc_init(nc_evsrc_t *, contract_mgr_t *, nc_evsrc_kind_t,
+    const nc_typedesc_t *, ctid_t);
+extern int nc_evsrc_open(nc_evsrc_t *);
+extern void nc_evsrc_start(nc_evsrc_t *, void *);
+extern boolean_t nc_evsrc_started(const nc_evsrc_t *);
+extern int nc_evsrc_stop(nc_evsrc_t *, uv_close_cb);
+extern void nc_evsrc_poll_cb(uv_poll_t *, int, int);
+extern void nc_evsrc_sched_cb(uv_idle_t *, int);
+
+extern uint_t nc_life_state(const node_contract_t *);
+extern void nc_life_status(node_contract_t *, ct_stathdl_t, int);
+extern void nc_life_event(node_contract_t *, uint_t, uint_t);
+extern void nc_life_adopted(node_contract_t *);
+extern void nc_life_abandoned(node_contract_t *);
+extern int nc_life_check(node_contract_t *, nc_lifeop_t);
+
+extern int nc_members_init(node_contract_t *, uint64_t);
+extern void nc_members_fini(node_contract_t *);
+extern int nc_members_resync(node_contract_t *);
+extern int nc_members_refresh(node_contract_t *);
+extern void nc_members_event(node_contract_t *, ct_evthdl_t, uint_t);
+extern boolean_t nc_members_has(const nc_members_t *, pid_t);
+extern uint_t nc_members_count(const nc_members_t *);
+extern int nc_members_walk(const nc_members_t *, int (*)(pid_t, void *),
+    void *);
+
+extern int nc_deadline_init(node_contract_t *, boolean_t, uint64_t,
+    uint64_t);
+extern void nc_deadline_fini(node_contract_t *);
+extern void nc_deadline_event(node_contract_t *, ctevid_t, uint_t, uint_t,
+    ctevid_t);
+extern void nc_deadline_answered(node_contract_t *, ctevid_t, boolean_t);
+extern boolean_t nc_deadline_stats(const node_contract_t *,
+    nc_deadline_stats_t *);
+
+extern int nc_sample_start(contract_mgr_t *, double, double, uint_t,
+    const v8plus_jsfunc_t *);
+extern void nc_sample_stop(contract_mgr_t *);
+extern void nc_sample_drain(contract_mgr_t *);
+extern void nc_sample_event(node_contract_t *);
+extern boolean_t nc_sample_get(const node_contract_t *, nc_sample_info_t *);
+extern int nc_sample_topk(contract_mgr_t *, nc_sample_info_t *, uint_t,
+    boolean_t, uint_t *);
+
+extern int nc_queue_init(node_contract_t *, boolean_t, uint_t, uint_t);
+extern void nc_queue_fini(node_contract_t *);
+extern boolean_t nc_queue_push(node_contract_t *, ctevid_t, uint_t, uint_t,
+    ctevid_t, ctid_t, int64_t);
+extern int nc_queue_next(node_contract_t *, v8plus_jsfunc_t, nvlist_t **);
+extern void nc_queue_flush(contract_mgr_t *);
+
+extern int nc_pr_tmpl_compile(const nvlist_t *, nc_tmpl_t *);
+extern int nc_dev_tmpl_compile(const nvlist_t *, nc_tmpl_t *);
+extern const nc_tmpl_t *nc_tmpl_get(contract_mgr_t *, const nc_typedesc_t *,
+    const nvlist_t *);
+extern int nc_tmpl_activate(contract_mgr_t *, const nc_tmpl_t *);
+extern int nc_tmpl_clear(contract_mgr_t *);
+extern boolean_t nc_tmpl_stats(const contract_mgr_t *, nc_tmpl_stats_t *);
+
+extern int nc_watch_field(const node_contract_t *, const char *);
+extern int nc_watch_init(node_contract_t *, uint_t, uint64_t,
+    v8plus_jsfunc_t);
+extern void nc_watch_fini(node_contract_t *);
+extern boolean_t nc_watch_stats(const contract_mgr_t *, nc_watch_stats_t *);
+
+extern int nc_metrics_enable(contract_mgr_t *);
+extern void nc_metrics_event(contract_mgr_t *, const node_contract_t *, uint_t,
+    ctevid_t, uint_t);
+extern void nc_metrics_answered(contract_mgr_t *, ctevid_t);
+extern int nc_metrics_render(contract_mgr_t *, const char **);
+
+extern int nc_sigsend_many(contract_mgr_t *, ctid_t *, uint_t, int,
+    uint64_t, v8plus_jsfunc_t);
+
+extern int nc_terminate_tree(node_contract_t *, int, int, boolean_t,
+    uint64_t, uint64_t, v8plus_jsfunc_t);
+
+extern int nc_journal_open(contract_mgr_t *, const char *, uint64_t, uint_t,
+    uint64_t);
+extern void nc_journal_close(contract_mgr_t *);
+extern int64_t nc_journal_append(contract_mgr_t *, ctid_t, nc_type_t, ctevid_t,
+    uint_t, uint_t, ctevid_t, ctid_t);
+extern void nc_journal_delivered(contract_mgr_t *, int64_t, ctevid_t);
+extern void nc_journal_acked(contract_mgr_t *, ctevid_t);
+extern boolean_t nc_journal_seen(contract_mgr_t *, ctevid_t);
+extern int nc_journal_replay(contract_mgr_t *,
+    int (*)(const nc_journal_ev_t *, void *), void *);
+extern boolean_t nc_journal_stats(const contract_mgr_t *,
+    nc_journal_stats_t *);
 
 #ifdef	__cplusplus
 }
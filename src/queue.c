@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Pull-mode event delivery.  A consumer may ask for some or all of a
+ * contract's event types to be queued rather than emitted.  handle_events()
+ * appends each such event to the contract's queue in compact form, without
+ * building any JS object for it.  The consumer asks for events with a
+ * callback; if any are queued, they are handed over at once as a batch,
+ * and otherwise the callback waits until the end of the drain in which
+ * events next arrive, when every waiting queue is given its whole batch in
+ * a single call.  A consumer that stops asking simply lets events queue,
+ * up to the queue's limit; informative events arriving at a full queue are
+ * counted as lost and reported with the next batch.  Critical and
+ * negotiation events await an answer that only the consumer can give, so
+ * they are queued past the limit, the queue growing to hold them.
+ */
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libcontract.h>
+#include "node_contract.h"
+
+typedef struct nc_qent {
+	ctevid_t nqe_evid;
+	uint_t nqe_type;
+	uint_t nqe_flags;
+	ctevid_t nqe_nevid;
+	ctid_t nqe_newct;
+	int64_t nqe_jidx;
+} nc_qent_t;
+
+struct nc_queue {
+	node_contract_t *nq_cp;
+	boolean_t nq_all;		/* queue every type */
+	uint_t nq_types;		/* else these, as NC_EVBIT()s */
+	uint_t nq_max;			/* limit for informative events */
+	uint_t nq_size;			/* entries allocated */
+	nc_qent_t *nq_ents;
+	uint_t nq_head;
+	uint_t nq_count;
+	uint64_t nq_lost;
+	v8plus_jsfunc_t nq_waiter;
+	boolean_t nq_waiting;
+	struct nc_queue *nq_dnext;	/* ready list */
+	struct nc_queue **nq_dprevp;
+};
+
+int
+nc_queue_init(node_contract_t *cp, boolean_t all, uint_t types, uint_t max)
+{
+	nc_queue_t *qp;
+
+	if (max == 0)
+		return (EINVAL);
+
+	if ((qp = calloc(1, sizeof (nc_queue_t))) == NULL)
+		return (ENOMEM);
+	if ((qp->nq_ents = calloc(max, sizeof (nc_qent_t))) == NULL) {
+		free(qp);
+		return (ENOMEM);
+	}
+
+	nc_queue_fini(cp);
+
+	qp->nq_cp = cp;
+	qp->nq_all = all;
+	qp->nq_types = types;
+	qp->nq_max = max;
+	qp->nq_size = max;
+	cp->nc_queue = qp;
+
+	return (0);
+}
+
+static void
+nq_unready(nc_queue_t *qp)
+{
+	if (qp->nq_dprevp == NULL)
+		return;
+
+	*qp->nq_dprevp = qp->nq_dnext;
+	if (qp->nq_dnext != NULL)
+		qp->nq_dnext->nq_dprevp = qp->nq_dprevp;
+	qp->nq_dnext = NULL;
+	qp->nq_dprevp = NULL;
+}
+
+static void
+nq_ready(contract_mgr_t *mp, nc_queue_t *qp)
+{
+	if (qp->nq_dprevp != NULL)
+		return;
+
+	qp->nq_dnext = mp->cm_qready;
+	if (qp->nq_dnext != NULL)
+		qp->nq_dnext->nq_dprevp = &qp->nq_dnext;
+	qp->nq_dprevp = &mp->cm_qready;
+	mp->cm_qready = qp;
+}
+
+/*
+ * Queued events are discarded; the kernel will redeliver any critical
+ * event that was not acknowledged once the contract is next opened.
+ */
+void
+nc_queue_fini(node_contract_t *cp)
+{
+	nc_queue_t *qp = cp->nc_queue;
+
+	if (qp == NULL)
+		return;
+
+	cp->nc_queue = NULL;
+	nq_unready(qp);
+	if (qp->nq_waiting)
+		v8plus_jsfunc_rele(qp->nq_waiter);
+	free(qp->nq_ents);
+	free(qp);
+}
+
+/*
+ * Double the queue's entries, unwrapping them to start at the beginning.
+ */
+static int
+nq_grow(nc_queue_t *qp)
+{
+	nc_qent_t *ents;
+	uint_t i;
+
+	if ((ents = calloc(qp->nq_size * 2, sizeof (nc_qent_t))) == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < qp->nq_count; i++)
+		ents[i] = qp->nq_ents[(qp->nq_head + i) % qp->nq_size];
+
+	free(qp->nq_ents);
+	qp->nq_ents = ents;
+	qp->nq_size *= 2;
+	qp->nq_head = 0;
+
+	return (0);
+}
+
+/*
+ * Queue the event if the consumer wants this type queued.  Returns B_TRUE
+ * if the event was taken (or counted as lost), B_FALSE if it should be
+ * emitted as usual.  An event awaiting an answer is never lost: if the
+ * queue cannot grow to hold it, it is emitted instead.
+ */
+boolean_t
+nc_queue_push(node_contract_t *cp, ctevid_t evid, uint_t evtype, uint_t flags,
+    ctevid_t nevid, ctid_t newct, int64_t jidx)
+{
+	nc_queue_t *qp = cp->nc_queue;
+	nc_qent_t *ep;
+
+	if (!qp->nq_all && !(qp->nq_types & NC_EVBIT(evtype)))
+		return (B_FALSE);
+
+	if (qp->nq_count >= qp->nq_max && !(flags & (CTE_ACK | CTE_NEG))) {
+		++qp->nq_lost;
+		++cp->nc_mgr->cm_ev_lost;
+		return (B_TRUE);
+	}
+
+	if (qp->nq_count == qp->nq_size && nq_grow(qp) != 0)
+		return (B_FALSE);
+
+	ep = &qp->nq_ents[(qp->nq_head + qp->nq_count++) % qp->nq_size];
+	ep->nqe_evid = evid;
+	ep->nqe_type = evtype;
+	ep->nqe_flags = flags;
+	ep->nqe_nevid = nevid;
+	ep->nqe_newct = newct;
+	ep->nqe_jidx = jidx;
+
+	if (qp->nq_waiting)
+		nq_ready(cp->nc_mgr, qp);
+
+	return (B_TRUE);
+}
+
+/*
+ * Empty the queue into a batch object: { events: [...], lost: n }.
+ */
+static nvlist_t *
+nq_batch(nc_queue_t *qp)
+{
+	node_contract_t *cp = qp->nq_cp;
+	const nc_qent_t *ep;
+	nvlist_t *lp, *sap, *rp;
+	char key[16];
+	uint_t i;
+	int err;
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		return (NULL);
+
+	for (i = 0; i < qp->nq_count; i++) {
+		ep = &qp->nq_ents[(qp->nq_head + i) % qp->nq_size];
+		sap = nc_event_to_nvlist(cp->nc_id, ep->nqe_evid,
+		    nc_descr_strlookup(cp->nc_type->nct_events, ep->nqe_type),
+		    ep->nqe_type, ep->nqe_flags, ep->nqe_nevid, ep->nqe_newct);
+		if (sap == NULL) {
+			nvlist_free(lp);
+			return (NULL);
+		}
+
+		(void) snprintf(key, sizeof (key), "%u", i);
+		err = v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_OBJECT, key, sap,
+		    V8PLUS_TYPE_NONE);
+		nvlist_free(sap);
+		if (err != 0) {
+			nvlist_free(lp);
+			return (NULL);
+		}
+	}
+
+	rp = v8plus_obj(
+	    V8PLUS_TYPE_OBJECT, "events", lp,
+	    V8PLUS_TYPE_NUMBER, "lost", (double)qp->nq_lost,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+	if (rp == NULL)
+		return (NULL);
+
+	/*
+	 * Appends since these events were queued may have moved their
+	 * records; the journal finds them again by event id.
+	 */
+	for (i = 0; i < qp->nq_count; i++) {
+		ep = &qp->nq_ents[(qp->nq_head + i) % qp->nq_size];
+		nc_journal_delivered(cp->nc_mgr, ep->nqe_jidx,
+		    ep->nqe_evid);
+	}
+	qp->nq_head = 0;
+	qp->nq_count = 0;
+	qp->nq_lost = 0;
+
+	return (rp);
+}
+
+/*
+ * The consumer wants the next batch.  If events are queued, return the
+ * batch now; otherwise keep the callback and return NULL.
+ */
+int
+nc_queue_next(node_contract_t *cp, v8plus_jsfunc_t cb, nvlist_t **bpp)
+{
+	nc_queue_t *qp = cp->nc_queue;
+
+	*bpp = NULL;
+
+	if (qp->nq_waiting)
+		return (EBUSY);
+
+	if (qp->nq_count != 0 || qp->nq_lost != 0) {
+		if ((*bpp = nq_batch(qp)) == NULL)
+			return (ENOMEM);
+		return (0);
+	}
+
+	v8plus_jsfunc_hold(cb);
+	qp->nq_waiter = cb;
+	qp->nq_waiting = B_TRUE;
+
+	return (0);
+}
+
+/*
+ * Called at the end of each drain: hand each waiting consumer whose queue
+ * received events its batch.  A callback may dispose of any contract,
+ * including its own, so we take each queue off the list before calling.
+ */
+void
+nc_queue_flush(contract_mgr_t *mp)
+{
+	nc_queue_t *qp;
+	v8plus_jsfunc_t cb;
+	nvlist_t *bp, *ap, *rp;
+
+	while ((qp = mp->cm_qready) != NULL) {
+		nq_unready(qp);
+
+		cb = qp->nq_waiter;
+		qp->nq_waiting = B_FALSE;
+
+		if ((bp = nq_batch(qp)) != NULL) {
+			ap = v8plus_obj(
+			    V8PLUS_TYPE_NULL, "0",
+			    V8PLUS_TYPE_OBJECT, "1", bp,
+			    V8PLUS_TYPE_NONE);
+			nvlist_free(bp);
+		} else {
+			/*
+			 * The events remain queued for the consumer's next
+			 * request.
+			 */
+			++mp->cm_ev_failures;
+			ap = v8plus_obj(
+			    V8PLUS_TYPE_INL_OBJECT, "0",
+				V8PLUS_TYPE_STRING, "message",
+				    "unable to fetch events",
+				V8PLUS_TYPE_NONE,
+			    V8PLUS_TYPE_NONE);
+		}
+
+		if (ap != NULL) {
+			rp = v8plus_call(cb, ap);
+			nvlist_free(ap);
+			nvlist_free(rp);
+		} else {
+			++mp->cm_ev_failures;
+		}
+		v8plus_jsfunc_rele(cb);
+	}
+}
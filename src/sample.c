@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Event-rate and queue-depth sampling.  When the consumer enables sampling,
+ * handle_events() notes every event against its contract.  The arrival rate
+ * is an exponentially-decayed event count: on each event we decay the count
+ * by the time elapsed since the last one and add one, so that the cost is
+ * constant per event and contracts that go quiet need no attention at all
+ * (their counts are decayed when read).  The count, scaled by the decay
+ * constant, is an estimate of events per second over roughly the last
+ * half-life.
+ *
+ * Queue depth is approximated without any status reads by the number of
+ * events for the contract we find in a single drain of an event endpoint:
+ * each call to handle_events() starts a new drain generation, and the
+ * per-contract batch count is reset the first time the contract is seen in
+ * each generation.  Only when the consumer asks for the noisiest contracts
+ * do we read the kernel's own queue depth from status, and then only for
+ * those few.
+ *
+ * A contract crossing either threshold fires the consumer's callback once;
+ * it fires again only after both measures have fallen below half their
+ * thresholds.
+ */
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NSM_DEF_HALFLIFE	10000
+#define	NSM_MAX_TOPK		1024
+
+struct nc_sampler {
+	double nsm_halflife;
+	double nsm_rate_thresh;
+	uint_t nsm_depth_thresh;
+	v8plus_jsfunc_t nsm_cb;
+	boolean_t nsm_has_cb;
+	uint64_t nsm_gen;
+};
+
+/*
+ * Return the contract's decayed event count as of now.
+ */
+static double
+nsm_decayed(const nc_sampler_t *sp, const nc_sample_t *ssp, uint64_t now)
+{
+	if (ssp->ncs_count == 0 || now <= ssp->ncs_last)
+		return (ssp->ncs_count);
+
+	return (ssp->ncs_count *
+	    exp2(-(double)(now - ssp->ncs_last) / sp->nsm_halflife));
+}
+
+/*
+ * Events per second corresponding to a decayed count: the count's mean
+ * lifetime is halflife / ln 2 milliseconds.
+ */
+static double
+nsm_rate(const nc_sampler_t *sp, double count)
+{
+	return (count * M_LN2 * 1000 / sp->nsm_halflife);
+}
+
+void
+nc_sample_drain(contract_mgr_t *mp)
+{
+	if (mp->cm_sampler != NULL)
+		++mp->cm_sampler->nsm_gen;
+}
+
+void
+nc_sample_event(node_contract_t *cp)
+{
+	nc_sampler_t *sp = cp->nc_mgr->cm_sampler;
+	nc_sample_t *ssp = &cp->nc_sample;
+	uint64_t now = uv_now(cp->nc_mgr->cm_loop);
+	double rate;
+	nvlist_t *ap, *rp;
+
+	ssp->ncs_count = nsm_decayed(sp, ssp, now) + 1;
+	ssp->ncs_last = now;
+	++ssp->ncs_events;
+
+	if (ssp->ncs_gen != sp->nsm_gen) {
+		ssp->ncs_gen = sp->nsm_gen;
+		ssp->ncs_batch = 0;
+	}
+	if (++ssp->ncs_batch > ssp->ncs_depth)
+		ssp->ncs_depth = ssp->ncs_batch;
+
+	if (!sp->nsm_has_cb)
+		return;
+
+	rate = nsm_rate(sp, ssp->ncs_count);
+	if (cp->nc_flags & NCF_SAMPLE_OVER) {
+		if ((sp->nsm_rate_thresh == 0 ||
+		    rate < sp->nsm_rate_thresh / 2) &&
+		    (sp->nsm_depth_thresh == 0 ||
+		    ssp->ncs_batch < sp->nsm_depth_thresh / 2))
+			cp->nc_flags &= ~NCF_SAMPLE_OVER;
+		return;
+	}
+
+	if ((sp->nsm_rate_thresh == 0 || rate < sp->nsm_rate_thresh) &&
+	    (sp->nsm_depth_thresh == 0 ||
+	    ssp->ncs_batch < sp->nsm_depth_thresh))
+		return;
+
+	cp->nc_flags |= NCF_SAMPLE_OVER;
+
+	ap = v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "0",
+		V8PLUS_TYPE_NUMBER, "ctid", (double)cp->nc_id,
+		V8PLUS_TYPE_NUMBER, "rate", rate,
+		V8PLUS_TYPE_NUMBER, "depth", (double)ssp->ncs_batch,
+		V8PLUS_TYPE_NUMBER, "events", (double)ssp->ncs_events,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	if (ap == NULL)
+		return;
+
+	rp = v8plus_call(sp->nsm_cb, ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+}
+
+int
+nc_sample_start(contract_mgr_t *mp, double halflife, double rate,
+    uint_t depth, const v8plus_jsfunc_t *cbp)
+{
+	nc_sampler_t *sp = mp->cm_sampler;
+
+	if (sp == NULL) {
+		if ((sp = calloc(1, sizeof (nc_sampler_t))) == NULL)
+			return (ENOMEM);
+		mp->cm_sampler = sp;
+	} else if (sp->nsm_has_cb) {
+		v8plus_jsfunc_rele(sp->nsm_cb);
+		sp->nsm_has_cb = B_FALSE;
+	}
+
+	sp->nsm_halflife = halflife > 0 ? halflife : NSM_DEF_HALFLIFE;
+	sp->nsm_rate_thresh = rate;
+	sp->nsm_depth_thresh = depth;
+
+	if (cbp != NULL && (rate > 0 || depth > 0)) {
+		v8plus_jsfunc_hold(*cbp);
+		sp->nsm_cb = *cbp;
+		sp->nsm_has_cb = B_TRUE;
+	}
+
+	return (0);
+}
+
+static void
+nsm_reset_one(node_contract_t *cp, void *arg __UNUSED)
+{
+	bzero(&cp->nc_sample, sizeof (nc_sample_t));
+	cp->nc_flags &= ~NCF_SAMPLE_OVER;
+}
+
+void
+nc_sample_stop(contract_mgr_t *mp)
+{
+	nc_sampler_t *sp = mp->cm_sampler;
+
+	if (sp == NULL)
+		return;
+
+	if (sp->nsm_has_cb)
+		v8plus_jsfunc_rele(sp->nsm_cb);
+
+	mp->cm_sampler = NULL;
+	free(sp);
+
+	nc_walk(mp, nsm_reset_one, NULL);
+}
+
+boolean_t
+nc_sample_get(const node_contract_t *cp, nc_sample_info_t *ip)
+{
+	const nc_sampler_t *sp = cp->nc_mgr->cm_sampler;
+	const nc_sample_t *ssp = &cp->nc_sample;
+
+	if (sp == NULL)
+		return (B_FALSE);
+
+	ip->nsi_ctid = cp->nc_id;
+	ip->nsi_rate = nsm_rate(sp,
+	    nsm_decayed(sp, ssp, uv_now(cp->nc_mgr->cm_loop)));
+	ip->nsi_depth = ssp->ncs_depth;
+	ip->nsi_events = ssp->ncs_events;
+	ip->nsi_over = (cp->nc_flags & NCF_SAMPLE_OVER) != 0;
+
+	return (B_TRUE);
+}
+
+typedef struct nsm_topk {
+	nc_sample_info_t *ntk_ents;
+	uint_t ntk_k;
+	uint_t ntk_count;
+	boolean_t ntk_by_depth;
+} nsm_topk_t;
+
+static double
+nsm_key(const nsm_topk_t *tkp, const nc_sample_info_t *ip)
+{
+	return (tkp->ntk_by_depth ? (double)ip->nsi_depth : ip->nsi_rate);
+}
+
+/*
+ * Keep the K largest entries seen so far, in descending order, by insertion;
+ * K is small, and most contracts fall below the smallest retained entry and
+ * cost one comparison.
+ */
+static void
+nsm_topk_one(node_contract_t *cp, void *arg)
+{
+	nsm_topk_t *tkp = arg;
+	nc_sample_info_t si;
+	uint_t i;
+
+	if (cp->nc_sample.ncs_events == 0)
+		return;
+
+	VERIFY(nc_sample_get(cp, &si));
+
+	if (tkp->ntk_count == tkp->ntk_k &&
+	    nsm_key(tkp, &si) <= nsm_key(tkp, &tkp->ntk_ents[tkp->ntk_k - 1]))
+		return;
+
+	i = tkp->ntk_count < tkp->ntk_k ? tkp->ntk_count++ : tkp->ntk_k - 1;
+	for (; i > 0 && nsm_key(tkp, &tkp->ntk_ents[i - 1]) <
+	    nsm_key(tkp, &si); i--)
+		tkp->ntk_ents[i] = tkp->ntk_ents[i - 1];
+	tkp->ntk_ents[i] = si;
+}
+
+/*
+ * Fill ents (of size k) with the k contracts having the highest event rate
+ * or drain depth, and return how many were found.  For those, and only
+ * those, read the kernel's queue depth as well.
+ */
+int
+nc_sample_topk(contract_mgr_t *mp, nc_sample_info_t *ents, uint_t k,
+    boolean_t by_depth, uint_t *countp)
+{
+	nsm_topk_t tk;
+	node_contract_t *cp;
+	ct_stathdl_t st;
+	uint_t i;
+
+	if (mp->cm_sampler == NULL)
+		return (ENOTSUP);
+	if (k == 0 || k > NSM_MAX_TOPK)
+		return (EINVAL);
+
+	tk.ntk_ents = ents;
+	tk.ntk_k = k;
+	tk.ntk_count = 0;
+	tk.ntk_by_depth = by_depth;
+
+	nc_walk(mp, nsm_topk_one, &tk);
+
+	for (i = 0; i < tk.ntk_count; i++) {
+		ents[i].nsi_queued = -1;
+		if ((cp = nc_lookup(mp, ents[i].nsi_ctid)) != NULL &&
+		    cp->nc_st_fd >= 0 &&
+		    ct_status_read(cp->nc_st_fd, CTD_COMMON, &st) == 0) {
+			ents[i].nsi_queued = ct_status_get_nevents(st);
+			ct_status_free(st);
+		}
+	}
+
+	*countp = tk.ntk_count;
+
+	return (0);
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Signal fan-out.  Signalling a large number of contracts one sigsend() per
+ * JS call costs an argument-parsing round trip for each; instead, we accept
+ * the whole set of ctids at once, signal them all, and then report the
+ * outcome for each ctid in a single callback.
+ *
+ * Unspaced, the whole set is signalled on a libuv worker thread.  Spaced
+ * out by a fixed interval, the signals are instead paced by a timer on the
+ * loop, so that a long fan-out doesn't hold one of libuv's few worker
+ * threads asleep for its whole duration: each tick sends the slice of
+ * signals that have come due, and is rearmed for the next.  Each signal's
+ * due time is a fixed offset from the first, so that timer lateness does
+ * not accumulate.  A slice too large to send without holding up the loop
+ * -- after a long stall, or when the interval is much shorter than a
+ * millisecond -- is sent from a work item instead, and the timer rearmed
+ * when it is done.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/procset.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NC_SIGSLICE_INLINE	32
+
+typedef struct nc_sigjob {
+	uv_work_t nsj_work;
+	uv_timer_t nsj_timer;
+	ctid_t *nsj_ctids;
+	int *nsj_errs;
+	uint_t nsj_count;
+	uint_t nsj_next;	/* next to send */
+	uint_t nsj_end;		/* end of the slice being sent */
+	int nsj_signo;
+	hrtime_t nsj_interval;
+	hrtime_t nsj_start;
+	hrtime_t nsj_elapsed;
+	hrtime_t nsj_max_call;
+	v8plus_jsfunc_t nsj_cb;
+} nc_sigjob_t;
+
+static void
+nc_sigjob_free(nc_sigjob_t *jp)
+{
+	free(jp->nsj_ctids);
+	free(jp->nsj_errs);
+	free(jp);
+}
+
+/*
+ * Send the signals from nsj_next up to nsj_end.  This may run on a worker
+ * thread, so must not touch V8 or any manager state.
+ */
+static void
+nc_sigjob_send(nc_sigjob_t *jp)
+{
+	hrtime_t t;
+	uint_t i;
+
+	for (i = jp->nsj_next; i < jp->nsj_end; i++) {
+		if (jp->nsj_errs[i] != 0)
+			continue;
+
+		t = gethrtime();
+		jp->nsj_errs[i] = sigsend(P_CTID, jp->nsj_ctids[i],
+		    jp->nsj_signo) == 0 ? 0 : errno;
+		t = gethrtime() - t;
+		if (t > jp->nsj_max_call)
+			jp->nsj_max_call = t;
+	}
+
+	jp->nsj_next = jp->nsj_end;
+}
+
+static void
+nc_sigjob_work(uv_work_t *wp)
+{
+	nc_sigjob_t *jp = wp->data;
+
+	jp->nsj_start = gethrtime();
+	jp->nsj_end = jp->nsj_count;
+	nc_sigjob_send(jp);
+	jp->nsj_elapsed = gethrtime() - jp->nsj_start;
+}
+
+static void
+nc_sigjob_report(nc_sigjob_t *jp)
+{
+	nvlist_t *lp, *ap, *rp;
+	uint_t i, failed = 0;
+	char key[16];
+	int err = 0;
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		err = -1;
+
+	for (i = 0; err == 0 && i < jp->nsj_count; i++) {
+		(void) snprintf(key, sizeof (key), "%u", i);
+		if (jp->nsj_errs[i] != 0)
+			++failed;
+		err = v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_INL_OBJECT, key,
+			V8PLUS_TYPE_NUMBER, "ctid", (double)jp->nsj_ctids[i],
+			V8PLUS_TYPE_NUMBER, "errno", (double)jp->nsj_errs[i],
+			V8PLUS_TYPE_STRING, "message", jp->nsj_errs[i] == 0 ?
+			    "" : strerror(jp->nsj_errs[i]),
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	}
+
+	if (err == 0) {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_NULL, "0",
+		    V8PLUS_TYPE_INL_OBJECT, "1",
+			V8PLUS_TYPE_NUMBER, "sent",
+			    (double)(jp->nsj_count - failed),
+			V8PLUS_TYPE_NUMBER, "failed", (double)failed,
+			V8PLUS_TYPE_NUMBER, "elapsed_ms",
+			    (double)jp->nsj_elapsed / MICROSEC,
+			V8PLUS_TYPE_NUMBER, "max_call_us",
+			    (double)jp->nsj_max_call / 1000,
+			V8PLUS_TYPE_OBJECT, "results", lp,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	} else {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_INL_OBJECT, "0",
+			V8PLUS_TYPE_STRING, "message",
+			    "unable to report signal results",
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	}
+	nvlist_free(lp);
+
+	if (ap != NULL) {
+		rp = v8plus_call(jp->nsj_cb, ap);
+		nvlist_free(ap);
+		nvlist_free(rp);
+	}
+
+	v8plus_jsfunc_rele(jp->nsj_cb);
+	nc_sigjob_free(jp);
+}
+
+static void
+nc_sigjob_done(uv_work_t *wp)
+{
+	nc_sigjob_report(wp->data);
+}
+
+static void
+nc_sigjob_closed(uv_handle_t *hp)
+{
+	nc_sigjob_report(hp->data);
+}
+
+static void nc_sigjob_tick(uv_timer_t *, int);
+
+/*
+ * Arm the timer for the next signal's due time, or, if every signal has
+ * been sent, finish: the report is made once the timer has been closed.
+ */
+static void
+nc_sigjob_arm(nc_sigjob_t *jp)
+{
+	hrtime_t due, now;
+
+	if (jp->nsj_next == jp->nsj_count) {
+		jp->nsj_elapsed = gethrtime() - jp->nsj_start;
+		uv_close((uv_handle_t *)&jp->nsj_timer, nc_sigjob_closed);
+		return;
+	}
+
+	due = jp->nsj_start + jp->nsj_interval * jp->nsj_next;
+	now = gethrtime();
+	(void) uv_timer_start(&jp->nsj_timer, nc_sigjob_tick,
+	    due <= now ? 0 : (due - now + MICROSEC - 1) / MICROSEC, 0);
+}
+
+static void
+nc_sigjob_slice_work(uv_work_t *wp)
+{
+	nc_sigjob_send(wp->data);
+}
+
+static void
+nc_sigjob_slice_done(uv_work_t *wp)
+{
+	nc_sigjob_arm(wp->data);
+}
+
+/*
+ * Send every signal now due.  The first tick fixes the schedule's start.
+ */
+static void
+nc_sigjob_tick(uv_timer_t *tp, int status __UNUSED)
+{
+	nc_sigjob_t *jp = tp->data;
+	hrtime_t now = gethrtime();
+	uint64_t due;
+
+	if (jp->nsj_start == 0)
+		jp->nsj_start = now;
+
+	due = (now - jp->nsj_start) / jp->nsj_interval + 1;
+	jp->nsj_end = due < jp->nsj_count ? (uint_t)due : jp->nsj_count;
+
+	/*
+	 * If the work can't be queued, we have no choice but to send the
+	 * slice here after all.
+	 */
+	if (jp->nsj_end - jp->nsj_next > NC_SIGSLICE_INLINE &&
+	    uv_queue_work(tp->loop, &jp->nsj_work, nc_sigjob_slice_work,
+	    nc_sigjob_slice_done) == 0)
+		return;
+
+	nc_sigjob_send(jp);
+	nc_sigjob_arm(jp);
+}
+
+/*
+ * Begin signalling the supplied contracts.  On success we take ownership of
+ * the ctid array, and cb will be called exactly once; on failure (ENOMEM,
+ * or EAGAIN if the work could not be queued), cb is never called.
+ * Contracts we hold and know to be empty or dead fail with ESRCH here,
+ * without being sent anything.
+ */
+int
+nc_sigsend_many(contract_mgr_t *mp, ctid_t *ctids, uint_t count, int signo,
+    uint64_t interval_us, v8plus_jsfunc_t cb)
+{
+	nc_sigjob_t *jp;
+	node_contract_t *cp;
+	uint_t i;
+
+	if ((jp = calloc(1, sizeof (nc_sigjob_t))) == NULL)
+		return (ENOMEM);
+	if ((jp->nsj_errs = calloc(count == 0 ? 1 : count,
+	    sizeof (int))) == NULL) {
+		free(jp);
+		return (ENOMEM);
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((cp = nc_lookup(mp, ctids[i])) != NULL)
+			jp->nsj_errs[i] = nc_life_check(cp, NLO_SIGNAL);
+	}
+
+	jp->nsj_ctids = ctids;
+	jp->nsj_count = count;
+	jp->nsj_signo = signo;
+	jp->nsj_interval = (hrtime_t)interval_us * 1000;
+	jp->nsj_work.data = jp;
+
+	v8plus_jsfunc_hold(cb);
+	jp->nsj_cb = cb;
+
+	if (jp->nsj_interval == 0) {
+		if (uv_queue_work(mp->cm_loop, &jp->nsj_work,
+		    nc_sigjob_work, nc_sigjob_done) != 0) {
+			v8plus_jsfunc_rele(cb);
+			free(jp->nsj_errs);
+			free(jp);
+			return (EAGAIN);
+		}
+		return (0);
+	}
+
+	(void) uv_timer_init(mp->cm_loop, &jp->nsj_timer);
+	jp->nsj_timer.data = jp;
+	(void) uv_timer_start(&jp->nsj_timer, nc_sigjob_tick, 0, 0);
+
+	return (0);
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Contract templates.  A template object supplied by the consumer is
+ * compiled into an nc_tmpl_t: the set of properties it specifies and their
+ * parsed values.  Consumers tend to activate the same few templates over and
+ * over, so each manager keeps a small cache of compiled templates keyed by
+ * the packed form of the object; a hit costs one nvlist_pack() and a
+ * comparison instead of a walk of every property and descriptor table.
+ *
+ * We also remember what we have written to the open template descriptor.
+ * If the new template specifies at least every property the last one did,
+ * and is of the same type, we keep the descriptor and write only those
+ * properties whose values differ, activating it again only if anything
+ * changed.  Otherwise, since we don't know the kernel's defaults for the
+ * properties the new template omits, we start over with a fresh descriptor.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/debug.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libcontract.h>
+#include <libnvpair.h>
+#include "node_contract.h"
+
+#define	NTC_SLOTS	16
+
+struct nc_tmpl {
+	const nc_typedesc_t *ntm_type;
+	uint_t ntm_set;
+	uint64_t ntm_num[NTP_MAX];
+	char *ntm_str[NTP_MAX];
+};
+
+typedef struct nc_tcent {
+	uint64_t ntc_hash;
+	char *ntc_packed;
+	size_t ntc_len;
+	nc_tmpl_t *ntc_tmpl;
+} nc_tcent_t;
+
+struct nc_tmplcache {
+	nc_tcent_t ntc_ents[NTC_SLOTS];
+	uint_t ntc_next;
+	nc_tmpl_t ntc_applied;	/* what cm_tmpl_fd holds */
+	boolean_t ntc_active;	/* cm_tmpl_fd is the active template */
+	nc_tmpl_stats_t ntc_stats;
+};
+
+static const char *ntm_names[NTP_MAX] = {
+	"critical",
+	"informative",
+	"cookie",
+	"transfer",
+	"fatal",
+	"param",
+	"svc_fmri",
+	"svc_aux",
+	"aset",
+	"minor",
+	"noneg"
+};
+
+static boolean_t
+ntm_isstr(nc_tprop_t p)
+{
+	return (p == NTP_SVC_FMRI || p == NTP_SVC_AUX || p == NTP_DEV_MINOR);
+}
+
+static void
+ntm_setnum(nc_tmpl_t *tp, nc_tprop_t p, uint64_t v)
+{
+	tp->ntm_num[p] = v;
+	tp->ntm_set |= 1U << p;
+}
+
+static int
+ntm_setstr(nc_tmpl_t *tp, nc_tprop_t p, const char *s)
+{
+	char *d;
+
+	if ((d = strdup(s)) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM, NULL);
+		return (-1);
+	}
+
+	free(tp->ntm_str[p]);
+	tp->ntm_str[p] = d;
+	tp->ntm_set |= 1U << p;
+
+	return (0);
+}
+
+static void
+ntm_reset(nc_tmpl_t *tp)
+{
+	uint_t p;
+
+	for (p = 0; p < NTP_MAX; p++)
+		free(tp->ntm_str[p]);
+	bzero(tp, sizeof (nc_tmpl_t));
+}
+
+static void
+ntm_free(nc_tmpl_t *tp)
+{
+	if (tp == NULL)
+		return;
+
+	ntm_reset(tp);
+	free(tp);
+}
+
+static uint_t
+ntm_evset(const nvlist_t *sp, const nc_descr_t *dp)
+{
+	uint_t set = 0;
+	boolean_t b;
+
+	for (; dp->ncd_str != NULL; dp++) {
+		if (nvlist_lookup_boolean_value((nvlist_t *)sp,
+		    dp->ncd_str, &b) == 0 && b)
+			set |= dp->ncd_i;
+	}
+
+	return (set);
+}
+
+static int
+nc_generic_tmpl_compile(const nvlist_t *lp, nc_tmpl_t *tp)
+{
+	const nc_typedesc_t *ntp = tp->ntm_type;
+	nvlist_t *sp;
+	char *s;
+
+	if (nvlist_lookup_nvlist((nvlist_t *)lp, "critical", &sp) == 0)
+		ntm_setnum(tp, NTP_CRITICAL, ntm_evset(sp, ntp->nct_events));
+
+	if (nvlist_lookup_nvlist((nvlist_t *)lp, "informative", &sp) == 0) {
+		ntm_setnum(tp, NTP_INFORMATIVE,
+		    ntm_evset(sp, ntp->nct_events));
+	}
+
+	if (nvlist_lookup_string((nvlist_t *)lp, "cookie", &s) == 0) {
+		uint64_t cv;
+
+		errno = 0;
+		cv = strtoull(s, NULL, 0);
+		if (errno != 0) {
+			(void) v8plus_syserr(errno,
+			    "unable to parse template property cookie: %s",
+			    strerror(errno));
+			return (-1);
+		}
+		ntm_setnum(tp, NTP_COOKIE, cv);
+	}
+
+	return (0);
+}
+
+int
+nc_pr_tmpl_compile(const nvlist_t *lp, nc_tmpl_t *tp)
+{
+	const nc_typedesc_t *ntp = &nc_types[NCT_PROCESS];
+	nvlist_t *sp;
+	double d;
+	char *s;
+
+	if (nvlist_lookup_double((nvlist_t *)lp, "transfer", &d) == 0)
+		ntm_setnum(tp, NTP_TRANSFER, (uint64_t)(ctid_t)d);
+
+	if (nvlist_lookup_nvlist((nvlist_t *)lp, "fatal", &sp) == 0)
+		ntm_setnum(tp, NTP_FATAL, ntm_evset(sp, ntp->nct_events));
+
+	if (nvlist_lookup_nvlist((nvlist_t *)lp, "param", &sp) == 0)
+		ntm_setnum(tp, NTP_PARAM, ntm_evset(sp, nc_pr_params));
+
+	if (nvlist_lookup_string((nvlist_t *)lp, "svc_fmri", &s) == 0 &&
+	    ntm_setstr(tp, NTP_SVC_FMRI, s) != 0)
+		return (-1);
+
+	if (nvlist_lookup_string((nvlist_t *)lp, "svc_aux", &s) == 0 &&
+	    ntm_setstr(tp, NTP_SVC_AUX, s) != 0)
+		return (-1);
+
+	return (0);
+}
+
+int
+nc_dev_tmpl_compile(const nvlist_t *lp, nc_tmpl_t *tp)
+{
+	nvlist_t *sp;
+	boolean_t b;
+	char *s;
+
+	if (nvlist_lookup_nvlist((nvlist_t *)lp, "dev_aset", &sp) == 0)
+		ntm_setnum(tp, NTP_DEV_ASET, ntm_evset(sp, nc_dev_states));
+
+	if (nvlist_lookup_string((nvlist_t *)lp, "dev_minor", &s) == 0 &&
+	    ntm_setstr(tp, NTP_DEV_MINOR, s) != 0)
+		return (-1);
+
+	if (nvlist_lookup_boolean_value((nvlist_t *)lp, "dev_noneg", &b) == 0)
+		ntm_setnum(tp, NTP_DEV_NONEG, b);
+
+	return (0);
+}
+
+/*
+ * FNV-1a.
+ */
+static uint64_t
+ntc_hash(const char *buf, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)buf[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return (h);
+}
+
+static nc_tmplcache_t *
+ntc_cache(contract_mgr_t *mp)
+{
+	if (mp->cm_tmplcache == NULL)
+		mp->cm_tmplcache = calloc(1, sizeof (nc_tmplcache_t));
+
+	return (mp->cm_tmplcache);
+}
+
+/*
+ * Return the compiled form of the template object, compiling it if we
+ * haven't seen it recently.  The result belongs to the cache, and remains
+ * valid until the next call.  On failure, a V8 exception is pending.
+ */
+const nc_tmpl_t *
+nc_tmpl_get(contract_mgr_t *mp, const nc_typedesc_t *ntp,
+    const nvlist_t *params)
+{
+	nc_tmplcache_t *cp;
+	nc_tcent_t *ep;
+	nc_tmpl_t *tp;
+	char *buf = NULL;
+	size_t len = 0;
+	uint64_t h;
+	uint_t i;
+	int err;
+
+	if ((cp = ntc_cache(mp)) == NULL) {
+		(void) v8plus_error(V8PLUSERR_NOMEM, NULL);
+		return (NULL);
+	}
+
+	if ((err = nvlist_pack((nvlist_t *)params, &buf, &len,
+	    NV_ENCODE_NATIVE, 0)) != 0) {
+		(void) v8plus_syserr(err, "unable to pack template: %s",
+		    strerror(err));
+		return (NULL);
+	}
+
+	h = ntc_hash(buf, len);
+	for (i = 0; i < NTC_SLOTS; i++) {
+		ep = &cp->ntc_ents[i];
+		if (ep->ntc_tmpl != NULL && ep->ntc_hash == h &&
+		    ep->ntc_len == len &&
+		    bcmp(ep->ntc_packed, buf, len) == 0) {
+			free(buf);
+			++cp->ntc_stats.nts_hits;
+			return (ep->ntc_tmpl);
+		}
+	}
+
+	++cp->ntc_stats.nts_misses;
+
+	if ((tp = calloc(1, sizeof (nc_tmpl_t))) == NULL) {
+		free(buf);
+		(void) v8plus_error(V8PLUSERR_NOMEM, NULL);
+		return (NULL);
+	}
+	tp->ntm_type = ntp;
+
+	if (nc_generic_tmpl_compile(params, tp) != 0 ||
+	    ntp->nct_tmpl_compile(params, tp) != 0) {
+		ntm_free(tp);
+		free(buf);
+		return (NULL);
+	}
+
+	ep = &cp->ntc_ents[cp->ntc_next];
+	cp->ntc_next = (cp->ntc_next + 1) % NTC_SLOTS;
+	ntm_free(ep->ntc_tmpl);
+	free(ep->ntc_packed);
+
+	ep->ntc_hash = h;
+	ep->ntc_packed = buf;
+	ep->ntc_len = len;
+	ep->ntc_tmpl = tp;
+
+	return (tp);
+}
+
+static boolean_t
+ntm_equal(const nc_tmpl_t *ap, const nc_tmpl_t *bp, nc_tprop_t p)
+{
+	if (!(ap->ntm_set & bp->ntm_set & (1U << p)))
+		return (B_FALSE);
+
+	if (ntm_isstr(p))
+		return (strcmp(ap->ntm_str[p], bp->ntm_str[p]) == 0);
+
+	return (ap->ntm_num[p] == bp->ntm_num[p]);
+}
+
+static int
+ntm_write(int fd, const nc_tmpl_t *tp, nc_tprop_t p)
+{
+	uint64_t v = tp->ntm_num[p];
+
+	switch (p) {
+	case NTP_CRITICAL:
+		return (ct_tmpl_set_critical(fd, (uint_t)v));
+	case NTP_INFORMATIVE:
+		return (ct_tmpl_set_informative(fd, (uint_t)v));
+	case NTP_COOKIE:
+		return (ct_tmpl_set_cookie(fd, v));
+	case NTP_TRANSFER:
+		return (ct_pr_tmpl_set_transfer(fd, (ctid_t)v));
+	case NTP_FATAL:
+		return (ct_pr_tmpl_set_fatal(fd, (uint_t)v));
+	case NTP_PARAM:
+		return (ct_pr_tmpl_set_param(fd, (uint_t)v));
+	case NTP_SVC_FMRI:
+		return (ct_pr_tmpl_set_svc_fmri(fd, tp->ntm_str[p]));
+	case NTP_SVC_AUX:
+		return (ct_pr_tmpl_set_svc_aux(fd, tp->ntm_str[p]));
+	case NTP_DEV_ASET:
+		return (ct_dev_tmpl_set_aset(fd, (uint_t)v));
+	case NTP_DEV_MINOR:
+		return (ct_dev_tmpl_set_minor(fd, tp->ntm_str[p]));
+	case NTP_DEV_NONEG:
+		return (v != 0 ? ct_dev_tmpl_set_noneg(fd) :
+		    ct_dev_tmpl_clear_noneg(fd));
+	default:
+		VERIFY(0);
+	}
+
+	return (EINVAL);
+}
+
+static int
+ntc_open(contract_mgr_t *mp, const nc_typedesc_t *ntp)
+{
+	char path[MAXPATHLEN];
+	int flags, err;
+
+	(void) snprintf(path, sizeof (path), "%s/template", ntp->nct_root);
+
+	if ((mp->cm_tmpl_fd = open(path, O_RDWR)) < 0) {
+		err = errno;
+		(void) v8plus_syserr(err, "unable to open %s: %s", path,
+		    strerror(err));
+		return (-1);
+	}
+
+	if ((flags = fcntl(mp->cm_tmpl_fd, F_GETFD, 0)) < 0 ||
+	    fcntl(mp->cm_tmpl_fd, F_SETFD, flags | FD_CLOEXEC) < 0) {
+		err = errno;
+		(void) close(mp->cm_tmpl_fd);
+		mp->cm_tmpl_fd = -1;
+		(void) v8plus_syserr(err, "unable to set CLOEXEC: %s",
+		    strerror(err));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Forget the template descriptor without deactivating it.
+ */
+static void
+ntc_discard(contract_mgr_t *mp)
+{
+	nc_tmplcache_t *cp = mp->cm_tmplcache;
+
+	if (mp->cm_tmpl_fd >= 0)
+		(void) close(mp->cm_tmpl_fd);
+	mp->cm_tmpl_fd = -1;
+
+	if (cp != NULL) {
+		ntm_reset(&cp->ntc_applied);
+		cp->ntc_active = B_FALSE;
+	}
+}
+
+/*
+ * Make the compiled template the active one.  On failure, a V8 exception is
+ * pending, and no template of ours is active.
+ */
+int
+nc_tmpl_activate(contract_mgr_t *mp, const nc_tmpl_t *tp)
+{
+	nc_tmplcache_t *cp = mp->cm_tmplcache;
+	nc_tmpl_t *ap = &cp->ntc_applied;
+	boolean_t changed = B_FALSE;
+	uint_t p;
+	int err;
+
+	if (mp->cm_tmpl_fd < 0 || ap->ntm_type != tp->ntm_type ||
+	    (ap->ntm_set & ~tp->ntm_set) != 0) {
+		if (mp->cm_tmpl_fd >= 0)
+			(void) ct_tmpl_clear(mp->cm_tmpl_fd);
+		ntc_discard(mp);
+		if (ntc_open(mp, tp->ntm_type) != 0)
+			return (-1);
+		ap->ntm_type = tp->ntm_type;
+		++cp->ntc_stats.nts_opens;
+	}
+
+	for (p = 0; p < NTP_MAX; p++) {
+		if (!(tp->ntm_set & (1U << p)))
+			continue;
+
+		if (ntm_equal(ap, tp, p)) {
+			++cp->ntc_stats.nts_skipped;
+			continue;
+		}
+
+		if ((err = ntm_write(mp->cm_tmpl_fd, tp, p)) != 0) {
+			(void) ct_tmpl_clear(mp->cm_tmpl_fd);
+			ntc_discard(mp);
+			(void) v8plus_syserr(err,
+			    "unable to set template property %s: %s",
+			    ntm_names[p], strerror(err));
+			return (-1);
+		}
+		++cp->ntc_stats.nts_writes;
+
+		if (ntm_isstr(p)) {
+			if (ntm_setstr(ap, p, tp->ntm_str[p]) != 0) {
+				(void) ct_tmpl_clear(mp->cm_tmpl_fd);
+				ntc_discard(mp);
+				return (-1);
+			}
+		} else {
+			ntm_setnum(ap, p, tp->ntm_num[p]);
+		}
+		changed = B_TRUE;
+	}
+
+	if (!changed && cp->ntc_active)
+		return (0);
+
+	if ((err = ct_tmpl_activate(mp->cm_tmpl_fd)) != 0) {
+		ntc_discard(mp);
+		(void) v8plus_syserr(err, "unable to activate template: %s",
+		    strerror(err));
+		return (-1);
+	}
+	++cp->ntc_stats.nts_activations;
+	cp->ntc_active = B_TRUE;
+
+	return (0);
+}
+
+/*
+ * Deactivate and close the template descriptor, if any.
+ */
+int
+nc_tmpl_clear(contract_mgr_t *mp)
+{
+	int err;
+
+	if (mp->cm_tmpl_fd < 0)
+		return (0);
+
+	if ((err = ct_tmpl_clear(mp->cm_tmpl_fd)) != 0)
+		return (err);
+
+	ntc_discard(mp);
+
+	return (0);
+}
+
+boolean_t
+nc_tmpl_stats(const contract_mgr_t *mp, nc_tmpl_stats_t *sp)
+{
+	if (mp->cm_tmplcache == NULL)
+		return (B_FALSE);
+
+	*sp = mp->cm_tmplcache->ntc_stats;
+
+	return (B_TRUE);
+}
@@ -0,0 +1,560 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Hierarchical termination of a process contract and the contracts it has
+ * inherited (as listed in pr_contracts), recursively.  We first walk the
+ * subtree, opening a listener on each contract's event endpoint before
+ * reading its status, so that no pr_empty can slip between the two.  We then
+ * signal every non-empty contract, top-down or bottom-up, and wait for each
+ * to report pr_empty.  If escalateAfterMs passes first, whatever is left is
+ * sent the kill signal; if timeoutMs passes, we give up.  Contracts whose
+ * event sets do not include pr_empty cannot be tracked from events, so for
+ * those alone we recheck status periodically.
+ *
+ * Each phase is timed, and the consumer's callback receives the timings
+ * along with the outcome for each contract.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/ctfs.h>
+#include <sys/procset.h>
+#include <sys/contract/process.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+#define	NTT_RECHECK_MS	1000
+
+typedef enum nc_term_phase {
+	NTP_SIGNAL,
+	NTP_WAIT,
+	NTP_KILL,
+	NTP_DONE
+} nc_term_phase_t;
+
+typedef struct nc_tnode {
+	struct nc_term *ntn_term;
+	ctid_t ntn_ctid;
+	ctid_t ntn_parent;
+	int ntn_ev_fd;
+	uv_poll_t ntn_poll;
+	boolean_t ntn_polling;
+	boolean_t ntn_watched;
+	boolean_t ntn_empty;
+	boolean_t ntn_killed;
+	int ntn_err;
+	hrtime_t ntn_empty_at;
+} nc_tnode_t;
+
+typedef struct nc_term {
+	contract_mgr_t *nt_mgr;
+	nc_tnode_t *nt_nodes;
+	uint_t nt_count;
+	uint_t nt_pending;
+	uint_t nt_unwatched;
+	uint_t nt_closing;
+	int nt_signo;
+	int nt_killsig;
+	boolean_t nt_bottomup;
+	uint64_t nt_escalate;
+	uint64_t nt_timeout;
+	uint64_t nt_started;
+	uv_timer_t nt_timer;
+	nc_term_phase_t nt_phase;
+	boolean_t nt_timedout;
+	hrtime_t nt_start;
+	hrtime_t nt_signalled;
+	hrtime_t nt_escalated;
+	hrtime_t nt_done;
+	v8plus_jsfunc_t nt_cb;
+} nc_term_t;
+
+static void nc_term_check(nc_term_t *);
+
+static double
+nc_term_ms(hrtime_t from, hrtime_t to)
+{
+	if (from == 0 || to < from)
+		return (0);
+
+	return ((double)(to - from) / MICROSEC);
+}
+
+/*
+ * Read a contract's status, returning its member count, the contracts it
+ * has inherited, and whether it will tell us when it empties.  The caller
+ * must free *ctsp.
+ */
+static int
+nc_term_status(ctid_t ctid, uint_t *npidsp, ctid_t **ctsp, uint_t *nctsp,
+    boolean_t *watchedp)
+{
+	char buf[MAXPATHLEN];
+	ct_stathdl_t st;
+	pid_t *pids;
+	ctid_t *cts;
+	uint_t evset;
+	int fd, err;
+
+	(void) snprintf(buf, sizeof (buf), CTFS_ROOT "/all/%d/status",
+	    (int)ctid);
+	if ((fd = open(buf, O_RDONLY)) < 0)
+		return (errno);
+
+	if ((err = ct_status_read(fd, CTD_ALL, &st)) != 0) {
+		(void) close(fd);
+		return (err);
+	}
+	(void) close(fd);
+
+	if (strcmp(ct_status_get_type(st), "process") != 0) {
+		ct_status_free(st);
+		return (ENOTSUP);
+	}
+
+	*npidsp = 0;
+	(void) ct_pr_status_get_members(st, &pids, npidsp);
+
+	if (ctsp != NULL) {
+		*nctsp = 0;
+		*ctsp = NULL;
+		if (ct_pr_status_get_contracts(st, &cts, nctsp) == 0 &&
+		    *nctsp > 0) {
+			if ((*ctsp = calloc(*nctsp, sizeof (ctid_t))) == NULL) {
+				ct_status_free(st);
+				return (ENOMEM);
+			}
+			bcopy(cts, *ctsp, *nctsp * sizeof (ctid_t));
+		}
+	}
+
+	if (watchedp != NULL) {
+		evset = ct_status_get_informative(st) |
+		    ct_status_get_critical(st);
+		*watchedp = (evset & CT_PR_EV_EMPTY) != 0;
+	}
+
+	ct_status_free(st);
+
+	return (0);
+}
+
+static int
+nc_term_listen(ctid_t ctid)
+{
+	char buf[MAXPATHLEN];
+	int fd, flags;
+
+	(void) snprintf(buf, sizeof (buf), CTFS_ROOT "/all/%d/events",
+	    (int)ctid);
+	if ((fd = open(buf, O_RDONLY | O_NONBLOCK)) < 0)
+		return (-1);
+
+	if ((flags = fcntl(fd, F_GETFD, 0)) >= 0)
+		(void) fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+
+	return (fd);
+}
+
+static void
+nc_term_close_cb(uv_handle_t *hp)
+{
+	nc_term_t *tp = hp->data;
+
+	if (--tp->nt_closing == 0) {
+		free(tp->nt_nodes);
+		free(tp);
+	}
+}
+
+static void
+nc_term_stop(nc_tnode_t *np)
+{
+	nc_term_t *tp = np->ntn_term;
+
+	if (!np->ntn_polling)
+		return;
+
+	np->ntn_polling = B_FALSE;
+	uv_poll_stop(&np->ntn_poll);
+	np->ntn_poll.data = tp;
+	++tp->nt_closing;
+	uv_close((uv_handle_t *)&np->ntn_poll, nc_term_close_cb);
+}
+
+static void
+nc_term_emptied(nc_tnode_t *np)
+{
+	nc_term_t *tp = np->ntn_term;
+
+	if (np->ntn_empty)
+		return;
+
+	np->ntn_empty = B_TRUE;
+	np->ntn_empty_at = gethrtime();
+	if (!np->ntn_watched)
+		--tp->nt_unwatched;
+	--tp->nt_pending;
+
+	nc_term_stop(np);
+}
+
+static void
+nc_term_finish(nc_term_t *tp)
+{
+	nvlist_t *lp, *ap, *rp;
+	nc_tnode_t *np;
+	char key[16];
+	uint_t i;
+	int err = 0;
+
+	tp->nt_phase = NTP_DONE;
+	tp->nt_done = gethrtime();
+	(void) uv_timer_stop(&tp->nt_timer);
+
+	for (i = 0; i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[i];
+		nc_term_stop(np);
+		if (np->ntn_ev_fd >= 0) {
+			(void) close(np->ntn_ev_fd);
+			np->ntn_ev_fd = -1;
+		}
+	}
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL)
+		err = -1;
+	for (i = 0; err == 0 && i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[i];
+		(void) snprintf(key, sizeof (key), "%u", i);
+		err = v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_INL_OBJECT, key,
+			V8PLUS_TYPE_NUMBER, "ctid", (double)np->ntn_ctid,
+			V8PLUS_TYPE_NUMBER, "parent", (double)np->ntn_parent,
+			V8PLUS_TYPE_BOOLEAN, "empty", np->ntn_empty,
+			V8PLUS_TYPE_BOOLEAN, "killed", np->ntn_killed,
+			V8PLUS_TYPE_NUMBER, "errno", (double)np->ntn_err,
+			V8PLUS_TYPE_NUMBER, "empty_ms", np->ntn_empty ?
+			    nc_term_ms(tp->nt_start, np->ntn_empty_at) : -1,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	}
+
+	if (err == 0) {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_NULL, "0",
+		    V8PLUS_TYPE_INL_OBJECT, "1",
+			V8PLUS_TYPE_NUMBER, "remaining",
+			    (double)tp->nt_pending,
+			V8PLUS_TYPE_BOOLEAN, "escalated",
+			    tp->nt_escalated != 0,
+			V8PLUS_TYPE_BOOLEAN, "timedout", tp->nt_timedout,
+			V8PLUS_TYPE_NUMBER, "signal_ms",
+			    nc_term_ms(tp->nt_start, tp->nt_signalled),
+			V8PLUS_TYPE_NUMBER, "wait_ms",
+			    nc_term_ms(tp->nt_signalled, tp->nt_escalated != 0 ?
+			    tp->nt_escalated : tp->nt_done),
+			V8PLUS_TYPE_NUMBER, "kill_ms",
+			    nc_term_ms(tp->nt_escalated, tp->nt_done),
+			V8PLUS_TYPE_NUMBER, "total_ms",
+			    nc_term_ms(tp->nt_start, tp->nt_done),
+			V8PLUS_TYPE_OBJECT, "contracts", lp,
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	} else {
+		ap = v8plus_obj(
+		    V8PLUS_TYPE_INL_OBJECT, "0",
+			V8PLUS_TYPE_STRING, "message",
+			    "unable to report termination results",
+			V8PLUS_TYPE_NONE,
+		    V8PLUS_TYPE_NONE);
+	}
+	nvlist_free(lp);
+
+	if (ap != NULL) {
+		rp = v8plus_call(tp->nt_cb, ap);
+		nvlist_free(ap);
+		nvlist_free(rp);
+	}
+	v8plus_jsfunc_rele(tp->nt_cb);
+
+	uv_close((uv_handle_t *)&tp->nt_timer, nc_term_close_cb);
+}
+
+static void
+nc_term_signal(nc_term_t *tp, int signo, boolean_t kill)
+{
+	nc_tnode_t *np;
+	uint_t i;
+
+	for (i = 0; i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[tp->nt_bottomup ? tp->nt_count - 1 - i : i];
+		if (np->ntn_empty)
+			continue;
+		np->ntn_killed = kill;
+		if (sigsend(P_CTID, np->ntn_ctid, signo) != 0 && errno != ESRCH)
+			np->ntn_err = errno;
+	}
+}
+
+/*
+ * Recheck the status of contracts we can't watch, or (when escalating) of
+ * all those not yet known to be empty, in case an event was missed.
+ */
+static void
+nc_term_recheck(nc_term_t *tp, boolean_t all)
+{
+	nc_tnode_t *np;
+	uint_t i, npids;
+
+	for (i = 0; i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[i];
+		if (np->ntn_empty || (np->ntn_watched && !all))
+			continue;
+		if (nc_term_status(np->ntn_ctid, &npids, NULL, NULL,
+		    NULL) != 0 || npids == 0)
+			nc_term_emptied(np);
+	}
+}
+
+static void
+nc_term_timer_cb(uv_timer_t *hp, int status __UNUSED)
+{
+	nc_term_t *tp = hp->data;
+	uint64_t elapsed = uv_now(tp->nt_mgr->cm_loop) - tp->nt_started;
+
+	if (tp->nt_phase == NTP_WAIT && tp->nt_escalate != 0 &&
+	    elapsed >= tp->nt_escalate) {
+		nc_term_recheck(tp, B_TRUE);
+		if (tp->nt_pending != 0) {
+			tp->nt_phase = NTP_KILL;
+			tp->nt_escalated = gethrtime();
+			nc_term_signal(tp, tp->nt_killsig, B_TRUE);
+		}
+	} else if (tp->nt_timeout != 0 && elapsed >= tp->nt_timeout) {
+		nc_term_recheck(tp, B_TRUE);
+		tp->nt_timedout = tp->nt_pending != 0;
+		nc_term_finish(tp);
+		return;
+	} else if (tp->nt_unwatched != 0) {
+		nc_term_recheck(tp, B_FALSE);
+	}
+
+	nc_term_check(tp);
+}
+
+/*
+ * Finish if everything is empty; otherwise arm the timer for whichever of
+ * escalation, timeout or the next recheck comes first.
+ */
+static void
+nc_term_check(nc_term_t *tp)
+{
+	uint64_t elapsed, next = UINT64_MAX;
+
+	if (tp->nt_phase == NTP_DONE || tp->nt_phase == NTP_SIGNAL)
+		return;
+
+	if (tp->nt_pending == 0) {
+		nc_term_finish(tp);
+		return;
+	}
+
+	elapsed = uv_now(tp->nt_mgr->cm_loop) - tp->nt_started;
+	if (tp->nt_phase == NTP_WAIT && tp->nt_escalate != 0)
+		next = tp->nt_escalate;
+	if (tp->nt_timeout != 0 && tp->nt_timeout < next)
+		next = tp->nt_timeout;
+	if (tp->nt_unwatched != 0 && elapsed + NTT_RECHECK_MS < next)
+		next = elapsed + NTT_RECHECK_MS;
+
+	if (next == UINT64_MAX)
+		return;
+
+	(void) uv_timer_start(&tp->nt_timer, nc_term_timer_cb,
+	    next > elapsed ? next - elapsed : 0, 0);
+}
+
+static void
+nc_term_event_cb(uv_poll_t *hp, int status __UNUSED, int events)
+{
+	nc_tnode_t *np = hp->data;
+	nc_term_t *tp = np->ntn_term;
+	ct_evthdl_t eh;
+	boolean_t empty = B_FALSE;
+
+	if (!(events & UV_READABLE))
+		return;
+
+	while (ct_event_read(np->ntn_ev_fd, &eh) == 0) {
+		if (ct_event_get_type(eh) == CT_PR_EV_EMPTY)
+			empty = B_TRUE;
+		ct_event_free(eh);
+	}
+
+	if (empty) {
+		nc_term_emptied(np);
+		nc_term_check(tp);
+	}
+}
+
+/*
+ * Add ctid, and recursively the contracts it has inherited, to the tree.
+ * Nodes are appended in breadth-first order, so the root is first and every
+ * contract precedes those it has inherited.
+ */
+static int
+nc_term_walk(nc_term_t *tp, ctid_t root)
+{
+	nc_tnode_t *np, *nnodes;
+	ctid_t *cts;
+	uint_t ncts, npids, size = 8;
+	uint_t i, j, k;
+	int err;
+
+	if ((tp->nt_nodes = calloc(size, sizeof (nc_tnode_t))) == NULL)
+		return (ENOMEM);
+	tp->nt_count = 1;
+	tp->nt_nodes[0].ntn_ctid = root;
+	tp->nt_nodes[0].ntn_parent = -1;
+
+	for (i = 0; i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[i];
+		np->ntn_term = tp;
+		np->ntn_ev_fd = nc_term_listen(np->ntn_ctid);
+
+		err = nc_term_status(np->ntn_ctid, &npids, &cts, &ncts,
+		    &np->ntn_watched);
+		if (err != 0 && i == 0)
+			return (err);
+		if (err != 0) {
+			/* Gone already, or not a process contract. */
+			np->ntn_empty = B_TRUE;
+			continue;
+		}
+
+		if (np->ntn_ev_fd < 0)
+			np->ntn_watched = B_FALSE;
+		if (npids == 0) {
+			np->ntn_empty = B_TRUE;
+			np->ntn_empty_at = gethrtime();
+		} else {
+			++tp->nt_pending;
+			if (!np->ntn_watched)
+				++tp->nt_unwatched;
+		}
+
+		for (j = 0; j < ncts; j++) {
+			for (k = 0; k < tp->nt_count; k++) {
+				if (tp->nt_nodes[k].ntn_ctid == cts[j])
+					break;
+			}
+			if (k < tp->nt_count)
+				continue;
+
+			if (tp->nt_count == size) {
+				size *= 2;
+				if ((nnodes = realloc(tp->nt_nodes,
+				    size * sizeof (nc_tnode_t))) == NULL) {
+					free(cts);
+					return (ENOMEM);
+				}
+				tp->nt_nodes = nnodes;
+			}
+			np = &tp->nt_nodes[tp->nt_count++];
+			bzero(np, sizeof (nc_tnode_t));
+			np->ntn_ctid = cts[j];
+			np->ntn_parent = tp->nt_nodes[i].ntn_ctid;
+			np->ntn_ev_fd = -1;
+		}
+		free(cts);
+	}
+
+	return (0);
+}
+
+/*
+ * Begin terminating the subtree rooted at cp.  The callback is invoked
+ * exactly once if we return 0.
+ */
+int
+nc_terminate_tree(node_contract_t *cp, int signo, int killsig,
+    boolean_t bottomup, uint64_t escalate, uint64_t timeout,
+    v8plus_jsfunc_t cb)
+{
+	contract_mgr_t *mp = cp->nc_mgr;
+	nc_term_t *tp;
+	nc_tnode_t *np;
+	uint_t i;
+	int err;
+
+	if ((tp = calloc(1, sizeof (nc_term_t))) == NULL)
+		return (ENOMEM);
+
+	tp->nt_mgr = mp;
+	tp->nt_signo = signo;
+	tp->nt_killsig = killsig;
+	tp->nt_bottomup = bottomup;
+	tp->nt_escalate = escalate;
+	tp->nt_timeout = timeout;
+	tp->nt_phase = NTP_SIGNAL;
+	tp->nt_start = gethrtime();
+	tp->nt_started = uv_now(mp->cm_loop);
+
+	if ((err = nc_term_walk(tp, cp->nc_id)) != 0) {
+		for (i = 0; tp->nt_nodes != NULL && i < tp->nt_count; i++) {
+			if (tp->nt_nodes[i].ntn_ev_fd >= 0)
+				(void) close(tp->nt_nodes[i].ntn_ev_fd);
+		}
+		free(tp->nt_nodes);
+		free(tp);
+		return (err);
+	}
+
+	/*
+	 * The node array is now fixed, so the poll handles within it may be
+	 * initialized.
+	 */
+	for (i = 0; i < tp->nt_count; i++) {
+		np = &tp->nt_nodes[i];
+		if (np->ntn_empty || !np->ntn_watched)
+			continue;
+		(void) uv_poll_init(mp->cm_loop, &np->ntn_poll, np->ntn_ev_fd);
+		np->ntn_poll.data = np;
+		(void) uv_poll_start(&np->ntn_poll, UV_READABLE,
+		    nc_term_event_cb);
+		np->ntn_polling = B_TRUE;
+	}
+
+	/*
+	 * The timer is closed last, in nc_term_finish(), so its share of
+	 * nt_closing keeps the operation alive until then.
+	 */
+	(void) uv_timer_init(mp->cm_loop, &tp->nt_timer);
+	tp->nt_timer.data = tp;
+	tp->nt_closing = 1;
+
+	v8plus_jsfunc_hold(cb);
+	tp->nt_cb = cb;
+
+	nc_term_signal(tp, signo, B_FALSE);
+	tp->nt_signalled = gethrtime();
+	tp->nt_phase = NTP_WAIT;
+
+	/*
+	 * Even if everything is already empty, the callback must not be
+	 * invoked before we return.
+	 */
+	(void) uv_timer_start(&tp->nt_timer, nc_term_timer_cb, 0, 0);
+
+	return (0);
+}
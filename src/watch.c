@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Status change subscriptions.  The kernel posts no event when a contract's
+ * state, holder, or service attributes change, so consumers that care must
+ * poll.  Rather than have each of them read and decode full status from JS
+ * on its own timer, a consumer may watch a set of fields on a contract: we
+ * read status natively, at no more detail than the watched fields require,
+ * compare each field against the value last seen, and call into JS only
+ * when something actually changed.
+ *
+ * Each contract manager has one watcher, whose single uv timer is armed for
+ * the earliest time at which any watched contract is due.  Watches are kept
+ * on a list; one removed while we are walking that list (by a callback that
+ * unwatches or disposes of a contract, for example) is only marked, and is
+ * freed once the walk is done.
+ */
+
+#include <sys/types.h>
+#include <sys/debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libcontract.h>
+#include <uv.h>
+#include "node_contract.h"
+
+typedef enum nc_wfield {
+	NWF_STATE,
+	NWF_HOLDER,
+	NWF_NEVENTS,
+	NWF_NTIME,
+	NWF_QTIME,
+	NWF_NEVID,
+	NWF_PR_SVC_FMRI,
+	NWF_PR_SVC_AUX,
+	NWF_PR_SVC_CTID,
+	NWF_PR_SVC_CREATOR,
+	NWF_PR_NMEMBERS,
+	NWF_PR_NCONTRACTS,
+	NWF_DEV_STATE,
+	NWF_DEV_NONEG,
+	NWF_MAX
+} nc_wfield_t;
+
+typedef enum nc_wkind {
+	NWK_NUMBER,
+	NWK_NUMBER64,
+	NWK_STRING,
+	NWK_BOOLEAN,
+	NWK_STATE
+} nc_wkind_t;
+
+typedef struct nc_wfdesc {
+	const char *nwf_name;
+	nc_wkind_t nwf_kind;
+	nc_type_t nwf_type;	/* NCT_MAX if common to all types */
+	int nwf_detail;
+} nc_wfdesc_t;
+
+static const nc_wfdesc_t nws_fields[NWF_MAX] = {
+	{ "state", NWK_STATE, NCT_MAX, CTD_COMMON },
+	{ "holder", NWK_NUMBER, NCT_MAX, CTD_COMMON },
+	{ "nevents", NWK_NUMBER, NCT_MAX, CTD_COMMON },
+	{ "ntime", NWK_NUMBER, NCT_MAX, CTD_COMMON },
+	{ "qtime", NWK_NUMBER, NCT_MAX, CTD_COMMON },
+	{ "nevid", NWK_NUMBER64, NCT_MAX, CTD_COMMON },
+	{ "pr_svc_fmri", NWK_STRING, NCT_PROCESS, CTD_FIXED },
+	{ "pr_svc_aux", NWK_STRING, NCT_PROCESS, CTD_FIXED },
+	{ "pr_svc_ctid", NWK_NUMBER, NCT_PROCESS, CTD_FIXED },
+	{ "pr_svc_creator", NWK_STRING, NCT_PROCESS, CTD_FIXED },
+	{ "pr_nmembers", NWK_NUMBER, NCT_PROCESS, CTD_ALL },
+	{ "pr_ncontracts", NWK_NUMBER, NCT_PROCESS, CTD_ALL },
+	{ "dev_state", NWK_STATE, NCT_DEVICE, CTD_FIXED },
+	{ "dev_noneg", NWK_BOOLEAN, NCT_DEVICE, CTD_FIXED }
+};
+
+typedef struct nc_wval {
+	uint64_t nwv_num;
+	char *nwv_str;
+} nc_wval_t;
+
+struct nc_watch {
+	node_contract_t *nw_cp;
+	uint_t nw_fields;
+	int nw_detail;
+	uint64_t nw_interval;
+	uint64_t nw_due;
+	v8plus_jsfunc_t nw_cb;
+	boolean_t nw_dead;
+	nc_wval_t nw_vals[NWF_MAX];
+	struct nc_watch *nw_next;
+	struct nc_watch **nw_prevp;
+};
+
+struct nc_watcher {
+	contract_mgr_t *nwr_mgr;
+	nc_watch_t *nwr_list;
+	boolean_t nwr_walking;
+	boolean_t nwr_armed;
+	uint64_t nwr_armed_due;
+	uv_timer_t nwr_timer;
+	nc_watch_stats_t nwr_stats;
+};
+
+static void nws_timer_cb(uv_timer_t *, int);
+
+int
+nc_watch_field(const node_contract_t *cp, const char *name)
+{
+	int i;
+
+	for (i = 0; i < NWF_MAX; i++) {
+		if (strcmp(nws_fields[i].nwf_name, name) != 0)
+			continue;
+		if (nws_fields[i].nwf_type != NCT_MAX &&
+		    nws_fields[i].nwf_type != cp->nc_type->nct_type)
+			return (-1);
+		return (i);
+	}
+
+	return (-1);
+}
+
+/*
+ * The watcher is allocated on first use and lives as long as its manager.
+ */
+static nc_watcher_t *
+nws_watcher(contract_mgr_t *mp)
+{
+	nc_watcher_t *wrp;
+
+	if (mp->cm_watcher != NULL)
+		return (mp->cm_watcher);
+
+	if ((wrp = calloc(1, sizeof (nc_watcher_t))) == NULL)
+		return (NULL);
+
+	wrp->nwr_mgr = mp;
+	(void) uv_timer_init(mp->cm_loop, &wrp->nwr_timer);
+	uv_unref((uv_handle_t *)&wrp->nwr_timer);
+	wrp->nwr_timer.data = wrp;
+	mp->cm_watcher = wrp;
+
+	return (wrp);
+}
+
+static void
+nws_arm(nc_watcher_t *wrp, uint64_t due)
+{
+	uint64_t now = uv_now(wrp->nwr_mgr->cm_loop);
+
+	if (wrp->nwr_walking)
+		return;
+	if (wrp->nwr_armed && wrp->nwr_armed_due <= due)
+		return;
+
+	(void) uv_timer_start(&wrp->nwr_timer, nws_timer_cb,
+	    due > now ? due - now : 0, 0);
+	wrp->nwr_armed = B_TRUE;
+	wrp->nwr_armed_due = due;
+}
+
+static void
+nws_free(nc_watch_t *wp)
+{
+	int i;
+
+	for (i = 0; i < NWF_MAX; i++)
+		free(wp->nw_vals[i].nwv_str);
+	v8plus_jsfunc_rele(wp->nw_cb);
+	free(wp);
+}
+
+static void
+nws_unlink(nc_watch_t *wp)
+{
+	*wp->nw_prevp = wp->nw_next;
+	if (wp->nw_next != NULL)
+		wp->nw_next->nw_prevp = wp->nw_prevp;
+}
+
+static void
+nws_read(nc_wfield_t f, ct_stathdl_t st, nc_wval_t *vp)
+{
+	uint_t u = 0;
+	ctid_t id = 0;
+	pid_t *pids;
+	ctid_t *cts;
+	char *s = NULL;
+
+	vp->nwv_num = 0;
+	vp->nwv_str = NULL;
+
+	switch (f) {
+	case NWF_STATE:
+		vp->nwv_num = ct_status_get_state(st);
+		break;
+	case NWF_HOLDER:
+		vp->nwv_num = (uint64_t)ct_status_get_holder(st);
+		break;
+	case NWF_NEVENTS:
+		vp->nwv_num = ct_status_get_nevents(st);
+		break;
+	case NWF_NTIME:
+		vp->nwv_num = ct_status_get_ntime(st);
+		break;
+	case NWF_QTIME:
+		vp->nwv_num = ct_status_get_qtime(st);
+		break;
+	case NWF_NEVID:
+		vp->nwv_num = ct_status_get_nevid(st);
+		break;
+	case NWF_PR_SVC_FMRI:
+		(void) ct_pr_status_get_svc_fmri(st, &s);
+		vp->nwv_str = s;
+		break;
+	case NWF_PR_SVC_AUX:
+		(void) ct_pr_status_get_svc_aux(st, &s);
+		vp->nwv_str = s;
+		break;
+	case NWF_PR_SVC_CTID:
+		(void) ct_pr_status_get_svc_ctid(st, &id);
+		vp->nwv_num = (uint64_t)id;
+		break;
+	case NWF_PR_SVC_CREATOR:
+		(void) ct_pr_status_get_svc_creator(st, &s);
+		vp->nwv_str = s;
+		break;
+	case NWF_PR_NMEMBERS:
+		(void) ct_pr_status_get_members(st, &pids, &u);
+		vp->nwv_num = u;
+		break;
+	case NWF_PR_NCONTRACTS:
+		(void) ct_pr_status_get_contracts(st, &cts, &u);
+		vp->nwv_num = u;
+		break;
+	case NWF_DEV_STATE:
+		(void) ct_dev_status_get_dev_state(st, &u);
+		vp->nwv_num = u;
+		break;
+	case NWF_DEV_NONEG:
+		(void) ct_dev_status_get_noneg(st, &u);
+		vp->nwv_num = (u != 0);
+		break;
+	default:
+		VERIFY(0);
+	}
+}
+
+static boolean_t
+nws_equal(const nc_wfdesc_t *dp, const nc_wval_t *ap, const nc_wval_t *bp)
+{
+	if (dp->nwf_kind != NWK_STRING)
+		return (ap->nwv_num == bp->nwv_num);
+
+	return (strcmp(ap->nwv_str != NULL ? ap->nwv_str : "",
+	    bp->nwv_str != NULL ? bp->nwv_str : "") == 0);
+}
+
+static int
+nws_add(nvlist_t *lp, nc_wfield_t f, const nc_wval_t *vp)
+{
+	const nc_wfdesc_t *dp = &nws_fields[f];
+
+	switch (dp->nwf_kind) {
+	case NWK_NUMBER:
+		return (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_NUMBER, dp->nwf_name, (double)vp->nwv_num,
+		    V8PLUS_TYPE_NONE));
+	case NWK_NUMBER64:
+		return (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_STRNUMBER64, dp->nwf_name, vp->nwv_num,
+		    V8PLUS_TYPE_NONE));
+	case NWK_STRING:
+		return (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_STRING, dp->nwf_name,
+		    vp->nwv_str != NULL ? vp->nwv_str : "",
+		    V8PLUS_TYPE_NONE));
+	case NWK_BOOLEAN:
+		return (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_BOOLEAN, dp->nwf_name,
+		    (boolean_t)(vp->nwv_num != 0),
+		    V8PLUS_TYPE_NONE));
+	case NWK_STATE:
+		return (v8plus_obj_setprops(lp,
+		    V8PLUS_TYPE_STRING, dp->nwf_name,
+		    nc_descr_strlookup(f == NWF_STATE ? nc_ct_states :
+		    nc_dev_states, (uint_t)vp->nwv_num),
+		    V8PLUS_TYPE_NONE));
+	default:
+		VERIFY(0);
+	}
+
+	return (-1);
+}
+
+/*
+ * Record the current value of each watched field in st.  If lp and pp are
+ * supplied, the new and previous values of each field that changed are
+ * added to them.  Returns the number of fields changed, or -1 if we were
+ * unable to build the lists.
+ */
+static int
+nws_update(nc_watch_t *wp, ct_stathdl_t st, nvlist_t *lp, nvlist_t *pp)
+{
+	nc_wval_t v;
+	int i, nchanged = 0;
+
+	for (i = 0; i < NWF_MAX; i++) {
+		if (!(wp->nw_fields & (1U << i)))
+			continue;
+
+		nws_read(i, st, &v);
+		if (lp != NULL && nws_equal(&nws_fields[i], &v,
+		    &wp->nw_vals[i]))
+			continue;
+
+		if (lp != NULL && (nws_add(lp, i, &v) != 0 ||
+		    nws_add(pp, i, &wp->nw_vals[i]) != 0))
+			return (-1);
+
+		free(wp->nw_vals[i].nwv_str);
+		wp->nw_vals[i].nwv_num = v.nwv_num;
+		wp->nw_vals[i].nwv_str =
+		    v.nwv_str != NULL ? strdup(v.nwv_str) : NULL;
+		++nchanged;
+	}
+
+	return (nchanged);
+}
+
+static void
+nws_error(nc_watcher_t *wrp, nc_watch_t *wp, int err)
+{
+	v8plus_jsfunc_t cb = wp->nw_cb;
+	nvlist_t *ap, *rp;
+
+	++wrp->nwr_stats.nws_errors;
+
+	/*
+	 * A contract whose status we can't read has most likely been
+	 * destroyed; we report the error once and stop watching.
+	 */
+	v8plus_jsfunc_hold(cb);
+	nc_watch_fini(wp->nw_cp);
+
+	ap = v8plus_obj(
+	    V8PLUS_TYPE_INL_OBJECT, "0",
+		V8PLUS_TYPE_STRING, "message", strerror(err),
+		V8PLUS_TYPE_NUMBER, "errno", (double)err,
+		V8PLUS_TYPE_NONE,
+	    V8PLUS_TYPE_NONE);
+	if (ap != NULL) {
+		rp = v8plus_call(cb, ap);
+		nvlist_free(ap);
+		nvlist_free(rp);
+	}
+
+	v8plus_jsfunc_rele(cb);
+}
+
+static void
+nws_poll(nc_watcher_t *wrp, nc_watch_t *wp)
+{
+	node_contract_t *cp = wp->nw_cp;
+	nvlist_t *lp = NULL, *pp = NULL, *ap, *rp;
+	ct_stathdl_t st;
+	int err, n;
+
+	++wrp->nwr_stats.nws_polls;
+
+	if ((err = ct_status_read(cp->nc_st_fd, wp->nw_detail, &st)) != 0) {
+		nws_error(wrp, wp, err);
+		return;
+	}
+
+	if ((lp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL ||
+	    (pp = v8plus_obj(V8PLUS_TYPE_NONE)) == NULL) {
+		nvlist_free(lp);
+		ct_status_free(st);
+		++wrp->nwr_stats.nws_errors;
+		return;
+	}
+
+	n = nws_update(wp, st, lp, pp);
+	ct_status_free(st);
+
+	if (n <= 0) {
+		if (n < 0)
+			++wrp->nwr_stats.nws_errors;
+		nvlist_free(lp);
+		nvlist_free(pp);
+		return;
+	}
+
+	wrp->nwr_stats.nws_changes += n;
+	++wrp->nwr_stats.nws_callbacks;
+
+	ap = v8plus_obj(
+	    V8PLUS_TYPE_NULL, "0",
+	    V8PLUS_TYPE_OBJECT, "1", lp,
+	    V8PLUS_TYPE_OBJECT, "2", pp,
+	    V8PLUS_TYPE_NONE);
+	nvlist_free(lp);
+	nvlist_free(pp);
+	if (ap == NULL)
+		return;
+
+	rp = v8plus_call(wp->nw_cb, ap);
+	nvlist_free(ap);
+	nvlist_free(rp);
+}
+
+static void
+nws_timer_cb(uv_timer_t *tp, int status __UNUSED)
+{
+	nc_watcher_t *wrp = tp->data;
+	uint64_t now = uv_now(wrp->nwr_mgr->cm_loop);
+	uint64_t next = UINT64_MAX;
+	nc_watch_t *wp, *nwp;
+
+	wrp->nwr_armed = B_FALSE;
+	++wrp->nwr_stats.nws_ticks;
+
+	wrp->nwr_walking = B_TRUE;
+	for (wp = wrp->nwr_list; wp != NULL; wp = wp->nw_next) {
+		if (wp->nw_dead || wp->nw_due > now)
+			continue;
+
+		/*
+		 * Keep to the original schedule unless we've fallen more than
+		 * an interval behind it.
+		 */
+		wp->nw_due += wp->nw_interval;
+		if (wp->nw_due <= now)
+			wp->nw_due = now + wp->nw_interval;
+
+		nws_poll(wrp, wp);
+	}
+	wrp->nwr_walking = B_FALSE;
+
+	for (wp = wrp->nwr_list; wp != NULL; wp = nwp) {
+		nwp = wp->nw_next;
+		if (wp->nw_dead) {
+			nws_unlink(wp);
+			nws_free(wp);
+		} else if (wp->nw_due < next) {
+			next = wp->nw_due;
+		}
+	}
+
+	if (next != UINT64_MAX)
+		nws_arm(wrp, next);
+}
+
+/*
+ * Begin watching the fields in the mask on this contract, replacing any
+ * existing watch.  The current values are read immediately, so that the
+ * first callback reports changes since this call.
+ */
+int
+nc_watch_init(node_contract_t *cp, uint_t fields, uint64_t interval,
+    v8plus_jsfunc_t cb)
+{
+	contract_mgr_t *mp = cp->nc_mgr;
+	nc_watcher_t *wrp;
+	nc_watch_t *wp;
+	ct_stathdl_t st;
+	int i, err;
+
+	if (fields == 0 || interval == 0)
+		return (EINVAL);
+
+	if ((wrp = nws_watcher(mp)) == NULL)
+		return (ENOMEM);
+	if ((wp = calloc(1, sizeof (nc_watch_t))) == NULL)
+		return (ENOMEM);
+
+	wp->nw_fields = fields;
+	wp->nw_detail = CTD_COMMON;
+	for (i = 0; i < NWF_MAX; i++) {
+		if ((fields & (1U << i)) &&
+		    nws_fields[i].nwf_detail > wp->nw_detail)
+			wp->nw_detail = nws_fields[i].nwf_detail;
+	}
+
+	if ((err = ct_status_read(cp->nc_st_fd, wp->nw_detail, &st)) != 0) {
+		free(wp);
+		return (err);
+	}
+	(void) nws_update(wp, st, NULL, NULL);
+	ct_status_free(st);
+
+	nc_watch_fini(cp);
+
+	wp->nw_cp = cp;
+	wp->nw_interval = interval;
+	wp->nw_due = uv_now(mp->cm_loop) + interval;
+	v8plus_jsfunc_hold(cb);
+	wp->nw_cb = cb;
+
+	wp->nw_next = wrp->nwr_list;
+	if (wp->nw_next != NULL)
+		wp->nw_next->nw_prevp = &wp->nw_next;
+	wp->nw_prevp = &wrp->nwr_list;
+	wrp->nwr_list = wp;
+	cp->nc_watch = wp;
+
+	++wrp->nwr_stats.nws_watched;
+	nws_arm(wrp, wp->nw_due);
+
+	return (0);
+}
+
+void
+nc_watch_fini(node_contract_t *cp)
+{
+	nc_watch_t *wp = cp->nc_watch;
+	nc_watcher_t *wrp = cp->nc_mgr->cm_watcher;
+
+	if (wp == NULL)
+		return;
+
+	cp->nc_watch = NULL;
+	wp->nw_cp = NULL;
+	--wrp->nwr_stats.nws_watched;
+
+	if (wrp->nwr_walking) {
+		wp->nw_dead = B_TRUE;
+		return;
+	}
+
+	nws_unlink(wp);
+	nws_free(wp);
+
+	if (wrp->nwr_list == NULL) {
+		(void) uv_timer_stop(&wrp->nwr_timer);
+		wrp->nwr_armed = B_FALSE;
+	}
+}
+
+boolean_t
+nc_watch_stats(const contract_mgr_t *mp, nc_watch_stats_t *sp)
+{
+	if (mp->cm_watcher == NULL)
+		return (B_FALSE);
+
+	*sp = mp->cm_watcher->nwr_stats;
+
+	return (B_TRUE);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Compare the throughput of the binary contract record codec against
+ * JSON.stringify/JSON.parse for representative events and status records.
+ * Does not require the binding, so it may be run on any platform:
+ *
+ *	node tools/bench-codec.js [iterations]
+ */
+
+var codec = require('../lib/codec.js');
+
+var N = parseInt(process.argv[2] || '200000', 10);
+
+var ev = {
+	ctid: 1234,
+	evid: '9007199254740993',
+	type: 'pr_exit',
+	flags: { info: true, ack: false, neg: false }
+};
+
+var st = {
+	ctid: 1234, zoneid: 0, type: 'process', state: 'owned', holder: 4321,
+	nevents: 0, ntime: -1, qtime: -1, nevid: '0', cookie: '3735928559',
+	informative: { pr_fork: true, pr_exit: true, pr_core: true },
+	critical: { pr_empty: true, pr_hwerr: true },
+	pr_param: { noorphan: true },
+	pr_fatal: { pr_hwerr: true },
+	pr_members: { 0: 4400, 1: 4401, 2: 4402, 3: 4403 },
+	pr_svc_fmri: 'svc:/site/application:default',
+	pr_svc_ctid: 77,
+	pr_svc_creator: 'svc.startd'
+};
+
+function
+run(name, fn)
+{
+	var t = process.hrtime();
+	var i, sink, ns;
+
+	for (i = 0; i < N; i++)
+		sink = fn();
+
+	t = process.hrtime(t);
+	ns = t[0] * 1e9 + t[1];
+	console.log('%s: %d ops/s (%d ns/op)', name,
+	    Math.round(N / (ns / 1e9)), Math.round(ns / N));
+
+	return (sink);
+}
+
+[ [ 'event', ev, codec.encodeEvent ], [ 'status', st, codec.encodeStatus ] ].
+    forEach(function (c) {
+	var name = c[0];
+	var obj = c[1];
+	var enc = c[2];
+	var json = JSON.stringify(obj);
+	var bin = enc(obj);
+
+	console.log('%s record: %d bytes binary, %d bytes JSON', name,
+	    bin.length, Buffer.byteLength(json));
+	run(name + ' encode json', function () {
+		return (new Buffer(JSON.stringify(obj)));
+	});
+	run(name + ' encode binary', function () { return (enc(obj)); });
+	run(name + ' decode json', function () {
+		return (JSON.parse(json).ctid);
+	});
+	run(name + ' decode binary (view)', function () {
+		return (codec.decode(bin).ctid());
+	});
+	run(name + ' decode binary (object)', function () {
+		return (codec.decode(bin).toObject());
+	});
+});
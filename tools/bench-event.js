@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Compare the cost of building event objects the way the binding used to
+ * -- an empty object filled in field by field from the nvlist, with a
+ * nested flags object -- against constructing a ContractEvent, and of a
+ * typical listener's property accesses on each.  Does not require the
+ * binding, so it may be run on any platform:
+ *
+ *	node tools/bench-event.js [iterations]
+ *
+ * Both sides are plain JavaScript.  The "generic" side is a stand-in for
+ * what v8plus does from C++ as it walks the nvlist, setting each property
+ * by name on a fresh object; it does not include crossing from C++ for
+ * each property, nor the building and freeing of the nvlist itself, which
+ * the binding's _event() path also avoids.  What is measured is the cost
+ * of the objects themselves and of the listener's accesses to them, not of
+ * delivering an event through the binding.
+ */
+
+var ContractEvent = require('../lib/event.js').ContractEvent;
+
+var N = parseInt(process.argv[2] || '1000000', 10);
+
+var TYPES = [ 'pr_exit', 'pr_fork', 'pr_empty', 'pr_core' ];
+
+/*
+ * The fields in the form the binding marshalled them: names and values
+ * arrive as the nvlist is walked, and each is set on the object in turn.
+ */
+var PAIRS = [
+	[ 'ctid', 1234 ],
+	[ 'evid', '9007199254740993' ],
+	[ 'type', null ],
+	[ 'flags', [ [ 'info', true ], [ 'ack', false ], [ 'neg', false ] ] ]
+];
+
+function
+fromPairs(pairs, type)
+{
+	var o = {};
+	var i, p;
+
+	for (i = 0; i < pairs.length; i++) {
+		p = pairs[i];
+		if (p[1] === null)
+			o[p[0]] = type;
+		else if (Array.isArray(p[1]))
+			o[p[0]] = fromPairs(p[1], type);
+		else
+			o[p[0]] = p[1];
+	}
+
+	return (o);
+}
+
+function
+listener(ev)
+{
+	return (ev.ctid + ev.type.length + (ev.flags.ack ? 1 : 0));
+}
+
+function
+listenerMask(ev)
+{
+	return (ev.ctid + ev.type.length + (ev.flagsMask & 0x2));
+}
+
+function
+run(name, fn)
+{
+	var t = process.hrtime();
+	var i, sink = 0, ns;
+
+	for (i = 0; i < N; i++)
+		sink += fn(TYPES[i & 3]);
+
+	t = process.hrtime(t);
+	ns = t[0] * 1e9 + t[1];
+	console.log('%s: %d ops/s (%d ns/op)', name,
+	    Math.round(N / (ns / 1e9)), Math.round(ns / N));
+
+	return (sink);
+}
+
+run('build generic', function (type) {
+	return (fromPairs(PAIRS, type).ctid);
+});
+run('build ContractEvent', function (type) {
+	return (new ContractEvent(1234, '9007199254740993', type, 0x1).ctid);
+});
+run('build+listen generic', function (type) {
+	return (listener(fromPairs(PAIRS, type)));
+});
+run('build+listen ContractEvent (flags)', function (type) {
+	return (listener(new ContractEvent(1234, '9007199254740993', type,
+	    0x1)));
+});
+run('build+listen ContractEvent (flagsMask)', function (type) {
+	return (listenerMask(new ContractEvent(1234, '9007199254740993', type,
+	    0x1)));
+});
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Replay an event trace recorded with contract.record.start() through
+ * lib/replay.js, on any platform, and print the replay's statistics as
+ * JSON:
+ *
+ *	node tools/replay.js [options] tracefile
+ *
+ *	--speed <n>		deliver events at n times their recorded rate
+ *				(default 1); 0 delivers them as fast as the
+ *				listeners keep up
+ *	--require <module>	load module, which exports a function called
+ *				with each contract as it is first seen and
+ *				the Replay, to attach the listeners under
+ *				study
+ *	--trace			trace every event, and print the trace
+ *				statistics too
+ */
+
+var path = require('path');
+var Replay = require('../lib/replay.js').Replay;
+
+var opts = {
+	speed: 1,
+	attach: null,
+	trace: false,
+	file: null
+};
+
+function
+usage(msg)
+{
+	if (msg)
+		console.error('replay: ' + msg);
+	console.error('usage: node tools/replay.js [--speed n] ' +
+	    '[--require module] [--trace] tracefile');
+	process.exit(2);
+}
+
+function
+parseArgs(argv)
+{
+	var i;
+
+	for (i = 0; i < argv.length; i++) {
+		if (argv[i] === '--trace') {
+			opts.trace = true;
+		} else if (argv[i] === '--speed' && i + 1 < argv.length) {
+			opts.speed = Number(argv[++i]);
+			if (isNaN(opts.speed) || opts.speed < 0)
+				usage('--speed requires a nonnegative number');
+		} else if (argv[i] === '--require' && i + 1 < argv.length) {
+			opts.attach = require(path.resolve(argv[++i]));
+			if (typeof (opts.attach) !== 'function')
+				usage(argv[i] + ' does not export a function');
+		} else if (argv[i].charAt(0) === '-' || opts.file !== null) {
+			usage('unexpected argument ' + argv[i]);
+		} else {
+			opts.file = argv[i];
+		}
+	}
+
+	if (opts.file === null)
+		usage('no trace file');
+}
+
+function
+main()
+{
+	var r, contract;
+
+	parseArgs(process.argv.slice(2));
+
+	try {
+		r = new Replay(opts.file, { speed: opts.speed });
+	} catch (e) {
+		console.error('replay: ' + e.message);
+		process.exit(1);
+	}
+
+	contract = require('../lib/index.js');
+	if (opts.trace)
+		contract.trace.enable({ every: 1 });
+
+	r.on('contract', function (c) {
+		if (opts.attach !== null)
+			opts.attach(c, r);
+	});
+	r.on('error', function (err) {
+		console.error('replay: ' + err.message);
+		process.exit(1);
+	});
+	r.on('end', function (stats) {
+		var out = { replay: stats };
+
+		if (opts.trace)
+			out.trace = contract.trace.stats();
+		console.log(JSON.stringify(out, null, 4));
+	});
+
+	r.start();
+}
+
+main();
@@ -0,0 +1,865 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Soak the binding under sustained contract churn: create, observe, adopt
+ * and dispose of contracts, set and clear templates, tear everything down
+ * with disposeAll(), and deliver storms of events, for as long as asked.
+ * Once per interval we sample RSS, descriptors, the size of the registry,
+ * events lost and event latency percentiles, and fail (exiting 1) if the
+ * registry disagrees with what we hold, anything leaks, an event is lost,
+ * or RSS or descriptors grow beyond the baseline taken after warm-up.
+ *
+ *	node tools/soak.js [options]
+ *
+ *	--native		use the real binding and real process
+ *				contracts (illumos only); the default is a
+ *				simulated backend that runs anywhere
+ *	--duration <secs>	how long to run (default 60; 0 runs forever)
+ *	--interval <secs>	how often to sample (default 5)
+ *	--contracts <n>		contracts to keep held (default 200)
+ *	--ops <n>		churn operations per tick (default 20)
+ *	--storm <n>		events per storm (default 1000)
+ *	--observe <n>		with --native, also observe n contracts held
+ *				by ctrun(1), each running a fork loop
+ *	--rss-growth <pct>	RSS growth allowed past the baseline
+ *				(default 20)
+ *
+ * The simulated backend stands in for lib/contract_binding and mimics its
+ * bookkeeping -- registry, holds, descriptors, event delivery through the
+ * prototype's _event() -- so it exercises everything above the native layer;
+ * only --native exercises the native layer itself.  Adoption requires
+ * orphaned contracts, which we cannot make on demand, so it is simulated
+ * only.
+ *
+ * With --native, each sample also reports, from eventSources(), how long
+ * the pbundle and the observed contracts' sources each waited to be
+ * serviced, and the critical and informative lanes' delivery latency, so
+ * that a pbundle storm (--storm) can be run against observed contracts
+ * (--observe) to see how each fares.
+ */
+
+var child_process = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var Module = require('module');
+
+var LIBDIR = path.join(__dirname, '..', 'lib');
+var FLAG_INFO = require('../lib/event.js').FLAG_INFO;
+var FLAG_ACK = require('../lib/event.js').FLAG_ACK;
+var WARMUP = 3;		/* intervals before taking the baseline */
+var FD_SLACK = 16;
+
+var opts = {
+	native: false,
+	duration: 60,
+	interval: 5,
+	contracts: 200,
+	ops: 20,
+	storm: 1000,
+	observe: 0,
+	rssGrowth: 20
+};
+
+var contract;
+var backend;
+
+function
+usage(msg)
+{
+	if (msg)
+		console.error('soak: ' + msg);
+	console.error('usage: node tools/soak.js [--native] ' +
+	    '[--duration secs] [--interval secs]\n    [--contracts n] ' +
+	    '[--ops n] [--storm n] [--observe n] [--rss-growth pct]');
+	process.exit(2);
+}
+
+function
+parseArgs(argv)
+{
+	var names = {
+		'--duration': 'duration',
+		'--interval': 'interval',
+		'--contracts': 'contracts',
+		'--ops': 'ops',
+		'--storm': 'storm',
+		'--observe': 'observe',
+		'--rss-growth': 'rssGrowth'
+	};
+	var i, v;
+
+	for (i = 0; i < argv.length; i++) {
+		if (argv[i] === '--native') {
+			opts.native = true;
+			continue;
+		}
+		if (names[argv[i]] === undefined || i + 1 >= argv.length)
+			usage('unknown option ' + argv[i]);
+		v = Number(argv[++i]);
+		if (isNaN(v) || v < 0)
+			usage(argv[i - 1] + ' requires a nonnegative number');
+		opts[names[argv[i - 1]]] = v;
+	}
+
+	if (opts.observe > 0 && !opts.native)
+		usage('--observe requires --native');
+}
+
+function
+now()
+{
+	var t = process.hrtime();
+
+	return (t[0] * 1e6 + t[1] / 1e3);
+}
+
+function
+pick(arr)
+{
+	return (arr[Math.floor(Math.random() * arr.length)]);
+}
+
+/*
+ * The simulated kernel and binding.
+ */
+function
+SimKernel()
+{
+	this.next = 100000;
+	this.contracts = {};	/* every contract "in the kernel" */
+	this.orphans = [];
+	this.latest = 0;
+	this.tmpl = null;
+	this.registry = {};	/* held native objects, by ctid */
+	this.nregistered = 0;
+	this.duplicates = 0;
+	this.fds = 0;
+	this.emitted = 0;
+	this.evid = 1;
+	this.traceEvery = 0;
+	this.traceCount = 0;
+	this.recording = false;
+}
+
+SimKernel.prototype.create = function create(orphan) {
+	var ctid = this.next++;
+
+	this.contracts[ctid] = { ctid: ctid, owned: !orphan, pending: {} };
+	if (orphan)
+		this.orphans.push(ctid);
+	else
+		this.latest = ctid;
+
+	return (ctid);
+};
+
+SimKernel.prototype.binding = function binding() {
+	var k = this;
+
+	function
+	SimContract(args)
+	{
+		var ctid = args[0] === undefined ? k.latest : args[0];
+		var kc = k.contracts[ctid];
+
+		if (kc === undefined || ctid === 0)
+			throw (new Error('unable to open contract ' + ctid));
+
+		if (args[1] === true) {
+			if (kc.owned)
+				throw (new Error('contract ' + ctid +
+				    ' is already owned'));
+			kc.owned = true;
+			k.orphans.splice(k.orphans.indexOf(ctid), 1);
+		}
+
+		this.ctid = ctid;
+		this.refcnt = 0;
+		this.disposed = false;
+		this.observing = args[0] !== undefined && args[1] !== true;
+		this.nfds = this.observing ? 3 : 2;
+		k.fds += this.nfds;
+	}
+
+	SimContract.prototype._hold = function _hold() {
+		if (this.disposed)
+			throw (new Error('this contract has been disposed'));
+		if (++this.refcnt !== 1)
+			return;
+		if (k.registry[this.ctid] !== undefined)
+			k.duplicates++;
+		else
+			k.nregistered++;
+		k.registry[this.ctid] = this;
+	};
+
+	SimContract.prototype._shutdown = function _shutdown() {
+		if (k.registry[this.ctid] === this) {
+			delete k.registry[this.ctid];
+			k.nregistered--;
+		}
+		this.disposed = true;
+		this.refcnt = 0;
+		k.fds -= this.nfds;
+		this.nfds = 0;
+	};
+
+	SimContract.prototype._rele = function _rele() {
+		if (this.refcnt !== 0 && --this.refcnt === 0)
+			this._shutdown();
+		return (this.refcnt);
+	};
+
+	SimContract.prototype._ctid = function _ctid() {
+		return (this.ctid);
+	};
+
+	SimContract.prototype._adopt = function _adopt() {
+		var kc = k.contracts[this.ctid];
+
+		if (kc.owned)
+			throw (new Error('contract ' + this.ctid +
+			    ' is already owned'));
+		kc.owned = true;
+		k.orphans.splice(k.orphans.indexOf(this.ctid), 1);
+		if (this.observing) {
+			this.observing = false;
+			this.nfds--;
+			k.fds--;
+		}
+	};
+
+	SimContract.prototype._status = function _status() {
+		if (this.disposed)
+			throw (new Error('this contract has been disposed'));
+		return ({ ctid: this.ctid, state: 'owned' });
+	};
+
+	SimContract.prototype._ack = function _ack(evid) {
+		var kc = k.contracts[this.ctid];
+
+		if (kc.pending[evid] === undefined)
+			throw (new Error('no such event ' + evid));
+		delete kc.pending[evid];
+	};
+
+	SimContract.prototype._nack = SimContract.prototype._ack;
+
+	return ({
+		_new: function () { return (new SimContract(arguments)); },
+		_latest_ctid: function () { return (k.latest); },
+		_set_template: function (t) {
+			if (typeof (t) !== 'object' || t === null)
+				throw (new TypeError(
+				    'template must be an object'));
+			k.tmpl = t;
+		},
+		_clear_template: function () { k.tmpl = null; },
+		_dispose_all: function (cb) {
+			var n = 0;
+
+			Object.keys(k.registry).forEach(function (ctid) {
+				k.registry[ctid]._shutdown();
+				n++;
+			});
+			if (cb !== undefined)
+				setTimeout(function () { cb(null, n); }, 0);
+		},
+		_mgr_stats: function () {
+			return ({
+				contracts: k.nregistered,
+				leaked: 0,
+				duplicates: k.duplicates,
+				fds: k.fds
+			});
+		},
+		_trace: function (every) {
+			k.traceEvery = every;
+			k.traceCount = 0;
+		},
+		_record: function (on) {
+			k.recording = on;
+		}
+	});
+};
+
+/*
+ * Deliver n events spread across held contracts, as a drain of the
+ * pbundle would: synchronously, from one turn of the loop, each through
+ * the native object's _event().
+ */
+SimKernel.prototype.storm = function storm(n) {
+	var ctids = Object.keys(this.registry);
+	var wakeup = now();
+	var i, obj, evid, type, mask;
+
+	if (ctids.length === 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		obj = this.registry[pick(ctids)];
+		if (obj === undefined || obj.disposed)
+			continue;
+		/*
+		 * Some events are critical and must be acknowledged.
+		 */
+		evid = String(this.evid++);
+		if (i % 100 === 99) {
+			type = 'pr_empty';
+			mask = FLAG_ACK;
+			this.contracts[obj.ctid].pending[evid] = true;
+		} else {
+			type = 'pr_exit';
+			mask = FLAG_INFO;
+		}
+		this.emitted++;
+		if (this.recording || (this.traceEvery !== 0 &&
+		    ++this.traceCount % this.traceEvery === 0)) {
+			obj._event(type, obj.ctid, evid, mask, undefined,
+			    undefined, wakeup, now());
+		} else {
+			obj._event(type, obj.ctid, evid, mask);
+		}
+	}
+};
+
+/*
+ * Substitute the simulated binding for lib/contract_binding.
+ */
+function
+loadSimulated()
+{
+	var kernel = new SimKernel();
+	var id = path.join(LIBDIR, 'contract_binding.sim');
+	var resolve = Module._resolveFilename;
+	var m = new Module(id, module);
+
+	m.filename = id;
+	m.loaded = true;
+	m.exports = kernel.binding();
+	require.cache[id] = m;
+
+	Module._resolveFilename = function (request, parent) {
+		if (request === './contract_binding' && parent &&
+		    path.dirname(parent.filename) === LIBDIR)
+			return (id);
+		return (resolve.apply(this, arguments));
+	};
+
+	return (kernel);
+}
+
+/*
+ * Each backend supplies spawn(cb), which creates a contract through the
+ * active template and calls back with its Contract, or with an error;
+ * storm(), which provokes a burst of events; and fds(), the number of
+ * descriptors the binding holds.  Contracts spawned natively run a short
+ * script and are disposed of once empty; every one must report pr_empty.
+ */
+function
+SimBackend()
+{
+	this.kernel = loadSimulated();
+	contract = require('../lib/index.js');
+}
+
+SimBackend.prototype.spawn = function spawn(cb) {
+	this.kernel.create(false);
+	cb(null, contract.latest());
+};
+
+SimBackend.prototype.orphan = function orphan() {
+	return (this.kernel.create(true));
+};
+
+SimBackend.prototype.storm = function storm(n) {
+	this.kernel.storm(n);
+};
+
+SimBackend.prototype.emitted = function emitted() {
+	return (this.kernel.emitted);
+};
+
+SimBackend.prototype.fds = function fds() {
+	return (this.kernel.fds);
+};
+
+function
+NativeBackend()
+{
+	contract = require('../lib/index.js');
+	this.stormPending = 0;
+}
+
+NativeBackend.prototype.spawn = function spawn(cb) {
+	var n = this.stormPending;
+	var child, c;
+
+	this.stormPending = 0;
+	child = child_process.spawn('/bin/sh', [ '-c',
+	    'i=0; while [ $i -lt ' + n + ' ]; do /bin/true & i=$((i+1)); ' +
+	    'done; wait' ], { stdio: 'ignore' });
+
+	try {
+		c = contract.latest();
+	} catch (e) {
+		cb(e);
+		return;
+	}
+	child.on('exit', function () { c._exited = now(); });
+	cb(null, c);
+};
+
+NativeBackend.prototype.orphan = function orphan() {
+	return (undefined);
+};
+
+/*
+ * The next contract spawned forks this many processes, each of which
+ * generates a fork and an exit event.
+ */
+NativeBackend.prototype.storm = function storm(n) {
+	this.stormPending += n;
+};
+
+NativeBackend.prototype.emitted = function emitted() {
+	return (undefined);
+};
+
+/*
+ * Start a process contract held by ctrun(1) whose members fork continually
+ * for as long as we run, and call back with its ctid and the ctrun process.
+ */
+NativeBackend.prototype.observable = function observable(cb) {
+	var child, buf = '';
+
+	child = child_process.spawn('/usr/bin/ctrun', [ '-l', 'child',
+	    '-i', 'fork,exit', '/bin/sh', '-c',
+	    'ps -o ctid= -p $$; while kill -0 ' + process.pid +
+	    ' 2>/dev/null; do /bin/true; done' ],
+	    { stdio: [ 'ignore', 'pipe', 'ignore' ] });
+
+	child.stdout.on('data', function (d) {
+		var ctid;
+
+		if (buf === null)
+			return;
+		buf += d;
+		if (buf.indexOf('\n') === -1)
+			return;
+
+		ctid = Number(buf.trim());
+		buf = null;
+		if (isNaN(ctid) || ctid <= 0) {
+			child.kill();
+			cb(new Error('ctrun reported no contract'));
+			return;
+		}
+		cb(null, ctid, child);
+	});
+};
+
+NativeBackend.prototype.fds = function fds() {
+	try {
+		return (fs.readdirSync('/proc/self/fd').length);
+	} catch (e) {
+		return (undefined);
+	}
+};
+
+/*
+ * The churn itself.
+ */
+var TEMPLATES = [ {
+	type: 'process',
+	critical: { pr_empty: true, pr_hwerr: true },
+	informative: { pr_fork: true, pr_exit: true },
+	param: { noorphan: true }
+}, {
+	type: 'process',
+	critical: { pr_empty: true },
+	informative: { pr_exit: true },
+	param: { noorphan: true },
+	cookie: '0x50a4'
+} ];
+
+var held = {};		/* Contract objects we hold, by ctid */
+var nheld = 0;
+var extra = [];		/* additional references from observe() */
+var received = 0;
+var emptied = 0;
+var pendingEmpty = {};	/* natively spawned contracts not yet empty */
+var observed = [];	/* contracts held by ctrun, with their Contracts */
+var observedEvents = 0;
+var failures = [];
+var samples = [];
+var start;
+
+function
+fail(msg)
+{
+	failures.push(msg);
+}
+
+function
+track(c)
+{
+	if (held[c.ctid] !== undefined) {
+		fail('contract ' + c.ctid + ' returned twice by latest()');
+		return;
+	}
+	held[c.ctid] = c;
+	nheld++;
+
+	c.on('lost', function (ev) {
+		fail('contract ' + ev.ctid + ' lost ' + ev.count +
+		    (ev.unknown ? ' or more' : '') + ' events');
+	});
+	c.on('pr_exit', function () { received++; });
+	c.on('pr_fork', function () { received++; });
+	c.on('pr_empty', function (ev) {
+		received++;
+		emptied++;
+		delete pendingEmpty[c.ctid];
+		if (ev.flags.ack)
+			c.ack(ev.evid);
+		if (opts.native)
+			release(c);
+	});
+	if (opts.native)
+		pendingEmpty[c.ctid] = now();
+}
+
+function
+release(c)
+{
+	if (held[c.ctid] !== c)
+		return;
+	delete held[c.ctid];
+	nheld--;
+	c.removeAllListeners();
+
+	extra = extra.filter(function (x) {
+		if (x.ctid !== c.ctid)
+			return (true);
+		x.dispose();
+		return (false);
+	});
+	c.dispose();
+}
+
+function
+churnOne()
+{
+	var ctids = Object.keys(held);
+	var op = Math.random();
+	var c, ctid;
+
+	if (nheld < opts.contracts && op < 0.5) {
+		contract.set_template(pick(TEMPLATES));
+		backend.spawn(function (err, nc) {
+			if (err) {
+				fail('spawn: ' + err.message);
+				return;
+			}
+			track(nc);
+		});
+		contract.clear_template();
+	} else if (op < 0.65 && ctids.length > 0) {
+		/*
+		 * A second reference to a contract we hold must be a handle
+		 * of its own on the same native object, and must not register
+		 * it again.
+		 */
+		ctid = Number(pick(ctids));
+		c = contract.observe(ctid);
+		if (c === held[ctid] || c._binding !== held[ctid]._binding)
+			fail('observe(' + ctid + ') did not share ' +
+			    'the contract');
+		extra.push(c);
+	} else if (op < 0.7 && (ctid = backend.orphan()) !== undefined) {
+		track(contract.adopt(ctid));
+	} else if (op < 0.85 && extra.length > 0) {
+		extra.pop().dispose();
+	} else if (!opts.native && ctids.length > 0) {
+		release(held[pick(ctids)]);
+	}
+}
+
+/*
+ * (Re)observe every contract held by ctrun.
+ */
+function
+observeAll()
+{
+	observed.forEach(function (o) {
+		o.contract = contract.observe(o.ctid);
+		o.contract.on('lost', function (ev) {
+			fail('observed contract ' + ev.ctid + ' lost ' +
+			    ev.count + (ev.unknown ? ' or more' : '') +
+			    ' events');
+		});
+		o.contract.on('pr_fork', function () { observedEvents++; });
+		o.contract.on('pr_exit', function () { observedEvents++; });
+	});
+}
+
+function
+disposeEverything(cb)
+{
+	held = {};
+	nheld = 0;
+	extra = [];
+	pendingEmpty = {};
+	observed.forEach(function (o) { o.contract = null; });
+	contract.disposeAll(function () { cb(); });
+}
+
+/*
+ * How long each kind of source waited to be serviced, and how long each
+ * lane took to deliver, since the sources were created.
+ */
+function
+sourceWaits()
+{
+	var es = contract.eventSources();
+	var out = {};
+
+	[ 'process', 'contract' ].forEach(function (k) {
+		var st = es[k];
+
+		out[k === 'process' ? 'pbundle' : k] = {
+			waits: st.waits,
+			wait_mean_us: Math.round(st.wait_mean_us),
+			wait_max_us: Math.round(st.wait_max_us),
+			priority: st.priority,
+			critical_mean_us:
+			    Math.round(st.lanes.critical.latency_mean_us),
+			critical_max_us:
+			    Math.round(st.lanes.critical.latency_max_us),
+			informative_mean_us:
+			    Math.round(st.lanes.informative.latency_mean_us),
+			informative_max_us:
+			    Math.round(st.lanes.informative.latency_max_us)
+		};
+	});
+
+	return (out);
+}
+
+function
+percentile(buckets, count, p)
+{
+	var want = Math.ceil(count * p);
+	var seen = 0;
+	var i;
+
+	for (i = 0; i < buckets.length; i++) {
+		seen += buckets[i];
+		if (seen >= want)
+			return (1 << i);
+	}
+
+	return (Infinity);
+}
+
+function
+sample(prevTrace)
+{
+	var st = contract.stats();
+	var tr = contract.trace.stats();
+	var total = tr.stages.total;
+	var buckets = total ? total.buckets.slice(0) : [];
+	var count = total ? total.count : 0;
+	var emitted = backend.emitted();
+	var s, i, late;
+
+	if (prevTrace !== null) {
+		for (i = 0; i < buckets.length; i++)
+			buckets[i] -= prevTrace.buckets[i];
+		count -= prevTrace.count;
+	}
+
+	s = {
+		t: Math.round((now() - start) / 1e6),
+		rss: process.memoryUsage().rss,
+		fds: backend.fds(),
+		registry: st.contracts,
+		held: nheld + observed.filter(function (o) {
+			return (o.contract !== null);
+		}).length,
+		leaked: st.leaked,
+		received: received,
+		emptied: emptied,
+		lost: emitted === undefined ? 0 : emitted - received,
+		p50_us: count === 0 ? 0 : percentile(buckets, count, 0.5),
+		p99_us: count === 0 ? 0 : percentile(buckets, count, 0.99),
+		p999_us: count === 0 ? 0 : percentile(buckets, count, 0.999)
+	};
+
+	if (opts.native) {
+		s.observed_events = observedEvents;
+		s.sources = sourceWaits();
+	}
+
+	if (s.registry !== s.held)
+		fail('registry holds ' + s.registry + ' contracts, expected ' +
+		    s.held);
+	if (s.leaked !== 0)
+		fail(s.leaked + ' contracts leaked');
+	if (st.duplicates)
+		fail(st.duplicates + ' duplicate registry entries');
+	if (s.lost !== 0)
+		fail(s.lost + ' events lost');
+	if (st.events_lost)
+		fail('binding counted ' + st.events_lost + ' events lost');
+
+	Object.keys(pendingEmpty).forEach(function (ctid) {
+		var c = held[ctid];
+
+		if (c !== undefined && c._exited !== undefined &&
+		    now() - c._exited > 30e6)
+			late = ctid;
+	});
+	if (late !== undefined)
+		fail('no pr_empty for contract ' + late + ' 30s after exit');
+
+	samples.push(s);
+	console.log(JSON.stringify(s));
+
+	return (total ? { buckets: total.buckets.slice(0),
+	    count: total.count } : null);
+}
+
+/*
+ * Once warm, neither RSS nor descriptors (allowing for what we hold) may
+ * grow past the baseline.
+ */
+function
+checkGrowth()
+{
+	var base, last, fdBase;
+
+	if (samples.length <= WARMUP)
+		return;
+
+	base = samples[WARMUP];
+	last = samples[samples.length - 1];
+
+	if (last.rss > base.rss * (1 + opts.rssGrowth / 100) &&
+	    last.rss - base.rss > 16 * 1024 * 1024) {
+		fail('RSS grew from ' + base.rss + ' to ' + last.rss);
+	}
+
+	if (base.fds !== undefined) {
+		fdBase = base.fds - base.held * 3;
+		if (last.fds > fdBase + last.held * 3 + FD_SLACK)
+			fail('descriptors grew from ' + base.fds + ' to ' +
+			    last.fds + ' with ' + last.held +
+			    ' contracts held');
+	}
+}
+
+function
+finish(code)
+{
+	contract.trace.disable();
+	observed.forEach(function (o) { o.child.kill(); });
+	if (failures.length > 0) {
+		failures.forEach(function (f) { console.error('FAIL: ' + f); });
+		code = 1;
+	} else {
+		console.error('soak: passed after %d seconds',
+		    Math.round((now() - start) / 1e6));
+	}
+	process.exit(code);
+}
+
+function
+tick()
+{
+	var i;
+
+	for (i = 0; i < opts.ops; i++)
+		churnOne();
+	if (Math.random() < 0.1)
+		backend.storm(opts.storm);
+}
+
+function
+startObserved(n, cb)
+{
+	if (observed.length === n) {
+		observeAll();
+		cb();
+		return;
+	}
+
+	backend.observable(function (err, ctid, child) {
+		if (err) {
+			console.error('soak: ' + err.message);
+			process.exit(1);
+		}
+		observed.push({ ctid: ctid, child: child, contract: null });
+		startObserved(n, cb);
+	});
+}
+
+function
+main()
+{
+	parseArgs(process.argv.slice(2));
+	backend = opts.native ? new NativeBackend() : new SimBackend();
+	startObserved(opts.observe, run);
+}
+
+function
+run()
+{
+	var prevTrace = null;
+	var fdStart, ticker, sampler, intervals = 0;
+
+	contract.trace.enable({ every: 1 });
+	fdStart = backend.fds();
+	start = now();
+
+	ticker = setInterval(tick, 10);
+
+	sampler = setInterval(function () {
+		prevTrace = sample(prevTrace);
+		checkGrowth();
+
+		/*
+		 * Every so often, tear everything down at once.
+		 */
+		if (++intervals % 12 === 0) {
+			clearInterval(ticker);
+			disposeEverything(function () {
+				observeAll();
+				ticker = setInterval(tick, 10);
+			});
+		}
+
+		if (failures.length > 0 || (opts.duration !== 0 &&
+		    now() - start >= opts.duration * 1e6)) {
+			clearInterval(ticker);
+			clearInterval(sampler);
+			disposeEverything(function () {
+				var fds = backend.fds();
+
+				if (contract.stats().contracts !== 0)
+					fail('registry not empty after ' +
+					    'disposeAll()');
+				if (fds !== undefined && fds > fdStart)
+					fail('descriptors not all closed: ' +
+					    fds + ' open, ' + fdStart +
+					    ' at start');
+				finish(0);
+			});
+		}
+	}, opts.interval * 1000);
+}
+
+main();
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * The binary record codec.  It is pure JS, so unlike the rest of the
+ * binding it can be checked anywhere: records must survive a round trip,
+ * 64-bit event ids and cookies included, and malformed frames must be
+ * refused rather than misread.
+ */
+
+var codec = require('../lib/codec');
+var test = require('tap').test;
+
+/*
+ * Event ids and cookies as the binding hands them to us, and as decode()
+ * must give them back.  The first few fit in a double; the rest don't.
+ */
+var U64 = [
+	[ '0', '0' ],
+	[ '42', '42' ],
+	[ '4294967296', '4294967296' ],
+	[ '9007199254740991', '9007199254740991' ],
+	[ '9007199254740992', '9007199254740992' ],
+	[ '9007199254740993', '9007199254740993' ],
+	[ '12345678901234567890', '12345678901234567890' ],
+	[ '18446744073709551615', '18446744073709551615' ],
+	[ '0xffffffffffffffff', '18446744073709551615' ],
+	[ '0x20000000000001', '9007199254740993' ]
+];
+
+function
+event(evid)
+{
+	return ({
+		ctid: 1234,
+		evid: evid,
+		type: 'pr_empty',
+		flags: { info: false, ack: true, neg: false }
+	});
+}
+
+test('event ids round-trip', function (t) {
+	U64.forEach(function (v) {
+		var buf = codec.encodeEvent(event(v[0]));
+		var ev = codec.decode(buf);
+
+		t.equal(buf.length, codec.EVENT_LENGTH, v[0] + ': length');
+		t.equal(ev.evid(), v[1], v[0] + ': evid');
+	});
+
+	t.equal(codec.decode(codec.encodeEvent(event(1000001))).evid(),
+	    '1000001', 'a numeric evid');
+	t.end();
+});
+
+test('negend events round-trip', function (t) {
+	var ev = event('18446744073709551557');
+	var out;
+
+	ev.type = 'negend';
+	ev.flags = { info: true, ack: false, neg: false };
+	ev.nevid = '9007199254741001';
+	ev.newct = 5678;
+
+	out = codec.decode(codec.encodeEvent(ev)).toObject();
+	t.deepEqual(out, ev, 'every field survives');
+
+	delete ev.nevid;
+	delete ev.newct;
+	out = codec.decode(codec.encodeEvent(ev)).toObject();
+	t.equal(out.nevid, undefined, 'no nevid unless one was given');
+	t.equal(out.newct, undefined, 'no newct unless one was given');
+	t.end();
+});
+
+test('events encode in place', function (t) {
+	var buf = new Buffer(3 + 2 * codec.EVENT_LENGTH);
+
+	codec.encodeEvent(event('1'), buf, 3);
+	codec.encodeEvent(event('18446744073709551615'), buf,
+	    3 + codec.EVENT_LENGTH);
+
+	t.equal(codec.frameLength(buf, 3), codec.EVENT_LENGTH, 'first frame');
+	t.equal(codec.decode(buf, 3).evid(), '1', 'first evid');
+	t.equal(codec.decode(buf, 3 + codec.EVENT_LENGTH).evid(),
+	    '18446744073709551615', 'second evid');
+	t.end();
+});
+
+test('status records round-trip', function (t) {
+	var st = {
+		ctid: 1234,
+		zoneid: 0,
+		type: 'process',
+		state: 'owned',
+		holder: 99,
+		nevents: 2,
+		ntime: -1,
+		qtime: -1,
+		nevid: '9007199254740993',
+		cookie: '18446744073709551615',
+		informative: {
+			negend: false, pr_empty: false, pr_fork: true,
+			pr_exit: false, pr_core: true, pr_signal: false,
+			pr_hwerr: false
+		},
+		critical: {
+			negend: false, pr_empty: true, pr_fork: false,
+			pr_exit: false, pr_core: false, pr_signal: false,
+			pr_hwerr: true
+		},
+		pr_param: {
+			inherit: false, noorphan: true, pgrponly: false,
+			regent: false
+		},
+		pr_members: { '0': 101, '1': 102, '2': 103 },
+		pr_svc_fmri: 'svc:/site/app:default',
+		pr_svc_ctid: 77,
+		pr_svc_creator: 'node'
+	};
+	var buf = codec.encodeStatus(st);
+	var view = codec.decode(buf);
+
+	t.equal(codec.frameLength(buf), buf.length, 'frame length');
+	t.equal(view.kind, 'status', 'kind');
+	t.equal(view.svcFmri(), st.pr_svc_fmri, 'fmri, read lazily');
+	t.equal(view.memberCount(), 3, 'member count, read lazily');
+	t.deepEqual(view.toObject(), st, 'every field survives');
+	t.end();
+});
+
+test('unknown status fields are skipped', function (t) {
+	var st = { ctid: 1, type: 'process', state: 'owned', cookie: '7',
+	    pr_svc_fmri: 'svc:/a' };
+	var buf = codec.encodeStatus(st);
+	var ext = new Buffer(buf.length + 10);
+	var view;
+
+	buf.copy(ext);
+	ext.writeUInt32LE(ext.length, 4);
+	ext.writeUInt16LE(0x7fff, buf.length);
+	ext.writeUInt32LE(4, buf.length + 2);
+	ext.writeUInt32LE(0xdeadbeef, buf.length + 6);
+
+	view = codec.decode(ext);
+	t.equal(view.svcFmri(), 'svc:/a', 'known field still found');
+	t.equal(view.toObject().cookie, '7', 'fixed fields intact');
+	t.end();
+});
+
+test('incomplete frames', function (t) {
+	var buf = codec.encodeEvent(event('1'));
+
+	t.equal(codec.frameLength(buf.slice(0, 4)), -1, 'short header');
+	t.equal(codec.frameLength(buf.slice(0, 12)), -1, 'short body');
+	t.throws(function () {
+		codec.decode(buf.slice(0, 12));
+	}, 'decoding a truncated frame throws');
+	t.end();
+});
+
+test('malformed frames', function (t) {
+	function
+	broken(what, off, v, width)
+	{
+		var buf = codec.encodeEvent(event('1'));
+
+		if (width === 4)
+			buf.writeUInt32LE(v, off);
+		else
+			buf[off] = v;
+
+		t.throws(function () {
+			codec.decode(buf);
+		}, what);
+	}
+
+	broken('bad magic', 0, 0x00);
+	broken('unsupported version', 1, codec.VERSION + 1);
+	broken('unknown kind', 2, 0x7f);
+	broken('length shorter than the header', 4, 4, 4);
+	broken('event of the wrong length', 4, codec.EVENT_LENGTH - 4, 4);
+	broken('status shorter than its fixed part', 2, codec.KIND_STATUS);
+
+	t.throws(function () {
+		codec.frameLength(new Buffer([ 0x12, 1, 1, 0, 40, 0, 0, 0 ]));
+	}, 'frameLength checks the magic');
+	t.end();
+});
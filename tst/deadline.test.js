@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Deadline tracking under simulated device contracts.  The wheel is native
+ * but free of system dependencies, so we build it with deadline_sim.c, which
+ * simulates the contracts and the clock, and check each of its results.
+ */
+
+var child_process = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var test = require('tap').test;
+
+var CC = process.env.CC || 'cc';
+var SRCDIR = path.join(__dirname, '..', 'src');
+
+test('deadline wheel under simulated device contracts', function (t) {
+	var exe = path.join(process.env.TMPDIR || '/tmp',
+	    'deadline_sim.' + process.pid);
+	var args = [ '-std=gnu99', '-Wall', '-Wextra', '-Werror', '-o', exe,
+	    path.join(SRCDIR, 'dlwheel.c'),
+	    path.join(__dirname, 'deadline_sim.c') ];
+
+	child_process.execFile(CC, args, function (err, stdout, stderr) {
+		t.ifError(err, 'build: ' + stderr);
+		if (err) {
+			t.end();
+			return;
+		}
+
+		child_process.execFile(exe, [], function (err2, out) {
+			var planned;
+
+			fs.unlinkSync(exe);
+			out.split('\n').forEach(function (line) {
+				var m;
+
+				if ((m = /^(not )?ok \d+ - (.*)$/.exec(line)))
+					t.ok(m[1] === undefined, m[2]);
+				else if ((m = /^1\.\.(\d+)$/.exec(line)))
+					planned = Number(m[1]);
+			});
+			t.ok(planned > 0, 'simulation ran to completion');
+			t.ifError(err2, 'simulation exit status');
+			t.end();
+		});
+	});
+});
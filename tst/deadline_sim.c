@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Drive the deadline wheel (src/dlwheel.c) with simulated device
+ * contracts and a simulated clock, standing in for what deadline.c asks of
+ * libcontract, libuv and V8, and report the results as TAP.  Built and run
+ * by deadline.test.js; it needs nothing but a C compiler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/dlwheel.h"
+
+#define	__UNUSED	__attribute__((__unused__))
+
+/*
+ * A simulated device contract: the negotiation time the kernel reports,
+ * whether qacks succeed, and what the wheel has asked of it.
+ */
+typedef struct sim_ct {
+	int64_t sc_ntime;	/* ms remaining as of sc_ntime_at, or -1 */
+	uint64_t sc_ntime_at;
+	int64_t sc_quantum;	/* a qack grants this much */
+	int sc_qack_ok;
+	unsigned int sc_qacks;
+	unsigned int sc_warns;
+	uint64_t sc_warn_evid;
+	double sc_warn_remaining;
+	nc_deadlines_t *sc_dl;
+	int sc_destroy_on_warn;
+} sim_ct_t;
+
+static uint64_t sim_clock;
+static int sim_running;
+static unsigned int sim_ntests;
+static unsigned int sim_nfailed;
+
+static uint64_t
+sim_now(void *arg __UNUSED)
+{
+	return (sim_clock);
+}
+
+static void
+sim_run(void *arg __UNUSED, int run)
+{
+	sim_running = run;
+}
+
+static int64_t
+sim_remaining(void *arg)
+{
+	sim_ct_t *sp = arg;
+	int64_t left;
+
+	if (sp->sc_ntime < 0)
+		return (-1);
+
+	left = sp->sc_ntime - (int64_t)(sim_clock - sp->sc_ntime_at);
+
+	return (left > 0 ? left : 0);
+}
+
+static int
+sim_qack(void *arg, uint64_t evid __UNUSED)
+{
+	sim_ct_t *sp = arg;
+
+	++sp->sc_qacks;
+	if (!sp->sc_qack_ok)
+		return (-1);
+
+	sp->sc_ntime = sp->sc_quantum;
+	sp->sc_ntime_at = sim_clock;
+
+	return (0);
+}
+
+static void
+sim_warn(void *arg, uint64_t evid, double remaining)
+{
+	sim_ct_t *sp = arg;
+
+	++sp->sc_warns;
+	sp->sc_warn_evid = evid;
+	sp->sc_warn_remaining = remaining;
+
+	if (sp->sc_destroy_on_warn) {
+		nc_dlwheel_set_destroy(sp->sc_dl);
+		sp->sc_dl = NULL;
+	}
+}
+
+static const nc_dlops_t sim_ops = {
+	sim_now,
+	sim_run,
+	sim_remaining,
+	sim_qack,
+	sim_warn
+};
+
+static void
+ok(int cond, const char *desc)
+{
+	++sim_ntests;
+	if (!cond)
+		++sim_nfailed;
+	(void) printf("%sok %u - %s\n", cond ? "" : "not ", sim_ntests, desc);
+}
+
+/*
+ * Advance the clock to the given time, one tick at a time, advancing the
+ * wheel whenever it has asked to run, as its timer would.
+ */
+static void
+sim_advance(nc_dlwheel_t *wp, uint64_t to)
+{
+	while (sim_clock < to) {
+		sim_clock += NDL_TICK_MS;
+		if (sim_clock > to)
+			sim_clock = to;
+		if (sim_running)
+			nc_dlwheel_advance(wp);
+	}
+}
+
+static nc_deadlines_t *
+sim_track(nc_dlwheel_t *wp, sim_ct_t *sp, int autoqack, int64_t ntime)
+{
+	(void) memset(sp, 0, sizeof (*sp));
+	sp->sc_ntime = ntime;
+	sp->sc_ntime_at = sim_clock;
+	sp->sc_quantum = 2000;
+	sp->sc_qack_ok = 1;
+	sp->sc_dl = nc_dlwheel_set_create(wp, sp);
+	nc_dlwheel_set_config(sp->sc_dl, autoqack, 1000, 0);
+
+	return (sp->sc_dl);
+}
+
+static void
+test_arm_fire(nc_dlwheel_t *wp)
+{
+	nc_deadline_stats_t st;
+	nc_deadlines_t *dlp;
+	sim_ct_t ct;
+	uint64_t start = sim_clock;
+
+	dlp = sim_track(wp, &ct, 0, 5000);
+	nc_dlwheel_track(dlp, 11);
+	ok(sim_running, "tracking an event starts the wheel");
+
+	sim_advance(wp, start + 3900);
+	ok(ct.sc_warns == 0, "no warning before the deadline less margin");
+
+	sim_advance(wp, start + 4000 + NDL_TICK_MS);
+	ok(ct.sc_warns == 1 && ct.sc_warn_evid == 11,
+	    "warned once at the deadline less margin");
+	ok(ct.sc_warn_remaining > 1000 - 2 * NDL_TICK_MS &&
+	    ct.sc_warn_remaining <= 1000, "warning reports the time remaining");
+
+	sim_advance(wp, start + 5000 + NDL_TICK_MS);
+	nc_dlwheel_stats(dlp, &st);
+	ok(ct.sc_warns == 1 && st.nds_warned == 1 && st.nds_expired == 1 &&
+	    st.nds_pending == 0, "expires at the deadline");
+	ok(!sim_running, "an empty wheel stops");
+
+	nc_dlwheel_set_destroy(dlp);
+}
+
+static void
+test_far(nc_dlwheel_t *wp)
+{
+	nc_deadlines_t *dlp;
+	sim_ct_t ct;
+	uint64_t start = sim_clock;
+
+	/*
+	 * Several revolutions out: the entry's slot is visited early, but it
+	 * must stay put until its own tick.
+	 */
+	dlp = sim_track(wp, &ct, 0, 3 * 256 * NDL_TICK_MS + 1500);
+	nc_dlwheel_track(dlp, 12);
+
+	sim_advance(wp, start + 3 * 256 * NDL_TICK_MS);
+	ok(ct.sc_warns == 0, "an entry revolutions away does not fire early");
+
+	sim_advance(wp, start + 3 * 256 * NDL_TICK_MS + 500 + NDL_TICK_MS);
+	ok(ct.sc_warns == 1, "an entry revolutions away fires on time");
+
+	nc_dlwheel_set_destroy(dlp);
+	ok(!sim_running, "destroying the set empties the wheel");
+}
+
+static void
+test_autoqack(nc_dlwheel_t *wp)
+{
+	nc_deadline_stats_t st;
+	nc_deadlines_t *dlp;
+	sim_ct_t ct;
+	uint64_t start = sim_clock;
+
+	dlp = sim_track(wp, &ct, 1, 3000);
+	nc_dlwheel_track(dlp, 21);
+
+	sim_advance(wp, start + 2000 + NDL_TICK_MS);
+	nc_dlwheel_stats(dlp, &st);
+	ok(ct.sc_qacks == 1 && st.nds_autoqacked == 1 && ct.sc_warns == 0,
+	    "autoqack answers at the deadline less margin");
+
+	sim_advance(wp, start + 2000 + 2 * 2000);
+	nc_dlwheel_stats(dlp, &st);
+	ok(ct.sc_qacks >= 2 && ct.sc_warns == 0 && st.nds_expired == 0 &&
+	    st.nds_pending == 1, "autoqack keeps the negotiation alive");
+
+	ct.sc_qack_ok = 0;
+	while (ct.sc_warns == 0 && sim_clock < start + 20000)
+		sim_advance(wp, sim_clock + NDL_TICK_MS);
+	nc_dlwheel_stats(dlp, &st);
+	ok(ct.sc_warns == 1 && st.nds_warned == 1,
+	    "a failed autoqack falls back to a warning");
+
+	nc_dlwheel_answered(dlp, 21, 1);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_answered == 1 && st.nds_pending == 0 && !sim_running,
+	    "an ack after a warning ends tracking");
+
+	nc_dlwheel_set_destroy(dlp);
+}
+
+static void
+test_answered(nc_dlwheel_t *wp)
+{
+	nc_deadline_stats_t st;
+	nc_deadlines_t *dlp;
+	sim_ct_t ct;
+	uint64_t start = sim_clock;
+
+	dlp = sim_track(wp, &ct, 0, 5000);
+	nc_dlwheel_track(dlp, 31);
+	nc_dlwheel_track(dlp, 32);
+
+	sim_advance(wp, start + 1500);
+	nc_dlwheel_answered(dlp, 31, 1);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_answered == 1 && st.nds_last_slack == 3500 &&
+	    st.nds_min_slack == 3500 && st.nds_late == 0,
+	    "an ack records the slack remaining");
+
+	/*
+	 * A qack rearms at the new deadline; the simulated kernel grants
+	 * the quantum from now.
+	 */
+	sim_advance(wp, start + 3000);
+	ct.sc_ntime = 4000;
+	ct.sc_ntime_at = sim_clock;
+	nc_dlwheel_answered(dlp, 32, 0);
+	sim_advance(wp, start + 4500);
+	ok(ct.sc_warns == 0, "a qack extends the deadline");
+
+	sim_advance(wp, start + 6000 + NDL_TICK_MS);
+	ok(ct.sc_warns == 1 && ct.sc_warn_evid == 32,
+	    "a qacked event warns at its new deadline");
+
+	nc_dlwheel_answered(dlp, 32, 1);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_answered == 2 && st.nds_min_slack < 1000 &&
+	    st.nds_sum_slack == 3500 + st.nds_last_slack,
+	    "slack statistics accumulate");
+	ok(st.nds_pending == 0 && !sim_running,
+	    "answered events are untracked");
+
+	nc_dlwheel_answered(dlp, 99, 1);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_answered == 2, "an answer to an untracked event is ignored");
+
+	nc_dlwheel_set_destroy(dlp);
+}
+
+static void
+test_negend(nc_dlwheel_t *wp)
+{
+	nc_deadline_stats_t st;
+	nc_deadlines_t *dlp;
+	sim_ct_t ct;
+	uint64_t start = sim_clock;
+
+	dlp = sim_track(wp, &ct, 0, -1);
+	nc_dlwheel_set_config(dlp, 0, 1000, 3000);
+	nc_dlwheel_track(dlp, 41);
+	nc_dlwheel_track(dlp, 42);
+
+	sim_advance(wp, start + 1000);
+	nc_dlwheel_concluded(dlp, 41);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_concluded == 1 && st.nds_pending == 1,
+	    "a negend concludes its negotiation");
+
+	nc_dlwheel_concluded(dlp, 77);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_concluded == 1, "a negend for another event is ignored");
+
+	sim_advance(wp, start + 2000 + NDL_TICK_MS);
+	ok(ct.sc_warns == 1 && ct.sc_warn_evid == 42,
+	    "without a negotiation time, the timeout applies");
+
+	nc_dlwheel_concluded(dlp, 42);
+	nc_dlwheel_stats(dlp, &st);
+	ok(st.nds_concluded == 2 && st.nds_pending == 0 && !sim_running,
+	    "a negend after a warning ends tracking");
+
+	nc_dlwheel_set_destroy(dlp);
+}
+
+static void
+test_reentry(nc_dlwheel_t *wp)
+{
+	sim_ct_t a, b;
+	uint64_t start = sim_clock;
+
+	/*
+	 * A consumer may dispose of the contract from within its listener;
+	 * another contract's entry in the same slot must still fire.
+	 */
+	(void) sim_track(wp, &a, 0, 2000);
+	(void) sim_track(wp, &b, 0, 2000);
+	a.sc_destroy_on_warn = 1;
+	nc_dlwheel_track(a.sc_dl, 51);
+	nc_dlwheel_track(a.sc_dl, 52);
+	nc_dlwheel_track(b.sc_dl, 53);
+
+	sim_advance(wp, start + 1000 + NDL_TICK_MS);
+	ok(a.sc_warns == 1 && a.sc_dl == NULL && b.sc_warns == 1,
+	    "destroying a set from a warning is safe");
+
+	nc_dlwheel_set_destroy(b.sc_dl);
+	ok(!sim_running, "the wheel stops once every set is gone");
+}
+
+int
+main(void)
+{
+	nc_dlwheel_t *wp;
+
+	sim_clock = 1000000;
+	if ((wp = nc_dlwheel_create(&sim_ops, NULL)) == NULL) {
+		(void) printf("Bail out! out of memory\n");
+		return (1);
+	}
+
+	test_arm_fire(wp);
+	test_far(wp);
+	test_autoqack(wp);
+	test_answered(wp);
+	test_negend(wp);
+	test_reentry(wp);
+
+	(void) printf("1..%u\n", sim_ntests);
+	free(wp);
+
+	return (sim_nfailed == 0 ? 0 : 1);
+}
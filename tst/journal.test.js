@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * The event journal as handle_events() drives it, holding record indexes
+ * across appends that make room.  We build journal.c with journal_sim.c,
+ * which stands in for the contract manager and the sync timer, against the
+ * same headers as the binding (so the binding must have been built), and
+ * check each of its results.  The simulator also reports the cost of each
+ * append and sync as comments, which are ignored here; run it directly to
+ * see them.
+ */
+
+var child_process = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var test = require('tap').test;
+
+var CC = process.env.CC || 'cc';
+var SRCDIR = path.join(__dirname, '..', 'src');
+var NODE_INC = path.join(path.dirname(process.execPath), '..', 'include',
+    'node');
+var V8PLUS_INC = path.dirname(require.resolve('v8plus'));
+
+test('journal records held across compaction', function (t) {
+	var exe = path.join(process.env.TMPDIR || '/tmp',
+	    'journal_sim.' + process.pid);
+	var args = [ '-std=gnu99', '-D__EXTENSIONS__', '-I' + SRCDIR,
+	    '-I' + V8PLUS_INC, '-I' + NODE_INC, '-o', exe,
+	    path.join(SRCDIR, 'journal.c'),
+	    path.join(__dirname, 'journal_sim.c') ];
+
+	child_process.execFile(CC, args, function (err, stdout, stderr) {
+		t.ifError(err, 'build: ' + stderr);
+		if (err) {
+			t.end();
+			return;
+		}
+
+		child_process.execFile(exe, [], function (err2, out) {
+			var planned;
+
+			fs.unlinkSync(exe);
+			out.split('\n').forEach(function (line) {
+				var m;
+
+				if ((m = /^(not )?ok \d+ - (.*)$/.exec(line)))
+					t.ok(m[1] === undefined, m[2]);
+				else if ((m = /^1\.\.(\d+)$/.exec(line)))
+					planned = Number(m[1]);
+			});
+			t.ok(planned > 0, 'simulation ran to completion');
+			t.ifError(err2, 'simulation exit status');
+			t.end();
+		});
+	});
+});
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2012, Joyent, Inc.  All rights reserved.
+ */
+
+/*
+ * Drive the event journal (src/journal.c) as handle_events() does, holding
+ * the indexes of deferred and queued events while later appends make room,
+ * and report the results as TAP.  The journal needs nothing of libuv but a
+ * sync timer, which we stand in for here; records are synced whenever the
+ * batch fills.  Built and run by journal.test.js.  The journal belongs to a
+ * contract manager, of which we need nothing else, so ours are all zeroes.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/contract/process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libcontract.h>
+#include "../src/node_contract.h"
+
+#define	SIM_RECORDS	16
+#define	SIM_EVENTS	200000
+
+static contract_mgr_t sim_mgr;
+static unsigned int sim_ntests;
+static unsigned int sim_nfailed;
+static unsigned int sim_nreplayed;
+static ctevid_t sim_replayed[SIM_RECORDS];
+
+int
+uv_timer_init(uv_loop_t *lp __UNUSED, uv_timer_t *tp __UNUSED)
+{
+	return (0);
+}
+
+int
+uv_timer_start(uv_timer_t *tp __UNUSED, uv_timer_cb cb __UNUSED,
+    int64_t timeout __UNUSED, int64_t repeat __UNUSED)
+{
+	return (0);
+}
+
+int
+uv_timer_stop(uv_timer_t *tp __UNUSED)
+{
+	return (0);
+}
+
+void
+uv_unref(uv_handle_t *hp __UNUSED)
+{
+}
+
+void
+uv_close(uv_handle_t *hp, uv_close_cb cb)
+{
+	cb(hp);
+}
+
+static void
+ok(int cond, const char *desc)
+{
+	++sim_ntests;
+	if (!cond)
+		++sim_nfailed;
+	(void) printf("%sok %u - %s\n", cond ? "" : "not ", sim_ntests, desc);
+}
+
+static int
+sim_replay_cb(const nc_journal_ev_t *ep, void *arg __UNUSED)
+{
+	if (sim_nreplayed < SIM_RECORDS)
+		sim_replayed[sim_nreplayed] = ep->nje_evid;
+	++sim_nreplayed;
+
+	return (0);
+}
+
+static void
+sim_replay(void)
+{
+	sim_nreplayed = 0;
+	(void) nc_journal_replay(&sim_mgr, sim_replay_cb, NULL);
+}
+
+static int64_t
+sim_append(ctevid_t evid, uint_t flags)
+{
+	return (nc_journal_append(&sim_mgr, 1, NCT_PROCESS, evid,
+	    CT_PR_EV_FORK, flags, 0, 0));
+}
+
+/*
+ * Informative events are deferred until the end of a drain, so reads later
+ * in the drain append while their indexes are held.  Here the journal fills
+ * with deferred events behind some already delivered, the next append
+ * compacts, and the deferred events are then marked delivered by their old
+ * indexes.
+ */
+static void
+test_compaction(void)
+{
+	nc_journal_stats_t st;
+	int64_t held[SIM_RECORDS];
+	ctevid_t evid;
+	int moved = 1;
+	int i;
+
+	for (evid = 1; evid <= 4; evid++)
+		nc_journal_delivered(&sim_mgr, sim_append(evid, 0), evid);
+
+	for (i = 0; evid <= SIM_RECORDS; evid++, i++)
+		held[i] = sim_append(evid, 0);
+
+	(void) sim_append(evid, 0);
+
+	(void) nc_journal_stats(&sim_mgr, &st);
+	ok(st.njs_compactions == 1 && st.njs_dropped == 0 &&
+	    st.njs_used == SIM_RECORDS - 3,
+	    "a full journal compacts away delivered records");
+
+	for (i = 0, evid = 5; evid <= SIM_RECORDS; evid++, i++) {
+		if (held[i] != (int64_t)evid - 1)
+			moved = 0;
+		nc_journal_delivered(&sim_mgr, held[i], evid);
+	}
+
+	(void) nc_journal_stats(&sim_mgr, &st);
+	ok(moved && st.njs_relocated == SIM_RECORDS - 4,
+	    "deferred events are found after the compaction moved them");
+	ok(st.njs_missing == 0, "no deferred event is missing");
+
+	sim_replay();
+	ok(sim_nreplayed == 1 && sim_replayed[0] == SIM_RECORDS + 1,
+	    "only the undelivered event is replayed");
+}
+
+/*
+ * If the journal holds nothing but undelivered events, making room drops
+ * the oldest.  Marking it delivered must be counted, not silently ignored,
+ * and the others must still be found.
+ */
+static void
+test_dropped(void)
+{
+	nc_journal_stats_t before, st;
+	int64_t held[SIM_RECORDS + 1];
+	ctevid_t base = 100;
+	int i;
+
+	(void) nc_journal_stats(&sim_mgr, &before);
+
+	for (i = 0; i <= SIM_RECORDS; i++)
+		held[i] = sim_append(base + i, 0);
+
+	(void) nc_journal_stats(&sim_mgr, &st);
+	ok(st.njs_dropped == before.njs_dropped + 1,
+	    "a journal of undelivered events drops the oldest");
+
+	for (i = 0; i <= SIM_RECORDS; i++)
+		nc_journal_delivered(&sim_mgr, held[i], base + i);
+
+	(void) nc_journal_stats(&sim_mgr, &st);
+	ok(st.njs_missing == before.njs_missing + 1,
+	    "marking the dropped event delivered is counted as missing");
+
+	sim_replay();
+	ok(sim_nreplayed == 0, "every surviving event was marked delivered");
+}
+
+/*
+ * Critical events are never dropped to make room: the journal grows
+ * instead, and each is still found by its id when acknowledged.
+ */
+static void
+test_critical(void)
+{
+	nc_journal_stats_t st;
+	int64_t info;
+	ctevid_t evid;
+
+	for (evid = 200; evid < 200 + SIM_RECORDS; evid++)
+		(void) sim_append(evid, CTE_ACK);
+	info = sim_append(300, 0);
+	nc_journal_delivered(&sim_mgr, info, 300);
+
+	for (evid = 200; evid < 200 + SIM_RECORDS; evid++)
+		nc_journal_acked(&sim_mgr, evid);
+
+	(void) nc_journal_stats(&sim_mgr, &st);
+	ok(st.njs_grown == 1 && st.njs_refused == 0,
+	    "the journal grew rather than refuse a critical event");
+
+	sim_replay();
+	ok(sim_nreplayed == 0, "every critical event was acknowledged");
+}
+
+/*
+ * The cost of journalling as handle_events() pays it: each event appended
+ * and then marked delivered, in a journal of the default size and batch,
+ * so that it compacts and syncs as it would in service.  The journal is a
+ * second manager's, and must leave the first one's alone.  The figures
+ * are reported, not checked.
+ */
+static void
+test_overhead(const char *path)
+{
+	contract_mgr_t mgr;
+	nc_journal_stats_t before, after, st;
+	hrtime_t start, elapsed;
+	ctevid_t evid;
+	int64_t idx;
+	int err;
+
+	(void) memset(&mgr, 0, sizeof (mgr));
+	(void) nc_journal_stats(&sim_mgr, &before);
+
+	if ((err = nc_journal_open(&mgr, path, 0, 0, 0)) != 0) {
+		ok(0, "a second manager opens its own journal");
+		return;
+	}
+
+	start = gethrtime();
+	for (evid = 1; evid <= SIM_EVENTS; evid++) {
+		idx = nc_journal_append(&mgr, 1, NCT_PROCESS, evid,
+		    CT_PR_EV_FORK, 0, 0, 0);
+		nc_journal_delivered(&mgr, idx, evid);
+	}
+	elapsed = gethrtime() - start;
+
+	(void) nc_journal_stats(&mgr, &st);
+	nc_journal_close(&mgr);
+	(void) nc_journal_stats(&sim_mgr, &after);
+
+	ok(st.njs_records == SIM_EVENTS && st.njs_dropped == 0,
+	    "a second manager journals every event it reads");
+	ok(after.njs_records == before.njs_records,
+	    "the first manager's journal is untouched");
+
+	(void) printf("# %u events: append %.0f ns, append and deliver "
+	    "%.0f ns per event\n", SIM_EVENTS,
+	    (double)st.njs_append_ns / SIM_EVENTS,
+	    (double)elapsed / SIM_EVENTS);
+	(void) printf("# %llu syncs of %.0f us each\n",
+	    (unsigned long long)st.njs_syncs, st.njs_syncs == 0 ? 0.0 :
+	    (double)st.njs_sync_ns / st.njs_syncs / 1000);
+}
+
+int
+main(void)
+{
+	char path[1024], bpath[1024];
+	const char *tmp;
+	int err;
+
+	if ((tmp = getenv("TMPDIR")) == NULL)
+		tmp = "/tmp";
+	(void) snprintf(path, sizeof (path), "%s/journal_sim.%d", tmp,
+	    (int)getpid());
+	(void) snprintf(bpath, sizeof (bpath), "%s/journal_sim.%d.overhead",
+	    tmp, (int)getpid());
+	(void) unlink(path);
+	(void) unlink(bpath);
+
+	if ((err = nc_journal_open(&sim_mgr, path, SIM_RECORDS, 4,
+	    0)) != 0) {
+		(void) printf("Bail out! journal_open: %s\n", strerror(err));
+		return (1);
+	}
+
+	test_compaction();
+	test_dropped();
+	test_critical();
+	test_overhead(bpath);
+	(void) unlink(bpath);
+
+	nc_journal_close(&sim_mgr);
+	(void) unlink(path);
+
+	(void) printf("1..%u\n", sim_ntests);
+
+	return (sim_nfailed == 0 ? 0 : 1);
+}